@@ -30,20 +30,23 @@ int MqttRelay::begin(const MqttRelayConfig& config, MqttClient* mqttClient) {
     // subscribe to command topic
     mqttClient->subscribe(discoveryDoc["cmd_t"].as<std::string>(), this);
 
-    // publish MQTT discovery, TODO: move to onConnected() callback?
+    // publish MQTT discovery (skipped if unchanged since last boot), kept for re-announcing
     char discoveryTopic[64];
     const char* component = discoveryDoc["_component_"] | "switch";
     snprintf(discoveryTopic, sizeof(discoveryTopic), "%s/%s/nibegw/%s/config", mqttClient->getConfig().discoveryPrefix.c_str(),
              component, name.c_str());
+    this->discoveryTopic = discoveryTopic;
 
     discoveryDoc.remove("_component_");
-    std::string discoveryMsg;
-    serializeJson(discoveryDoc, discoveryMsg);
-    mqttClient->publish(discoveryTopic, discoveryMsg, QOS0, true);
+    serializeJson(discoveryDoc, discoveryPayload);
+    mqttClient->registerDiscoveryCallback(this);
+    mqttClient->publishDiscovery(this->discoveryTopic, discoveryPayload);
 
     return 0;
 }
 
+void MqttRelay::onHomeassistantOnline() { mqttClient->publishDiscovery(discoveryTopic, discoveryPayload); }
+
 JsonDocument MqttRelay::homeassistantDiscoveryMessage(const MqttRelayConfig& config, const MqttClient& mqttClient) const {
     JsonDocument discoveryDoc = mqttClient.getDeviceDiscoveryInfoRef();
     const std::string& nibeRootTopic = mqttClient.getConfig().rootTopic;
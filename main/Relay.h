@@ -16,7 +16,7 @@ struct MqttRelayConfig {
     std::string homeassistantDiscoveryOverride;
 };
 
-class MqttRelay : MqttSubscriptionCallback {
+class MqttRelay : MqttSubscriptionCallback, MqttDiscoveryCallback {
    public:
     MqttRelay(Relay relay, const std::string& name, Metrics& metrics);
 
@@ -37,11 +37,14 @@ class MqttRelay : MqttSubscriptionCallback {
     enum Relay relay;
     MqttClient* mqttClient;
     std::string stateTopic;
+    std::string discoveryTopic;
+    std::string discoveryPayload;
 
     Metrics& metrics;
     Metric* metricRelayState = nullptr;
 
     void onMqttMessage(const std::string& topic, const std::string& payload);
+    void onHomeassistantOnline();
     void publishState(bool state);
 };
 
@@ -9,6 +9,7 @@
 
 // shared file names (configmgr and web)
 #define NIBE_MODBUS_FILE "/nibe_modbus.csv"
+#define NIBE_MODBUS_DB_FILE "/nibe_modbus.bin"  // compiled from NIBE_MODBUS_FILE
 
 // shared metric names (main and web)
 #define METRIC_NAME_INIT_STATUS R"(nibegw_status_info{category="init"})"
@@ -2,6 +2,7 @@
 
 #include <ArduinoJson.h>
 
+#include <charconv>
 #include <cstring>
 
 #if CONFIG_IDF_TARGET_LINUX
@@ -12,6 +13,31 @@
 static const char* TAG = "config";
 
 #define CONFIG_FILE "/config.json"
+#define NIBE_MODBUS_DB_TMP_FILE "/nibe_modbus.bin.tmp"
+
+#if !CONFIG_IDF_TARGET_LINUX
+// written to a temporary file first, a partially written database is never loaded
+static esp_err_t saveNibeModbusDB(const NibeRegisterTable& registers) {
+    File file = LittleFS.open(NIBE_MODBUS_DB_TMP_FILE, FILE_WRITE);
+    if (!file) {
+        ESP_LOGE(TAG, "Failed to write nibe modbus database %s", NIBE_MODBUS_DB_TMP_FILE);
+        return ESP_FAIL;
+    }
+    bool saved = registers.save([&file](const void* data, size_t size) { return file.write((const uint8_t*)data, size) == size; });
+    file.close();
+    if (!saved) {
+        ESP_LOGE(TAG, "Failed to write nibe modbus database %s", NIBE_MODBUS_DB_TMP_FILE);
+        LittleFS.remove(NIBE_MODBUS_DB_TMP_FILE);
+        return ESP_FAIL;
+    }
+    LittleFS.remove(NIBE_MODBUS_DB_FILE);
+    if (!LittleFS.rename(NIBE_MODBUS_DB_TMP_FILE, NIBE_MODBUS_DB_FILE)) {
+        ESP_LOGE(TAG, "Failed to save nibe modbus database %s", NIBE_MODBUS_DB_FILE);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+#endif
 
 NibeMqttGwConfigManager::NibeMqttGwConfigManager() {
     // initialize with default values
@@ -28,6 +54,8 @@ NibeMqttGwConfigManager::NibeMqttGwConfigManager() {
                 .deviceManufacturer = "Nibe",
                 .deviceModel = "Heatpump",
                 .deviceConfigurationUrl = "",
+                .deviceDiscovery = false,
+                .bufferSize = 0,
                 .hostname = "",
                 .logTopic = "nibegw/log",
             },
@@ -36,6 +64,11 @@ NibeMqttGwConfigManager::NibeMqttGwConfigManager() {
                 .registers = {},
                 .pollRegisters = {},
                 .pollRegistersSlow = {},
+                .poll = {},
+                .publish = {},
+                .dataMessagePublishBudget = NIBE_DATA_MESSAGE_PUBLISH_BUDGET_DEFAULT,
+                .dataMessagePublishRate = NIBE_DATA_MESSAGE_PUBLISH_RATE_DEFAULT,
+                .jsonState = false,
                 .metrics = {},
                 .homeassistantDiscoveryOverrides = {},
             },
@@ -103,34 +136,54 @@ esp_err_t NibeMqttGwConfigManager::begin() {
         ESP_LOGW(TAG, "Config file %s not found", CONFIG_FILE);
     }
 
-    File file = LittleFS.open(NIBE_MODBUS_FILE);
-    if (file) {
-        ESP_LOGI(TAG, "Reading nibe modbus config file %s", NIBE_MODBUS_FILE);
-        nonstd::arduinostream is(file);
-        // filter for registers that are specified in config to poll, as metrics or for HA discovery
-        if (parseNibeModbusCSV(is, &config.nibe.registers,
-                               std::bind(&NibeMqttGwConfigManager::nibeRegisterFilterConfigured, this, std::placeholders::_1)) !=
-            ESP_OK) {
+    // precompiled database, compiled once from the CSV if missing (uploaded with older firmware) or incompatible
+    if (!openNibeModbusDB()) {
+        File file = LittleFS.open(NIBE_MODBUS_FILE);
+        if (file) {
+            ESP_LOGI(TAG, "Reading nibe modbus config file %s", NIBE_MODBUS_FILE);
+            nonstd::arduinostream is(file);
+            NibeRegisterTable tmpNibeRegisters;
+            if (parseNibeModbusCSV(is, &tmpNibeRegisters) != ESP_OK) {
+                file.close();
+                return ESP_FAIL;
+            }
             file.close();
+            if (saveNibeModbusDB(tmpNibeRegisters) != ESP_OK || !openNibeModbusDB()) {
+                return ESP_FAIL;
+            }
+        } else {
+            ESP_LOGW(TAG, "Nibe modbus config file %s not found", NIBE_MODBUS_FILE);
+        }
+    }
+    // only configured registers are kept in RAM, others are looked up on demand
+    if (nibeRegisterCatalog.isOpen()) {
+        if (!nibeRegisterCatalog.load(config.nibe.registers, configuredNibeRegisters())) {
             return ESP_FAIL;
         }
-        file.close();
-    } else {
-        ESP_LOGW(TAG, "Nibe modbus config file %s not found", NIBE_MODBUS_FILE);
+        config.nibe.catalog = &nibeRegisterCatalog;
+        ESP_LOGI(TAG, "Loaded %d of %d nibe registers from %s, %d bytes", (int)config.nibe.registers.size(),
+                 (int)nibeRegisterCatalog.size(), NIBE_MODBUS_DB_FILE, (int)config.nibe.registers.memoryUsage());
     }
 #endif
 
     return ESP_OK;
 }
 
-bool NibeMqttGwConfigManager::nibeRegisterFilterConfigured(u_int16_t id) const {
-    // filter for registers that are specified in config for polling, as metrics or for HA discovery
-    auto pollRegistersEnd = this->config.nibe.pollRegisters.end();
-    auto pollRegistersSlowEnd = this->config.nibe.pollRegistersSlow.end();
-    return std::find(this->config.nibe.pollRegisters.begin(), pollRegistersEnd, id) != pollRegistersEnd ||
-           std::find(this->config.nibe.pollRegistersSlow.begin(), pollRegistersSlowEnd, id) != pollRegistersSlowEnd ||
-           this->config.nibe.metrics.find(id) != this->config.nibe.metrics.end() ||
-           this->config.nibe.homeassistantDiscoveryOverrides.find(id) != this->config.nibe.homeassistantDiscoveryOverrides.end();
+NibeRegisterIdSet NibeMqttGwConfigManager::configuredNibeRegisters() const {
+    // registers that are specified in config for polling, publishing, as metrics or for HA discovery
+    NibeRegisterIdSet ids;
+    for (uint16_t id : config.nibe.pollRegisters) {
+        ids.insert(id);
+    }
+    for (uint16_t id : config.nibe.pollRegistersSlow) {
+        ids.insert(id);
+    }
+    ids.insertKeys(config.nibe.poll);
+    ids.insertKeys(config.nibe.publish);
+    ids.insertKeys(config.nibe.metrics);
+    ids.insertKeys(config.nibe.homeassistantDiscoveryOverrides);
+    ids.build();
+    return ids;
 }
 
 // returns config file as uploaded (i.e. including comments)
@@ -163,6 +216,8 @@ const std::string NibeMqttGwConfigManager::getRuntimeConfigAsJson() {
     doc["mqtt"]["deviceModel"] = config.mqtt.deviceModel;
     doc["mqtt"]["deviceManufacturer"] = config.mqtt.deviceManufacturer;
     doc["mqtt"]["deviceConfigurationUrl"] = config.mqtt.deviceConfigurationUrl;
+    doc["mqtt"]["deviceDiscovery"] = config.mqtt.deviceDiscovery;
+    doc["mqtt"]["bufferSize"] = config.mqtt.bufferSize;
 
     JsonArray pollRegisters = doc["nibe"]["pollRegisters"].to<JsonArray>();
     for (auto reg : config.nibe.pollRegisters) {
@@ -172,6 +227,19 @@ const std::string NibeMqttGwConfigManager::getRuntimeConfigAsJson() {
     for (auto reg : config.nibe.pollRegistersSlow) {
         pollRegistersSlow.add(reg);
     }
+    JsonObject poll = doc["nibe"]["poll"].to<JsonObject>();
+    for (auto [id, pollConfig] : config.nibe.poll) {
+        poll[std::to_string(id)]["interval"] = pollConfig.interval;
+    }
+    JsonObject publish = doc["nibe"]["publish"].to<JsonObject>();
+    for (auto [id, publishConfig] : config.nibe.publish) {
+        JsonObject p = publish[std::to_string(id)].to<JsonObject>();
+        p["deadband"] = publishConfig.deadband;
+        p["heartbeat"] = publishConfig.heartbeat;
+    }
+    doc["nibe"]["dataMessage"]["publishBudget"] = config.nibe.dataMessagePublishBudget;
+    doc["nibe"]["dataMessage"]["publishRate"] = config.nibe.dataMessagePublishRate;
+    doc["nibe"]["jsonState"] = config.nibe.jsonState;
     JsonObject metrics = doc["nibe"]["metrics"].to<JsonObject>();
     for (auto [id, metric] : config.nibe.metrics) {
         JsonObject m = metrics[std::to_string(id)].to<JsonObject>();
@@ -180,9 +248,9 @@ const std::string NibeMqttGwConfigManager::getRuntimeConfigAsJson() {
         if (metric.scale != 0) m["scale"] = metric.scale;
     }
     JsonObject homeassistantDiscoveryOverrides = doc["nibe"]["homeassistantDiscoveryOverrides"].to<JsonObject>();
-    for (auto [id, override] : config.nibe.homeassistantDiscoveryOverrides) {
+    for (const auto& [id, override] : config.nibe.homeassistantDiscoveryOverrides) {
         JsonDocument _doc;
-        DeserializationError err = deserializeJson(_doc, override);
+        DeserializationError err = deserializeJson(_doc, override.json);
         if (err) {
             ESP_LOGE(TAG, "deserializeJson() of homeassistantDiscoveryOverrides[%u] failed: %s", id, err.c_str());
         }
@@ -265,6 +333,13 @@ esp_err_t NibeMqttGwConfigManager::parseJson(const char* jsonString, NibeMqttGwC
         snprintf(defaultConfigUrl, sizeof(defaultConfigUrl), "http://%s.fritz.box", hostname.c_str());
         config.mqtt.deviceConfigurationUrl = defaultConfigUrl;
     }
+    config.mqtt.deviceDiscovery = doc["mqtt"]["deviceDiscovery"] | false;
+    // 0: default of discovery mode
+    config.mqtt.bufferSize = doc["mqtt"]["bufferSize"] | 0;
+    if (config.mqtt.bufferSize < 0) {
+        ESP_LOGE(TAG, "mqtt.bufferSize must be >= 0");
+        config.mqtt.bufferSize = 0;
+    }
 
     JsonArray pollRegisters = doc["nibe"]["pollRegisters"].as<JsonArray>();
     for (auto reg : pollRegisters) {
@@ -275,6 +350,47 @@ esp_err_t NibeMqttGwConfigManager::parseJson(const char* jsonString, NibeMqttGwC
         config.nibe.pollRegistersSlow.push_back(reg.as<uint16_t>());
     }
 
+    JsonObject poll = doc["nibe"]["poll"].as<JsonObject>();
+    for (auto pollConfig : poll) {
+        uint16_t id = atoi(pollConfig.key().c_str());
+        uint32_t interval = pollConfig.value()["interval"] | 0;
+        if (id > 0 && interval > 0) {
+            config.nibe.poll[id] = {
+                .interval = interval,
+            };
+        } else {
+            // log and skip
+            ESP_LOGE(TAG, "nibe.poll: invalid register address or interval %s", pollConfig.key().c_str());
+        }
+    }
+
+    JsonObject publish = doc["nibe"]["publish"].as<JsonObject>();
+    for (auto publishConfig : publish) {
+        uint16_t id = atoi(publishConfig.key().c_str());
+        int32_t deadband = publishConfig.value()["deadband"] | 0;
+        if (id > 0 && deadband >= 0) {
+            config.nibe.publish[id] = {
+                .deadband = deadband,
+                .heartbeat = publishConfig.value()["heartbeat"] | NIBE_PUBLISH_HEARTBEAT_DEFAULT,
+            };
+        } else {
+            // log and skip
+            ESP_LOGE(TAG, "nibe.publish: invalid register address or deadband %s", publishConfig.key().c_str());
+        }
+    }
+
+    config.nibe.dataMessagePublishBudget = doc["nibe"]["dataMessage"]["publishBudget"] | NIBE_DATA_MESSAGE_PUBLISH_BUDGET_DEFAULT;
+    if (config.nibe.dataMessagePublishBudget <= 0) {
+        ESP_LOGE(TAG, "nibe.dataMessage.publishBudget must be > 0");
+        config.nibe.dataMessagePublishBudget = NIBE_DATA_MESSAGE_PUBLISH_BUDGET_DEFAULT;
+    }
+    config.nibe.dataMessagePublishRate = doc["nibe"]["dataMessage"]["publishRate"] | NIBE_DATA_MESSAGE_PUBLISH_RATE_DEFAULT;
+    if (config.nibe.dataMessagePublishRate <= 0) {
+        ESP_LOGE(TAG, "nibe.dataMessage.publishRate must be > 0");
+        config.nibe.dataMessagePublishRate = NIBE_DATA_MESSAGE_PUBLISH_RATE_DEFAULT;
+    }
+    config.nibe.jsonState = doc["nibe"]["jsonState"] | false;
+
     JsonObject metrics = doc["nibe"]["metrics"].as<JsonObject>();
     for (auto metric : metrics) {
         uint16_t id = atoi(metric.key().c_str());
@@ -295,9 +411,15 @@ esp_err_t NibeMqttGwConfigManager::parseJson(const char* jsonString, NibeMqttGwC
     for (auto override : homeassistantDiscoveryOverrides) {
         uint16_t id = atoi(override.key().c_str());
         if (id > 0) {
+            // parsed once, discovery payloads are built without JSON parsing
             std::string overrideJson;
             serializeJson(override.value(), overrideJson);
-            config.nibe.homeassistantDiscoveryOverrides[id] = overrideJson;
+            MqttDiscoveryOverride parsed;
+            if (MqttHelper::parseMqttDiscoveryInfoOverride(overrideJson, parsed) == ESP_OK) {
+                config.nibe.homeassistantDiscoveryOverrides[id] = std::move(parsed);
+            } else {
+                ESP_LOGE(TAG, "nibe.homeassistantDiscoveryOverrides: invalid override for register %u", id);
+            }
         } else {
             // log and skip
             ESP_LOGE(TAG, "nibe.homeassistantDiscoveryOverrides: invalid register address %s", override.key().c_str());
@@ -328,10 +450,35 @@ esp_err_t NibeMqttGwConfigManager::parseJson(const char* jsonString, NibeMqttGwC
     return ESP_OK;
 }
 
+#if !CONFIG_IDF_TARGET_LINUX
+bool NibeMqttGwConfigManager::openNibeModbusDB() {
+    closeNibeModbusDB();
+    nibeModbusDBFile = LittleFS.open(NIBE_MODBUS_DB_FILE);
+    if (!nibeModbusDBFile) {
+        return false;
+    }
+    File& file = nibeModbusDBFile;
+    if (!nibeRegisterCatalog.open([&file](size_t offset, void* data, size_t size) {
+            return file.seek(offset) && file.read((uint8_t*)data, size) == size;
+        })) {
+        closeNibeModbusDB();
+        return false;
+    }
+    return true;
+}
+
+void NibeMqttGwConfigManager::closeNibeModbusDB() {
+    nibeRegisterCatalog.close();
+    if (nibeModbusDBFile) {
+        nibeModbusDBFile.close();
+    }
+}
+#endif
+
 esp_err_t NibeMqttGwConfigManager::saveNibeModbusConfig(const char* uploadFileName) {
 #if CONFIG_IDF_TARGET_LINUX
     // uploadFileName = csv - only for testing
-    std::unordered_map<uint16_t, NibeRegister> tmpNibeRegisters;
+    NibeRegisterTable tmpNibeRegisters;
     auto is = nonstd::icharbufstream(uploadFileName);
     if (parseNibeModbusCSV(is, &tmpNibeRegisters) != ESP_OK) {
         return ESP_FAIL;
@@ -340,18 +487,24 @@ esp_err_t NibeMqttGwConfigManager::saveNibeModbusConfig(const char* uploadFileNa
     // store for testing
     config.nibe.registers = tmpNibeRegisters;
 #else
-    // validate csv
+    // validate csv and compile database
     File file = LittleFS.open(uploadFileName);
     if (!file) {
         ESP_LOGE(TAG, "Failed to open nibe modbus config file %s", uploadFileName);
         return ESP_FAIL;
     }
     nonstd::arduinostream is(file);
-    if (parseNibeModbusCSV(is) != ESP_OK) {
+    NibeRegisterTable tmpNibeRegisters;
+    if (parseNibeModbusCSV(is, &tmpNibeRegisters) != ESP_OK) {
         file.close();
         return ESP_FAIL;
     }
     file.close();
+    // database is replaced, no more lookups until reboot
+    closeNibeModbusDB();
+    if (saveNibeModbusDB(tmpNibeRegisters) != ESP_OK) {
+        return ESP_FAIL;
+    }
 
     // delete old config and rename upload file
     if (!LittleFS.remove(NIBE_MODBUS_FILE) || !LittleFS.rename(uploadFileName, NIBE_MODBUS_FILE)) {
@@ -371,59 +524,60 @@ esp_err_t NibeMqttGwConfigManager::saveNibeModbusConfig(const char* uploadFileNa
 // Title;Info;ID;Unit;Size;Factor;Min;Max;Default;Mode
 // "BT1 Outdoor Temperature";"Current outdoor temperature";40004;"°C";s16;10;0;0;0;R;
 //
-// if registers is null, the input is only checked for format
-esp_err_t NibeMqttGwConfigManager::parseNibeModbusCSV(nonstd::istream& is, std::unordered_map<uint16_t, NibeRegister>* registers,
-                                                      nibeRegisterFilterFunction_t filter) {
-    std::string line;
-    line.reserve(256);
-    int line_num = 0;
+// the register loop is inlined in parseNibeModbusCSV (configmgr.h) together with the filter
+esp_err_t NibeMqttGwConfigManager::parseNibeModbusCSVHeader(nonstd::ibufstream& reader, int& line_num) {
+    std::string_view line;
 
     // eat header and check format
-    if (!is) {
-        ESP_LOGE(TAG, "Nibe Modbus CSV, line %d: Bad header", line_num);
-        return ESP_FAIL;
-    }
-    nonstd::getline(is, line);
     line_num++;
-    if (!line.starts_with("ModbusManager")) {
+    if (!reader.getline(line) || !line.starts_with("ModbusManager")) {
         ESP_LOGE(TAG, "Nibe Modbus CSV, line %d: Bad header", line_num);
         return ESP_FAIL;
     }
     for (int i = 0; i < 3; i++) {
-        nonstd::getline(is, line);
         line_num++;
-        if (!is) {
+        if (!reader.getline(line)) {
             ESP_LOGE(TAG, "Nibe Modbus CSV, line %d: Bad header", line_num);
             return ESP_FAIL;
         }
     }
-    nonstd::getline(is, line);
     line_num++;
-    if (!is || line != "Title;Info;ID;Unit;Size;Factor;Min;Max;Default;Mode") {
+    if (!reader.getline(line) || line != "Title;Info;ID;Unit;Size;Factor;Min;Max;Default;Mode") {
         ESP_LOGE(TAG, "Nibe Modbus CSV, line %d: Bad header", line_num);
         return ESP_FAIL;
     }
-    // read register configuration
-    while (is) {
-        nonstd::getline(is, line);
+    return ESP_OK;
+}
+
+// returns ESP_OK for the next register, ESP_ERR_NOT_FOUND at end of input or ESP_FAIL on format error
+esp_err_t NibeMqttGwConfigManager::parseNibeModbusCSVNext(nonstd::ibufstream& reader, int& line_num,
+                                                          NibeRegister& _register) {
+    std::string_view line;
+    while (reader.getline(line)) {
         line_num++;
-        // if (line_num % 50 == 0) {
-        //     ESP_LOGI(TAG, "Nibe Modbus CSV, line %d, minHeap %lu", line_num, ESP.getMinFreeHeap());
-        // }
         if (line.empty()) {
             continue;
         }
-        NibeRegister _register;
         esp_err_t err = parseNibeModbusCSVLine(line, _register);
         if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Nibe Modbus CSV, line %d: Format error in token #%d: %s", line_num, err, line.c_str());
+            ESP_LOGE(TAG, "Nibe Modbus CSV, line %d: Format error in token #%d: %.*s", line_num, err, (int)line.size(),
+                     line.data());
             return ESP_FAIL;
         }
-        if (registers != nullptr && filter(_register.id)) {
-            registers->operator[](_register.id) = _register;
-        }
+        return ESP_OK;
     }
-    return ESP_OK;
+    if (!reader.eof()) {
+        ESP_LOGE(TAG, "Nibe Modbus CSV, line %d: Line too long", line_num + 1);
+        return ESP_FAIL;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+// whole token must be a number within the range of T
+template <typename T>
+static bool parseCsvNumber(std::string_view token, T& value) {
+    auto [ptr, ec] = std::from_chars(token.data(), token.data() + token.size(), value);
+    return ec == std::errc() && ptr == token.data() + token.size();
 }
 
 // Format:
@@ -431,114 +585,113 @@ esp_err_t NibeMqttGwConfigManager::parseNibeModbusCSV(nonstd::istream& is, std::
 // "BT1 Outdoor Temperature";"Current outdoor temperature";40004;"°C";s16;10;0;0;0;R;
 //
 // returns ESP_OK if correctly parsed and register is valid or the number of the bad token
-esp_err_t NibeMqttGwConfigManager::parseNibeModbusCSVLine(const std::string& line, NibeRegister& _register) {
-    auto is = nonstd::istringstream(line);
-    std::string token;
+esp_err_t NibeMqttGwConfigManager::parseNibeModbusCSVLine(std::string_view line, NibeRegister& _register) {
+    std::string_view token;
+    std::string unquoted;
     esp_err_t token_num = 1;  // returned as err msg
-    try {
-        // Title (mandatory)
-        if (getNextCsvToken(is, token) != ESP_OK) return token_num;
-        if (token.empty()) return token_num;
-        _register.title = token;
-        token_num++;
-        // Info (optional), ignored
-        if (getNextCsvToken(is, token) != ESP_OK) return token_num;
-        token_num++;
-        // ID
-        if (getNextCsvToken(is, token) != ESP_OK) return token_num;
-        if (token.empty()) return token_num;
-        _register.id = std::stoi(token);
-        token_num++;
-        // Unit
-        if (getNextCsvToken(is, token) != ESP_OK) return token_num;
-        _register.unit = NibeRegister::stringToUnit(token.c_str());
-        if (_register.unit == NibeRegisterUnit::Unknown) return token_num;
-        token_num++;
-        // Size
-        if (getNextCsvToken(is, token) != ESP_OK) return token_num;
-        _register.dataType = nibeModbusSizeToDataType(token);
-        if (_register.dataType == NibeRegisterDataType::Unknown) return token_num;
-        token_num++;
-        // Factor
-        if (getNextCsvToken(is, token) != ESP_OK) return token_num;
-        _register.factor = std::stoi(token);
-        token_num++;
-        // Min
-        if (getNextCsvToken(is, token) != ESP_OK) return token_num;
-        _register.minValue = std::stoi(token);
-        token_num++;
-        // Max
-        if (getNextCsvToken(is, token) != ESP_OK) return token_num;
-        _register.maxValue = std::stoi(token);
-        token_num++;
-        // Default
-        if (getNextCsvToken(is, token) != ESP_OK) return token_num;
-        _register.defaultValue = std::stoi(token);
-        token_num++;
-        // Mode
-        if (getNextCsvToken(is, token) != ESP_OK) return token_num;
-        _register.mode = nibeModbusMode(token);
-        if (_register.mode == NibeRegisterMode::Unknown) return token_num;
+    // Title (mandatory)
+    if (getNextCsvToken(line, token, unquoted) != ESP_OK) return token_num;
+    if (token.empty()) return token_num;
+    _register.title.assign(token);
+    token_num++;
+    // Info (optional), ignored
+    if (getNextCsvToken(line, token, unquoted) != ESP_OK) return token_num;
+    token_num++;
+    // ID
+    if (getNextCsvToken(line, token, unquoted) != ESP_OK) return token_num;
+    if (!parseCsvNumber(token, _register.id)) return token_num;
+    token_num++;
+    // Unit
+    if (getNextCsvToken(line, token, unquoted) != ESP_OK) return token_num;
+    _register.unit = NibeRegister::stringToUnit(token);
+    if (_register.unit == NibeRegisterUnit::Unknown) return token_num;
+    token_num++;
+    // Size
+    if (getNextCsvToken(line, token, unquoted) != ESP_OK) return token_num;
+    _register.dataType = nibeModbusSizeToDataType(token);
+    if (_register.dataType == NibeRegisterDataType::Unknown) return token_num;
+    token_num++;
+    // Factor
+    if (getNextCsvToken(line, token, unquoted) != ESP_OK) return token_num;
+    if (!parseCsvNumber(token, _register.factor)) return token_num;
+    token_num++;
+    // Min
+    if (getNextCsvToken(line, token, unquoted) != ESP_OK) return token_num;
+    if (!parseCsvNumber(token, _register.minValue)) return token_num;
+    token_num++;
+    // Max
+    if (getNextCsvToken(line, token, unquoted) != ESP_OK) return token_num;
+    if (!parseCsvNumber(token, _register.maxValue)) return token_num;
+    // 0..0: no limits
+    if (_register.minValue > _register.maxValue) return token_num;
+    token_num++;
+    // Default
+    if (getNextCsvToken(line, token, unquoted) != ESP_OK) return token_num;
+    if (!parseCsvNumber(token, _register.defaultValue)) return token_num;
+    token_num++;
+    // Mode
+    if (getNextCsvToken(line, token, unquoted) != ESP_OK) return token_num;
+    _register.mode = nibeModbusMode(token);
+    if (_register.mode == NibeRegisterMode::Unknown) return token_num;
 
-        return ESP_OK;
-#if CONFIG_IDF_TARGET_LINUX
-    } catch (...) {
-        // for linux only to get tests green
-        // don't use on esp32 because it hides OOMs
-        return token_num;
-    }
-#else
-    } catch (const std::invalid_argument& e) {
-        // TODO: is not caught on linux but works on esp32, unclear why
-        return token_num;
-    }
-#endif
+    return ESP_OK;
 }
 
-// Reads next CSV token and stores it in 'token', reads ; separator
-// handles quoting
-esp_err_t NibeMqttGwConfigManager::getNextCsvToken(nonstd::istream& is, std::string& token) {
-    token.clear();
-
-    bool quoted = false;
-    int c = is.get();
-    if (c == EOF) {
+// Reads next CSV token from line and consumes it incl. ; separator
+// handles quoting, token is a view into line unless quoted with "" inside
+esp_err_t NibeMqttGwConfigManager::getNextCsvToken(std::string_view& line, std::string_view& token, std::string& unquoted) {
+    if (line.empty()) {
+        return ESP_FAIL;
+    }
+    if (line.front() != '"') {
+        size_t end = line.find(';');
+        token = line.substr(0, end);
+        line.remove_prefix(end == std::string_view::npos ? line.size() : end + 1);
+        return ESP_OK;
+    }
+    size_t close = line.find('"', 1);
+    if (close == std::string_view::npos) {
         return ESP_FAIL;
     }
-    if (c == '"') {
-        quoted = true;
-        c = is.get();
+    if (close + 1 == line.size() || line[close + 1] == ';') {
+        // "token"
+        token = line.substr(1, close - 1);
+        line.remove_prefix(std::min(close + 2, line.size()));
+        return ESP_OK;
     }
+    // "" within quoted string or characters after closing quote
+    unquoted.clear();
+    bool quoted = true;
+    size_t i = 1;
     while (1) {
-        if (quoted) {
-            if (c == EOF) {
+        if (i == line.size()) {
+            if (quoted) {
                 return ESP_FAIL;
-            } else if (c == '"') {
-                c = is.get();
-                if (c == '"') {
-                    // "" within quoted string
-                    token.push_back(c);
-                    c = is.get();
-                } else {
-                    quoted = false;
-                }
-            } else {
-                token.push_back(c);
-                c = is.get();
             }
-        } else {
-            if (c == ';' || c == EOF) {
-                return ESP_OK;
+            break;
+        }
+        char c = line[i++];
+        if (quoted) {
+            if (c != '"') {
+                unquoted.push_back(c);
+            } else if (i < line.size() && line[i] == '"') {
+                unquoted.push_back(c);
+                i++;
             } else {
-                token.push_back(c);
-                c = is.get();
+                quoted = false;
             }
+        } else if (c == ';') {
+            break;
+        } else {
+            unquoted.push_back(c);
         }
     }
+    token = unquoted;
+    line.remove_prefix(i);
     return ESP_OK;
 }
 
-NibeRegisterDataType NibeMqttGwConfigManager::nibeModbusSizeToDataType(const std::string& size) {
+NibeRegisterDataType NibeMqttGwConfigManager::nibeModbusSizeToDataType(std::string_view size) {
     if (size == "s8") return NibeRegisterDataType::Int8;
     if (size == "s16") return NibeRegisterDataType::Int16;
     if (size == "s32") return NibeRegisterDataType::Int32;
@@ -548,7 +701,7 @@ NibeRegisterDataType NibeMqttGwConfigManager::nibeModbusSizeToDataType(const std
     return NibeRegisterDataType::Unknown;
 }
 
-NibeRegisterMode NibeMqttGwConfigManager::nibeModbusMode(const std::string& mode) {
+NibeRegisterMode NibeMqttGwConfigManager::nibeModbusMode(std::string_view mode) {
     if (mode == "R") return NibeRegisterMode::Read;
     if (mode == "W") return NibeRegisterMode::Write;
     if (mode == "R/W") return NibeRegisterMode::ReadWrite;
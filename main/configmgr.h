@@ -19,9 +19,10 @@ struct NibeMqttGwConfig {
     LogConfig logging;
 };
 
+#define NIBE_MODBUS_CSV_BUFFER_SIZE 512  // max line length
+
 // filter function for NibeRegister ids
-// typedef bool (* nibeRegisterFilterFunction_t)(u_int16_t nibeRegisterId);
-typedef std::function<bool(u_int16_t)> nibeRegisterFilterFunction_t;
+typedef bool (*nibeRegisterFilterFunction_t)(u_int16_t nibeRegisterId);
 
 // Configuration is stored in SPIFFS as JSON file.
 class NibeMqttGwConfigManager {
@@ -43,19 +44,52 @@ class NibeMqttGwConfigManager {
     std::string hostname;
     std::string defaultClientId;
     NibeMqttGwConfig config;
+    // all registers of the ModbusManager CSV, config.nibe.registers holds the configured registers only
+    NibeRegisterCatalog nibeRegisterCatalog;
+#if !CONFIG_IDF_TARGET_LINUX
+    File nibeModbusDBFile;  // kept open for catalog lookups
+
+    bool openNibeModbusDB();
+    void closeNibeModbusDB();
+#endif
 
     esp_err_t parseJson(const char* configJson, NibeMqttGwConfig& config);
-    static NibeRegisterDataType nibeModbusSizeToDataType(const std::string& size);
-    static NibeRegisterMode nibeModbusMode(const std::string& size);
+    static NibeRegisterDataType nibeModbusSizeToDataType(std::string_view size);
+    static NibeRegisterMode nibeModbusMode(std::string_view mode);
+    static esp_err_t parseNibeModbusCSVHeader(nonstd::ibufstream& reader, int& line_num);
+    static esp_err_t parseNibeModbusCSVNext(nonstd::ibufstream& reader, int& line_num, NibeRegister& _register);
 
    public:  // for testing only
-    static esp_err_t parseNibeModbusCSV(nonstd::istream& is, std::unordered_map<uint16_t, NibeRegister>* registers = nullptr,
-                                        nibeRegisterFilterFunction_t filter = nibeRegisterFilterAll);
-    static esp_err_t parseNibeModbusCSVLine(const std::string& line, NibeRegister& _register);
-    static esp_err_t getNextCsvToken(nonstd::istream& is, std::string& token);
+    // Nibe ModbusManager CSV, see configmgr.cpp for the format
+    // if registers is null, the input is only checked for format
+    // filter is a predicate bool(u_int16_t id), e.g. NibeRegisterIdSet, inlined for each line
+    template <typename Filter = nibeRegisterFilterFunction_t>
+    static esp_err_t parseNibeModbusCSV(nonstd::istream& is, NibeRegisterTable* registers = nullptr,
+                                        const Filter& filter = nibeRegisterFilterAll) {
+        // lines are parsed in place in the read buffer
+        std::vector<char> buffer(NIBE_MODBUS_CSV_BUFFER_SIZE);
+        nonstd::ibufstream reader(is, buffer.data(), buffer.size());
+        int line_num = 0;
+        if (parseNibeModbusCSVHeader(reader, line_num) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        // read register configuration
+        NibeRegister _register;
+        esp_err_t err;
+        while ((err = parseNibeModbusCSVNext(reader, line_num, _register)) == ESP_OK) {
+            if (registers != nullptr && filter(_register.id)) {
+                registers->insert(_register);
+            }
+        }
+        return err == ESP_ERR_NOT_FOUND ? ESP_OK : ESP_FAIL;
+    }
+    static esp_err_t parseNibeModbusCSVLine(std::string_view line, NibeRegister& _register);
+    // token is a view into line or into unquoted (quoted token with "")
+    static esp_err_t getNextCsvToken(std::string_view& line, std::string_view& token, std::string& unquoted);
 
     static bool nibeRegisterFilterAll(u_int16_t id) { return true; }
-    bool nibeRegisterFilterConfigured(u_int16_t id) const;
+    // built once, used as filter predicate when loading registers
+    NibeRegisterIdSet configuredNibeRegisters() const;
 };
 
 #endif
\ No newline at end of file
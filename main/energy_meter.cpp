@@ -94,14 +94,17 @@ esp_err_t EnergyMeter::beginMqtt(MqttClient& mqttClient) {
     deviceDiscovery["dev_cla"] = "energy";
     deviceDiscovery["stat_cla"] = "total_increasing";
 
-    std::string discoveryPayload;
+    // skipped if unchanged since last boot, kept for re-announcing
+    discoveryTopic = mqttClient.getConfig().discoveryPrefix + "/sensor/nibegw/energy-meter/config";
     serializeJson(deviceDiscovery, discoveryPayload);
-    mqttClient.publish(mqttClient.getConfig().discoveryPrefix + "/sensor/nibegw/energy-meter/config", discoveryPayload, QOS0,
-                       true);
+    mqttClient.registerDiscoveryCallback(this);
+    mqttClient.publishDiscovery(discoveryTopic, discoveryPayload);
 
     return ESP_OK;
 }
 
+void EnergyMeter::onHomeassistantOnline() { mqttClient->publishDiscovery(discoveryTopic, discoveryPayload); }
+
 // interrupt-on-pin-change -> 2 interrupts for every S0 pulse
 // (S0 impulse is 90ms according to meter spec, max freq is 3.3/s for 12kW -> 300ms is shortest time between pulses)
 // notify EnergyMeter::task which evaluates pin state and counts energy, no SPI communication in ISR
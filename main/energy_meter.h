@@ -22,7 +22,7 @@
 // INTCON: interrupt-on-pin-change, i.e. 2 interrupts for every S0 pulse
 // INTCAP=0 means start of S0 pulse (and resets interrupt) -> increment energy by 1 Wh
 // Attention: interrupt is also reset by reading pin stage (GPIO) which happens on relay state publishing
-class EnergyMeter {
+class EnergyMeter : MqttDiscoveryCallback {
    public:
     EnergyMeter(Metrics& metrics);
 
@@ -35,6 +35,9 @@ class EnergyMeter {
     void setEnergyInWh(u_int32_t energyInWh) { metricEnergyInWh.setValue(energyInWh); }
     void adjustEnergyInWh(u_int32_t energyInWh);
 
+    // MqttDiscoveryCallback
+    void onHomeassistantOnline();
+
    private:
     nvs_handle_t nvsHandle;
 
@@ -60,6 +63,8 @@ class EnergyMeter {
 
     MqttClient* mqttClient = nullptr;
     std::string mqttTopic;
+    std::string discoveryTopic;
+    std::string discoveryPayload;
 };
 
 #endif
\ No newline at end of file
@@ -58,7 +58,7 @@ EnergyMeter energyMeter(metrics);
 
 NibeMqttGw nibeMqttGw(metrics);
 NibeRS485 nibeRS485(&RS485Serial, RS485_DIRECTION_PIN, RS485_RX_PIN, RS485_TX_PIN);
-NibeGw nibegw(nibeRS485);
+NibeGw nibegw(nibeRS485, metrics);
 
 NibeMqttGwWebServer httpServer(80, metrics, configManager, nibeMqttGw, energyMeter);
 
@@ -68,6 +68,7 @@ Metric& metricMinimumFreeBytes = metrics.addMetric(R"(nibegw_minimum_free_bytes)
 Metric& metricUptime = metrics.addMetric(R"(nibegw_uptime_seconds_total)", 1);
 Metric& metricPollingTime = metrics.addMetric(R"(nibegw_task_runtime_seconds{task="pollingTask"})", 1000);
 Metric& metricBootCount = metrics.addMetric(METRIC_NAME_BOOT_COUNT, 1);
+Metric& metricConfigLoadTime = metrics.addMetric(R"(nibegw_boot_duration_seconds{phase="config"})", 1000);
 
 static nvs_handle_t nvsHandle;
 
@@ -147,10 +148,13 @@ void setupNormalBoot() {
     metricInitStatus.setValue((int32_t)InitStatus::OK);
     esp_err_t err;
     // early init of logging
+    unsigned long configStartTime = millis();
     if (configManager.begin() != ESP_OK) {
         ESP_LOGE(TAG, "Could not initialize config manager");
         metricInitStatus.setValue((int32_t)InitStatus::ErrConfigMgr);
     }
+    // config, nibe register database (incl. one-time CSV compilation) and configured registers
+    metricConfigLoadTime.setValue(millis() - configStartTime);
     const NibeMqttGwConfig& config = configManager.getConfig();
     if (config.logging.mqttLoggingEnabled) {
         err = MqttLogging::begin(config.logging, mqttClient);
@@ -227,7 +231,8 @@ void setupNormalBoot() {
     }
 
     // start polling task
-    // Prios: idle=0, main_app/arduino setup/loop=1, mqtt_logging=4, mqtt=5 (default), polling=10, nibegw=15
+    // Prios: idle=0, main_app/arduino setup/loop=1, mqtt_logging=4, mqtt=5 (default), nibegw publisher=9, polling=10,
+    //        energy meter=11, nibegw=15
     err = xTaskCreatePinnedToCore(&pollingTask, "pollingTask", 4 * 1024, NULL, 10, NULL, 1);
     if (err != pdPASS) {
         ESP_LOGE(TAG, "Could not start polling task");
@@ -259,7 +264,9 @@ void pollingTask(void* pvParameters) {
         }
 
         energyMeter.publishState();
-        nibeMqttGw.publishState();
+
+        // hashes of discovery messages published since last run, NVS is written only on change
+        mqttClient.saveDiscoveryHashes();
 
         // metrics
         metricTotalFreeBytes.setValue(ESP.getFreeHeap());
@@ -10,21 +10,47 @@ esp_err_t Metrics::begin() {
 }
 
 Metric& Metrics::addMetric(const char* name, int factor, int scale, bool counter) {
+    if (numMetrics >= MAX_METRICS) {
+        ESP_LOGE(TAG, "max number of metrics reached: %s", name);
+        // not exported, but callers can keep a reference
+        static Metric dummy;
+        return dummy;
+    }
     // Metric objects are statically pre-allocted
-    Metric& m = metrics[numMetrics];
+    Metric& m = metrics[numMetrics++];
     m.name = name;
     m.factor = factor;
     m.scale = scale;
     m.counter = counter;
-    if (numMetrics < MAX_METRICS) {
-        numMetrics++;
-    } else {
-        ESP_LOGE(TAG, "max number of metrics reached");
-    }
     estimatedSize += m.name.size() + 20;
     return m;
 }
 
+Histogram& Metrics::addHistogram(const char* name, const int32_t* bounds, int numBounds, int factor, int scale) {
+    if (numHistograms >= MAX_HISTOGRAMS) {
+        ESP_LOGE(TAG, "max number of histograms reached: %s", name);
+        // not exported, but callers can keep a reference
+        static Histogram dummy;
+        return dummy;
+    }
+    // Histogram objects are statically pre-allocted
+    Histogram& h = histograms[numHistograms++];
+    h.name = name;
+    h.factor = factor;
+    h.scale = scale;
+    if (numBounds > MAX_HISTOGRAM_BUCKETS) {
+        ESP_LOGE(TAG, "max number of histogram buckets exceeded: %s", name);
+        numBounds = MAX_HISTOGRAM_BUCKETS;
+    }
+    for (int i = 0; i < numBounds; i++) {
+        h.bounds[i] = bounds[i];
+    }
+    h.numBounds = numBounds;
+    // one line per bucket + sum + count
+    estimatedSize += (numBounds + 3) * (h.name.size() + 30);
+    return h;
+}
+
 Metric* Metrics::findMetric(const char* name) {
     if (name == nullptr) {
         return nullptr;
@@ -48,6 +74,10 @@ std::string Metrics::getAllMetricsAsString() {
             s += "\n";
         }
     }
+    for (int i = 0; i < numHistograms; i++) {
+        s += histograms[i].getValueAsString();
+        s += "\n";
+    }
     return s;
 }
 
@@ -59,3 +89,49 @@ std::string Metric::getValueAsString() {
     s += Metrics::formatNumber(value.load(), factor, scale);
     return s;
 }
+
+uint32_t Histogram::getCount() const { return getBucketCount(numBounds); }
+
+uint32_t Histogram::getBucketCount(int i) const {
+    uint32_t count = 0;
+    for (int j = 0; j <= i && j <= numBounds; j++) {
+        count += buckets[j];
+    }
+    return count;
+}
+
+// name_bucket{...,le="<bound>"} lines, name_sum and name_count
+std::string Histogram::getValueAsString() {
+    // split name into metric name and attributes
+    size_t pos = name.find('{');
+    std::string baseName = name.substr(0, pos);
+    std::string attributes = pos != std::string::npos ? name.substr(pos + 1, name.size() - pos - 2) + "," : "";
+
+    std::string s;
+    s.reserve((numBounds + 3) * (name.size() + 30));
+    uint32_t count = 0;
+    for (int i = 0; i <= numBounds; i++) {
+        count += buckets[i];
+        s += baseName;
+        s += "_bucket{";
+        s += attributes;
+        s += "le=\"";
+        s += i < numBounds ? Metrics::formatNumber(bounds[i], factor, scale) : "+Inf";
+        s += "\"} ";
+        s += std::to_string(count);
+        s += "\n";
+    }
+    std::string attr = pos != std::string::npos ? name.substr(pos) : "";
+    s += baseName;
+    s += "_sum";
+    s += attr;
+    s += " ";
+    s += Metrics::formatNumber(sum.load(), factor, scale);
+    s += "\n";
+    s += baseName;
+    s += "_count";
+    s += attr;
+    s += " ";
+    s += std::to_string(count);
+    return s;
+}
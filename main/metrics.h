@@ -4,10 +4,14 @@
 #include <esp_err.h>
 
 #include <atomic>
+#include <charconv>
 #include <climits>
 #include <string>
 
 #define MAX_METRICS 128
+#define MAX_HISTOGRAMS 16
+#define MAX_HISTOGRAM_BUCKETS 12
+#define FORMAT_NUMBER_BUFFER_SIZE 48  // int64 with decimals, fixed notation of large floats
 
 // indicates a metric w/o a value
 // uninitialized metrics are not included in getAllMetricsAsString() to avoid e.g. broken counter metrics
@@ -67,6 +71,44 @@ class Metric {
     friend class Metrics;
 };
 
+// Prometheus like histogram
+// - name may contain static attributes, bucket attribute le is added when formatting
+// - raw values and bucket upper bounds are int32_t, formatted using factor and scale like Metric
+// - thread safe: atomic counters, but bucket counts, sum and count are not consistent with each other
+class Histogram {
+   public:
+    Histogram() {}
+
+    const std::string& getName() const { return name; }
+
+    void observe(int32_t value) {
+        int i = 0;
+        while (i < numBounds && value > bounds[i]) {
+            i++;
+        }
+        buckets[i]++;
+        sum += value;
+    }
+
+    uint32_t getCount() const;
+    int64_t getSum() const { return sum; }
+    // cumulative count of bucket i, i = numBounds is the +Inf bucket
+    uint32_t getBucketCount(int i) const;
+
+    std::string getValueAsString();
+
+   private:
+    std::string name;
+    int factor;
+    int scale;
+    int32_t bounds[MAX_HISTOGRAM_BUCKETS];  // upper bounds, ascending
+    int numBounds = 0;
+    std::atomic<uint32_t> buckets[MAX_HISTOGRAM_BUCKETS + 1] = {};  // not cumulative, last one is +Inf
+    std::atomic<int64_t> sum = 0;
+
+    friend class Metrics;
+};
+
 // Prometheus like metric store
 // - adding and getting metrics is thread safe
 // - getAllMetricsAsString() reports latest values (no consistency)
@@ -78,46 +120,57 @@ class Metrics {
 
     Metric& addMetric(const char* name, int factor = 1, int scale = 1, bool counter = false);
     Metric* findMetric(const char* name);
+    // bounds: ascending bucket upper bounds (raw values), max MAX_HISTOGRAM_BUCKETS, +Inf bucket is added
+    Histogram& addHistogram(const char* name, const int32_t* bounds, int numBounds, int factor = 1, int scale = 1);
 
     std::string getAllMetricsAsString();
 
     // avoid FP arithmetic
     static std::string formatNumber(auto value, int factor, int scale) {
-        value *= scale;
+        char buffer[FORMAT_NUMBER_BUFFER_SIZE];
+        return std::string(buffer, formatNumber(buffer, sizeof(buffer), value, factor, scale));
+    }
+    // allocation-free variant, returns number of chars written (not null-terminated), 0 if buffer is too small
+    static size_t formatNumber(char* buffer, size_t size, auto value, int factor, int scale) {
+        auto scaled = value * scale;
+        char* end = buffer + size;
         if (factor == 1) {
-            return std::to_string(value);
-        } else if (factor == 10) {
-            auto s = std::to_string(value / 10);
-            s += ".";
-            s += std::to_string(abs(value) % 10);
-            return s;
-        } else if (factor == 100) {
-            auto s = std::to_string(value / 100);
-            auto remainder = abs(value % 100);
-            if (remainder < 10) {
-                s += ".0";
-            } else {
-                s += ".";
-            }
-            s += std::to_string(remainder);
-            return s;
-        } else if (factor == 1000) {
-            auto s = std::to_string(value / 1000);
-            auto remainder = abs(value % 1000);
-            if (remainder < 10) {
-                s += ".00";
-            } else if (remainder < 100) {
-                s += ".0";
-            } else {
-                s += ".";
-            }
-            s += std::to_string(remainder);
-            return s;
-        } else {
-            char s[30];
-            snprintf(s, sizeof(s), "%f", (float)value / factor);
-            return s;
+            auto result = std::to_chars(buffer, end, scaled);
+            return result.ec == std::errc() ? result.ptr - buffer : 0;
+        }
+        int decimals = powerOf10(factor);
+        if (decimals < 0) {
+            // same as "%f"
+            auto result = std::to_chars(buffer, end, (float)scaled / factor, std::chars_format::fixed, 6);
+            return result.ec == std::errc() ? result.ptr - buffer : 0;
+        }
+        // e.g. 10 -> 1 decimal, microseconds as seconds -> 6 decimals
+        auto integer = scaled / factor;
+        auto remainder = abs(scaled % factor);
+        char* ptr = buffer;
+        if (scaled < 0 && integer == 0 && ptr < end) {
+            *ptr++ = '-';  // e.g. -0.5
+        }
+        auto result = std::to_chars(ptr, end, integer);
+        if (result.ec != std::errc() || end - result.ptr < decimals + 1) {
+            return 0;
+        }
+        ptr = result.ptr;
+        *ptr++ = '.';
+        for (int i = decimals - 1; i >= 0; i--) {
+            ptr[i] = (char)('0' + remainder % 10);
+            remainder /= 10;
+        }
+        return ptr + decimals - buffer;
+    }
+    // returns n if value == 10^n, -1 otherwise
+    static int powerOf10(int value) {
+        int n = 0;
+        while (value >= 10 && value % 10 == 0) {
+            value /= 10;
+            n++;
         }
+        return value == 1 ? n : -1;
     }
     // std::abs is not defined for unsigned types but needed by formatNumber()
     template <typename T>
@@ -128,6 +181,8 @@ class Metrics {
    private:
     Metric metrics[MAX_METRICS];  // TODO: vector or simple pre-allocated array?
     std::atomic<int> numMetrics = 0;
+    Histogram histograms[MAX_HISTOGRAMS];
+    std::atomic<int> numHistograms = 0;
     std::atomic<int> estimatedSize = 0;
 };
 
@@ -2,14 +2,37 @@
 
 #include <esp_app_desc.h>
 #include <esp_log.h>
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <vector>
 
 #include "config.h"
 #include "mqtt_helper.h"
 
 static const char* TAG = "mqtt";
 
-MqttClient::MqttClient(Metrics& metrics) : metricMqttStatus(metrics.addMetric(METRIC_NAME_MQTT_STATUS, 1)) {
+// histogram buckets in ms
+static const int32_t pacedWaitTimeBuckets[] = {100, 500, 1000, 2000, 5000, 10000, 30000};
+
+MqttClient::MqttClient(Metrics& metrics)
+    : metricMqttStatus(metrics.addMetric(METRIC_NAME_MQTT_STATUS, 1)),
+      metricDiscoveryPublished(metrics.addMetric(R"(nibegw_mqtt_discovery_total{result="published"})", 1, 1, true)),
+      metricDiscoverySkipped(metrics.addMetric(R"(nibegw_mqtt_discovery_total{result="skipped"})", 1, 1, true)),
+      metricOutboxBytes(metrics.addMetric("nibegw_mqtt_outbox_bytes", 1)),
+      metricPacedQueueBytes(metrics.addMetric("nibegw_mqtt_paced_queue_bytes", 1)),
+      metricPacedDropped(metrics.addMetric("nibegw_mqtt_paced_dropped_total", 1, 1, true)),
+      metricPacedWaitTime(metrics.addHistogram("nibegw_mqtt_paced_wait_seconds", pacedWaitTimeBuckets,
+                                               sizeof(pacedWaitTimeBuckets) / sizeof(pacedWaitTimeBuckets[0]), 1000)),
+      pacedQueue(MqttTokenBucket(MQTT_PACED_BYTES_PER_SECOND, MQTT_PACED_BURST_BYTES, MQTT_PACED_MESSAGES_PER_SECOND,
+                                 MQTT_PACED_BURST_MESSAGES)),
+      discovery(*this) {
     metricMqttStatus.setValue((int32_t)MqttStatus::Disconnected);
+    metricDiscoveryPublished.setValue(0);
+    metricDiscoverySkipped.setValue(0);
+    metricOutboxBytes.setValue(0);
+    metricPacedQueueBytes.setValue(0);
+    metricPacedDropped.setValue(0);
 }
 
 esp_err_t MqttClient::begin(const MqttConfig& config) {
@@ -54,6 +77,17 @@ esp_err_t MqttClient::begin(const MqttConfig& config) {
 
     deviceDiscoveryInfoRef["avty_t"] = availabilityTopic;
     deviceDiscoveryInfoRef["dev"]["ids"].add(config.clientId);
+    deviceDiscoveryInfoRefMembers = MqttHelper::toJsonMembers(deviceDiscoveryInfoRef);
+
+    // https://www.home-assistant.io/integrations/mqtt/#device-discovery-payload
+    JsonDocument deviceDiscoveryDoc;
+    deviceDiscoveryDoc["avty_t"] = availabilityTopic;
+    deviceDiscoveryDoc["dev"] = deviceDiscoveryInfo["dev"];
+    deviceDiscoveryDoc["o"]["name"] = "nibegw";
+    deviceDiscoveryDoc["o"]["sw"] = app_desc->version;
+    int bufferSize = config.bufferSize > 0       ? config.bufferSize
+                     : config.deviceDiscovery ? MQTT_DEVICE_DISCOVERY_BUFFER_SIZE_DEFAULT
+                                              : MQTT_BUFFER_SIZE_DEFAULT;
 
     ESP_LOGI(TAG, "MQTT Broker URL: %s", config.brokerUri.c_str());
     esp_mqtt_client_config_t mqtt_cfg = {};
@@ -65,6 +99,9 @@ esp_err_t MqttClient::begin(const MqttConfig& config) {
     mqtt_cfg.session.last_will.msg = "offline";
     mqtt_cfg.session.last_will.qos = 0;
     mqtt_cfg.session.last_will.retain = 1;
+    // received messages are small (commands, HA status), only the device discovery message needs a large buffer
+    mqtt_cfg.buffer.size = std::min(bufferSize, MQTT_BUFFER_SIZE_DEFAULT);
+    mqtt_cfg.buffer.out_size = bufferSize;
 
     client = esp_mqtt_client_init(&mqtt_cfg);
     if (client == NULL) {
@@ -84,6 +121,47 @@ esp_err_t MqttClient::begin(const MqttConfig& config) {
     }
     ESP_LOGI(TAG, "MQTT client started, status=%ld", metricMqttStatus.getValue());
 
+    if (xTaskCreatePinnedToCore(&pacedTask, "mqttPacedTask", 4 * 1024, this, MQTT_PACED_TASK_PRIORITY, &pacedTaskHandle, 1) !=
+        pdPASS) {
+        ESP_LOGE(TAG, "Could not create mqttPacedTask");
+        return ESP_FAIL;
+    }
+
+    // discovery messages published before reboot are retained by the broker
+    uint8_t discoveryMode = (uint8_t)MqttDiscoveryMode::Entity;  // before device discovery was supported
+    uint32_t discoveryFallbackSize = 0;
+    err = nvs_open(NIBEGW_NVS_NAMESPACE, NVS_READWRITE, &nvsHandle);
+    if (err == ESP_OK) {
+        // not found: defaults
+        nvs_get_u8(nvsHandle, NIBEGW_NVS_KEY_DISCOVERY_MODE, &discoveryMode);
+        nvs_get_u32(nvsHandle, NIBEGW_NVS_KEY_DISCOVERY_FALLBACK, &discoveryFallbackSize);
+
+        size_t size = 0;
+        err = nvs_get_blob(nvsHandle, NIBEGW_NVS_KEY_DISCOVERY_HASHES, nullptr, &size);
+        if (err == ESP_OK) {
+            std::vector<uint8_t> data(size);
+            err = nvs_get_blob(nvsHandle, NIBEGW_NVS_KEY_DISCOVERY_HASHES, data.data(), &size);
+            if (err != ESP_OK || !discovery.getHashes().load(data.data(), size)) {
+                ESP_LOGW(TAG, "Invalid discovery hashes in NVS, all discovery messages are published");
+            }
+        } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGE(TAG, "nvs_get_blob(%s) failed: %d", NIBEGW_NVS_KEY_DISCOVERY_HASHES, err);
+        }
+    } else {
+        ESP_LOGE(TAG, "nvs_open failed: %d", err);
+        nvsHandle = 0;
+    }
+    ESP_LOGI(TAG, "%d discovery hashes loaded", (int)discovery.getHashes().size());
+    {
+        std::lock_guard<std::mutex> lock(discoveryMutex);
+        discovery.begin(config.discoveryPrefix, MqttHelper::toJsonMembers(deviceDiscoveryDoc), deviceDiscoveryInfoRefMembers,
+                        config.deviceDiscovery, bufferSize, (MqttDiscoveryMode)discoveryMode, discoveryFallbackSize);
+    }
+
+    // re-announce on HA birth message
+    homeassistantStatusTopic = config.discoveryPrefix + "/status";
+    subscribe(homeassistantStatusTopic, this);
+
     return ESP_OK;
 }
 
@@ -105,6 +183,96 @@ esp_err_t MqttClient::registerLifecycleCallback(MqttClientLifecycleCallback* cal
     return ESP_OK;
 }
 
+// not thread safe
+esp_err_t MqttClient::registerDiscoveryCallback(MqttDiscoveryCallback* callback) {
+    if (discoveryCallbackCount >= MAX_SUBSCRIPTIONS) {
+        ESP_LOGE(TAG, "Maximum number of discovery callbacks reached");
+        return ESP_ERR_NO_MEM;
+    }
+    discoveryCallbacks[discoveryCallbackCount] = callback;
+    discoveryCallbackCount++;
+    return ESP_OK;
+}
+
+// hashes before mode, otherwise messages would be skipped after an early reboot
+void MqttClient::saveDiscoveryMode(MqttDiscoveryMode mode, uint32_t fallbackSize) {
+    if (nvsHandle == 0) {
+        return;
+    }
+    writeDiscoveryHashes();
+    esp_err_t err = nvs_set_u8(nvsHandle, NIBEGW_NVS_KEY_DISCOVERY_MODE, (uint8_t)mode);
+    if (err == ESP_OK) {
+        err = nvs_set_u32(nvsHandle, NIBEGW_NVS_KEY_DISCOVERY_FALLBACK, fallbackSize);
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(nvsHandle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "nvs_set/nvs_commit(%s) failed: %d", NIBEGW_NVS_KEY_DISCOVERY_MODE, err);
+    }
+}
+
+int MqttClient::publishDiscovery(std::string_view topic, std::string_view payload) {
+    std::lock_guard<std::mutex> lock(discoveryMutex);
+    int64_t due = discovery.due();
+    int msg_id = discovery.publish(topic, payload, esp_timer_get_time());
+    metricDiscoverySkipped.setValue(discovery.skipped());
+    if (discovery.due() != due && pacedTaskHandle != nullptr) {
+        xTaskNotifyGive(pacedTaskHandle);
+    }
+    return msg_id;
+}
+
+int MqttClient::publishDeviceDiscovery() {
+    std::lock_guard<std::mutex> lock(discoveryMutex);
+    int msg_id = discovery.publishDevice();
+    metricDiscoverySkipped.setValue(discovery.skipped());
+    return msg_id;
+}
+
+// burst on boot and HA restart, paced to avoid outbox growth and heap dips
+int MqttClient::enqueueDiscovery(std::string_view topic, std::string_view payload) {
+    return enqueuePaced(topic, payload, QOS0, true, true);
+}
+
+esp_err_t MqttClient::saveDiscoveryHashes() {
+    std::lock_guard<std::mutex> lock(discoveryMutex);
+    return writeDiscoveryHashes();
+}
+
+esp_err_t MqttClient::writeDiscoveryHashes() {
+    MqttDiscoveryHashes& hashes = discovery.getHashes();
+    if (!hashes.isDirty() || nvsHandle == 0) {
+        return ESP_OK;
+    }
+    esp_err_t err = nvs_set_blob(nvsHandle, NIBEGW_NVS_KEY_DISCOVERY_HASHES, hashes.data(), hashes.dataSize());
+    if (err == ESP_OK) {
+        err = nvs_commit(nvsHandle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "nvs_set_blob/nvs_commit(%s) failed: %d", NIBEGW_NVS_KEY_DISCOVERY_HASHES, err);
+    } else {
+        ESP_LOGI(TAG, "%d discovery hashes saved", (int)hashes.size());
+    }
+    // avoid endless write attempts to nvs
+    hashes.clearDirty();
+    return err;
+}
+
+void MqttClient::onMqttMessage(const std::string& topic, const std::string& payload) {
+    if (topic != homeassistantStatusTopic || payload != "online") {
+        return;
+    }
+    ESP_LOGI(TAG, "Home Assistant online, re-announcing");
+    {
+        std::lock_guard<std::mutex> lock(discoveryMutex);
+        discovery.invalidate();
+    }
+    for (size_t i = 0; i < discoveryCallbackCount; i++) {
+        discoveryCallbacks[i]->onHomeassistantOnline();
+    }
+}
+
 int MqttClient::publishAvailability() { return publish(availabilityTopic, "online", 0, QOS0, true); }
 
 int MqttClient::publish(const std::string& topic, const std::string& payload, MqttQOS qos, bool retain) {
@@ -130,6 +298,116 @@ int MqttClient::publish(const std::string& topic, const char* payload, int lengt
     return msg_id;
 }
 
+int MqttClient::publish(std::string_view topic, std::string_view payload, MqttQOS qos, bool retain) {
+    // esp_mqtt_client_publish() requires a null-terminated topic
+    char topicBuffer[MQTT_MAX_TOPIC_LENGTH];
+    if (topic.size() >= sizeof(topicBuffer)) {
+        ESP_LOGE(TAG, "Topic too long: %.*s", (int)topic.size(), topic.data());
+        return -1;
+    }
+    topic.copy(topicBuffer, topic.size());
+    topicBuffer[topic.size()] = '\0';
+    // length 0 means null-terminated payload
+    const char* data = payload.empty() ? "" : payload.data();
+    int msg_id = esp_mqtt_client_publish(client, topicBuffer, data, payload.size(), qos, retain);
+    if (CONFIG_LOG_MAXIMUM_LEVEL >= ESP_LOG_INFO) {
+        if (topic != config->logTopic) {
+            ESP_LOGD(TAG, "publish msg_id=%d, topic=%s, payload=%.*s", msg_id, topicBuffer, (int)payload.size(), data);
+        }
+    }
+    return msg_id;
+}
+
+int MqttClient::publishPaced(std::string_view topic, std::string_view payload, MqttQOS qos, bool retain) {
+    return enqueuePaced(topic, payload, qos, retain, false);
+}
+
+int MqttClient::enqueuePaced(std::string_view topic, std::string_view payload, MqttQOS qos, bool retain, bool discovery) {
+    bool queued;
+    {
+        std::lock_guard<std::mutex> lock(pacedMutex);
+        queued = pacedQueue.push(topic, payload, qos, retain, esp_timer_get_time(), discovery);
+        metricPacedQueueBytes.setValue(pacedQueue.bytes());
+        // rejected and evicted messages
+        metricPacedDropped.setValue(pacedQueue.dropped());
+    }
+    if (!queued) {
+        // do not log for logTopic, would lead to recursion
+        if (topic != config->logTopic) {
+            ESP_LOGW(TAG, "Paced queue full, dropped: %.*s", (int)topic.size(), topic.data());
+        }
+        return -1;
+    }
+    if (pacedTaskHandle != nullptr) {
+        xTaskNotifyGive(pacedTaskHandle);
+    }
+    return 0;
+}
+
+// C wrapper for FreeRTOS task
+void MqttClient::pacedTask(void* pvParameters) { ((MqttClient*)pvParameters)->pacedTask(); }
+
+// paced messages are kept while disconnected, notified by publishPaced() and on connect
+void MqttClient::pacedTask() {
+    while (1) {
+        int64_t deviceDiscoveryDelay;
+        {
+            std::lock_guard<std::mutex> lock(discoveryMutex);
+            int64_t due = discovery.due();
+            deviceDiscoveryDelay = due < 0 ? -1 : std::max(due - esp_timer_get_time(), (int64_t)0);
+        }
+        if (deviceDiscoveryDelay == 0) {
+            publishDeviceDiscovery();
+            deviceDiscoveryDelay = -1;
+        }
+
+        int64_t delay = -1;
+        if (metricMqttStatus.getValue() == (int32_t)MqttStatus::OK) {
+            do {
+                delay = publishNextPaced();
+            } while (delay == 0);
+        }
+        if (deviceDiscoveryDelay > 0 && (delay < 0 || deviceDiscoveryDelay < delay)) {
+            delay = deviceDiscoveryDelay;
+        }
+        metricOutboxBytes.setValue(esp_mqtt_client_get_outbox_size(client));
+
+        uint32_t delayMs = delay < 0 ? MQTT_PACED_IDLE_DELAY_MS : (uint32_t)((delay + 999) / 1000);
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(delayMs) + 1);
+    }
+}
+
+// 0: published, > 0: microseconds to wait, -1: queue empty
+int64_t MqttClient::publishNextPaced() {
+    MqttPacedQueue::Message message;
+    int64_t now = esp_timer_get_time();
+    int64_t delay;
+    {
+        std::lock_guard<std::mutex> lock(pacedMutex);
+        delay = pacedQueue.pop(message, now);
+    }
+    if (delay != 0) {
+        return delay;
+    }
+
+    // lock not held, publishPaced() is called e.g. by MQTT event handler holding the client lock
+    int msg_id = publish(message.topic, message.payload, (MqttQOS)message.qos, message.retain);
+    if (msg_id < 0) {
+        std::lock_guard<std::mutex> lock(pacedMutex);
+        pacedQueue.requeue(std::move(message));
+        return MQTT_PACED_RETRY_DELAY_MS * 1000;
+    }
+    metricPacedWaitTime.observe((now - message.enqueued) / 1000);
+    if (message.discovery) {
+        std::lock_guard<std::mutex> lock(discoveryMutex);
+        discovery.published(message.topic, message.payload);
+        metricDiscoveryPublished.incrementValue(1);
+    }
+    std::lock_guard<std::mutex> lock(pacedMutex);
+    metricPacedQueueBytes.setValue(pacedQueue.bytes());
+    return 0;
+}
+
 // not thread safe
 int MqttClient::subscribe(const std::string& topic, MqttSubscriptionCallback* callback, int qos) {
     if (subscriptionCount >= MAX_SUBSCRIPTIONS) {
@@ -165,6 +443,10 @@ void MqttClient::onConnectedEvent(esp_mqtt_event_handle_t event) {
     for (size_t i = 0; i < lifecycleCallbackCount; i++) {
         lifecycleCallbacks[i]->onConnected();
     }
+    // resume paced messages queued while disconnected
+    if (pacedTaskHandle != nullptr) {
+        xTaskNotifyGive(pacedTaskHandle);
+    }
 
     // re-subscribe
     for (size_t i = 0; i < subscriptionCount; i++) {
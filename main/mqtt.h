@@ -2,16 +2,41 @@
 #define _mqtt_h_
 
 #include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <mqtt_client.h>
+#include <sdkconfig.h>
+#if !CONFIG_IDF_TARGET_LINUX
+#include <nvs.h>
+#endif
 
+#include <mutex>
 #include <string>
+#include <string_view>
 
 #include "config.h"
 #include "metrics.h"
+#include "mqtt_helper.h"
 //
 #include <ArduinoJson.h>
 
 #define MAX_SUBSCRIPTIONS 10
+#define MQTT_MAX_TOPIC_LENGTH 128
+#define MQTT_BUFFER_SIZE_DEFAULT 1024  // same as esp-mqtt
+#define MQTT_DEVICE_DISCOVERY_BUFFER_SIZE_DEFAULT (16 * 1024)  // output buffer, ~50 entities
+
+#define NIBEGW_NVS_KEY_DISCOVERY_HASHES "discoveryHashes"
+#define NIBEGW_NVS_KEY_DISCOVERY_MODE "discoveryMode"     // MqttDiscoveryMode of last session
+#define NIBEGW_NVS_KEY_DISCOVERY_FALLBACK "discFallback"  // output buffer size exceeded by device discovery
+
+// pacing of low priority messages (discovery, logs), burst below lwIP TCP send buffer (CONFIG_LWIP_TCP_SND_BUF_DEFAULT)
+#define MQTT_PACED_BYTES_PER_SECOND (8 * 1024)
+#define MQTT_PACED_BURST_BYTES (4 * 1024)
+#define MQTT_PACED_MESSAGES_PER_SECOND 20
+#define MQTT_PACED_BURST_MESSAGES 10
+#define MQTT_PACED_RETRY_DELAY_MS 100  // publishing failed, e.g. outbox full
+#define MQTT_PACED_IDLE_DELAY_MS 5000  // update of outbox metric while queue is empty
+#define MQTT_PACED_TASK_PRIORITY 5     // above logging (4), below nibegw publisher (9)
 
 enum class MqttStatus {
     OK = 0,
@@ -33,6 +58,11 @@ struct MqttConfig {
     std::string deviceManufacturer;
     std::string deviceModel;
     std::string deviceConfigurationUrl;
+    // one HA device discovery message for all entities instead of one message per entity
+    // falls back to entity discovery messages if the device message exceeds bufferSize, persisted until bufferSize changes
+    bool deviceDiscovery = false;
+    // esp-mqtt output buffer (bytes), 0: MQTT_BUFFER_SIZE_DEFAULT or MQTT_DEVICE_DISCOVERY_BUFFER_SIZE_DEFAULT
+    int bufferSize = 0;
 
     std::string hostname;
     // do not log for logTopic, would lead to recursion
@@ -55,33 +85,65 @@ class MqttClientLifecycleCallback {
     virtual void onDisconnected() = 0;
 };
 
+class MqttDiscoveryCallback {
+   public:
+    // Home Assistant (re)started (birth message), discovery messages must be published again
+    virtual void onHomeassistantOnline() = 0;
+};
+
 typedef void (MqttSubscriptionCallback::*MqttCallbackFunction)(std::string, std::string);
 
-class MqttClient {
+class MqttClient : public MqttSubscriptionCallback, private MqttDiscoveryTransport {
    public:
     MqttClient(Metrics& metrics);
     const MqttConfig& getConfig() const { return *config; }
     const std::string& getAvailabilityTopic() const { return availabilityTopic; }
     const JsonDocument& getDeviceDiscoveryInfo() const { return deviceDiscoveryInfo; }
     const JsonDocument& getDeviceDiscoveryInfoRef() const { return deviceDiscoveryInfoRef; }
+    // pre-serialized deviceDiscoveryInfoRef for building discovery payloads, see MqttDiscoveryPayload
+    const std::string& getDeviceDiscoveryInfoRefMembers() const { return deviceDiscoveryInfoRefMembers; }
 
     esp_err_t begin(const MqttConfig& config);
     MqttStatus status() const { return (MqttStatus)metricMqttStatus.getValue(); }
 
     esp_err_t registerLifecycleCallback(MqttClientLifecycleCallback* callback);
+    esp_err_t registerDiscoveryCallback(MqttDiscoveryCallback* callback);
 
     int publishAvailability();
     int publish(const std::string& topic, const std::string& payload, MqttQOS qos = QOS0, bool retain = false);
     int publish(const std::string& topic, const char* payload, MqttQOS qos = QOS0, bool retain = false);
     int publish(const std::string& topic, const char* payload, int length, MqttQOS qos = QOS0, bool retain = false);
+    // allocation-free, e.g. for precomputed topics and values formatted into a stack buffer
+    int publish(std::string_view topic, std::string_view payload, MqttQOS qos = QOS0, bool retain = false);
+    // low priority messages (discovery, logs), queued and published rate limited, state updates use publish()
+    // returns 0 if queued, -1 if dropped (queue full), may be evicted later by discovery messages
+    int publishPaced(std::string_view topic, std::string_view payload, MqttQOS qos = QOS0, bool retain = false);
     int subscribe(const std::string& topic, MqttSubscriptionCallback* callback, int qos = 0);
 
+    // retained HA discovery message, skipped if published unchanged before (also before reboot) and HA was not restarted
+    // MqttConfig::deviceDiscovery: collected as component of the device discovery message
+    int publishDiscovery(std::string_view topic, std::string_view payload);
+    // collected components as one message, called by paced task MQTT_DEVICE_DISCOVERY_DELAY_MS after last change (or tests)
+    int publishDeviceDiscovery();
+    // persists hashes of published discovery messages if changed, e.g. called periodically
+    esp_err_t saveDiscoveryHashes();
+
+    // MqttSubscriptionCallback: HA status (birth message)
+    void onMqttMessage(const std::string& topic, const std::string& payload);
+
    private:
     Metric& metricMqttStatus;
+    Metric& metricDiscoveryPublished;
+    Metric& metricDiscoverySkipped;
+    Metric& metricOutboxBytes;
+    Metric& metricPacedQueueBytes;
+    Metric& metricPacedDropped;
+    Histogram& metricPacedWaitTime;
     const MqttConfig* config;
     std::string availabilityTopic;
     JsonDocument deviceDiscoveryInfo;
     JsonDocument deviceDiscoveryInfoRef;
+    std::string deviceDiscoveryInfoRefMembers;
     esp_mqtt_client_handle_t client;
     MqttClientLifecycleCallback* lifecycleCallbacks[MAX_SUBSCRIPTIONS];
     int lifecycleCallbackCount = 0;
@@ -91,11 +153,31 @@ class MqttClient {
         MqttSubscriptionCallback* callback;
     } subscriptions[MAX_SUBSCRIPTIONS];
     int subscriptionCount = 0;
+    MqttDiscoveryCallback* discoveryCallbacks[MAX_SUBSCRIPTIONS];
+    int discoveryCallbackCount = 0;
+    std::string homeassistantStatusTopic;
+    std::mutex discoveryMutex;  // publishDiscovery() is called by several tasks
+    MqttDiscovery discovery;
+    std::mutex pacedMutex;  // not held while publishing, esp_mqtt_client_publish() may block
+    MqttPacedQueue pacedQueue;
+    TaskHandle_t pacedTaskHandle = nullptr;
+#if !CONFIG_IDF_TARGET_LINUX
+    nvs_handle_t nvsHandle = 0;
+#endif
 
     void onDataEvent(esp_mqtt_event_handle_t event);
     void onConnectedEvent(esp_mqtt_event_handle_t event);
     void onDisconnectedEvent(esp_mqtt_event_handle_t event);
 
+    static void pacedTask(void* pvParameters);
+    void pacedTask();
+    int enqueuePaced(std::string_view topic, std::string_view payload, MqttQOS qos, bool retain, bool discovery);
+    int64_t publishNextPaced();
+    // MqttDiscoveryTransport, discoveryMutex must be held
+    int enqueueDiscovery(std::string_view topic, std::string_view payload);
+    void saveDiscoveryMode(MqttDiscoveryMode mode, uint32_t fallbackSize);
+    esp_err_t writeDiscoveryHashes();
+
     static void mqtt_event_handler(void* handler_args, esp_event_base_t base, int32_t event_id, void* event_data);
 };
 
@@ -2,6 +2,10 @@
 
 #include <esp_log.h>
 
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
 static const char* TAG = "mqtt";
 
 // extra file for testing
@@ -56,3 +60,625 @@ void MqttHelper::mergeMqttDiscoveryInfoOverride(JsonDocument& discoveryDoc, cons
         }
     }
 }
+
+esp_err_t MqttHelper::parseMqttDiscoveryInfoOverride(const std::string& json, MqttDiscoveryOverride& override) {
+    override = {};
+    override.json = json;
+    if (json.empty()) {
+        return ESP_OK;
+    }
+    JsonDocument overrideDoc;
+    DeserializationError err = deserializeJson(overrideDoc, json);
+    if (err || !overrideDoc.is<JsonObject>()) {
+        ESP_LOGE(TAG, "Failed to parse override discovery message (%s): %s", err ? err.c_str() : "no object", json.c_str());
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (auto kv : overrideDoc.as<JsonObject>()) {
+        std::string_view key(kv.key().c_str(), kv.key().size());
+        if (key == "_component_") {
+            override.component = kv.value() | "";
+            continue;
+        }
+        override.keys.emplace_back(key);
+        if (kv.value().isNull()) {
+            continue;
+        }
+        if (!override.members.empty()) {
+            override.members += ',';
+        }
+        appendJsonString(override.members, key);
+        override.members += ':';
+        std::string value;  // serializeJson() replaces the string content
+        serializeJson(kv.value(), value);
+        override.members += value;
+    }
+    override.keys.shrink_to_fit();
+    return ESP_OK;
+}
+
+std::string MqttHelper::toJsonMembers(const JsonDocument& doc) {
+    std::string json;
+    serializeJson(doc, json);
+    if (json.size() < 2 || json.front() != '{') {
+        return "";
+    }
+    return json.substr(1, json.size() - 2);
+}
+
+// same escaping as ArduinoJson
+void MqttHelper::appendJsonString(std::string& json, std::string_view value) {
+    json += '"';
+    for (char c : value) {
+        switch (c) {
+            case '"':
+                json += "\\\"";
+                break;
+            case '\\':
+                json += "\\\\";
+                break;
+            case '\b':
+                json += "\\b";
+                break;
+            case '\f':
+                json += "\\f";
+                break;
+            case '\n':
+                json += "\\n";
+                break;
+            case '\r':
+                json += "\\r";
+                break;
+            case '\t':
+                json += "\\t";
+                break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    json += escaped;
+                } else {
+                    json += c;
+                }
+                break;
+        }
+    }
+    json += '"';
+}
+
+bool MqttDiscoveryOverride::overrides(std::string_view key) const {
+    for (const auto& overridden : keys) {
+        if (overridden == key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+MqttDiscoveryPayload::MqttDiscoveryPayload(std::string& payload, const MqttDiscoveryOverride* override)
+    : payload(payload), override(override) {
+    payload = '{';
+}
+
+void MqttDiscoveryPayload::addFragment(std::string_view members) {
+    if (members.empty()) {
+        return;
+    }
+    if (payload.size() > 1) {
+        payload += ',';
+    }
+    payload += members;
+}
+
+// false if the member is overridden and must be skipped
+bool MqttDiscoveryPayload::addKey(std::string_view key) {
+    if (override != nullptr && override->overrides(key)) {
+        return false;
+    }
+    if (payload.size() > 1) {
+        payload += ',';
+    }
+    MqttHelper::appendJsonString(payload, key);
+    payload += ':';
+    return true;
+}
+
+void MqttDiscoveryPayload::add(std::string_view key, std::string_view value) {
+    if (addKey(key)) {
+        MqttHelper::appendJsonString(payload, value);
+    }
+}
+
+void MqttDiscoveryPayload::add(std::string_view key, int32_t value) {
+    char buffer[12];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    addNumber(key, std::string_view(buffer, result.ptr - buffer));
+}
+
+void MqttDiscoveryPayload::addNumber(std::string_view key, std::string_view number) {
+    if (addKey(key)) {
+        payload += number;
+    }
+}
+
+void MqttDiscoveryPayload::finish() {
+    if (override != nullptr) {
+        addFragment(override->members);
+    }
+    payload += '}';
+}
+
+// FNV-1a, 32 bit
+uint32_t MqttDiscoveryHashes::hash(std::string_view data) {
+    uint32_t hash = 2166136261u;
+    for (char c : data) {
+        hash ^= (uint8_t)c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+std::vector<MqttDiscoveryHashes::Entry>::const_iterator MqttDiscoveryHashes::find(uint32_t topic) const {
+    return std::lower_bound(entries.begin(), entries.end(), topic,
+                            [](const Entry& entry, uint32_t topic) { return entry.topic < topic; });
+}
+
+bool MqttDiscoveryHashes::isPublishRequired(std::string_view topic, std::string_view payload) const {
+    uint32_t topicHash = hash(topic);
+    auto iter = find(topicHash);
+    return iter == entries.end() || iter->topic != topicHash || iter->payload == 0 || iter->payload != hash(payload);
+}
+
+void MqttDiscoveryHashes::published(std::string_view topic, std::string_view payload) {
+    uint32_t topicHash = hash(topic);
+    uint32_t payloadHash = hash(payload);
+    auto iter = entries.begin() + (find(topicHash) - entries.begin());
+    if (iter != entries.end() && iter->topic == topicHash) {
+        if (iter->payload != payloadHash) {
+            iter->payload = payloadHash;
+            dirty = true;
+        }
+    } else if (entries.size() < MQTT_DISCOVERY_HASHES_MAX) {
+        entries.insert(iter, {topicHash, payloadHash});
+        dirty = true;
+    }
+}
+
+// persisted hashes are still valid for the retained messages of the broker, not marked dirty
+void MqttDiscoveryHashes::invalidate() {
+    for (auto& entry : entries) {
+        entry.payload = 0;
+    }
+}
+
+void MqttDiscoveryHashes::remove(std::string_view topic) {
+    uint32_t topicHash = hash(topic);
+    auto iter = entries.begin() + (find(topicHash) - entries.begin());
+    if (iter != entries.end() && iter->topic == topicHash) {
+        entries.erase(iter);
+        dirty = true;
+    }
+}
+
+void MqttDiscoveryHashes::clear() {
+    dirty = dirty || !entries.empty();
+    entries.clear();
+}
+
+bool MqttDiscoveryHashes::load(const void* data, size_t size) {
+    entries.clear();
+    dirty = false;
+    if (size % sizeof(Entry) != 0 || size / sizeof(Entry) > MQTT_DISCOVERY_HASHES_MAX) {
+        return false;
+    }
+    entries.resize(size / sizeof(Entry));
+    std::memcpy(entries.data(), data, size);
+    if (!std::is_sorted(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.topic < b.topic; })) {
+        entries.clear();
+        return false;
+    }
+    return true;
+}
+
+MqttTokenBucket::MqttTokenBucket(uint32_t bytesPerSecond, uint32_t burstBytes, uint32_t messagesPerSecond,
+                                 uint32_t burstMessages)
+    : bytesPerSecond(bytesPerSecond),
+      burstBytes(burstBytes * 1000000ll),
+      messagesPerSecond(messagesPerSecond),
+      burstMessages(burstMessages * 1000000ll),
+      byteTokens(this->burstBytes),
+      messageTokens(this->burstMessages) {}
+
+void MqttTokenBucket::refill(int64_t now) {
+    if (lastRefill >= 0 && now > lastRefill) {
+        int64_t elapsed = now - lastRefill;
+        byteTokens = std::min(burstBytes, byteTokens + elapsed * bytesPerSecond);
+        messageTokens = std::min(burstMessages, messageTokens + elapsed * messagesPerSecond);
+    }
+    if (now > lastRefill) {
+        lastRefill = now;
+    }
+}
+
+int64_t MqttTokenBucket::delay(size_t bytes, int64_t now) {
+    refill(now);
+    int64_t requiredBytes = std::min(burstBytes, (int64_t)bytes * 1000000);
+    int64_t delay = 0;
+    if (byteTokens < requiredBytes) {
+        delay = (requiredBytes - byteTokens + bytesPerSecond - 1) / bytesPerSecond;
+    }
+    if (messageTokens < 1000000) {
+        delay = std::max(delay, (1000000 - messageTokens + messagesPerSecond - 1) / messagesPerSecond);
+    }
+    return delay;
+}
+
+// may go negative for messages larger than the byte burst, the deficit is paid back before the next message
+void MqttTokenBucket::consume(size_t bytes) {
+    byteTokens -= (int64_t)bytes * 1000000;
+    messageTokens -= 1000000;
+}
+
+bool MqttPacedQueue::push(std::string_view topic, std::string_view payload, int qos, bool retain, int64_t now,
+                          bool discovery) {
+    size_t size = topic.size() + payload.size();
+    // retained message replaces queued message of same topic
+    auto replaced = retain ? findRetained(topic) : messages.end();
+    size_t freed = replaced != messages.end() ? replaced->topic.size() + replaced->payload.size() : 0;
+    if (queuedBytes + size - freed > maxBytes) {
+        if (!discovery) {
+            droppedMessages++;
+            return false;
+        }
+        evict(queuedBytes + size - freed - maxBytes, topic);
+        replaced = retain ? findRetained(topic) : messages.end();
+    }
+    if (replaced != messages.end()) {
+        queuedBytes = queuedBytes - replaced->payload.size() + payload.size();
+        replaced->payload = payload;
+        replaced->qos = qos;
+        replaced->discovery = discovery;
+        return true;
+    }
+    messages.push_back({std::string(topic), std::string(payload), qos, retain, now, discovery});
+    queuedBytes += size;
+    return true;
+}
+
+int64_t MqttPacedQueue::pop(Message& message, int64_t now) {
+    if (messages.empty()) {
+        return -1;
+    }
+    size_t size = messages.front().topic.size() + messages.front().payload.size();
+    int64_t delay = bucket.delay(size, now);
+    if (delay > 0) {
+        return delay;
+    }
+    bucket.consume(size);
+    message = std::move(messages.front());
+    messages.pop_front();
+    queuedBytes -= size;
+    return 0;
+}
+
+std::deque<MqttPacedQueue::Message>::iterator MqttPacedQueue::findRetained(std::string_view topic) {
+    return std::find_if(messages.begin(), messages.end(),
+                        [topic](const Message& message) { return message.retain && message.topic == topic; });
+}
+
+// evicts oldest non-discovery messages, except a retained message of topic about to be replaced
+void MqttPacedQueue::evict(size_t bytes, std::string_view topic) {
+    size_t evicted = 0;
+    for (auto it = messages.begin(); it != messages.end() && evicted < bytes;) {
+        if (it->discovery || (it->retain && it->topic == topic)) {
+            ++it;
+            continue;
+        }
+        evicted += it->topic.size() + it->payload.size();
+        queuedBytes -= it->topic.size() + it->payload.size();
+        it = messages.erase(it);
+        droppedMessages++;
+    }
+}
+
+void MqttPacedQueue::requeue(Message&& message) {
+    queuedBytes += message.topic.size() + message.payload.size();
+    messages.push_front(std::move(message));
+}
+
+void MqttDeviceDiscovery::begin(std::string_view discoveryPrefix, std::string_view deviceMembers, size_t maxSize) {
+    this->discoveryPrefix = discoveryPrefix;
+    this->deviceMembers = deviceMembers;
+    this->maxSize = maxSize;
+    fallbackActive = false;
+    components.clear();
+}
+
+esp_err_t MqttDeviceDiscovery::add(std::string_view topic, std::string_view payload) {
+    // <prefix>/<platform>/[<node_id>/]<object_id>/config
+    if (!topic.starts_with(discoveryPrefix) || topic.size() <= discoveryPrefix.size() || topic[discoveryPrefix.size()] != '/' ||
+        !topic.ends_with("/config")) {
+        ESP_LOGE(TAG, "Invalid discovery topic %.*s", (int)topic.size(), topic.data());
+        return ESP_ERR_INVALID_ARG;
+    }
+    std::string_view path = topic.substr(discoveryPrefix.size() + 1, topic.size() - discoveryPrefix.size() - 8);
+    size_t platformEnd = path.find('/');
+    size_t objectIdStart = path.rfind('/');
+    if (platformEnd == std::string_view::npos || platformEnd == 0 || objectIdStart + 1 == path.size()) {
+        ESP_LOGE(TAG, "Invalid discovery topic %.*s", (int)topic.size(), topic.data());
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    JsonDocument doc;
+    DeserializationError err = deserializeJson(doc, payload);
+    if (err || !doc.is<JsonObject>()) {
+        ESP_LOGE(TAG, "Invalid discovery message of %.*s", (int)topic.size(), topic.data());
+        return ESP_ERR_INVALID_ARG;
+    }
+    doc.remove("dev");
+    doc.remove("avty_t");
+
+    auto iter = std::find_if(components.begin(), components.end(),
+                             [&](const Component& component) { return component.topic == topic; });
+    if (iter == components.end()) {
+        components.push_back({std::string(topic), std::string(path.substr(objectIdStart + 1)),
+                              std::string(path.substr(0, platformEnd)), {}});
+        iter = components.end() - 1;
+    }
+    iter->members = MqttHelper::toJsonMembers(doc);
+    return payloadSize() > maxSize ? ESP_ERR_INVALID_SIZE : ESP_OK;
+}
+
+// {<deviceMembers>,"cmps":{"<objectId>":{"p":"<platform>",<members>},...}}
+void MqttDeviceDiscovery::build(std::string& payload) const {
+    payload.clear();
+    payload.reserve(payloadSize());
+    payload += '{';
+    if (!deviceMembers.empty()) {
+        payload += deviceMembers;
+        payload += ',';
+    }
+    payload += "\"cmps\":{";
+    for (size_t i = 0; i < components.size(); i++) {
+        const Component& component = components[i];
+        if (i > 0) {
+            payload += ',';
+        }
+        MqttHelper::appendJsonString(payload, component.objectId);
+        payload += ":{\"p\":";
+        MqttHelper::appendJsonString(payload, component.platform);
+        if (!component.members.empty()) {
+            payload += ',';
+            payload += component.members;
+        }
+        payload += '}';
+    }
+    payload += "}}";
+}
+
+// same as build(), object ids and platforms are topic levels and never escaped
+size_t MqttDeviceDiscovery::payloadSize() const {
+    size_t size = 1 + (deviceMembers.empty() ? 0 : deviceMembers.size() + 1) + 8 + 2;
+    for (size_t i = 0; i < components.size(); i++) {
+        const Component& component = components[i];
+        size += (i > 0 ? 1 : 0) + component.objectId.size() + 2 + 6 + component.platform.size() + 2 + 1;
+        if (!component.members.empty()) {
+            size += 1 + component.members.size();
+        }
+    }
+    return size;
+}
+
+void MqttDeviceDiscovery::entityPayload(const Component& component, std::string_view deviceInfoRefMembers,
+                                        std::string& payload) {
+    payload.clear();
+    payload += '{';
+    payload += deviceInfoRefMembers;
+    if (!component.members.empty()) {
+        if (!deviceInfoRefMembers.empty()) {
+            payload += ',';
+        }
+        payload += component.members;
+    }
+    payload += '}';
+}
+
+void MqttDeviceDiscovery::fallback() {
+    fallbackActive = true;
+    components.clear();
+    components.shrink_to_fit();
+}
+
+// device discovery falls back to entity discovery once per buffer size
+// switching modes clears the hashes, all discovery messages of the new mode are published
+// retained messages of the other mode are migrated (see Home Assistant MQTT discovery migration) and then removed
+void MqttDiscovery::begin(std::string_view discoveryPrefix, std::string_view deviceMembers,
+                          std::string_view deviceInfoRefMembers, bool deviceDiscovery, size_t maxSize,
+                          MqttDiscoveryMode stored, uint32_t fallbackSize) {
+    this->deviceDiscovery.begin(discoveryPrefix, deviceMembers, maxSize);
+    deviceTopic = std::string(discoveryPrefix) + "/device/nibegw/config";
+    this->deviceInfoRefMembers = deviceInfoRefMembers;
+    deviceDue = -1;
+    deviceDelay = MQTT_DEVICE_DISCOVERY_DELAY_MS * 1000;
+    migrateEntityDiscovery = false;
+    migratingTopics.clear();
+    awaitingTopics.clear();
+    removingTopics.clear();
+    deviceRemoval = DeviceRemoval::None;
+    deviceRemovalDue = false;
+    saveModePending = false;
+    if (deviceDiscovery && fallbackSize == maxSize) {
+        ESP_LOGW(TAG, "Device discovery exceeded MQTT buffer (%d bytes) before, using entity discovery", (int)fallbackSize);
+        this->deviceDiscovery.fallback();
+    }
+    mode = deviceDiscovery && !this->deviceDiscovery.isFallback() ? MqttDiscoveryMode::Device : MqttDiscoveryMode::Entity;
+    if (mode == stored) {
+        return;
+    }
+    ESP_LOGI(TAG, "%s discovery enabled, publishing all discovery messages",
+             mode == MqttDiscoveryMode::Device ? "Device" : "Entity");
+    hashes.clear();
+    saveModePending = true;
+    saveFallbackSize = fallbackSize;
+    if (stored == MqttDiscoveryMode::Device) {
+        // removed once the entity messages were queued, see publishDevice()
+        deviceRemoval = DeviceRemoval::Migrating;
+        enqueue(deviceTopic, MQTT_DISCOVERY_MIGRATE_PAYLOAD);
+    } else {
+        migrateEntityDiscovery = true;
+    }
+}
+
+int MqttDiscovery::publish(std::string_view topic, std::string_view payload, int64_t now) {
+    if (mode == MqttDiscoveryMode::Device) {
+        size_t components = deviceDiscovery.size();
+        esp_err_t err = deviceDiscovery.add(topic, payload);
+        if (err == ESP_OK) {
+            if (migrateEntityDiscovery && deviceDiscovery.size() > components) {
+                // retained by the broker since entity discovery, entity kept by Home Assistant
+                migratingTopics.emplace_back(topic);
+                enqueue(topic, MQTT_DISCOVERY_MIGRATE_PAYLOAD);
+            }
+            // components are announced one by one, e.g. Nibe registers on first appearance
+            deviceDue = now + deviceDelay;
+            return 0;
+        }
+        if (err == ESP_ERR_INVALID_SIZE) {
+            fallback();
+            return 0;
+        }
+        // not a valid entity discovery message, published as is
+    } else if (deviceRemoval != DeviceRemoval::None && !deviceRemovalDue) {
+        // device message of the last session removed after entities were announced, like device discovery
+        deviceDue = now + deviceDelay;
+    }
+    return enqueue(topic, payload);
+}
+
+int MqttDiscovery::publishDevice() {
+    deviceDue = -1;
+    if (mode != MqttDiscoveryMode::Device) {
+        if (deviceRemoval != DeviceRemoval::None && !deviceRemovalDue) {
+            deviceRemovalDue = true;
+            removeDevice();
+        }
+        return 0;
+    }
+    if (deviceDiscovery.size() == 0) {
+        return 0;
+    }
+    std::string payload;
+    deviceDiscovery.build(payload);
+    bool publishRequired = hashes.isPublishRequired(deviceTopic, payload);
+    if (publishRequired) {
+        ESP_LOGI(TAG, "Device discovery: %d components, %d bytes", (int)deviceDiscovery.size(), (int)payload.size());
+        // message grows while components are announced, avoid re-publishing it every few seconds
+        deviceDelay = std::min(deviceDelay * 2, (int64_t)MQTT_DEVICE_DISCOVERY_MAX_DELAY_MS * 1000);
+    }
+    // a queued device message is replaced by this one, migrated topics are removed once the latest was sent
+    awaitingTopics.insert(awaitingTopics.end(), migratingTopics.begin(), migratingTopics.end());
+    migratingTopics.clear();
+    if (!awaitingTopics.empty()) {
+        awaitingDeviceHash = MqttDiscoveryHashes::hash(payload);
+    }
+    int msg_id = enqueue(deviceTopic, payload);
+    if (!publishRequired && !awaitingTopics.empty()) {
+        removeMigratedEntities();
+    }
+    return msg_id;
+}
+
+// messages are sent in order, removal is queued after the migrate message and its replacement were sent
+// a retained message would otherwise replace the queued migrate message
+void MqttDiscovery::published(std::string_view topic, std::string_view payload) {
+    hashes.published(topic, payload);
+    if (topic == deviceTopic) {
+        if (deviceRemoval == DeviceRemoval::Migrating && payload == MQTT_DISCOVERY_MIGRATE_PAYLOAD) {
+            deviceRemoval = DeviceRemoval::Migrated;
+            removeDevice();
+        } else if (deviceRemoval == DeviceRemoval::Removing && payload.empty()) {
+            deviceRemoval = DeviceRemoval::None;
+            saveMode();
+        } else if (!awaitingTopics.empty() && MqttDiscoveryHashes::hash(payload) == awaitingDeviceHash) {
+            removeMigratedEntities();
+        }
+    } else if (payload.empty()) {
+        auto iter = std::find(removingTopics.begin(), removingTopics.end(), topic);
+        if (iter != removingTopics.end()) {
+            removingTopics.erase(iter);
+            saveMode();
+        }
+    }
+}
+
+void MqttDiscovery::invalidate() {
+    hashes.invalidate();
+    deviceDelay = MQTT_DEVICE_DISCOVERY_DELAY_MS * 1000;
+}
+
+int MqttDiscovery::enqueue(std::string_view topic, std::string_view payload) {
+    if (!hashes.isPublishRequired(topic, payload)) {
+        ESP_LOGD(TAG, "discovery unchanged, skipped: %.*s", (int)topic.size(), topic.data());
+        skippedMessages++;
+        return 0;
+    }
+    // hash is recorded by published() once sent, not persisted for messages that never reached the broker
+    return transport.enqueueDiscovery(topic, payload);
+}
+
+// collected components (incl. the one exceeding the limit) are published as entity messages
+void MqttDiscovery::fallback() {
+    ESP_LOGW(TAG, "Device discovery exceeds MQTT buffer (%d bytes), falling back to entity discovery",
+             (int)deviceDiscovery.payloadSize());
+    // device discovery message published before is migrated to the entity messages, removed once they were queued
+    deviceRemoval = DeviceRemoval::Migrating;
+    deviceRemovalDue = false;
+    enqueue(deviceTopic, MQTT_DISCOVERY_MIGRATE_PAYLOAD);
+    std::string payload;
+    for (const auto& component : deviceDiscovery.getComponents()) {
+        MqttDeviceDiscovery::entityPayload(component, deviceInfoRefMembers, payload);
+        // e.g. entity discovery of an earlier session, migrated or removed
+        hashes.remove(component.topic);
+        enqueue(component.topic, payload);
+    }
+    // entity topics still being migrated are restored by the entity messages
+    migrateEntityDiscovery = false;
+    migratingTopics.clear();
+    awaitingTopics.clear();
+    removingTopics.clear();
+    // entity discovery on next boot, no partial device discovery message
+    saveModePending = true;
+    saveFallbackSize = deviceDiscovery.getMaxSize();
+    deviceDiscovery.fallback();
+    mode = MqttDiscoveryMode::Entity;
+    deviceDue = -1;
+    deviceRemovalDue = true;
+    removeDevice();
+}
+
+void MqttDiscovery::removeMigratedEntities() {
+    // published() may be called while queueing, e.g. by a transport sending immediately
+    std::vector<std::string> topics;
+    topics.swap(awaitingTopics);
+    removingTopics.insert(removingTopics.end(), topics.begin(), topics.end());
+    for (const auto& topic : topics) {
+        enqueue(topic, "");
+    }
+}
+
+void MqttDiscovery::removeDevice() {
+    if (deviceRemoval != DeviceRemoval::Migrated || !deviceRemovalDue) {
+        return;
+    }
+    deviceRemoval = DeviceRemoval::Removing;
+    enqueue(deviceTopic, "");
+}
+
+void MqttDiscovery::saveMode() {
+    if (!saveModePending || !migratingTopics.empty() || !awaitingTopics.empty() || !removingTopics.empty() ||
+        deviceRemoval != DeviceRemoval::None) {
+        return;
+    }
+    saveModePending = false;
+    ESP_LOGI(TAG, "%s discovery migrated", mode == MqttDiscoveryMode::Device ? "Device" : "Entity");
+    transport.saveDiscoveryMode(mode, saveFallbackSize);
+}
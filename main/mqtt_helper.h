@@ -1,16 +1,277 @@
 #ifndef _mqtt_helper_h_
 #define _mqtt_helper_h_
 
+#include <esp_err.h>
+
+#include <deque>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "config.h"
 //
 #include <ArduinoJson.h>
 
+// Home Assistant discovery override, parsed once at config load, e.g.
+// {"_component_":"number","unit_of_meas":"Grad Celsius","dev_cla":null}
+struct MqttDiscoveryOverride {
+    std::string json;               // as configured
+    std::string component;          // "_component_", empty: not overridden
+    std::string members;            // non-null members serialized without braces, appended to the discovery payload
+    std::vector<std::string> keys;  // overridden and removed (null) keys, skipped in the default members
+
+    bool overrides(std::string_view key) const;
+};
+
+// JSON object built from serialized members, no JsonDocument and no parsing
+// - default members that are overridden are skipped, the override members are appended by finish()
+// - fragments (e.g. the device info) are copied as is and cannot be removed by an override
+class MqttDiscoveryPayload {
+   public:
+    MqttDiscoveryPayload(std::string& payload, const MqttDiscoveryOverride* override = nullptr);
+
+    void addFragment(std::string_view members);
+    void add(std::string_view key, std::string_view value);  // string value, escaped
+    void add(std::string_view key, int32_t value);
+    void addNumber(std::string_view key, std::string_view number);  // formatted number
+    void finish();
+
+   private:
+    std::string& payload;
+    const MqttDiscoveryOverride* override;
+
+    bool addKey(std::string_view key);
+};
+
+#define MQTT_DISCOVERY_HASHES_MAX 256  // 2 KB persisted, messages of further topics are always published
+
+// hashes of published (retained) discovery messages, persisted to skip re-publishing unchanged messages on boot
+class MqttDiscoveryHashes {
+   public:
+    struct Entry {
+        uint32_t topic;    // hash of topic
+        uint32_t payload;  // hash of payload, 0: publish required
+    };
+
+    static uint32_t hash(std::string_view data);
+
+    // payload changed or not published since invalidate()
+    bool isPublishRequired(std::string_view topic, std::string_view payload) const;
+    void published(std::string_view topic, std::string_view payload);
+    // retained messages must be published again, e.g. Home Assistant restarted
+    void invalidate();
+    // not published (persisted), e.g. switching between device and entity discovery
+    void remove(std::string_view topic);
+    void clear();
+
+    // persisted image: entries sorted by topic hash, same layout as in memory
+    const void* data() const { return entries.data(); }
+    size_t dataSize() const { return entries.size() * sizeof(Entry); }
+    bool load(const void* data, size_t size);
+    size_t size() const { return entries.size(); }
+    // changed since load() or clearDirty()
+    bool isDirty() const { return dirty; }
+    void clearDirty() { dirty = false; }
+
+   private:
+    std::vector<Entry> entries;
+    bool dirty = false;
+
+    std::vector<Entry>::const_iterator find(uint32_t topic) const;
+};
+
+// Home Assistant device discovery: one retained message with all components ("cmps") of the device
+// https://www.home-assistant.io/integrations/mqtt/#device-discovery-payload
+// - entity discovery messages are collected as components, "dev" and "avty_t" are device level members
+// - bounded by maxSize (MQTT buffer), exceeding it falls back to entity discovery, see fallback()
+class MqttDeviceDiscovery {
+   public:
+    struct Component {
+        std::string topic;     // entity discovery topic, for fallback
+        std::string objectId;  // key in "cmps"
+        std::string platform;  // "p", e.g. sensor
+        std::string members;   // entity members without braces, "dev" and "avty_t" removed
+    };
+
+    // deviceMembers: serialized without braces, e.g. "dev", "o" (origin, required) and "avty_t"
+    void begin(std::string_view discoveryPrefix, std::string_view deviceMembers, size_t maxSize);
+    // topic: <prefix>/<platform>/[<node_id>/]<object_id>/config, replaces a component of the same topic
+    // ESP_ERR_INVALID_SIZE: collected, but payload exceeds maxSize, ESP_ERR_INVALID_ARG: invalid topic or payload
+    esp_err_t add(std::string_view topic, std::string_view payload);
+    void build(std::string& payload) const;
+    size_t payloadSize() const;
+    // entity discovery message of a collected component, device info as reference (e.g. only "ids")
+    static void entityPayload(const Component& component, std::string_view deviceInfoRefMembers, std::string& payload);
+    // components are released, entity discovery for the rest of the session
+    void fallback();
+    bool isFallback() const { return fallbackActive; }
+    size_t getMaxSize() const { return maxSize; }
+
+    const std::vector<Component>& getComponents() const { return components; }
+    size_t size() const { return components.size(); }
+
+   private:
+    std::string discoveryPrefix;
+    std::string deviceMembers;
+    size_t maxSize = 0;
+    bool fallbackActive = false;
+    std::vector<Component> components;  // in order of first announce
+};
+
+// token bucket limiting bytes and messages per second, time in microseconds passed by the caller
+// - tokens are scaled by 1000000 for integer arithmetic without rounding errors
+// - messages larger than the byte burst are allowed once the bucket is full
+class MqttTokenBucket {
+   public:
+    MqttTokenBucket(uint32_t bytesPerSecond, uint32_t burstBytes, uint32_t messagesPerSecond, uint32_t burstMessages);
+
+    // microseconds until a message of size bytes conforms, 0 if it does now
+    int64_t delay(size_t bytes, int64_t now);
+    void consume(size_t bytes);
+
+   private:
+    int64_t bytesPerSecond;
+    int64_t burstBytes;
+    int64_t messagesPerSecond;
+    int64_t burstMessages;
+    int64_t byteTokens;
+    int64_t messageTokens;
+    int64_t lastRefill = -1;
+
+    void refill(int64_t now);
+};
+
+#define MQTT_PACED_QUEUE_MAX_BYTES (32 * 1024)  // HA discovery of ~50 registers on boot
+
+// FIFO of low priority messages (discovery, logs) paced by a token bucket, not thread safe
+// - bounded by bytes (topic + payload), messages are dropped if full
+// - a retained message replaces a queued message of the same topic, only the latest is relevant
+class MqttPacedQueue {
+   public:
+    struct Message {
+        std::string topic;
+        std::string payload;
+        int qos;
+        bool retain;
+        int64_t enqueued;  // microseconds
+        bool discovery;    // HA discovery message, hash is recorded once published
+    };
+
+    MqttPacedQueue(const MqttTokenBucket& bucket, size_t maxBytes = MQTT_PACED_QUEUE_MAX_BYTES)
+        : bucket(bucket), maxBytes(maxBytes) {}
+
+    // false if queue is full, discovery messages are never dropped: queued log messages are evicted (oldest first) and
+    // the limit is exceeded if still needed, bounded by the number of entities as retained messages replace each other
+    bool push(std::string_view topic, std::string_view payload, int qos, bool retain, int64_t now, bool discovery = false);
+    // 0: next message moved to message and tokens consumed, > 0: microseconds to wait, -1: empty
+    int64_t pop(Message& message, int64_t now);
+    // publishing failed, message is sent next
+    void requeue(Message&& message);
+
+    size_t size() const { return messages.size(); }
+    size_t bytes() const { return queuedBytes; }
+    // messages rejected or evicted
+    size_t dropped() const { return droppedMessages; }
+
+   private:
+    MqttTokenBucket bucket;
+    size_t maxBytes;
+    size_t queuedBytes = 0;
+    size_t droppedMessages = 0;
+    std::deque<Message> messages;
+
+    std::deque<Message>::iterator findRetained(std::string_view topic);
+    void evict(size_t bytes, std::string_view topic);
+};
+
+#define MQTT_DEVICE_DISCOVERY_DELAY_MS 5000  // device discovery published after components settled
+// delay doubled after each device discovery message, components added later are not re-published every few seconds
+#define MQTT_DEVICE_DISCOVERY_MAX_DELAY_MS (5 * 60 * 1000)
+// switching discovery modes: Home Assistant keeps the entities (and their customisations) of migrated topics
+#define MQTT_DISCOVERY_MIGRATE_PAYLOAD R"({"migrate_discovery":true})"
+
+enum class MqttDiscoveryMode : uint8_t {
+    Entity = 0,  // also fallback of device discovery
+    Device = 1,
+};
+
+// publishing and persistence of MqttDiscovery, implemented by MqttClient (paced queue, NVS)
+class MqttDiscoveryTransport {
+   public:
+    // retained discovery message, queued, MqttDiscovery::published() must be called once it was sent
+    virtual int enqueueDiscovery(std::string_view topic, std::string_view payload) = 0;
+    // discovery hashes (if changed) and mode of this session, fallbackSize: buffer size exceeded by device discovery
+    virtual void saveDiscoveryMode(MqttDiscoveryMode mode, uint32_t fallbackSize) = 0;
+};
+
+// Home Assistant discovery of MqttClient, not thread safe, time in microseconds passed by the caller
+// - retained messages published unchanged before (also before reboot) are skipped, hashes recorded once sent
+// - entity or device discovery, device discovery falls back to entity discovery if it exceeds the MQTT buffer
+// - switching modes removes the retained messages of the other mode, entities must not be discovered twice
+class MqttDiscovery {
+   public:
+    MqttDiscovery(MqttDiscoveryTransport& transport) : transport(transport) {}
+
+    // hashes must be loaded before, stored and fallbackSize as saved by the last session
+    // deviceMembers: device level members of the device discovery message, deviceInfoRefMembers: of entity messages
+    void begin(std::string_view discoveryPrefix, std::string_view deviceMembers, std::string_view deviceInfoRefMembers,
+               bool deviceDiscovery, size_t maxSize, MqttDiscoveryMode stored, uint32_t fallbackSize);
+    // entity discovery message, collected as component of the device discovery message in device mode
+    int publish(std::string_view topic, std::string_view payload, int64_t now);
+    // collected components as one message, called once due()
+    // entity discovery: device discovery message of the last session removed
+    int publishDevice();
+    // -1: no device discovery message scheduled
+    int64_t due() const { return deviceDue; }
+    // message queued by MqttDiscoveryTransport::enqueueDiscovery() was sent
+    void published(std::string_view topic, std::string_view payload);
+    // Home Assistant restarted, all discovery messages must be published again
+    void invalidate();
+
+    MqttDiscoveryMode getMode() const { return mode; }
+    MqttDiscoveryHashes& getHashes() { return hashes; }
+    // messages skipped as unchanged
+    size_t skipped() const { return skippedMessages; }
+
+   private:
+    MqttDiscoveryTransport& transport;
+    MqttDiscoveryHashes hashes;
+    MqttDeviceDiscovery deviceDiscovery;
+    std::string deviceTopic;
+    std::string deviceInfoRefMembers;
+    MqttDiscoveryMode mode = MqttDiscoveryMode::Entity;
+    int64_t deviceDue = -1;
+    int64_t deviceDelay = MQTT_DEVICE_DISCOVERY_DELAY_MS * 1000;
+    // switched from entity discovery: entity topics are migrated to the device message, removed once it was sent
+    bool migrateEntityDiscovery = false;
+    std::vector<std::string> migratingTopics;  // migrate message queued, not part of a queued device message yet
+    std::vector<std::string> awaitingTopics;   // part of the queued device message with hash awaitingDeviceHash
+    uint32_t awaitingDeviceHash = 0;
+    std::vector<std::string> removingTopics;  // empty message queued
+    // switched to entity discovery: device topic is migrated to the entity messages, removed once they were sent
+    enum class DeviceRemoval : uint8_t { None, Migrating, Migrated, Removing };
+    DeviceRemoval deviceRemoval = DeviceRemoval::None;
+    bool deviceRemovalDue = false;  // entity messages queued
+    // mode is saved once the retained messages of the other mode were removed, migrated again after an early reboot
+    bool saveModePending = false;
+    uint32_t saveFallbackSize = 0;
+    size_t skippedMessages = 0;
+
+    int enqueue(std::string_view topic, std::string_view payload);
+    void fallback();
+    void removeMigratedEntities();
+    void removeDevice();
+    void saveMode();
+};
+
 class MqttHelper {
    public:
     static bool matchTopic(const char* topic, const char* filter);
     static void mergeMqttDiscoveryInfoOverride(JsonDocument& discoveryDoc, const std::string& override);
+    static esp_err_t parseMqttDiscoveryInfoOverride(const std::string& json, MqttDiscoveryOverride& override);
+    // members of a JSON object without braces, e.g. pre-serialized device info for discovery payloads
+    static std::string toJsonMembers(const JsonDocument& doc);
+    static void appendJsonString(std::string& json, std::string_view value);
 };
 
-#endif
\ No newline at end of file
+#endif
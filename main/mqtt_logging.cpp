@@ -99,7 +99,8 @@ esp_err_t MqttLogging::publishLogMsg(char *msg, int length) {
     if ((eventBits & MQTT_CONNECTED_BIT) == 0) {
         return ESP_FAIL;
     }
-    return instance.mqttClient->publish(logTopic, msg, length);
+    // low priority, paced with discovery messages, -1 if the paced queue is full
+    return instance.mqttClient->publishPaced(logTopic, std::string_view(msg, length));
 }
 
 void MqttLogging::onConnected() {
@@ -23,17 +23,85 @@
 #include <esp_log.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <sdkconfig.h>
 
+#include <algorithm>
 #include <cstring>
 
+#if CONFIG_IDF_TARGET_LINUX
+#include <chrono>
+#else
+#include <esp_timer.h>
+#endif
+
 static const char* TAG = "nibegw";
 
+// histogram buckets in us, sending a response on RS485 takes several ms
+static const int32_t responseTimeBuckets[] = {1000, 2500, 5000, 7500, 10000, 15000, 20000, 30000, 50000, 100000};
+static const int32_t callbackTimeBuckets[] = {10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000};
+#define NUM_BUCKETS(buckets) (sizeof(buckets) / sizeof(buckets[0]))
+
+static int64_t getTimeUs() {
+#if CONFIG_IDF_TARGET_LINUX
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+    return esp_timer_get_time();
+#endif
+}
+
 static char hex[] = "0123456789ABCDEF";
 
-NibeGw::NibeGw(NibeInterface& nibeInterface) : nibeInterface(nibeInterface) {
+NibeGw::NibeGw(NibeInterface& nibeInterface, Metrics& metrics)
+    : nibeInterface(nibeInterface),
+      metricReadTokenResponseTime(metrics.addHistogram(R"(nibegw_token_response_seconds{token="read"})", responseTimeBuckets,
+                                                       NUM_BUCKETS(responseTimeBuckets), 1000000)),
+      metricWriteTokenResponseTime(metrics.addHistogram(R"(nibegw_token_response_seconds{token="write"})", responseTimeBuckets,
+                                                        NUM_BUCKETS(responseTimeBuckets), 1000000)),
+      metricCallbackTimeReadToken(metrics.addHistogram(R"(nibegw_callback_seconds{cmd="ModbusReadReq"})", callbackTimeBuckets,
+                                                       NUM_BUCKETS(callbackTimeBuckets), 1000000)),
+      metricCallbackTimeWriteToken(metrics.addHistogram(R"(nibegw_callback_seconds{cmd="ModbusWriteReq"})", callbackTimeBuckets,
+                                                        NUM_BUCKETS(callbackTimeBuckets), 1000000)),
+      metricCallbackTimeDataMsg(metrics.addHistogram(R"(nibegw_callback_seconds{cmd="ModbusDataMsg"})", callbackTimeBuckets,
+                                                     NUM_BUCKETS(callbackTimeBuckets), 1000000)),
+      metricCallbackTimeReadResp(metrics.addHistogram(R"(nibegw_callback_seconds{cmd="ModbusReadResp"})", callbackTimeBuckets,
+                                                      NUM_BUCKETS(callbackTimeBuckets), 1000000)),
+      metricCallbackTimeWriteResp(metrics.addHistogram(R"(nibegw_callback_seconds{cmd="ModbusWriteResp"})", callbackTimeBuckets,
+                                                       NUM_BUCKETS(callbackTimeBuckets), 1000000)),
+      metricCallbackTimeOther(metrics.addHistogram(R"(nibegw_callback_seconds{cmd="other"})", callbackTimeBuckets,
+                                                   NUM_BUCKETS(callbackTimeBuckets), 1000000)),
+      metricFramesReadToken(metrics.addMetric(R"(nibegw_frames_total{cmd="ModbusReadReq"})", 1, 1, true)),
+      metricFramesWriteToken(metrics.addMetric(R"(nibegw_frames_total{cmd="ModbusWriteReq"})", 1, 1, true)),
+      metricFramesDataMsg(metrics.addMetric(R"(nibegw_frames_total{cmd="ModbusDataMsg"})", 1, 1, true)),
+      metricFramesReadResp(metrics.addMetric(R"(nibegw_frames_total{cmd="ModbusReadResp"})", 1, 1, true)),
+      metricFramesWriteResp(metrics.addMetric(R"(nibegw_frames_total{cmd="ModbusWriteResp"})", 1, 1, true)),
+      metricFramesOther(metrics.addMetric(R"(nibegw_frames_total{cmd="other"})", 1, 1, true)),
+      metricChecksumErrors(metrics.addMetric("nibegw_checksum_errors_total", 1, 1, true)),
+      metricNaks(metrics.addMetric("nibegw_naks_total", 1, 1, true)),
+      metricOversizeFrames(metrics.addMetric("nibegw_oversize_frames_total", 1, 1, true)),
+      metricResyncs(metrics.addMetric("nibegw_resyncs_total", 1, 1, true)),
+      metricDiscardedBytes(metrics.addMetric("nibegw_discarded_bytes_total", 1, 1, true)),
+      metricReceivedBytes(metrics.addMetric("nibegw_received_bytes_total", 1, 1, true)),
+      metricReceiveRate(metrics.addMetric("nibegw_receive_rate_bytes_per_second", 10)) {
     state = STATE_WAIT_START;
     index = 0;
     callback = nullptr;
+    readTime = 0;
+    rateIntervalStart = getTimeUs();
+    rateIntervalBytes = 0;
+
+    metricFramesReadToken.setValue(0);
+    metricFramesWriteToken.setValue(0);
+    metricFramesDataMsg.setValue(0);
+    metricFramesReadResp.setValue(0);
+    metricFramesWriteResp.setValue(0);
+    metricFramesOther.setValue(0);
+    metricChecksumErrors.setValue(0);
+    metricNaks.setValue(0);
+    metricOversizeFrames.setValue(0);
+    metricResyncs.setValue(0);
+    metricDiscardedBytes.setValue(0);
+    metricReceivedBytes.setValue(0);
+    metricReceiveRate.setValue(0);
 }
 
 esp_err_t NibeGw::begin() {
@@ -50,56 +118,99 @@ esp_err_t NibeGw::begin() {
 void NibeGw::task(void* pvParameters) {
     NibeGw* gw = (NibeGw*)pvParameters;
     while (1) {
-        gw->stateMachineLoop();
-        vTaskDelay(1 / portTICK_PERIOD_MS);
+        gw->loop();
+    }
+}
+
+void NibeGw::loop() {
+    if (nibeInterface.waitForData(NIBE_GW_WAIT_TIMEOUT_MS)) {
+        stateMachineLoop();
+    }
+    updateReceiveRate(getTimeUs());
+}
+
+// bytes/s averaged over NIBE_GW_RATE_INTERVAL_MS, updated at most every NIBE_GW_WAIT_TIMEOUT_MS
+void NibeGw::updateReceiveRate(int64_t now) {
+    int64_t interval = now - rateIntervalStart;
+    if (interval >= NIBE_GW_RATE_INTERVAL_MS * 1000) {
+        // factor 10
+        metricReceiveRate.setValue(rateIntervalBytes * 10000000ll / interval);
+        rateIntervalStart = now;
+        rateIntervalBytes = 0;
     }
 }
 
 // processes all data available from NibeInterface
 void NibeGw::stateMachineLoop() {
+    uint8_t data[NIBE_GW_READ_CHUNK_SIZE];
     while (1) {
-        int b = nibeInterface.readData();
-        if (b < 0) {
+        int len = nibeInterface.read(data, sizeof(data));
+        if (len <= 0) {
             // no more input -> return
-            // ESP_LOGV(TAG, "state=%d, read=-1", state);
             return;
         }
+        readTime = getTimeUs();
+        processData(data, len);
+    }
+}
+
+// feeds a span of received bytes into the state machine
+// frame start and data bytes are scanned/copied in runs, all other states consume one byte
+void NibeGw::processData(const uint8_t* const data, size_t len) {
+    // counted per span instead of per byte
+    uint32_t discarded = 0;
+    size_t i = 0;
+    while (i < len) {
         // enable only for tests or protocol debugging on linux target, overloads ESP32 when connected to heat pump
-        // ESP_LOGV(TAG, "state=%d, read=%02X", state, b);
+        // ESP_LOGV(TAG, "state=%d, read=%02X", state, data[i]);
         switch (state) {
             case STATE_WAIT_START: {
-                if (b == (int)NibeStart::Response) {
-                    bufferAsMsg->start = NibeStart::Response;
-                    state = STATE_WAIT_MODBUS40_1;
-                    checksum = 0;
-
-                    ESP_LOGV(TAG, "Frame start found");
+                // skip everything up to next start character
+                const uint8_t* start = (const uint8_t*)memchr(data + i, (int)NibeStart::Response, len - i);
+                if (start == nullptr) {
+                    discarded += len - i;
+                    i = len;
+                    break;
                 }
+                discarded += start - (data + i);
+                i = start - data + 1;
+                bufferAsMsg->start = NibeStart::Response;
+                state = STATE_WAIT_MODBUS40_1;
+                checksum = 0;
+
+                ESP_LOGV(TAG, "Frame start found");
                 break;
             }
 
             case STATE_WAIT_MODBUS40_1: {
+                uint8_t b = data[i++];
                 if (b == ((int)NibeDeviceAddress::MODBUS40 & 0xff)) {
                     checksum ^= b;
                     state = STATE_WAIT_MODBUS40_2;
                 } else {
+                    // other device address, rest of frame is skipped while searching for next start
+                    discarded += 2;
                     state = STATE_WAIT_START;
                 }
                 break;
             }
 
             case STATE_WAIT_MODBUS40_2: {
+                uint8_t b = data[i++];
                 if (b == ((int)NibeDeviceAddress::MODBUS40 >> 8)) {
                     bufferAsMsg->deviceAddress = NibeDeviceAddress::MODBUS40;
                     checksum ^= b;
                     state = STATE_WAIT_CMD;
                 } else {
+                    // other device address, rest of frame is skipped while searching for next start
+                    discarded += 3;
                     state = STATE_WAIT_START;
                 }
                 break;
             }
 
             case STATE_WAIT_CMD: {
+                uint8_t b = data[i++];
                 bufferAsMsg->cmd = (NibeCmd)b;
                 checksum ^= b;
                 state = STATE_WAIT_LEN;
@@ -107,6 +218,7 @@ void NibeGw::stateMachineLoop() {
             }
 
             case STATE_WAIT_LEN: {
+                uint8_t b = data[i++];
                 bufferAsMsg->len = b;
                 checksum ^= b;
                 index = 5;
@@ -121,21 +233,34 @@ void NibeGw::stateMachineLoop() {
             case STATE_WAIT_DATA: {
                 if (index >= MAX_DATA_LEN - 1) {
                     // too long message, keep 1 char for CRC
+                    i++;
+                    discarded += index + 1;
+                    metricOversizeFrames.incrementValue(1);
+                    metricResyncs.incrementValue(1);
                     state = STATE_WAIT_START;
-                } else {
-                    buffer[index++] = b;
-                    checksum ^= b;
-                    if (index >= bufferAsMsg->len + 5) {
-                        state = STATE_WAIT_CRC;
-                    } else if (b == (int)NibeStart::Response) {
-                        // check for duplicated start character 5C
-                        state = STATE_WAIT_DATA_5C;
-                    }
+                    break;
+                }
+                // copy run of data bytes up to end of message, end of buffer or next (duplicated) start character
+                size_t n = std::min({len - i, (size_t)(bufferAsMsg->len + 5 - index), (size_t)(MAX_DATA_LEN - 1 - index)});
+                const uint8_t* start = (const uint8_t*)memchr(data + i, (int)NibeStart::Response, n);
+                if (start != nullptr) {
+                    n = start - (data + i) + 1;
+                }
+                memcpy(buffer + index, data + i, n);
+                checksum ^= calcCheckSum(data + i, n);
+                index += n;
+                i += n;
+                if (index >= bufferAsMsg->len + 5) {
+                    state = STATE_WAIT_CRC;
+                } else if (start != nullptr) {
+                    // check for duplicated start character 5C
+                    state = STATE_WAIT_DATA_5C;
                 }
                 break;
             }
 
             case STATE_WAIT_DATA_5C: {
+                uint8_t b = data[i++];
                 if (b == (int)NibeStart::Response) {
                     // duplicated start character in data, skip one
                     bufferAsMsg->len--;
@@ -154,6 +279,7 @@ void NibeGw::stateMachineLoop() {
             }
 
             case STATE_WAIT_CRC: {
+                uint8_t b = data[i++];
                 buffer[index++] = b;
                 ESP_LOGV(TAG, "checksum=%02X, msg_checksum=%02X", checksum, b);
 
@@ -161,6 +287,9 @@ void NibeGw::stateMachineLoop() {
                     // if checksum is 0x5C (start character), heat pump seems to send 0xC5 checksum
                     processReceivedModbusMessage();
                 } else {
+                    discarded += index;
+                    metricChecksumErrors.incrementValue(1);
+                    metricResyncs.incrementValue(1);
                     sendNak();
                     ESP_LOGV(TAG, "Checksum failure");
                 }
@@ -169,23 +298,70 @@ void NibeGw::stateMachineLoop() {
             }
         }
     }
+
+    metricReceivedBytes.incrementValue(len);
+    rateIntervalBytes += len;
+    if (discarded > 0) {
+        metricDiscardedBytes.incrementValue(discarded);
+    }
 }
 
 void NibeGw::processReceivedModbusMessage() {
     // NibeStart::Response and NibeDeviceAddress::MODBUS40 are ensured by state machine
     NibeGwCallback* callback = this->callback;
+    getFramesMetric(bufferAsMsg->cmd).incrementValue(1);
     if (bufferAsMsg->cmd == NibeCmd::ModbusReadReq && bufferAsMsg->len == 0) {
         ESP_LOGV(TAG, "READ_TOKEN received");
+        int64_t start = getTimeUs();
         int msglen = callback != nullptr ? callback->onReadTokenReceived((NibeReadRequestMessage*)buffer) : 0;
+        metricCallbackTimeReadToken.observe(getTimeUs() - start);
         sendResponseMessage(msglen);
+        metricReadTokenResponseTime.observe(getTimeUs() - readTime);
     } else if (bufferAsMsg->cmd == NibeCmd::ModbusWriteReq && bufferAsMsg->len == 0) {
         ESP_LOGV(TAG, "WRITE_TOKEN received");
+        int64_t start = getTimeUs();
         int msglen = callback != nullptr ? callback->onWriteTokenReceived((NibeWriteRequestMessage*)buffer) : 0;
+        metricCallbackTimeWriteToken.observe(getTimeUs() - start);
         sendResponseMessage(msglen);
+        metricWriteTokenResponseTime.observe(getTimeUs() - readTime);
     } else {
         sendAck();
         ESP_LOGV(TAG, "Message received, cmd=%02X", (uint8_t)bufferAsMsg->cmd);
-        if (callback != nullptr) callback->onMessageReceived(bufferAsMsg, index);
+        if (callback != nullptr) {
+            int64_t start = getTimeUs();
+            callback->onMessageReceived(bufferAsMsg, index);
+            getCallbackTimeMetric(bufferAsMsg->cmd).observe(getTimeUs() - start);
+        }
+    }
+}
+
+Metric& NibeGw::getFramesMetric(NibeCmd cmd) {
+    switch (cmd) {
+        case NibeCmd::ModbusReadReq:
+            return metricFramesReadToken;
+        case NibeCmd::ModbusWriteReq:
+            return metricFramesWriteToken;
+        case NibeCmd::ModbusDataMsg:
+            return metricFramesDataMsg;
+        case NibeCmd::ModbusReadResp:
+            return metricFramesReadResp;
+        case NibeCmd::ModbusWriteResp:
+            return metricFramesWriteResp;
+        default:
+            return metricFramesOther;
+    }
+}
+
+Histogram& NibeGw::getCallbackTimeMetric(NibeCmd cmd) {
+    switch (cmd) {
+        case NibeCmd::ModbusDataMsg:
+            return metricCallbackTimeDataMsg;
+        case NibeCmd::ModbusReadResp:
+            return metricCallbackTimeReadResp;
+        case NibeCmd::ModbusWriteResp:
+            return metricCallbackTimeWriteResp;
+        default:
+            return metricCallbackTimeOther;
     }
 }
 
@@ -204,6 +380,7 @@ void NibeGw::sendAck() {
 }
 
 void NibeGw::sendNak() {
+    metricNaks.incrementValue(1);
     nibeInterface.sendData(0x15);
     ESP_LOGV(TAG, "Send NAK");
 }
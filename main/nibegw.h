@@ -44,6 +44,10 @@
 // - own task that handles the RS485 loop
 // - separated into nibegw and nibgw_rs485 to get rid of Arduino.h for testing on linux
 // - bigger refactoring to make NibeGW testable, separated NibeGW and NibeInterface
+// - bulk read from NibeInterface, state machine parses whole spans of received data
+// - event driven receive, task sleeps until NibeInterface signals received data
+// - metrics for token response latency and callback execution time
+// - protocol statistics: frames, checksum errors, NAKs, discarded bytes, throughput
 
 #ifndef _nibegw_h_
 #define _nibegw_h_
@@ -54,6 +58,8 @@
 
 #include <string>
 
+#include "metrics.h"
+
 // state machine states
 enum eState {
     STATE_WAIT_START,
@@ -69,6 +75,13 @@ enum eState {
 #define NIBE_GW_TASK_STACK_SIZE 10 * 1024
 #define NIBE_GW_TASK_PRIORITY 15
 
+// max number of bytes fetched from NibeInterface per read() call
+#define NIBE_GW_READ_CHUNK_SIZE 64
+// max time the task sleeps when no data is received
+#define NIBE_GW_WAIT_TIMEOUT_MS 1000
+// averaging interval for receive rate metric
+#define NIBE_GW_RATE_INTERVAL_MS 10000
+
 // message buffer for RS-485 communication. Max message length is 80 uint8_ts + 6 uint8_ts header
 #define MAX_DATA_LEN 128
 
@@ -161,8 +174,10 @@ class NibeInterface {
    public:
     // check if data can be read (non-blocking)
     virtual bool isDataAvailable() = 0;
-    // read data from interface, returns -1 if no data is available
-    virtual int readData() = 0;
+    // block until data can be read or timeout, returns isDataAvailable()
+    virtual bool waitForData(uint32_t timeoutMs) = 0;
+    // read up to max bytes into buf (non-blocking), returns number of bytes read or 0 if no data is available
+    virtual int read(uint8_t* buf, size_t max) = 0;
 
     virtual void sendData(const uint8_t* const data, uint8_t len) = 0;
     virtual void sendData(const uint8_t data) = 0;
@@ -170,7 +185,7 @@ class NibeInterface {
 
 class NibeGw {
    public:
-    NibeGw(NibeInterface& nibeInterface);
+    NibeGw(NibeInterface& nibeInterface, Metrics& metrics);
 
     esp_err_t begin();
     esp_err_t begin(NibeGwCallback& callback) {
@@ -190,8 +205,13 @@ class NibeGw {
     // for logging and debugging
     static std::string dataToString(const uint8_t* const data, int len);
 
+    // one iteration of the task loop: wait for data and process it
+    void loop();
+
     // for testing
     void stateMachineLoop();
+    void processData(const uint8_t* const data, size_t len);
+    void updateReceiveRate(int64_t now);
     auto getState() { return state; }
 
    private:
@@ -204,8 +224,38 @@ class NibeGw {
     NibeResponseMessage* const bufferAsMsg = (NibeResponseMessage*)buffer;
     uint8_t index;
     uint8_t checksum;
+    int64_t readTime;  // time when last chunk was read from NibeInterface, us
+
+    // token received -> response sent, including callback execution and sending on RS485
+    Histogram& metricReadTokenResponseTime;
+    Histogram& metricWriteTokenResponseTime;
+    // callback execution time per cmd
+    Histogram& metricCallbackTimeReadToken;
+    Histogram& metricCallbackTimeWriteToken;
+    Histogram& metricCallbackTimeDataMsg;
+    Histogram& metricCallbackTimeReadResp;
+    Histogram& metricCallbackTimeWriteResp;
+    Histogram& metricCallbackTimeOther;
+    // protocol statistics
+    Metric& metricFramesReadToken;
+    Metric& metricFramesWriteToken;
+    Metric& metricFramesDataMsg;
+    Metric& metricFramesReadResp;
+    Metric& metricFramesWriteResp;
+    Metric& metricFramesOther;
+    Metric& metricChecksumErrors;
+    Metric& metricNaks;
+    Metric& metricOversizeFrames;
+    Metric& metricResyncs;         // frame dropped (checksum failure, too long message)
+    Metric& metricDiscardedBytes;  // frames for other devices, dropped frames, garbage between frames
+    Metric& metricReceivedBytes;
+    Metric& metricReceiveRate;
+    int64_t rateIntervalStart;
+    int32_t rateIntervalBytes;
 
     void processReceivedModbusMessage();
+    Metric& getFramesMetric(NibeCmd cmd);
+    Histogram& getCallbackTimeMetric(NibeCmd cmd);
     void sendResponseMessage(int len);
     void sendAck();
     void sendNak();
@@ -2,13 +2,18 @@
 
 #include <esp_log.h>
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
 #include <cstring>
+#include <iterator>
 
 #include "mqtt_helper.h"
 
 static const char* TAG = "nibegw_config";
 
-int32_t NibeRegister::decodeDataRaw(const uint8_t* const data) const {
+int32_t NibeRegisterInfo::decodeDataRaw(const uint8_t* const data) const {
     int32_t value = 0;
     switch (dataType) {
         case NibeRegisterDataType::UInt8:
@@ -36,187 +41,231 @@ int32_t NibeRegister::decodeDataRaw(const uint8_t* const data) const {
     return value;
 }
 
-std::string NibeRegister::decodeData(const uint8_t* const data) const {
-    std::string value;
+std::string NibeRegisterInfo::decodeData(const uint8_t* const data) const {
+    char buffer[FORMAT_NUMBER_BUFFER_SIZE];
+    return std::string(buffer, decodeData(data, buffer, sizeof(buffer)));
+}
+
+size_t NibeRegisterInfo::decodeData(const uint8_t* const data, char* buffer, size_t size) const {
     switch (dataType) {
         case NibeRegisterDataType::UInt8:
-            value = formatNumber(data[0]);
-            break;
+            return formatNumber(buffer, size, data[0]);
         case NibeRegisterDataType::Int8:
-            value = formatNumber((int8_t)data[0]);
-            break;
+            return formatNumber(buffer, size, (int8_t)data[0]);
         case NibeRegisterDataType::UInt16:
-            value = formatNumber(*(uint16_t*)data);
-            break;
+            return formatNumber(buffer, size, *(uint16_t*)data);
         case NibeRegisterDataType::Int16:
-            value = formatNumber(*(int16_t*)data);
-            break;
+            return formatNumber(buffer, size, *(int16_t*)data);
         case NibeRegisterDataType::UInt32:
-            value = formatNumber(*(uint32_t*)data);
-            break;
+            return formatNumber(buffer, size, *(uint32_t*)data);
         case NibeRegisterDataType::Int32:
-            value = formatNumber(*(int32_t*)data);
-            break;
+            return formatNumber(buffer, size, *(int32_t*)data);
         default:
             ESP_LOGW(TAG, "Register %d has unknown data type %d", id, (int)dataType);
-            break;
+            return 0;
     }
-    return value;
 }
 
 // Returns true if value was successfully encoded, false otherwise.
-// TODO: sort out exception problem on linux target
-bool NibeRegister::encodeData(const std::string& str, uint8_t* data) const {
-    try {
-        switch (dataType) {
-            case NibeRegisterDataType::UInt8:
-            case NibeRegisterDataType::UInt16:
-            case NibeRegisterDataType::UInt32: {
-                uint32_t numValue = parseUnsignedNumber(str);
-                *(uint32_t*)data = numValue;
-                break;
-            }
-
-            case NibeRegisterDataType::Int8:
-            case NibeRegisterDataType::Int16:
-            case NibeRegisterDataType::Int32: {
-                int32_t numValue = parseSignedNumber(str);
-                *(int32_t*)data = numValue;
-                break;
-            }
-            default:
-                ESP_LOGW(TAG, "Register %d has unknown data type %d", id, (int)dataType);
-                return false;
+bool NibeRegisterInfo::encodeData(std::string_view str, uint8_t* data) const {
+    int64_t value;
+    esp_err_t err;
+    switch (dataType) {
+        case NibeRegisterDataType::UInt8:
+        case NibeRegisterDataType::UInt16:
+        case NibeRegisterDataType::UInt32: {
+            uint32_t numValue;
+            err = parseUnsignedNumber(str, numValue);
+            value = numValue;
+            break;
         }
-        return true;
 
-#if CONFIG_IDF_TARGET_LINUX
-    } catch (...) {
-        // for linux only to get tests green
-        // don't use on esp32 because it hides OOMs
-        ESP_LOGW(TAG, "Failed to parse number %s for register %d", str.c_str(), id);
+        case NibeRegisterDataType::Int8:
+        case NibeRegisterDataType::Int16:
+        case NibeRegisterDataType::Int32: {
+            int32_t numValue;
+            err = parseSignedNumber(str, numValue);
+            value = numValue;
+            break;
+        }
+        default:
+            ESP_LOGW(TAG, "Register %d has unknown data type %d", id, (int)dataType);
+            return false;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to parse number %.*s for register %d", (int)str.size(), str.data(), id);
         return false;
     }
-#else
-    } catch (const std::invalid_argument& e) {
-        // TODO: is not caught on linux but works on esp32, unclear why
-        ESP_LOGW(TAG, "Failed to parse number %s for register %d", str.c_str(), id);
+    if (!isValidValue(value)) {
+        ESP_LOGW(TAG, "Value %.*s out of range for register %d", (int)str.size(), str.data(), id);
         return false;
     }
-#endif
+    // little endian, sign extended to 4 bytes
+    *(int32_t*)data = (int32_t)value;
+    return true;
 }
 
-// throws std::invalid_argument exception if str can't be parsed
-int32_t NibeRegister::parseSignedNumber(const std::string& str) const {
-    int32_t value = 0;
-    // avoid FP arithmetic on typically used factors
-    if (factor == 1) {
-        return std::stoi(str);
-    } else if (factor == 10 || factor == 100) {
-        // split str at decimal point
-        size_t pos = str.find(".");
-        int numDecimals = factor == 10 ? 1 : 2;
-        if (pos != std::string::npos && pos < str.size() - numDecimals) {
-            // remove decimal point
-            std::string strInt = str.substr(0, pos) + str.substr(pos + 1, numDecimals);
-            value = std::stoi(strInt);
-        } else {
-            value = std::stoi(str) * factor;
+// [-]digits[.digits] * factor, truncated toward zero
+static esp_err_t parseFixedPoint(std::string_view str, int factor, int64_t& value) {
+    bool negative = !str.empty() && str.front() == '-';
+    if (negative) {
+        str.remove_prefix(1);
+    }
+    size_t point = str.find('.');
+    std::string_view intPart = str.substr(0, point);
+    std::string_view fracPart = point != std::string_view::npos ? str.substr(point + 1) : std::string_view();
+    if ((intPart.empty() && fracPart.empty()) || factor <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint64_t intValue = 0;
+    if (!intPart.empty()) {
+        auto [ptr, ec] = std::from_chars(intPart.data(), intPart.data() + intPart.size(), intValue);
+        if (ptr != intPart.data() + intPart.size()) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (ec != std::errc() || intValue > UINT32_MAX) {
+            return ESP_ERR_INVALID_SIZE;
         }
-    } else {
-        float fValue = std::stof(str);
-        value = fValue * factor;
     }
-    return value;
+    // 6 decimals are more than enough for any int16 factor
+    uint32_t fracValue = 0;
+    uint32_t fracScale = 1;
+    for (char c : fracPart) {
+        if (c < '0' || c > '9') {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (fracScale < 1000000) {
+            fracValue = fracValue * 10 + (c - '0');
+            fracScale *= 10;
+        }
+    }
+    int64_t magnitude = (int64_t)intValue * factor + (int64_t)fracValue * factor / fracScale;
+    value = negative ? -magnitude : magnitude;
+    return ESP_OK;
 }
 
-// throws std::invalid_argument exception if str can't be parsed
-uint32_t NibeRegister::parseUnsignedNumber(const std::string& str) const {
-    uint32_t value = 0;
-    // avoid FP arithmetic on typically used factors
-    if (factor == 1) {
-        return std::stoul(str);
-    } else if (factor == 10 || factor == 100) {
-        // split str at decimal point
-        size_t pos = str.find(".");
-        int numDecimals = factor == 10 ? 1 : 2;
-        if (pos != std::string::npos && pos < str.size() - numDecimals) {
-            // remove decimal point
-            std::string strInt = str.substr(0, pos) + str.substr(pos + 1, numDecimals);
-            value = std::stoul(strInt);
-        } else {
-            value = std::stoul(str) * factor;
-        }
-    } else {
-        float fValue = std::stof(str);
-        value = fValue * factor;
+esp_err_t NibeRegisterInfo::parseSignedNumber(std::string_view str, int32_t& rawValue) const {
+    int64_t value;
+    esp_err_t err = parseFixedPoint(str, factor, value);
+    if (err != ESP_OK) {
+        return err;
     }
-    return value;
+    if (value < INT32_MIN || value > INT32_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    rawValue = value;
+    return ESP_OK;
+}
+
+esp_err_t NibeRegisterInfo::parseUnsignedNumber(std::string_view str, uint32_t& rawValue) const {
+    int64_t value;
+    esp_err_t err = parseFixedPoint(str, factor, value);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (value < 0 || value > UINT32_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    rawValue = value;
+    return ESP_OK;
 }
 
-NibeRegisterUnit NibeRegister::stringToUnit(const char* unit) {
-    if (strcmp(unit, "") == 0) {
+bool NibeRegisterInfo::isValidValue(int64_t rawValue) const {
+    int64_t min;
+    int64_t max;
+    switch (dataType) {
+        case NibeRegisterDataType::UInt8:
+            min = 0;
+            max = UINT8_MAX;
+            break;
+        case NibeRegisterDataType::Int8:
+            min = INT8_MIN;
+            max = INT8_MAX;
+            break;
+        case NibeRegisterDataType::UInt16:
+            min = 0;
+            max = UINT16_MAX;
+            break;
+        case NibeRegisterDataType::Int16:
+            min = INT16_MIN;
+            max = INT16_MAX;
+            break;
+        case NibeRegisterDataType::UInt32:
+            min = 0;
+            max = UINT32_MAX;
+            break;
+        case NibeRegisterDataType::Int32:
+            min = INT32_MIN;
+            max = INT32_MAX;
+            break;
+        default:
+            return false;
+    }
+    if (rawValue < min || rawValue > max) {
+        return false;
+    }
+    return (minValue == 0 && maxValue == 0) || (rawValue >= minValue && rawValue <= maxValue);
+}
+
+NibeRegisterUnit NibeRegister::stringToUnit(std::string_view unit) {
+    if (unit == "") {
         return NibeRegisterUnit::NoUnit;
-    } else if (strcmp(unit, "1") == 0) {
+    } else if (unit == "1") {
         return NibeRegisterUnit::NoUnit;
-    } else if (strcmp(unit, " ") == 0) {
+    } else if (unit == " ") {
         return NibeRegisterUnit::NoUnit;
-    } else if (strcmp(unit, "°C") == 0) {  // °C in UTF-8
+    } else if (unit == "°C") {  // °C in UTF-8
         return NibeRegisterUnit::GradCelcius;
-    } else if (strcmp(unit,
-                      "\xB0"
-                      "C") == 0) {  // °C in ISO-8859-1
+    } else if (unit == "\xB0" "C") {  // °C in ISO-8859-1
         return NibeRegisterUnit::GradCelcius;
-    } else if (strcmp(unit,
-                      "\xba"
-                      "C") == 0) {  // buggy °C found in csv
+    } else if (unit == "\xba" "C") {  // buggy °C found in csv
         return NibeRegisterUnit::GradCelcius;
-    } else if (strcmp(unit, "%") == 0) {
+    } else if (unit == "%") {
         return NibeRegisterUnit::Percent;
-    } else if (strcmp(unit, "l/m") == 0) {
+    } else if (unit == "l/m") {
         return NibeRegisterUnit::LiterPerMinute;
-    } else if (strcmp(unit, "%RH") == 0) {
+    } else if (unit == "%RH") {
         return NibeRegisterUnit::RelativeHumidity;
-    } else if (strcmp(unit, "rpm") == 0) {
+    } else if (unit == "rpm") {
         return NibeRegisterUnit::RPM;
-    } else if (strcmp(unit, "kPa") == 0) {
+    } else if (unit == "kPa") {
         return NibeRegisterUnit::KiloPascal;
-    } else if (strcmp(unit, "bar") == 0) {
+    } else if (unit == "bar") {
         return NibeRegisterUnit::Bar;
-    } else if (strcmp(unit, "V") == 0) {
+    } else if (unit == "V") {
         return NibeRegisterUnit::Volt;
-    } else if (strcmp(unit, "A") == 0) {
+    } else if (unit == "A") {
         return NibeRegisterUnit::Ampere;
-    } else if (strcmp(unit, "W") == 0) {
+    } else if (unit == "W") {
         return NibeRegisterUnit::Watt;
-    } else if (strcmp(unit, "kW") == 0) {
+    } else if (unit == "kW") {
         return NibeRegisterUnit::KiloWatt;
-    } else if (strcmp(unit, "Wh") == 0) {
+    } else if (unit == "Wh") {
         return NibeRegisterUnit::WattHour;
-    } else if (strcmp(unit, "kWh") == 0) {
+    } else if (unit == "kWh") {
         return NibeRegisterUnit::KiloWattHour;
-    } else if (strcmp(unit, "Hz") == 0) {
+    } else if (unit == "Hz") {
         return NibeRegisterUnit::Hertz;
-    } else if (strcmp(unit, "s") == 0) {
+    } else if (unit == "s") {
         return NibeRegisterUnit::Seconds;
-    } else if (strcmp(unit, "secs") == 0) {
+    } else if (unit == "secs") {
         return NibeRegisterUnit::Seconds;
-    } else if (strcmp(unit, "min") == 0) {
+    } else if (unit == "min") {
         return NibeRegisterUnit::Minutes;
-    } else if (strcmp(unit, "h") == 0) {
+    } else if (unit == "h") {
         return NibeRegisterUnit::Hours;
-    } else if (strcmp(unit, "hrs") == 0) {
+    } else if (unit == "hrs") {
         return NibeRegisterUnit::Hours;
-    } else if (strcmp(unit, "days") == 0) {
+    } else if (unit == "days") {
         return NibeRegisterUnit::Days;
-    } else if (strcmp(unit, "Months") == 0) {
+    } else if (unit == "Months") {
         return NibeRegisterUnit::Months;
     } else {
         return NibeRegisterUnit::Unknown;
     }
 }
 
-const char* NibeRegister::unitAsString() const {
+const char* NibeRegisterInfo::unitAsString() const {
     switch (unit) {
         case NibeRegisterUnit::NoUnit:
             return "";
@@ -263,91 +312,101 @@ const char* NibeRegister::unitAsString() const {
     }
 }
 
-JsonDocument NibeRegister::homeassistantDiscoveryMessage(const NibeMqttConfig& config, const std::string& nibeRootTopic,
-                                                         const JsonDocument& deviceDiscoveryInfo) const {
-    JsonDocument discoveryDoc = deviceDiscoveryInfo;
+std::string_view NibeRegister::homeassistantDiscoveryMessage(const NibeMqttConfig& config, const std::string& nibeRootTopic,
+                                                             std::string_view deviceDiscoveryInfo, std::string& payload) const {
+    auto iter = config.homeassistantDiscoveryOverrides.find(id);
+    const MqttDiscoveryOverride* override = iter != config.homeassistantDiscoveryOverrides.end() ? &iter->second : nullptr;
+    std::string_view component = mode != NibeRegisterMode::Read ? "number" : "sensor";
+    if (override != nullptr && !override->component.empty()) {
+        component = override->component;
+    }
+
+    payload.reserve(deviceDiscoveryInfo.size() + 320);
+    MqttDiscoveryPayload discovery(payload, override);
+    discovery.addFragment(deviceDiscoveryInfo);
 
     char objId[64];
     snprintf(objId, sizeof(objId), "nibe-%u", id);
-    discoveryDoc["uniq_id"] = objId;
+    discovery.add("uniq_id", objId);
 
-    discoveryDoc["name"] = title;
+    discovery.add("name", title);
 
     char stateTopic[64];
     snprintf(stateTopic, sizeof(stateTopic), "%s%u", nibeRootTopic.c_str(), id);
-    discoveryDoc["stat_t"] = stateTopic;
+    if (config.jsonState) {
+        char jsonStateTopic[64];
+        snprintf(jsonStateTopic, sizeof(jsonStateTopic), "%s" NIBE_JSON_STATE_TOPIC, nibeRootTopic.c_str());
+        discovery.add("stat_t", jsonStateTopic);
+        // a state message contains only published registers, others keep their state
+        char valueTemplate[64];
+        snprintf(valueTemplate, sizeof(valueTemplate), "{{ value_json['%u'] | default(this.state) }}", id);
+        discovery.add("val_tpl", valueTemplate);
+    } else {
+        discovery.add("stat_t", stateTopic);
+    }
 
+    const char* deviceClass = nullptr;
+    const char* stateClass = "measurement";
     switch (this->unit) {
         case NibeRegisterUnit::Unknown:
         case NibeRegisterUnit::NoUnit:
+            stateClass = nullptr;
             break;
         case NibeRegisterUnit::GradCelcius:
-            discoveryDoc["unit_of_meas"] = unitAsString();
-            discoveryDoc["dev_cla"] = "temperature";
-            discoveryDoc["stat_cla"] = "measurement";
+            deviceClass = "temperature";
             break;
         case NibeRegisterUnit::Hours:
-            discoveryDoc["unit_of_meas"] = unitAsString();
-            discoveryDoc["dev_cla"] = "duration";
-            discoveryDoc["stat_cla"] = "total";
+            deviceClass = "duration";
+            stateClass = "total";
             break;
         case NibeRegisterUnit::Minutes:
-            discoveryDoc["unit_of_meas"] = unitAsString();
-            discoveryDoc["dev_cla"] = "duration";
-            discoveryDoc["stat_cla"] = "measurement";
+            deviceClass = "duration";
             break;
         case NibeRegisterUnit::Watt:
         case NibeRegisterUnit::KiloWatt:
-            discoveryDoc["unit_of_meas"] = unitAsString();
-            discoveryDoc["dev_cla"] = "power";
-            discoveryDoc["stat_cla"] = "measurement";
+            deviceClass = "power";
             break;
         case NibeRegisterUnit::WattHour:
         case NibeRegisterUnit::KiloWattHour:
-            discoveryDoc["unit_of_meas"] = unitAsString();
-            discoveryDoc["dev_cla"] = "energy";
-            discoveryDoc["stat_cla"] = "total";
+            deviceClass = "energy";
+            stateClass = "total";
             break;
         case NibeRegisterUnit::Hertz:
-            discoveryDoc["unit_of_meas"] = unitAsString();
-            discoveryDoc["dev_cla"] = "frequency";
-            discoveryDoc["stat_cla"] = "measurement";
+            deviceClass = "frequency";
             break;
         default:
-            discoveryDoc["unit_of_meas"] = unitAsString();
-            discoveryDoc["stat_cla"] = "measurement";
             break;
     }
+    if (stateClass != nullptr) {
+        discovery.add("unit_of_meas", unitAsString());
+    }
+    if (deviceClass != nullptr) {
+        discovery.add("dev_cla", deviceClass);
+    }
+    // numbers have no state class
+    if (stateClass != nullptr && mode == NibeRegisterMode::Read) {
+        discovery.add("stat_cla", stateClass);
+    }
+
+    // object id follows the (overridden) component
+    char defaultEntityId[80];
+    snprintf(defaultEntityId, sizeof(defaultEntityId), "%.*s.%s", (int)component.size(), component.data(), objId);
+    discovery.add("def_ent_id", defaultEntityId);
 
     if (mode != NibeRegisterMode::Read) {
-        discoveryDoc["_component_"] = "number";
-        discoveryDoc["def_ent_id"] = std::string("number.") + objId;
-        discoveryDoc.remove("stat_cla");
         char cmdTopic[68];
         snprintf(cmdTopic, sizeof(cmdTopic), "%s/set", stateTopic);
-        discoveryDoc["cmd_t"] = cmdTopic;
-        discoveryDoc["min"] = minValue;
-        discoveryDoc["max"] = maxValue;
-        if (factor != 1) {
-            discoveryDoc["step"] = 1.0 / factor;
-        } else {
-            discoveryDoc["step"] = 1;
-        }
-    } else {
-        discoveryDoc["_component_"] = "sensor";
-        discoveryDoc["def_ent_id"] = std::string("sensor.") + objId;
+        discovery.add("cmd_t", cmdTopic);
+        discovery.add("min", minValue);
+        discovery.add("max", maxValue);
+        // smallest raw step, e.g. 0.1 for factor 10
+        char step[FORMAT_NUMBER_BUFFER_SIZE];
+        size_t length = factor > 0 ? formatNumber(step, sizeof(step), 1) : 0;
+        discovery.addNumber("step", length > 0 ? std::string_view(step, length) : "1");
     }
 
-    auto iter = config.homeassistantDiscoveryOverrides.find(id);
-    if (iter == config.homeassistantDiscoveryOverrides.end()) {
-        return discoveryDoc;
-    } else {
-        auto override = iter->second;
-        MqttHelper::mergeMqttDiscoveryInfoOverride(discoveryDoc, override);
-        // fix def_ent_id because _component_ might have changed
-        discoveryDoc["def_ent_id"] = std::string(discoveryDoc["_component_"]) + "." + objId;
-        return discoveryDoc;
-    }
+    discovery.finish();
+    return component;
 }
 
 // prom metric config must be configured explicitly (i.e. register id) but there are defaults for all config values
@@ -407,4 +466,239 @@ void NibeRegister::appendPromAttributes(std::string& promMetricName) const {
         registerAttr += R"(",)";
         promMetricName.insert(attrPos + 1, registerAttr);
     }
-}
\ No newline at end of file
+}
+
+void NibeRegisterTable::insert(const NibeRegister& _register) {
+    Entry entry = {_register, (uint32_t)titles.size()};
+    titles.insert(titles.end(), _register.title.begin(), _register.title.end());
+    titles.push_back('\0');
+    // ModbusManager CSV is sorted by id -> append
+    auto iter = entries.end();
+    if (!entries.empty() && entries.back().id >= entry.id) {
+        iter = std::lower_bound(entries.begin(), entries.end(), entry.id,
+                                [](const Entry& entry, uint16_t id) { return entry.id < id; });
+    }
+    if (iter != entries.end() && iter->id == entry.id) {
+        *iter = entry;
+    } else {
+        entries.insert(iter, entry);
+    }
+    idBitmaps.clear();
+    idRanks.clear();
+}
+
+const NibeRegisterTable::Entry* NibeRegisterTable::find(uint16_t id) const {
+    int index = indexOf(id);
+    return index >= 0 ? &entries[index] : nullptr;
+}
+
+// number of bits set, no popcount instruction on Xtensa
+static constexpr auto popcount8 = [] {
+    std::array<uint8_t, 256> table{};
+    for (int i = 0; i < 256; i++) {
+        table[i] = std::popcount((unsigned)i);
+    }
+    return table;
+}();
+
+int NibeRegisterTable::indexOf(uint16_t id) const {
+    if (!idBitmaps.empty()) {
+        uint32_t offset = (uint32_t)id - minId;
+        if (id < minId || offset / 8 >= idBitmaps.size()) {
+            return -1;
+        }
+        uint8_t bitmap = idBitmaps[offset / 8];
+        uint8_t bit = (uint8_t)1 << (offset % 8);
+        if ((bitmap & bit) == 0) {
+            return -1;
+        }
+        return idRanks[offset / 8] + popcount8[bitmap & (bit - 1)];
+    }
+    // branchless binary search, no mispredictions
+    size_t n = entries.size();
+    if (n == 0) {
+        return -1;
+    }
+    const Entry* base = entries.data();
+    while (n > 1) {
+        size_t half = n / 2;
+        base = base[half].id <= id ? base + half : base;
+        n -= half;
+    }
+    return base->id == id ? base - entries.data() : -1;
+}
+
+bool NibeRegisterTable::save(const writeFunction_t& write) const {
+    Header header = {NIBE_REGISTER_TABLE_MAGIC, sizeof(Entry), (uint32_t)entries.size(), (uint32_t)titles.size()};
+    return write(&header, sizeof(header)) && write(entries.data(), entries.size() * sizeof(Entry)) &&
+           write(titles.data(), titles.size());
+}
+
+bool NibeRegisterTable::load(const readFunction_t& read) {
+    clear();
+    Header header;
+    if (!read(&header, sizeof(header))) {
+        ESP_LOGE(TAG, "Register database: missing header");
+        return false;
+    }
+    if (header.magic != NIBE_REGISTER_TABLE_MAGIC || header.entrySize != sizeof(Entry) || header.numEntries > UINT16_MAX + 1) {
+        ESP_LOGE(TAG, "Register database: incompatible format");
+        return false;
+    }
+    entries.resize(header.numEntries);
+    titles.resize(header.titlesSize);
+    if (!read(entries.data(), entries.size() * sizeof(Entry)) || !read(titles.data(), titles.size())) {
+        ESP_LOGE(TAG, "Register database: truncated");
+        clear();
+        return false;
+    }
+    // sorted by id, titles within string pool and zero terminated
+    bool valid = entries.empty() || (!titles.empty() && titles.back() == '\0');
+    for (size_t i = 0; valid && i < entries.size(); i++) {
+        valid = entries[i].title < titles.size() && (i == 0 || entries[i - 1].id < entries[i].id);
+    }
+    if (!valid) {
+        ESP_LOGE(TAG, "Register database: corrupt");
+        clear();
+        return false;
+    }
+    buildIndex();
+    return true;
+}
+
+void NibeRegisterTable::clear() {
+    entries.clear();
+    titles.clear();
+    idBitmaps.clear();
+    idRanks.clear();
+}
+
+void NibeRegisterTable::shrinkToFit() {
+    entries.shrink_to_fit();
+    titles.shrink_to_fit();
+    buildIndex();
+}
+
+// only if not larger than the entries, binary search over a few registers (e.g. configured ones) is fast anyway
+void NibeRegisterTable::buildIndex() {
+    idBitmaps.clear();
+    idRanks.clear();
+    size_t blocks = entries.empty() ? 0 : (entries.back().id - entries.front().id) / 8 + 1;
+    if (blocks > 0 && blocks * (sizeof(uint8_t) + sizeof(uint16_t)) <= entries.size() * sizeof(Entry)) {
+        minId = entries.front().id;
+        idBitmaps.resize(blocks);
+        idRanks.resize(blocks);
+        for (size_t i = 0; i < entries.size(); i++) {
+            uint32_t offset = entries[i].id - minId;
+            if (idBitmaps[offset / 8] == 0) {
+                idRanks[offset / 8] = i;  // sorted, first register of block
+            }
+            idBitmaps[offset / 8] |= (uint8_t)1 << (offset % 8);
+        }
+    }
+    idBitmaps.shrink_to_fit();
+    idRanks.shrink_to_fit();
+}
+
+bool NibeRegisterCatalog::open(const readAtFunction_t& readAt) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->readAt = nullptr;
+    numEntries = 0;
+    titlesSize = 0;
+    NibeRegisterTable::Header header;
+    if (!readAt(0, &header, sizeof(header))) {
+        ESP_LOGE(TAG, "Register catalog: missing header");
+        return false;
+    }
+    if (header.magic != NIBE_REGISTER_TABLE_MAGIC || header.entrySize != sizeof(NibeRegisterTable::Entry) ||
+        header.numEntries > UINT16_MAX + 1) {
+        ESP_LOGE(TAG, "Register catalog: incompatible format");
+        return false;
+    }
+    // last title must be complete, detects truncated files without reading everything
+    char last;
+    if (header.titlesSize > 0 &&
+        (!readAt(sizeof(header) + header.numEntries * sizeof(NibeRegisterTable::Entry) + header.titlesSize - 1, &last, 1) ||
+         last != '\0')) {
+        ESP_LOGE(TAG, "Register catalog: truncated");
+        return false;
+    }
+    this->readAt = readAt;
+    numEntries = header.numEntries;
+    titlesSize = header.titlesSize;
+    return true;
+}
+
+void NibeRegisterCatalog::close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    readAt = nullptr;
+    numEntries = 0;
+    titlesSize = 0;
+}
+
+bool NibeRegisterCatalog::isOpen() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return readAt != nullptr;
+}
+
+size_t NibeRegisterCatalog::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return numEntries;
+}
+
+bool NibeRegisterCatalog::find(uint16_t id, NibeRegister& _register) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (readAt == nullptr) {
+        return false;
+    }
+    uint32_t low = 0;
+    uint32_t high = numEntries;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        NibeRegisterTable::Entry entry;
+        if (!readEntries(mid, &entry, 1)) {
+            return false;
+        }
+        if (entry.id == id) {
+            return readRegister(entry, _register);
+        }
+        if (entry.id < id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return false;
+}
+
+bool NibeRegisterCatalog::readEntries(uint32_t index, NibeRegisterTable::Entry* entries, uint32_t count) {
+    if (!readAt(entriesOffset() + index * sizeof(NibeRegisterTable::Entry), entries, count * sizeof(NibeRegisterTable::Entry))) {
+        ESP_LOGE(TAG, "Register catalog: read failed");
+        return false;
+    }
+    return true;
+}
+
+// title is read in small chunks up to its terminating zero
+bool NibeRegisterCatalog::readRegister(const NibeRegisterTable::Entry& entry, NibeRegister& _register) {
+    if (entry.title >= titlesSize) {
+        ESP_LOGE(TAG, "Register catalog: corrupt");
+        return false;
+    }
+    _register = NibeRegister(entry, "");
+    char chunk[32];
+    for (uint32_t offset = entry.title; offset < titlesSize; offset += sizeof(chunk)) {
+        size_t size = std::min<size_t>(titlesSize - offset, sizeof(chunk));
+        if (!readAt(titlesOffset() + offset, chunk, size)) {
+            ESP_LOGE(TAG, "Register catalog: read failed");
+            return false;
+        }
+        size_t length = strnlen(chunk, size);
+        _register.title.append(chunk, length);
+        if (length < size) {
+            return true;
+        }
+    }
+    // title pool is zero terminated (checked in open)
+    return true;
+}
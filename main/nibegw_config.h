@@ -5,16 +5,30 @@
 
 // ensure that config.h is included before ArduinoJson
 #include <ArduinoJson.h>
+#include <esp_err.h>
 
+#include <algorithm>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 #include "metrics.h"
+#include "mqtt_helper.h"
 #include "nibegw.h"
 
+#define NIBE_POLL_INTERVAL_DEFAULT 30         // seconds
+#define NIBE_PUBLISH_HEARTBEAT_DEFAULT 300    // seconds
+#define NIBE_DATA_MESSAGE_PUBLISH_BUDGET_DEFAULT 4  // registers per ModbusDataMsg
+#define NIBE_DATA_MESSAGE_PUBLISH_RATE_DEFAULT 2    // registers per second
+#define NIBE_JSON_STATE_TOPIC "state"                // <rootTopic>/nibe/state, see NibeMqttConfig::jsonState
+
+#define NIBE_REGISTER_TABLE_MAGIC 0x4E524231  // "NRB1", binary register database
+
 // configuration
-enum class NibeRegisterDataType {
+enum class NibeRegisterDataType : uint8_t {
     Unknown,
     UInt8,
     Int8,
@@ -24,14 +38,14 @@ enum class NibeRegisterDataType {
     Int32,
 };
 
-enum class NibeRegisterMode {
+enum class NibeRegisterMode : uint8_t {
     Unknown = 0x00,
     Read = 0x01,
     Write = 0x02,
     ReadWrite = Read | Write,
 };
 
-enum class NibeRegisterUnit {
+enum class NibeRegisterUnit : uint8_t {
     Unknown,
     NoUnit,  // no unit
 
@@ -61,44 +75,59 @@ enum class NibeRegisterUnit {
 struct NibeRegisterMetricConfig;
 struct NibeMqttConfig;
 
-// represents register configuration from ModbusManager
-// Title;Info;ID;Unit;Size;Factor;Min;Max;Default;Mode
-class NibeRegister {
+// register configuration w/o title, everything needed to decode and encode values
+// compact entry of NibeRegisterTable
+class NibeRegisterInfo {
    public:
+    int32_t minValue;
+    int32_t maxValue;
+    int32_t defaultValue;
     uint16_t id;
-    std::string title;
+    int16_t factor;
     NibeRegisterUnit unit;
     NibeRegisterDataType dataType;  // = size
-    int factor;
-    int minValue;
-    int maxValue;
-    int defaultValue;
     NibeRegisterMode mode;
 
-    NibeRegister() = default;
-    NibeRegister(uint16_t id, const std::string& title, NibeRegisterUnit unit, NibeRegisterDataType dataType, int factor,
-                 int minValue, int maxValue, int defaultValue, NibeRegisterMode mode)
-        : id(id),
-          title(title),
-          unit(unit),
-          dataType(dataType),
-          factor(factor),
-          minValue(minValue),
-          maxValue(maxValue),
-          defaultValue(defaultValue),
-          mode(mode) {}
-
     int32_t decodeDataRaw(const uint8_t* const data) const;
     std::string decodeData(const uint8_t* const data) const;
-    bool encodeData(const std::string& value, uint8_t* data) const;
+    // allocation-free variant, returns length of value (not null-terminated), 0 on error
+    size_t decodeData(const uint8_t* const data, char* buffer, size_t size) const;
+    // validates value against data type and minValue..maxValue, logs the reason on error
+    bool encodeData(std::string_view value, uint8_t* data) const;
     std::string formatNumber(auto value) const { return Metrics::formatNumber(value, factor, 1); }
-    int32_t parseSignedNumber(const std::string& value) const;
-    uint32_t parseUnsignedNumber(const std::string& value) const;
+    size_t formatNumber(char* buffer, size_t size, auto value) const {
+        return Metrics::formatNumber(buffer, size, value, factor, 1);
+    }
+    // fixed-point parsing of decimal numbers into raw values (value * factor), no floating point, no exceptions
+    // decimals beyond the precision of factor are truncated
+    // ESP_ERR_INVALID_ARG: not a number, ESP_ERR_INVALID_SIZE: out of 32 bit range
+    esp_err_t parseSignedNumber(std::string_view value, int32_t& rawValue) const;
+    esp_err_t parseUnsignedNumber(std::string_view value, uint32_t& rawValue) const;
+    // raw value within range of data type and minValue..maxValue (no limits if both are 0)
+    bool isValidValue(int64_t rawValue) const;
     const char* unitAsString() const;
-    static NibeRegisterUnit stringToUnit(const char* unit);
 
-    JsonDocument homeassistantDiscoveryMessage(const NibeMqttConfig& config, const std::string& nibeRootTopic,
-                                               const JsonDocument& deviceDiscoveryInfo) const;
+    bool operator==(const NibeRegisterInfo& other) const = default;
+};
+
+// represents register configuration from ModbusManager
+// Title;Info;ID;Unit;Size;Factor;Min;Max;Default;Mode
+class NibeRegister : public NibeRegisterInfo {
+   public:
+    std::string title;
+
+    NibeRegister() = default;
+    NibeRegister(uint16_t id, const std::string& title, NibeRegisterUnit unit, NibeRegisterDataType dataType, int factor,
+                 int minValue, int maxValue, int defaultValue, NibeRegisterMode mode)
+        : NibeRegisterInfo{minValue, maxValue, defaultValue, id, (int16_t)factor, unit, dataType, mode}, title(title) {}
+    NibeRegister(const NibeRegisterInfo& info, const std::string& title) : NibeRegisterInfo(info), title(title) {}
+
+    static NibeRegisterUnit stringToUnit(std::string_view unit);
+
+    // builds the HA discovery payload (JSON) and returns the component, e.g. "sensor" or "number"
+    // deviceDiscoveryInfo: pre-serialized members, see MqttHelper::toJsonMembers()
+    std::string_view homeassistantDiscoveryMessage(const NibeMqttConfig& config, const std::string& nibeRootTopic,
+                                                   std::string_view deviceDiscoveryInfo, std::string& payload) const;
 
     NibeRegisterMetricConfig toPromMetricConfig(const NibeMqttConfig& config) const;
     std::string promMetricName() const;
@@ -107,6 +136,146 @@ class NibeRegister {
     bool operator==(const NibeRegister& other) const = default;
 };
 
+// registers sorted by id, titles in a shared string pool
+// - no hash nodes and no heap allocation per register, 24 bytes per register + title
+// - O(1) lookup via rank index: bitmap per 8 ids + index of first register, 3 bytes per 8 ids (~3.5 KB for 40001..49999)
+//   built by shrinkToFit() and load() if smaller than the entries, binary search otherwise (few registers, e.g. configured)
+class NibeRegisterTable {
+   public:
+    struct Entry : public NibeRegisterInfo {
+        uint32_t title;  // offset into string pool
+    };
+    // binary image: Header, entries, titles; same layout and byte order as in memory (written and read by the same firmware)
+    struct Header {
+        uint32_t magic;
+        uint32_t entrySize;  // sizeof(Entry), detects incompatible firmware
+        uint32_t numEntries;
+        uint32_t titlesSize;
+    };
+    typedef std::function<bool(const void* data, size_t size)> writeFunction_t;
+    typedef std::function<bool(void* data, size_t size)> readFunction_t;  // false if less than size bytes were read
+
+    // replaces register with same id, title of replaced register is not released
+    void insert(const NibeRegister& _register);
+    const Entry* find(uint16_t id) const;
+    // -1 if not found
+    int indexOf(uint16_t id) const;
+    const Entry& operator[](size_t index) const { return entries[index]; }
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    std::vector<Entry>::const_iterator begin() const { return entries.begin(); }
+    std::vector<Entry>::const_iterator end() const { return entries.end(); }
+    void clear();
+    // release unused capacity and build the lookup index, e.g. after loading
+    void shrinkToFit();
+    // write/read binary image, load() validates the image and leaves an empty table on error
+    bool save(const writeFunction_t& write) const;
+    bool load(const readFunction_t& read);
+    // heap usage in bytes (w/o allocator overhead)
+    size_t memoryUsage() const {
+        return entries.capacity() * sizeof(Entry) + titles.capacity() + idBitmaps.capacity() +
+               idRanks.capacity() * sizeof(uint16_t);
+    }
+
+    const char* title(const Entry& entry) const { return &titles[entry.title]; }
+    // full register incl. title (allocates), e.g. for HA discovery
+    NibeRegister get(const Entry& entry) const { return NibeRegister(entry, title(entry)); }
+
+   private:
+    std::vector<Entry> entries;
+    std::vector<char> titles;  // zero terminated strings
+    // block (id - minId) / 8: bit per id and index of first entry in block; empty: not built
+    std::vector<uint8_t> idBitmaps;
+    std::vector<uint16_t> idRanks;
+    uint16_t minId = 0;
+
+    void buildIndex();
+};
+
+// set of register ids as sorted array, built once and used as filter predicate, e.g. for the configured registers
+// - a few bytes per id instead of hash nodes or a 8 KB bitset over the whole id space
+class NibeRegisterIdSet {
+   public:
+    void insert(uint16_t id) { ids.push_back(id); }
+    template <typename Container>
+    void insertKeys(const Container& container) {
+        for (const auto& entry : container) {
+            ids.push_back(entry.first);
+        }
+    }
+    // must be called after inserting and before lookups
+    void build() {
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        ids.shrink_to_fit();
+    }
+    bool contains(uint16_t id) const { return std::binary_search(ids.begin(), ids.end(), id); }
+    bool operator()(uint16_t id) const { return contains(id); }
+    size_t size() const { return ids.size(); }
+
+   private:
+    std::vector<uint16_t> ids;
+};
+
+// all registers of a binary register database (NibeRegisterTable::save), looked up on demand by a binary search with
+// seeks instead of loading them into RAM, e.g. for ad-hoc reads and writes of registers that are not configured
+// thread-safe, every lookup reads ~log2(n) entries
+class NibeRegisterCatalog {
+   public:
+    // read size bytes at offset, false if less than size bytes were read
+    typedef std::function<bool(size_t offset, void* data, size_t size)> readAtFunction_t;
+
+    // validates the header, entries and titles are read on demand
+    bool open(const readAtFunction_t& readAt);
+    void close();
+    bool isOpen();
+    size_t size();
+    bool find(uint16_t id, NibeRegister& _register);
+    // copy registers matching filter into table, e.g. the configured registers that are kept in RAM
+    // filter is a predicate bool(uint16_t id), inlined instead of called through std::function
+    template <typename Filter>
+    bool load(NibeRegisterTable& registers, const Filter& filter) {
+        std::lock_guard<std::mutex> lock(mutex);
+        registers.clear();
+        if (readAt == nullptr) {
+            return false;
+        }
+        // entries are read in chunks, titles only for matching registers
+        NibeRegisterTable::Entry entries[16];
+        NibeRegister _register;
+        for (uint32_t index = 0; index < numEntries; index += std::size(entries)) {
+            uint32_t count = std::min<uint32_t>(numEntries - index, std::size(entries));
+            if (!readEntries(index, entries, count)) {
+                registers.clear();
+                return false;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                if (!filter(entries[i].id)) {
+                    continue;
+                }
+                if (!readRegister(entries[i], _register)) {
+                    registers.clear();
+                    return false;
+                }
+                registers.insert(_register);
+            }
+        }
+        registers.shrinkToFit();
+        return true;
+    }
+
+   private:
+    std::mutex mutex;
+    readAtFunction_t readAt;
+    uint32_t numEntries = 0;
+    uint32_t titlesSize = 0;
+
+    size_t entriesOffset() const { return sizeof(NibeRegisterTable::Header); }
+    size_t titlesOffset() const { return entriesOffset() + numEntries * sizeof(NibeRegisterTable::Entry); }
+    bool readEntries(uint32_t index, NibeRegisterTable::Entry* entries, uint32_t count);
+    bool readRegister(const NibeRegisterTable::Entry& entry, NibeRegister& _register);
+};
+
 struct NibeRegisterMetricConfig {
     std::string name;
     int factor;
@@ -116,12 +285,31 @@ struct NibeRegisterMetricConfig {
     bool isValid() const { return !name.empty() && factor != 0 && scale != 0; }
 };
 
+struct NibeRegisterPollConfig {
+    uint32_t interval;  // seconds
+};
+
+// change-driven MQTT publishing
+struct NibeRegisterPublishConfig {
+    int32_t deadband;    // raw register value, publish if value changes by more than deadband
+    uint32_t heartbeat;  // seconds, publish unchanged value after heartbeat, 0 = never
+};
+
 struct NibeMqttConfig {
-    std::unordered_map<uint16_t, NibeRegister> registers;  // TODO const NibeRegister, but doesn't work
-    std::vector<uint16_t> pollRegisters;
-    std::vector<uint16_t> pollRegistersSlow;
+    NibeRegisterTable registers;  // configured registers
+    NibeRegisterCatalog* catalog = nullptr;  // all registers, on demand lookup, nullptr: configured registers only
+    std::vector<uint16_t> pollRegisters;      // legacy, polled every NIBE_POLL_INTERVAL_DEFAULT
+    std::vector<uint16_t> pollRegistersSlow;  // legacy, polled every n * NIBE_POLL_INTERVAL_DEFAULT (n = size)
+    std::unordered_map<uint16_t, NibeRegisterPollConfig> poll;  // takes precedence over legacy lists
+    std::unordered_map<uint16_t, NibeRegisterPublishConfig> publish;  // default: deadband 0, NIBE_PUBLISH_HEARTBEAT_DEFAULT
+    // max registers published per ModbusDataMsg and max average rate (token bucket), changed registers are deferred
+    int dataMessagePublishBudget = NIBE_DATA_MESSAGE_PUBLISH_BUDGET_DEFAULT;
+    int dataMessagePublishRate = NIBE_DATA_MESSAGE_PUBLISH_RATE_DEFAULT;  // per second
+    // values of a ModbusDataMsg or read responses (batched) in one JSON message on <rootTopic>/nibe/state instead of
+    // one topic per register, HA discovery extracts values with val_tpl, no dataMessage budget/rate limit
+    bool jsonState = false;
     std::unordered_map<uint16_t, NibeRegisterMetricConfig> metrics;
-    std::unordered_map<uint16_t, std::string> homeassistantDiscoveryOverrides;
+    std::unordered_map<uint16_t, MqttDiscoveryOverride> homeassistantDiscoveryOverrides;
 };
 
 #endif
\ No newline at end of file
@@ -1,94 +1,215 @@
 #include "nibegw_mqtt.h"
 
 #include <esp_log.h>
-#include <esp_timer.h>
+#include <sdkconfig.h>
 
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
 #include <cstring>
 
+#if CONFIG_IDF_TARGET_LINUX
+#include <chrono>
+#else
+#include <esp_timer.h>
+#endif
+
 static const char* TAG = "nibegw_mqtt";
 
+static int64_t getTimeUs() {
+#if CONFIG_IDF_TARGET_LINUX
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+    return esp_timer_get_time();
+#endif
+}
+
+static uint32_t getTimeMs() { return getTimeUs() / 1000; }
+
+// histogram buckets in ms
+static const int32_t pollDelayBuckets[] = {1000, 2000, 5000, 10000, 30000, 60000, 300000};
+
 NibeMqttGw::NibeMqttGw(Metrics& metrics)
-    : metrics(metrics), metricPublishStateTime(metrics.addMetric(R"(nibegw_task_runtime_seconds{task="publishNibeRegisters"})", 1000)) {
+    : metrics(metrics),
+      readQueueHigh(metrics, "high", READ_REGISTER_HIGH_PRIO_RING_BUFFER_SIZE),
+      readQueueLow(metrics, "low", READ_REGISTER_RING_BUFFER_SIZE),
+      metricReadStarvationAvoided(metrics.addMetric(R"(nibegw_read_starvation_avoided_total)", 1, 1, true)),
+      metricPollDelay(metrics.addHistogram("nibegw_poll_delay_seconds", pollDelayBuckets,
+                                           sizeof(pollDelayBuckets) / sizeof(pollDelayBuckets[0]), 1000)),
+      metricMqttPublished(metrics.addMetric(R"(nibegw_register_publish_total{result="published"})", 1, 1, true)),
+      metricMqttSuppressed(metrics.addMetric(R"(nibegw_register_publish_total{result="suppressed"})", 1, 1, true)),
+      metricMqttDeferred(metrics.addMetric(R"(nibegw_register_publish_total{result="deferred"})", 1, 1, true)),
+      metricSamplesDropped(metrics.addMetric("nibegw_samples_dropped_total", 1, 1, true)) {
     mqttClient = nullptr;
-    numNibeRegistersToPoll = 0;
+    highPrioReadsInRow = 0;
+    clock = getTimeMs;
+    metricReadStarvationAvoided.setValue(0);
+    metricMqttPublished.setValue(0);
+    metricMqttSuppressed.setValue(0);
+    metricMqttDeferred.setValue(0);
+    metricSamplesDropped.setValue(0);
+    publisherTaskHandle = nullptr;
+    announceRequested = false;
+    dataMsgPublishTokens = 0;
+    dataMsgPublishTime = 0;
+    dataMsgPublishStart = 0;
+    jsonStateTime = 0;
 }
 
 esp_err_t NibeMqttGw::begin(const NibeMqttConfig& config, MqttClient& mqttClient) {
     this->config = &config;
     this->mqttClient = &mqttClient;
 
-    readNibeRegistersRingBuffer = xRingbufferCreateNoSplit(sizeof(uint16_t), READ_REGISTER_RING_BUFFER_SIZE);
-    if (readNibeRegistersRingBuffer == nullptr) {
-        ESP_LOGE(TAG, "Could not create readNibeRegistersRingBuffer");
+    if (readQueueHigh.begin() != ESP_OK || readQueueLow.begin() != ESP_OK) {
         return ESP_FAIL;
     }
     writeNibeRegistersRingBuffer = xRingbufferCreateNoSplit(sizeof(NibeMqttGwWriteRequest), WRITE_REGISTER_RING_BUFFER_SIZE);
-    if (readNibeRegistersRingBuffer == nullptr) {
+    if (writeNibeRegistersRingBuffer == nullptr) {
         ESP_LOGE(TAG, "Could not create writeNibeRegistersRingBuffer");
         return ESP_FAIL;
     }
 
     nibeRootTopic = mqttClient.getConfig().rootTopic + "/nibe/";
+    jsonStateTopic = nibeRootTopic + NIBE_JSON_STATE_TOPIC;
+    jsonState.clear();
+    if (config.jsonState) {
+        jsonState.reserve(NIBE_JSON_STATE_RESERVE);
+    }
 
-    // subscribe to 'set' topic of all registers
+    // subscribe to 'set' and 'get' (refresh) topic of all registers
     std::string commandTopic = nibeRootTopic + "+/set";
     mqttClient.subscribe(commandTopic, this);
+    std::string refreshTopic = nibeRootTopic + "+/get";
+    mqttClient.subscribe(refreshTopic, this);
+    mqttClient.registerDiscoveryCallback(this);
+
+    buildPollSchedule();
+    registerStates.clear();
+    adhocRegisters.clear();
+    registerStateIndex.assign(config.registers.size() + NIBE_ADHOC_REGISTERS_MAX, NO_REGISTER_STATE);
+    // metrics must not be added later on, web task iterates them without lock
+    for (const auto& [id, metricConfig] : config.metrics) {
+        int index = config.registers.indexOf(id);
+        if (index >= 0) {
+            getRegisterState(index);
+        }
+    }
+    dataMsgPublishTokens = config.dataMessagePublishBudget * 1000;
+    dataMsgPublishTime = clock();
+    dataMsgPublishStart = 0;
+    // slot table is learned with first ModbusDataMsg (address 0 never matches)
+    for (auto& slot : dataMsgSlots) {
+        slot = {0, -1, false};
+    }
 
-    nextNibeRegisterToPollSlow = config.pollRegistersSlow.cbegin();
-    numNibeRegistersToPoll = config.pollRegisters.size() + (config.pollRegistersSlow.size() > 0 ? 1 : 0);
+    // answering a read token for a polled register is just a copy of the precompiled frame
+    readRequestFrames.resize(pollScheduler.size());
+    readRequestFrameIndex.clear();
+    for (uint16_t frameIndex = 0; frameIndex < pollScheduler.size(); frameIndex++) {
+        uint16_t address = pollScheduler[frameIndex].address;
+        buildReadRequest(&readRequestFrames[frameIndex], address);
+        readRequestFrameIndex.insert({address, frameIndex});
+    }
 
     // pre-announce known registers for HA auto-discovery, offloads nibegw task
     // polled registers
-    for (const auto& regAdr : config.pollRegisters) {
-        auto iter = config.registers.find(regAdr);
-        if (iter != config.registers.end()) {
-            announceNibeRegister(iter->second);
-        }
-    }
-    for (const auto& regAdr : config.pollRegistersSlow) {
-        auto iter = config.registers.find(regAdr);
-        if (iter != config.registers.end()) {
-            announceNibeRegister(iter->second);
+    for (uint16_t i = 0; i < pollScheduler.size(); i++) {
+        int index = config.registers.indexOf(pollScheduler[i].address);
+        if (index >= 0) {
+            announceNibeRegister(index);
         }
     }
     // nibegw doesn't know upfront about registers sent as NibeDataMessage (20 fast registers) -> get announced on first data
 
-    // announce all registers with homeassistantDiscoveryOverrides as overrides are expensive (json parsing)
+    // announce all registers with homeassistantDiscoveryOverrides
     // writable registers need to be pre-announced and therefore always require overrides (even if empty)
     for (auto ovrIter = config.homeassistantDiscoveryOverrides.cbegin(); ovrIter != config.homeassistantDiscoveryOverrides.cend();
          ovrIter++) {
-        auto iter = config.registers.find(ovrIter->first);
-        if (iter != config.registers.end()) {
-            announceNibeRegister(iter->second);
+        int index = config.registers.indexOf(ovrIter->first);
+        if (index >= 0) {
+            announceNibeRegister(index);
         }
     }
+
+#if !CONFIG_IDF_TARGET_LINUX
+    // formatting and MQTT publishing must not delay RS485 responses in nibegw task
+    if (xTaskCreatePinnedToCore(&publisherTask, "nibegwPublisher", NIBE_MQTT_GW_PUBLISHER_TASK_STACK_SIZE, this,
+                                NIBE_MQTT_GW_PUBLISHER_TASK_PRIORITY, &publisherTaskHandle, 1) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create publisher task");
+        return ESP_FAIL;
+    }
+#endif
     return ESP_OK;
 }
 
-void NibeMqttGw::publishState() {
-    // put subscribed registers into queue so that onMessageTokenReceived can send them to nibe
-    ESP_LOGI(TAG, "publishState, requesting %d registers", numNibeRegistersToPoll);
-
-    // TODO: clear ring buffer? - nibegw should be fast enough to keep up with the queue
-    lastPublishStateStartTime = esp_timer_get_time() / 1000;
+// legacy pollRegisters every NIBE_POLL_INTERVAL_DEFAULT, pollRegistersSlow every n * NIBE_POLL_INTERVAL_DEFAULT
+// (same rate as the former round robin over the slow list), intervals in poll take precedence
+void NibeMqttGw::buildPollSchedule() {
+    std::vector<uint16_t> addresses;
+    std::unordered_map<uint16_t, uint32_t> intervals;  // seconds
+    auto add = [&](uint16_t address, uint32_t interval) {
+        if (intervals.insert_or_assign(address, interval).second) {
+            addresses.push_back(address);
+        }
+    };
     for (auto address : config->pollRegisters) {
-        requestNibeRegister(address);
+        add(address, NIBE_POLL_INTERVAL_DEFAULT);
     }
-    // plus one register from low frequency list
-    if (nextNibeRegisterToPollSlow  == config->pollRegistersSlow.cend()) {
-        nextNibeRegisterToPollSlow = config->pollRegistersSlow.cbegin();
+    for (auto address : config->pollRegistersSlow) {
+        add(address, NIBE_POLL_INTERVAL_DEFAULT * config->pollRegistersSlow.size());
+    }
+    std::vector<uint16_t> pollAddresses;
+    for (const auto& [address, pollConfig] : config->poll) {
+        pollAddresses.push_back(address);
+    }
+    std::sort(pollAddresses.begin(), pollAddresses.end());
+    for (auto address : pollAddresses) {
+        add(address, config->poll.at(address).interval);
+    }
+
+    // all registers are due immediately, deadlines spread out as read tokens arrive
+    pollScheduler.clear();
+    uint32_t now = clock();
+    for (auto address : addresses) {
+        pollScheduler.add(address, intervals[address] * 1000, now);
+    }
+    ESP_LOGI(TAG, "Polling %d registers", (int)pollScheduler.size());
+}
+
+// state topic, publish config and metric of a register in use
+NibeMqttGw::RegisterState& NibeMqttGw::getRegisterState(int index) {
+    uint16_t stateIndex = registerStateIndex[index];
+    if (stateIndex != NO_REGISTER_STATE) {
+        return registerStates[stateIndex];
     }
-    if (nextNibeRegisterToPollSlow != config->pollRegistersSlow.cend()) {
-        requestNibeRegister(*nextNibeRegisterToPollSlow);
-        nextNibeRegisterToPollSlow++;
+    const NibeRegisterInfo& entry = getRegisterInfo(index);
+    auto cfgIter = config->publish.find(entry.id);
+    NibeRegisterPublishConfig publishConfig =
+        cfgIter != config->publish.end() ? cfgIter->second : NibeRegisterPublishConfig{0, NIBE_PUBLISH_HEARTBEAT_DEFAULT};
+    // only registers that are configured as metrics, all created in begin()
+    Metric* metric = nullptr;
+    if (config->metrics.find(entry.id) != config->metrics.end()) {
+        const NibeRegisterMetricConfig& metricCfg = getRegister(index).toPromMetricConfig(*config);
+        if (metricCfg.isValid()) {
+            metric = &metrics.addMetric(metricCfg.name.c_str(), metricCfg.factor, metricCfg.scale, metricCfg.counter);
+        }
     }
+    registerStateIndex[index] = registerStates.size();
+    registerStates.push_back(
+        {{0, 0, publishConfig.deadband, publishConfig.heartbeat * 1000, false, nibeRootTopic + std::to_string(entry.id)},
+         metric,
+         (size_t)index < config->registers.size(),
+         {},
+         {}});
+    return registerStates.back();
 }
 
-// topic: nibegw/nibe/<id>/set
-// payload: new value
+// topic: nibegw/nibe/<id>/set, payload: new value
+// topic: nibegw/nibe/<id>/get, payload: ignored, register is read and published (background refresh)
 void NibeMqttGw::onMqttMessage(const std::string& topic, const std::string& payload) {
     ESP_LOGI(TAG, "Received MQTT message: %s: %s", topic.c_str(), payload.c_str());
-    if (!topic.starts_with(nibeRootTopic) || !topic.ends_with("/set")) {
+    bool refresh = topic.ends_with("/get");
+    if (!topic.starts_with(nibeRootTopic) || !(refresh || topic.ends_with("/set"))) {
         ESP_LOGW(TAG, "Invalid topic %s", topic.c_str());
         return;
     }
@@ -97,92 +218,273 @@ void NibeMqttGw::onMqttMessage(const std::string& topic, const std::string& payl
         ESP_LOGW(TAG, "Invalid topic %s", topic.c_str());
         return;
     }
+    if (refresh) {
+        // e.g. HA automations, must not delay interactive reads from web UI
+        requestNibeRegister(address, NibeReadPriority::Low);
+        return;
+    }
     writeNibeRegister(address, payload.c_str());
 }
 
-void NibeMqttGw::requestNibeRegister(uint16_t address) {
-    if (!xRingbufferSend(readNibeRegistersRingBuffer, &address, sizeof(address), 0)) {
-        ESP_LOGW(TAG, "Could not send register %d to readNibeRegistersRingBuffer. Buffer full.", address);
+void NibeMqttGw::requestNibeRegister(uint16_t address, NibeReadPriority priority) {
+    auto iter = readRequestFrameIndex.find(address);
+    NibeMqttGwReadRequest request = {iter != readRequestFrameIndex.end() ? iter->second : (uint16_t)READ_REQUEST_FRAME_ADHOC,
+                                     address};
+    if (priority == NibeReadPriority::High) {
+        readQueueHigh.push(request);
+    } else {
+        readQueueLow.push(request);
     }
 }
 
+// value is validated and encoded here, not on nibegw task (catalog lookup reads from flash)
 void NibeMqttGw::writeNibeRegister(uint16_t address, const char* value) {
     if (value == nullptr) {
         ESP_LOGE(TAG, "writeNibeRegister: value is null for register %d", address);
         return;
     }
-    auto valueLen = strlen(value);
-    if (valueLen == 0) {
+    if (value[0] == '\0') {
         ESP_LOGE(TAG, "writeNibeRegister: missing value for register %d", address);
         return;
     }
-    if (valueLen > sizeof(NibeMqttGwWriteRequest::value) - 1) {
-        ESP_LOGE(TAG, "writeNibeRegister: value too long for register %d: %s", address, value);
+    // config->registers is not modified after begin(), ad-hoc registers of the publisher task are not used
+    NibeRegister catalogRegister;
+    const NibeRegisterInfo* _register = config->registers.find(address);
+    if (_register == nullptr && config->catalog != nullptr && config->catalog->find(address, catalogRegister)) {
+        _register = &catalogRegister;
+    }
+    if (_register == nullptr) {
+        ESP_LOGW(TAG, "Received write request for unknown register %d", address);
+        return;
+    }
+    if (_register->mode == NibeRegisterMode::Read) {
+        ESP_LOGW(TAG, "Received write request for read-only register %d", address);
+        return;
+    }
+    NibeMqttGwWriteRequest writeRequest = {address, {}};
+    if (!_register->encodeData(value, writeRequest.value)) {
         return;
     }
-    NibeMqttGwWriteRequest writeRequest;
-    writeRequest.address = address;
-    strncpy(writeRequest.value, value, sizeof(writeRequest.value));
-    writeRequest.value[sizeof(writeRequest.value) - 1] = '\0';  // ensure null termination
     if (!xRingbufferSend(writeNibeRegistersRingBuffer, &writeRequest, sizeof(writeRequest), 0)) {
         ESP_LOGE(TAG, "Could not send register %d to writeNibeRegistersRingBuffer. Buffer full.", address);
     }
 }
 
-void NibeMqttGw::onMessageReceived(const NibeResponseMessage* const msg, int len) {
-    switch (msg->cmd) {
-        case NibeCmd::ModbusReadResp: {
-            ESP_LOGV(TAG, "onMessageReceived ModbusReadResp: %s", NibeGw::dataToString((uint8_t*)msg, len).c_str());
-            const NibeRegister* reg = findNibeRegister(msg->readResponse.registerAddress);
-            if (reg == nullptr) {
-                ESP_LOGW(TAG, "Received NibeResponseMessage for unknown register %d", msg->readResponse.registerAddress);
+void NibeMqttGw::queueSample(const NibeSample& sample) {
+    if (!sampleQueue.push(sample)) {
+        ESP_LOGW(TAG, "Sample queue full, dropping register %d", sample.address);
+        metricSamplesDropped.incrementValue(1);
+        return;
+    }
+    if (publisherTaskHandle != nullptr) {
+        xTaskNotifyGive(publisherTaskHandle);
+    }
+}
+
+void NibeMqttGw::publisherTask(void* pvParameters) {
+    NibeMqttGw* gw = (NibeMqttGw*)pvParameters;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+        gw->processPendingSamples();
+    }
+}
+
+int NibeMqttGw::processPendingSamples() {
+    if (announceRequested.exchange(false)) {
+        announceNibeRegisters();
+    }
+    int processed = 0;
+    NibeSample sample;
+    while (sampleQueue.pop(sample)) {
+        processSample(sample);
+        processed++;
+    }
+    // read responses are batched, ModbusDataMsg values are published when the message is processed
+    if (!jsonState.empty() && clock() - jsonStateTime >= NIBE_JSON_STATE_BATCH_TIME) {
+        publishJsonState();
+    }
+    return processed;
+}
+
+void NibeMqttGw::processSample(const NibeSample& sample) {
+    switch (sample.source) {
+        case NibeSampleSource::ReadResponse: {
+            int index = findNibeRegister(sample.address);
+            if (index < 0) {
+                ESP_LOGW(TAG, "Received NibeResponseMessage for unknown register %d", sample.address);
                 return;
             }
+            publishMqtt(index, sample.value, sample.time);
+            publishMetric(index, sample.value);
+            break;
+        }
+        case NibeSampleSource::DataMessage: {
+            NibeDataMessageRegister& registerData = pendingDataMessage.registers[sample.slot];
+            registerData.registerAddress = sample.address;
+            std::memcpy(registerData.value, sample.value, sizeof(registerData.value));
+            if (sample.slot == 19) {
+                onDataMessageReceived(pendingDataMessage, sample.time);
+            }
+            break;
+        }
+        case NibeSampleSource::Write:
+        case NibeSampleSource::ReadRequest: {
+            // confirm state after write even if the value didn't change (e.g. write failed), answer explicit reads
+            int index = indexOfRegister(sample.address);
+            if (index >= 0 && registerStateIndex[index] != NO_REGISTER_STATE) {
+                registerStates[registerStateIndex[index]].publishState.valid = false;
+            }
+            break;
+        }
+    }
+}
 
-            publishMqtt(*reg, msg->readResponse.value);
-            publishMetric(*reg, msg->readResponse.value);
+// publish changed registers immediately, limited by budget per message and rate
+// metrics are updated for all registers
+void NibeMqttGw::onDataMessageReceived(const NibeDataMessage& dataMessage, uint32_t now) {
+    for (int i = 0; i < 20; i++) {
+        if (dataMessage.registers[i].registerAddress != dataMsgSlots[i].address) {
+            learnDataMsgSlots(dataMessage);
             break;
         }
+    }
 
-        case NibeCmd::ModbusDataMsg: {
-            // ~ one ModMusDataMsg ever 2s, up to 20 registers
-            // Limitation: can only handle 16bit registers
-            ESP_LOGV(TAG, "onMessageReceived ModbusDataMsg: %s", NibeGw::dataToString((uint8_t*)msg, len).c_str());
+    // JSON state: one message per ModbusDataMsg, no limits
+    int budget = config->jsonState ? 20 : takeDataMsgPublishBudget(now);
+    int published = 0;
+    int deferred = 0;
+    int receivedNibeRegisters = 0;
+    int nextStart = dataMsgPublishStart;
+    for (int n = 0; n < 20; n++) {
+        int i = (dataMsgPublishStart + n) % 20;
+        const DataMsgSlot& slot = dataMsgSlots[i];
+        if (slot.index < 0) {
+            continue;
+        }
+        const NibeRegisterInfo& _register = getRegisterInfo(slot.index);
+        RegisterState& state = getRegisterState(slot.index);
+        const uint8_t* data = dataMessage.registers[i].value;
+        uint8_t data32[4];
+        if (slot.paired) {
+            // low word first, same byte order as ModbusReadResp
+            std::memcpy(data32, dataMessage.registers[i].value, 2);
+            std::memcpy(data32 + 2, dataMessage.registers[i + 1].value, 2);
+            data = data32;
+        }
+        int32_t value = _register.decodeDataRaw(data);
+        if (!state.publishState.isDue(value, now)) {
+            metricMqttSuppressed.incrementValue(1);
+        } else if (published < budget) {
+            publishMqtt(slot.index, data, value, now);
+            published++;
+            nextStart = i + 1;
+        } else {
+            // still due with next ModbusDataMsg
+            metricMqttDeferred.incrementValue(1);
+            deferred++;
+        }
+        if (state.metric != nullptr) {
+            state.metric->setValue(value);
+        }
+        receivedNibeRegisters++;
+    }
+    // continue after last published register, deferred registers are checked first with next message
+    dataMsgPublishStart = nextStart % 20;
+    if (!config->jsonState) {
+        dataMsgPublishTokens -= published * 1000;
+    }
+    publishJsonState();
+    ESP_LOGD(TAG, "onMessageReceived ModbusDataMsg: received %d registers, published %d, deferred %d", receivedNibeRegisters,
+             published, deferred);
+}
 
-            int receivedNibeRegisters = 0;
-            int publishIdx = modbusDataMsgMqttPublish % 20;
-            for (int i = 0; i < 20; i++) {
-                NibeDataMessageRegister registerData = msg->dataMessage.registers[i];
-                if (registerData.registerAddress == 0xFFFF) {
-                    // 0xffff indicates that not all 20 registers in ModbusDataMsg are used
+void NibeMqttGw::learnDataMsgSlots(const NibeDataMessage& dataMessage) {
+    ESP_LOGI(TAG, "ModbusDataMsg: learning register layout");
+    for (int i = 0; i < 20; i++) {
+        DataMsgSlot& slot = dataMsgSlots[i];
+        slot = {dataMessage.registers[i].registerAddress, -1, false};
+        if (slot.address == 0xFFFF) {
+            // 0xffff indicates that not all 20 registers in ModbusDataMsg are used
+            continue;
+        }
+        if (i > 0 && dataMsgSlots[i - 1].paired) {
+            // high word of 32 bit register in previous slot
+            continue;
+        }
+        int index = findNibeRegister(slot.address);
+        if (index < 0) {
+            ESP_LOGW(TAG, "Received ModbusDataMsg for unknown register %d", slot.address);
+            continue;
+        }
+        const NibeRegisterInfo& _register = getRegisterInfo(index);
+        switch (_register.dataType) {
+            case NibeRegisterDataType::UInt8:
+            case NibeRegisterDataType::Int8:
+            case NibeRegisterDataType::UInt16:
+            case NibeRegisterDataType::Int16:
+                break;
+            case NibeRegisterDataType::UInt32:
+            case NibeRegisterDataType::Int32:
+                // 32 bit registers are sent as two consecutive 16 bit registers N, N+1
+                if (i + 1 < 20 && dataMessage.registers[i + 1].registerAddress == slot.address + 1) {
+                    slot.paired = true;
                     break;
                 }
-                const NibeRegister* _register = findNibeRegister(registerData.registerAddress);
-                if (_register == nullptr) {
-                    ESP_LOGW(TAG, "Received ModbusDataMsg for unknown register %d", registerData.registerAddress);
-                    continue;
-                }
-                switch (_register->dataType) {
-                    case NibeRegisterDataType::UInt8:
-                    case NibeRegisterDataType::Int8:
-                    case NibeRegisterDataType::UInt16:
-                    case NibeRegisterDataType::Int16:
-                        break;
-                    default:
-                        ESP_LOGW(TAG, "Unsupported data type %d in ModbusDataMsg for register %d", (int)_register->dataType, _register->id);
-                        continue;
-                }
+                ESP_LOGW(TAG, "32 bit register %d in ModbusDataMsg requires register %d in next slot", _register.id,
+                         _register.id + 1);
+                continue;
+            default:
+                ESP_LOGW(TAG, "Unsupported data type %d in ModbusDataMsg for register %d", (int)_register.dataType, _register.id);
+                continue;
+        }
+        slot.index = index;
+        // topic and metric, unconfigured registers are announced too as they are sent permanently
+        getRegisterState(index).announce = true;
+    }
+}
 
-                // publish 2 registers every ModbusDataMsg = every 2s
-                // -> ~1 register/s or all 20 registers take ~20s which is around the same speed as polling
-                if (i == publishIdx || i == publishIdx + 1) {
-                    publishMqtt(*_register, registerData.value);
-                }
-                publishMetric(*_register, registerData.value);
-                receivedNibeRegisters++;
+// token bucket, refilled with dataMessagePublishRate, max dataMessagePublishBudget
+int NibeMqttGw::takeDataMsgPublishBudget(uint32_t now) {
+    uint32_t maxTokens = config->dataMessagePublishBudget * 1000;
+    uint32_t elapsed = now - dataMsgPublishTime;
+    dataMsgPublishTime = now;
+    if (elapsed >= maxTokens / config->dataMessagePublishRate) {
+        dataMsgPublishTokens = maxTokens;
+    } else {
+        dataMsgPublishTokens = std::min(maxTokens, dataMsgPublishTokens + elapsed * config->dataMessagePublishRate);
+    }
+    return dataMsgPublishTokens / 1000;
+}
+
+void NibeMqttGw::onMessageReceived(const NibeResponseMessage* const msg, int len) {
+    switch (msg->cmd) {
+        case NibeCmd::ModbusReadResp: {
+            ESP_LOGV(TAG, "onMessageReceived ModbusReadResp: %s", NibeGw::dataToString((uint8_t*)msg, len).c_str());
+            NibeSample sample = {msg->readResponse.registerAddress, NibeSampleSource::ReadResponse, 0, {}, clock()};
+            std::memcpy(sample.value, msg->readResponse.value, sizeof(sample.value));
+            queueSample(sample);
+            break;
+        }
+
+        case NibeCmd::ModbusDataMsg: {
+            // ~ one ModMusDataMsg ever 2s, up to 20 registers
+            ESP_LOGV(TAG, "onMessageReceived ModbusDataMsg: %s", NibeGw::dataToString((uint8_t*)msg, len).c_str());
+            // all or nothing, publisher task processes complete messages
+            if (sampleQueue.available() < 20) {
+                ESP_LOGW(TAG, "Sample queue full, dropping ModbusDataMsg");
+                metricSamplesDropped.incrementValue(20);
+                break;
+            }
+            uint32_t now = clock();
+            for (uint8_t i = 0; i < 20; i++) {
+                const NibeDataMessageRegister& registerData = msg->dataMessage.registers[i];
+                NibeSample sample = {registerData.registerAddress, NibeSampleSource::DataMessage, i, {}, now};
+                std::memcpy(sample.value, registerData.value, sizeof(registerData.value));
+                sampleQueue.push(sample);
+            }
+            if (publisherTaskHandle != nullptr) {
+                xTaskNotifyGive(publisherTaskHandle);
             }
-            modbusDataMsgMqttPublish += 2;  // 2 registers published per ModbusDataMsg
-            ESP_LOGD(TAG, "onMessageReceived ModbusDataMsg: received %d registers", receivedNibeRegisters);
             break;
         }
 
@@ -210,91 +512,222 @@ void NibeMqttGw::onMessageReceived(const NibeResponseMessage* const msg, int len
     }
 }
 
-const NibeRegister* NibeMqttGw::findNibeRegister(uint16_t address) {
-    auto iter = config->registers.find(address);
-    if (iter == config->registers.end()) {
+int NibeMqttGw::indexOfRegister(uint16_t address) const {
+    int index = config->registers.indexOf(address);
+    if (index >= 0) {
+        return index;
+    }
+    for (size_t i = 0; i < adhocRegisters.size(); i++) {
+        if (adhocRegisters[i].id == address) {
+            return config->registers.size() + i;
+        }
+    }
+    return -1;
+}
+
+// unconfigured registers are looked up in the catalog once and kept
+int NibeMqttGw::findNibeRegister(uint16_t address) {
+    int index = indexOfRegister(address);
+    if (index >= 0) {
+        return index;
+    }
+    NibeRegister _register;
+    if (config->catalog == nullptr || !config->catalog->find(address, _register)) {
         ESP_LOGW(TAG, "Received data for unknown register %d", address);
-        return nullptr;
+        return -1;
+    }
+    if (adhocRegisters.size() >= NIBE_ADHOC_REGISTERS_MAX) {
+        ESP_LOGW(TAG, "Too many unconfigured registers, ignoring register %d", address);
+        return -1;
+    }
+    ESP_LOGI(TAG, "Register %d not configured, using register catalog", address);
+    adhocRegisters.push_back(std::move(_register));
+    return config->registers.size() + adhocRegisters.size() - 1;
+}
+
+const NibeRegisterInfo& NibeMqttGw::getRegisterInfo(int index) const {
+    size_t size = config->registers.size();
+    if ((size_t)index < size) {
+        return config->registers[index];
     }
-    return &iter->second;
+    return adhocRegisters[index - size];
+}
+
+NibeRegister NibeMqttGw::getRegister(int index) const {
+    size_t size = config->registers.size();
+    if ((size_t)index < size) {
+        return config->registers.get(config->registers[index]);
+    }
+    return adhocRegisters[index - size];
 }
 
 // send registers as mqtt messages, announce new registers for HA auto-discovery
-void NibeMqttGw::publishMqtt(const NibeRegister& _register, const uint8_t* const data) {
+void NibeMqttGw::publishMqtt(int index, const uint8_t* const data, uint32_t now) {
     // TODO: should check data consistency (len vs data type)
-    // decode raw data
-    std::string value = _register.decodeData(data);
+    int32_t value = getRegisterInfo(index).decodeDataRaw(data);
+    if (!getRegisterState(index).publishState.isDue(value, now)) {
+        metricMqttSuppressed.incrementValue(1);
+        return;
+    }
+    publishMqtt(index, data, value, now);
+}
+
+void NibeMqttGw::publishMqtt(int index, const uint8_t* const data, int32_t rawValue, uint32_t now) {
+    RegisterState& state = getRegisterState(index);
+    state.publishState.value = rawValue;
+    state.publishState.time = now;
+    state.publishState.valid = true;
+    metricMqttPublished.incrementValue(1);
+    // decode raw data, no heap allocation
+    char value[FORMAT_NUMBER_BUFFER_SIZE];
+    size_t length = getRegisterInfo(index).decodeData(data, value, sizeof(value));
     // publish data to mqtt
-    mqttClient->publish(nibeRootTopic + std::to_string(_register.id), value);
+    if (config->jsonState) {
+        addJsonState(getRegisterInfo(index).id, std::string_view(value, length), now);
+    } else {
+        mqttClient->publish(state.publishState.topic, std::string_view(value, length));
+    }
 
-    // announce _register on first appearance
-    if (announcedNibeRegisters.find(_register.id) == announcedNibeRegisters.end()) {
-        announceNibeRegister(_register);
+    // announce register on first appearance, ad-hoc reads (e.g. once from web UI) are not permanent HA entities
+    if (state.discoveryPayload.empty() && state.announce) {
+        announceNibeRegister(index);
     }
 }
 
-// send registers as metrics, create metric if not exists but only for registers that are configured as metrics
-void NibeMqttGw::publishMetric(const NibeRegister& _register, const uint8_t* const data) {
-    auto iter2 = nibeRegisterMetrics.find(_register.id);
-    if (iter2 == nibeRegisterMetrics.end()) {
-        const NibeRegisterMetricConfig& metricCfg = _register.toPromMetricConfig(*config);
-        if (metricCfg.isValid()) {
-            Metric& metric = metrics.addMetric(metricCfg.name.c_str(), metricCfg.factor, metricCfg.scale, metricCfg.counter);
-            iter2 = nibeRegisterMetrics.insert({_register.id, &metric}).first;
-        } else {
-            // do not publish this register as metric
-            iter2 = nibeRegisterMetrics.insert({_register.id, nullptr}).first;
-        }
+// {"<id>":<value>,...}, a register published twice before publishJsonState() appears twice (last one wins)
+void NibeMqttGw::addJsonState(uint16_t id, std::string_view value, uint32_t now) {
+    if (value.empty()) {
+        return;  // unknown data type, not a valid JSON value
+    }
+    if (jsonState.empty()) {
+        jsonState += '{';
+        jsonStateTime = now;
+    } else {
+        jsonState += ',';
+    }
+    char key[8];
+    auto result = std::to_chars(key, key + sizeof(key), id);
+    jsonState += '"';
+    jsonState.append(key, result.ptr - key);
+    jsonState += "\":";
+    jsonState.append(value);
+}
+
+void NibeMqttGw::publishJsonState() {
+    if (jsonState.empty()) {
+        return;
     }
-    Metric* metric = iter2->second;
+    jsonState += '}';
+    mqttClient->publish(std::string_view(jsonStateTopic), std::string_view(jsonState));
+    jsonState.clear();  // keeps capacity
+}
+
+// change-driven publishing: value changed by more than deadband or heartbeat expired
+bool NibeMqttGw::PublishState::isDue(int32_t value, uint32_t now) const {
+    return !valid || std::abs((int64_t)value - this->value) > deadband || (heartbeat != 0 && now - time >= heartbeat);
+}
+
+// send registers as metrics
+void NibeMqttGw::publishMetric(int index, const uint8_t* const data) {
+    Metric* metric = getRegisterState(index).metric;
     if (metric != nullptr) {
-        int32_t valueInt = _register.decodeDataRaw(data);
+        int32_t valueInt = getRegisterInfo(index).decodeDataRaw(data);
         metric->setValue(valueInt);
     }
 }
 
-void NibeMqttGw::announceNibeRegister(const NibeRegister& _register) {
-    ESP_LOGI(TAG, "Announcing register %u", _register.id);
+void NibeMqttGw::announceNibeRegister(int index) {
+    RegisterState& state = getRegisterState(index);
+    if (state.discoveryPayload.empty()) {
+        const NibeRegister& _register = getRegister(index);
+        ESP_LOGI(TAG, "Announcing register %u", _register.id);
+        std::string_view component = _register.homeassistantDiscoveryMessage(
+            *config, nibeRootTopic, mqttClient->getDeviceDiscoveryInfoRefMembers(), state.discoveryPayload);
+        // !!! if crash (strlen in ROM) -> stack too small (nibegw.h: NIBE_GW_TASK_STACK_SIZE) or incorrect format string!!!
+        char discoveryTopic[64];
+        snprintf(discoveryTopic, sizeof(discoveryTopic), "%s/%.*s/nibegw/nibe-%u/config",
+                 mqttClient->getConfig().discoveryPrefix.c_str(), (int)component.size(), component.data(), _register.id);
+        state.discoveryTopic = discoveryTopic;
+        state.discoveryPayload.shrink_to_fit();
+    }
+    mqttClient->publishDiscovery(state.discoveryTopic, state.discoveryPayload);
+}
 
-    auto discoveryDoc = _register.homeassistantDiscoveryMessage(*config, nibeRootTopic, mqttClient->getDeviceDiscoveryInfoRef());
-    // !!! if crash (strlen in ROM) -> stack too small (nibegw.h: NIBE_GW_TASK_STACK_SIZE) or incorrect format string!!!
-    char discoveryTopic[64];
-    const char* component = discoveryDoc["_component_"] | "sensor";
-    snprintf(discoveryTopic, sizeof(discoveryTopic), "%s/%s/nibegw/nibe-%u/config",
-             mqttClient->getConfig().discoveryPrefix.c_str(), component, _register.id);
+void NibeMqttGw::announceNibeRegisters() {
+    for (const RegisterState& state : registerStates) {
+        if (!state.discoveryPayload.empty()) {
+            mqttClient->publishDiscovery(state.discoveryTopic, state.discoveryPayload);
+        }
+    }
+}
 
-    discoveryDoc.remove("_component_");
-    std::string discoveryMsg;
-    serializeJson(discoveryDoc, discoveryMsg);
-    mqttClient->publish(discoveryTopic, discoveryMsg, QOS0, true);
-    announcedNibeRegisters.insert(_register.id);
+void NibeMqttGw::onHomeassistantOnline() {
+    announceRequested = true;
+    if (publisherTaskHandle != nullptr) {
+        xTaskNotifyGive(publisherTaskHandle);
+    }
 }
 
 int NibeMqttGw::onReadTokenReceived(NibeReadRequestMessage* readRequest) {
-    size_t item_size;
-    uint16_t* readRegisterPtr = (uint16_t*)xRingbufferReceive(readNibeRegistersRingBuffer, &item_size, 0);
-    if (readRegisterPtr == nullptr) {
-        // no more registers to read
-        // calculate time to publish state
-        uint32_t startTime = lastPublishStateStartTime.exchange(0);
-        if (startTime > 0) {
-            uint32_t now = esp_timer_get_time() / 1000;
-            metricPublishStateTime.setValue(now - startTime);
-        }
+    NibeMqttGwReadRequest request;
+    if (!nextReadRequest(request)) {
+        // no register to read
         return 0;
     }
-    uint16_t address = *readRegisterPtr;
-    vRingbufferReturnItem(readNibeRegistersRingBuffer, (void*)readRegisterPtr);
 
+    if (request.frameIndex < readRequestFrames.size()) {
+        std::memcpy(readRequest, &readRequestFrames[request.frameIndex], sizeof(NibeReadRequestMessage));
+    } else {
+        buildReadRequest(readRequest, request.address);
+    }
+    if (!request.polled) {
+        queueSample({request.address, NibeSampleSource::ReadRequest, 0, {}, clock()});
+    }
+
+    // LOGV: formatting the frame is too expensive for the nibegw task
+    ESP_LOGV(TAG, "onReadTokenReceived, read register %d: %s", (int)request.address,
+             NibeGw::dataToString((uint8_t*)readRequest, sizeof(NibeReadRequestMessage)).c_str());
+    return sizeof(NibeReadRequestMessage);
+}
+
+bool NibeMqttGw::nextReadRequest(NibeMqttGwReadRequest& request) {
+    if (highPrioReadsInRow >= READ_HIGH_PRIO_BURST && nextLowPriorityReadRequest(request)) {
+        // avoid starvation of background polling
+        highPrioReadsInRow = 0;
+        metricReadStarvationAvoided.incrementValue(1);
+        return true;
+    }
+    if (readQueueHigh.pop(request)) {
+        highPrioReadsInRow++;
+        return true;
+    }
+    highPrioReadsInRow = 0;
+    return nextLowPriorityReadRequest(request);
+}
+
+// queued low priority requests, then polled register with earliest due deadline
+bool NibeMqttGw::nextLowPriorityReadRequest(NibeMqttGwReadRequest& request) {
+    if (readQueueLow.pop(request)) {
+        return true;
+    }
+    uint16_t index;
+    uint32_t delay;
+    if (!pollScheduler.next(clock(), index, delay)) {
+        return false;
+    }
+    metricPollDelay.observe(delay);
+    request.frameIndex = index;
+    request.address = pollScheduler[index].address;
+    request.polled = true;
+    return true;
+}
+
+void NibeMqttGw::buildReadRequest(NibeReadRequestMessage* readRequest, uint16_t address) {
     readRequest->start = NibeStart::Request;
     readRequest->cmd = NibeCmd::ModbusReadReq;
     readRequest->len = 2;
     readRequest->registerAddress = address;
     readRequest->chksum = NibeGw::calcCheckSum((uint8_t*)readRequest, sizeof(NibeReadRequestMessage) - 1);
-
-    ESP_LOGD(TAG, "onReadTokenReceived, read register %d: %s", (int)address,
-             NibeGw::dataToString((uint8_t*)readRequest, sizeof(NibeReadRequestMessage)).c_str());
-    return sizeof(NibeReadRequestMessage);
 }
 
 int NibeMqttGw::onWriteTokenReceived(NibeWriteRequestMessage* writeRequest) {
@@ -305,31 +738,121 @@ int NibeMqttGw::onWriteTokenReceived(NibeWriteRequestMessage* writeRequest) {
         return 0;
     }
     uint16_t address = writeRegisterPtr->address;
-    const NibeRegister* _register = findNibeRegister(address);
-    if (_register == nullptr) {
-        vRingbufferReturnItem(writeNibeRegistersRingBuffer, (void*)writeRegisterPtr);
-        ESP_LOGW(TAG, "Received write request for unknown register %d", address);
-        return 0;
-    }
-    if (_register->mode == NibeRegisterMode::Read) {
-        vRingbufferReturnItem(writeNibeRegistersRingBuffer, (void*)writeRegisterPtr);
-        ESP_LOGW(TAG, "Received write request for read-only register %d", address);
-        return 0;
-    }
-
     writeRequest->start = NibeStart::Request;
     writeRequest->cmd = NibeCmd::ModbusWriteReq;
     writeRequest->len = 6;
     writeRequest->registerAddress = address;
-    if (!_register->encodeData(writeRegisterPtr->value, writeRequest->value)) {
-        vRingbufferReturnItem(writeNibeRegistersRingBuffer, (void*)writeRegisterPtr);
-        return 0;
-    }
+    std::memcpy(writeRequest->value, writeRegisterPtr->value, sizeof(writeRequest->value));
     writeRequest->chksum = NibeGw::calcCheckSum((uint8_t*)writeRequest, sizeof(NibeWriteRequestMessage) - 1);
 
     vRingbufferReturnItem(writeNibeRegistersRingBuffer, (void*)writeRegisterPtr);
 
+    queueSample({address, NibeSampleSource::Write, 0, {}, clock()});
+
     ESP_LOGD(TAG, "onWriteTokenReceived for register %d: %s", (int)address,
              NibeGw::dataToString((uint8_t*)writeRequest, sizeof(NibeWriteRequestMessage)).c_str());
     return sizeof(NibeWriteRequestMessage);
 }
+
+// histogram buckets in ms, one read token per ~1s
+static const int32_t waitTimeBuckets[] = {1000, 2000, 5000, 10000, 20000, 30000, 60000, 120000};
+
+static std::string laneMetricName(const char* name, const char* lane) {
+    return std::string(name) + "{lane=\"" + lane + "\"}";
+}
+
+NibeMqttGwReadQueue::NibeMqttGwReadQueue(Metrics& metrics, const char* lane, size_t size)
+    : size(size),
+      ringBuffer(nullptr),
+      metricDepth(metrics.addMetric(laneMetricName("nibegw_read_queue_depth", lane).c_str(), 1)),
+      metricDeduplicated(metrics.addMetric(laneMetricName("nibegw_read_requests_deduplicated_total", lane).c_str(), 1, 1, true)),
+      metricDropped(metrics.addMetric(laneMetricName("nibegw_read_requests_dropped_total", lane).c_str(), 1, 1, true)),
+      metricWaitTime(metrics.addHistogram(laneMetricName("nibegw_read_queue_wait_seconds", lane).c_str(), waitTimeBuckets,
+                                          sizeof(waitTimeBuckets) / sizeof(waitTimeBuckets[0]), 1000)) {
+    metricDepth.setValue(0);
+    metricDeduplicated.setValue(0);
+    metricDropped.setValue(0);
+}
+
+esp_err_t NibeMqttGwReadQueue::begin() {
+    if (ringBuffer == nullptr) {
+        ringBuffer = xRingbufferCreateNoSplit(sizeof(NibeMqttGwReadRequest), size);
+        if (ringBuffer == nullptr) {
+            ESP_LOGE(TAG, "Could not create read request ring buffer");
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
+// a register is queued only once, RS485 read tokens are scarce (~1/s)
+// addresses outside of NibeRegisterAddressSet range are not deduplicated
+bool NibeMqttGwReadQueue::push(NibeMqttGwReadRequest request) {
+    bool tracked = NibeRegisterAddressSet::inRange(request.address);
+    if (tracked && !pending.insert(request.address)) {
+        ESP_LOGD(TAG, "Register %d already queued", request.address);
+        metricDeduplicated.incrementValue(1);
+        return false;
+    }
+    request.queuedTime = getTimeUs() / 1000;
+    if (!xRingbufferSend(ringBuffer, &request, sizeof(request), 0)) {
+        ESP_LOGW(TAG, "Could not queue read request for register %d. Buffer full.", request.address);
+        if (tracked) {
+            pending.erase(request.address);
+        }
+        metricDropped.incrementValue(1);
+        return false;
+    }
+    metricDepth.incrementValue(1);
+    return true;
+}
+
+bool NibeMqttGwReadQueue::pop(NibeMqttGwReadRequest& request) {
+    size_t item_size;
+    NibeMqttGwReadRequest* requestPtr = (NibeMqttGwReadRequest*)xRingbufferReceive(ringBuffer, &item_size, 0);
+    if (requestPtr == nullptr) {
+        return false;
+    }
+    request = *requestPtr;
+    vRingbufferReturnItem(ringBuffer, (void*)requestPtr);
+    pending.erase(request.address);
+    metricDepth.incrementValue(-1);
+    metricWaitTime.observe((uint32_t)(getTimeUs() / 1000) - request.queuedTime);
+    return true;
+}
+
+void NibePollScheduler::clear() {
+    entries.clear();
+    heap.clear();
+}
+
+uint16_t NibePollScheduler::add(uint16_t address, uint32_t interval, uint32_t now) {
+    uint16_t index = entries.size();
+    entries.push_back({address, interval, now});
+    heap.push_back(index);
+    std::push_heap(heap.begin(), heap.end(), [this](uint16_t a, uint16_t b) { return later(a, b); });
+    return index;
+}
+
+bool NibePollScheduler::next(uint32_t now, uint16_t& index, uint32_t& delay) {
+    if (heap.empty() || (int32_t)(now - entries[heap.front()].deadline) < 0) {
+        return false;
+    }
+    auto cmp = [this](uint16_t a, uint16_t b) { return later(a, b); };
+    std::pop_heap(heap.begin(), heap.end(), cmp);
+    index = heap.back();
+    Entry& entry = entries[index];
+    delay = now - entry.deadline;
+    // keep the phase if possible, skip missed intervals instead of catching up with a burst
+    entry.deadline += entry.interval;
+    if ((int32_t)(now - entry.deadline) >= 0) {
+        entry.deadline = now + entry.interval;
+    }
+    std::push_heap(heap.begin(), heap.end(), cmp);
+    return true;
+}
+
+bool NibePollScheduler::later(uint16_t a, uint16_t b) const {
+    int32_t diff = entries[a].deadline - entries[b].deadline;
+    return diff != 0 ? diff > 0 : a > b;
+}
@@ -1,36 +1,206 @@
 #ifndef _nibegw_mqtt_h_
 #define _nibegw_mqtt_h_
 
+#include <freertos/FreeRTOS.h>
 #include <freertos/ringbuf.h>
+#include <freertos/task.h>
 
-#include <unordered_set>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
 
 #include "mqtt.h"
 #include "nibegw.h"
 #include "nibegw_config.h"
 
 #define READ_REGISTER_RING_BUFFER_SIZE 256  // max number of pending registers to poll
+#define READ_REGISTER_HIGH_PRIO_RING_BUFFER_SIZE 32  // max number of pending interactive register reads
+#define READ_HIGH_PRIO_BURST 4  // max number of high priority reads in a row when low priority reads are pending
 #define WRITE_REGISTER_RING_BUFFER_SIZE 16  // max number of pending registers to write
+#define NIBE_SAMPLE_QUEUE_SIZE 64  // max number of received samples not yet published, power of 2
+#define NIBE_ADHOC_REGISTERS_MAX 32  // max number of unconfigured registers looked up in the register catalog
+#define NIBE_JSON_STATE_BATCH_TIME 2000  // ms, max delay of read responses in JSON state, ModbusDataMsg every ~2s
+#define NIBE_JSON_STATE_RESERVE 512  // initial capacity of JSON state message
 
-class NibeMqttGw : public NibeGwCallback, MqttSubscriptionCallback {
+#define NIBE_MQTT_GW_PUBLISHER_TASK_STACK_SIZE 6 * 1024
+#define NIBE_MQTT_GW_PUBLISHER_TASK_PRIORITY 9  // below nibegw (15) and polling (10)
+
+#define READ_REQUEST_FRAME_ADHOC 0xFFFF  // read request w/o precompiled frame
+#define NO_REGISTER_STATE 0xFFFF
+
+// queued read request
+struct NibeMqttGwReadRequest {
+    uint16_t frameIndex;  // index into precompiled read request frames or READ_REQUEST_FRAME_ADHOC
+    uint16_t address;
+    uint32_t queuedTime;  // ms, set by NibeMqttGwReadQueue::push()
+    bool polled;          // false: requested explicitly (web UI, MQTT get), value is published even if unchanged
+};
+
+enum class NibeReadPriority {
+    High,  // interactive reads, e.g. /nibe/read
+    Low,   // background polling and refresh, e.g. nibegw/nibe/<id>/get
+};
+
+// lock-free set of Nibe register addresses (bitset), thread safe
+// covers the Nibe modbus register range 40000..49999, other addresses are never contained
+class NibeRegisterAddressSet {
+   public:
+    static constexpr uint16_t MIN_ADDRESS = 40000;
+    static constexpr uint16_t MAX_ADDRESS = 49999;
+
+    static bool inRange(uint16_t address) { return address >= MIN_ADDRESS && address <= MAX_ADDRESS; }
+
+    // returns false if address was already contained or is out of range
+    bool insert(uint16_t address) {
+        if (!inRange(address)) {
+            return false;
+        }
+        uint32_t mask = bitMask(address);
+        return (bits[wordIndex(address)].fetch_or(mask) & mask) == 0;
+    }
+    void erase(uint16_t address) {
+        if (inRange(address)) {
+            bits[wordIndex(address)].fetch_and(~bitMask(address));
+        }
+    }
+    bool contains(uint16_t address) const { return inRange(address) && (bits[wordIndex(address)] & bitMask(address)) != 0; }
+
+   private:
+    std::atomic<uint32_t> bits[(MAX_ADDRESS - MIN_ADDRESS) / 32 + 1] = {};
+
+    static int wordIndex(uint16_t address) { return (address - MIN_ADDRESS) / 32; }
+    static uint32_t bitMask(uint16_t address) { return 1u << ((address - MIN_ADDRESS) % 32); }
+};
+
+enum class NibeSampleSource : uint8_t {
+    ReadResponse,
+    DataMessage,
+    Write,        // register was written, publish next value
+    ReadRequest,  // register is read on request, publish next value
+};
+
+// register value received from Nibe, passed from nibegw task to publisher task
+struct NibeSample {
+    uint16_t address;
+    NibeSampleSource source;
+    uint8_t slot;      // DataMessage: slot 0..19, all slots are queued in order
+    uint8_t value[4];  // raw data as received, DataMessage: 2 bytes
+    uint32_t time;     // ms, received
+};
+
+// lock-free single producer (nibegw task), single consumer (publisher task) queue
+class NibeSampleQueue {
+   public:
+    // producer
+    bool push(const NibeSample& sample) {
+        uint32_t head = this->head.load(std::memory_order_relaxed);
+        if (head - tail.load(std::memory_order_acquire) == NIBE_SAMPLE_QUEUE_SIZE) {
+            return false;
+        }
+        samples[head % NIBE_SAMPLE_QUEUE_SIZE] = sample;
+        this->head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    size_t available() const {
+        return NIBE_SAMPLE_QUEUE_SIZE - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+    }
+    // consumer
+    bool pop(NibeSample& sample) {
+        uint32_t tail = this->tail.load(std::memory_order_relaxed);
+        if (head.load(std::memory_order_acquire) == tail) {
+            return false;
+        }
+        sample = samples[tail % NIBE_SAMPLE_QUEUE_SIZE];
+        this->tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+   private:
+    NibeSample samples[NIBE_SAMPLE_QUEUE_SIZE];
+    std::atomic<uint32_t> head = 0;  // next write
+    std::atomic<uint32_t> tail = 0;  // next read
+};
+
+// FIFO of read requests for one priority lane
+// - a register is queued only once (addresses in range of NibeRegisterAddressSet)
+// - push() and pop() may be called from different tasks
+class NibeMqttGwReadQueue {
+   public:
+    NibeMqttGwReadQueue(Metrics& metrics, const char* lane, size_t size);
+
+    esp_err_t begin();
+    // returns false if request was deduplicated or dropped because queue is full
+    bool push(NibeMqttGwReadRequest request);
+    // returns false if queue is empty
+    bool pop(NibeMqttGwReadRequest& request);
+
+   private:
+    size_t size;
+    RingbufHandle_t ringBuffer;
+    NibeRegisterAddressSet pending;  // registers in ringBuffer
+
+    Metric& metricDepth;
+    Metric& metricDeduplicated;
+    Metric& metricDropped;
+    Histogram& metricWaitTime;
+};
+
+// earliest deadline first scheduler for polled registers
+// - every read token not used for a queued read request polls the register with the earliest due deadline
+// - time in ms is passed by the caller (testable with a fake clock), wrap around safe for intervals < 24 days
+// - not thread safe, used by nibegw task only (after begin())
+class NibePollScheduler {
+   public:
+    struct Entry {
+        uint16_t address;
+        uint32_t interval;  // ms
+        uint32_t deadline;  // ms
+    };
+
+    void clear();
+    // first deadline is now, returns index of entry
+    uint16_t add(uint16_t address, uint32_t interval, uint32_t now);
+    // returns false if no register is due, delay = time since deadline (ms)
+    bool next(uint32_t now, uint16_t& index, uint32_t& delay);
+
+    size_t size() const { return entries.size(); }
+    const Entry& operator[](size_t index) const { return entries[index]; }
+
+   private:
+    std::vector<Entry> entries;
+    std::vector<uint16_t> heap;  // min heap of entry indexes, ordered by deadline, then index
+
+    bool later(uint16_t a, uint16_t b) const;
+};
+
+class NibeMqttGw : public NibeGwCallback, MqttSubscriptionCallback, MqttDiscoveryCallback {
    public:
     NibeMqttGw(Metrics& metrics);
 
     esp_err_t begin(const NibeMqttConfig& config, MqttClient& mqttClient);
 
-    // request and publish configured registers to mqtt
-    void publishState();
+    // replace clock (ms) used for poll scheduling, e.g. for testing, call before begin()
+    void setClock(uint32_t (*clock)()) { this->clock = clock; }
+
+    // publish received samples to MQTT and metrics, called by publisher task (or tests on Linux target)
+    // returns number of processed samples
+    int processPendingSamples();
     // request and publish a single register
-    void requestNibeRegister(uint16_t address);
+    void requestNibeRegister(uint16_t address, NibeReadPriority priority = NibeReadPriority::High);
     // write a single register
     void writeNibeRegister(uint16_t address, const char* str);
+    // announce registers announced so far (cached discovery payloads), unchanged ones are skipped by MqttClient
+    // publisher task (or tests on Linux target)
+    void announceNibeRegisters();
 
-    // NibeGwCallback
+    // NibeGwCallback, runs on nibegw task: only queues samples, publishing is done by publisher task
     void onMessageReceived(const NibeResponseMessage* const msg, int len);
     int onReadTokenReceived(NibeReadRequestMessage* data);
     int onWriteTokenReceived(NibeWriteRequestMessage* data);
     // MqttSubscriptionCallback
     void onMqttMessage(const std::string& topic, const std::string& payload);
+    // MqttDiscoveryCallback, runs on MQTT task: re-announcing is done by publisher task
+    void onHomeassistantOnline();
 
    private:
     Metrics& metrics;
@@ -38,27 +208,110 @@ class NibeMqttGw : public NibeGwCallback, MqttSubscriptionCallback {
     MqttClient* mqttClient;
 
     std::string nibeRootTopic;
-    std::unordered_set<uint16_t> announcedNibeRegisters;
-    std::unordered_map<uint16_t, Metric*> nibeRegisterMetrics;
-    int modbusDataMsgMqttPublish;
 
-    RingbufHandle_t readNibeRegistersRingBuffer;
+    NibeSampleQueue sampleQueue;
+    TaskHandle_t publisherTaskHandle;
+    std::atomic<bool> announceRequested;  // HA restarted
+    NibeDataMessage pendingDataMessage;  // assembled from DataMessage samples
+
+    // last published value per register, publisher task only
+    struct PublishState {
+        int32_t value;
+        uint32_t time;       // ms
+        int32_t deadband;    // from config, cached
+        uint32_t heartbeat;  // ms, from config, cached
+        bool valid;          // false: publish next value regardless of deadband
+        std::string topic;   // state topic, cached
+
+        bool isDue(int32_t value, uint32_t now) const;
+    };
+    // runtime state of registers in use (published or metric), metrics in begin(), others on first use, publisher task only
+    // all registers of the ModbusManager CSV are known, only a few of them are used
+    struct RegisterState {
+        PublishState publishState;
+        Metric* metric;  // nullptr: register not configured as metric
+        bool announce;   // HA entity: configured or sent in ModbusDataMsg, not for one-off reads (web UI, MQTT get)
+        // HA discovery, built on first announce, re-announcing is a plain publish, empty: not announced
+        std::string discoveryTopic;
+        std::string discoveryPayload;
+    };
+    std::vector<RegisterState> registerStates;
+    std::vector<uint16_t> registerStateIndex;  // index = register index, NO_REGISTER_STATE: not in use
+
+    // unconfigured registers (e.g. ad-hoc reads), looked up in config->catalog on first use, publisher task only
+    // register index = config->registers.size() + index in adhocRegisters, bounded for constant memory
+    std::vector<NibeRegister> adhocRegisters;
+
+    // ModbusDataMsg slot layout (fixed by LOG.SET), learned from first message and on change of register addresses
+    // avoids register, metric and publish state lookups for every message, publisher task only
+    struct DataMsgSlot {
+        uint16_t address;
+        int index;  // register index, -1: slot unused, unknown register, unsupported data type or high word
+        bool paired;  // 32 bit register, high word in next slot (address + 1)
+    };
+    DataMsgSlot dataMsgSlots[20];
+
+    // ModbusDataMsg publishing: token bucket (1000 = 1 register), slot to start with (fairness for deferred registers)
+    uint32_t dataMsgPublishTokens;
+    uint32_t dataMsgPublishTime;
+    int dataMsgPublishStart;
+
+    // NibeMqttConfig::jsonState: published values collected until a ModbusDataMsg is processed or
+    // NIBE_JSON_STATE_BATCH_TIME expired, publisher task only
+    std::string jsonStateTopic;
+    std::string jsonState;   // "{" and members w/o closing brace, empty: no values pending
+    uint32_t jsonStateTime;  // ms, first value of pending message
+
+    // precompiled read request frames for polled registers, index = poll scheduler index, built in begin()
+    std::vector<NibeReadRequestMessage> readRequestFrames;
+    std::unordered_map<uint16_t, uint16_t> readRequestFrameIndex;  // address -> index into readRequestFrames
+
+    // strict priority, but a pending low priority read is served after READ_HIGH_PRIO_BURST high priority reads
+    NibeMqttGwReadQueue readQueueHigh;
+    NibeMqttGwReadQueue readQueueLow;
+    int highPrioReadsInRow;
+    NibePollScheduler pollScheduler;
+    uint32_t (*clock)();
     RingbufHandle_t writeNibeRegistersRingBuffer;
 
-    Metric& metricPublishStateTime;
-    std::atomic<uint32_t> lastPublishStateStartTime;
-    std::vector<uint16_t>::const_iterator nextNibeRegisterToPollSlow;
-    int numNibeRegistersToPoll;
+    Metric& metricReadStarvationAvoided;
+    Histogram& metricPollDelay;
+    Metric& metricMqttPublished;
+    Metric& metricMqttSuppressed;
+    Metric& metricMqttDeferred;
+    Metric& metricSamplesDropped;
 
-    const NibeRegister* findNibeRegister(uint16_t address);
-    void publishMetric(const NibeRegister& _register, const uint8_t* const data);
-    void publishMqtt(const NibeRegister& _register, const uint8_t* const data);
-    void announceNibeRegister(const NibeRegister& _register);
+    static void publisherTask(void* pvParameters);
+    void queueSample(const NibeSample& sample);
+    void processSample(const NibeSample& sample);
+    void buildPollSchedule();
+    bool nextReadRequest(NibeMqttGwReadRequest& request);
+    bool nextLowPriorityReadRequest(NibeMqttGwReadRequest& request);
+    static void buildReadRequest(NibeReadRequestMessage* readRequest, uint16_t address);
+    // register index: index in config->registers or following ad-hoc register, -1 if unknown
+    int indexOfRegister(uint16_t address) const;
+    // like indexOfRegister(), falls back to config->catalog
+    int findNibeRegister(uint16_t address);
+    const NibeRegisterInfo& getRegisterInfo(int index) const;
+    // incl. title (allocates)
+    NibeRegister getRegister(int index) const;
+    // creates state on first use, references are invalidated by creating another state
+    RegisterState& getRegisterState(int index);
+    int takeDataMsgPublishBudget(uint32_t now);
+    void learnDataMsgSlots(const NibeDataMessage& dataMessage);
+    void onDataMessageReceived(const NibeDataMessage& dataMessage, uint32_t now);
+    void publishMetric(int index, const uint8_t* const data);
+    // publish if value changed or heartbeat expired
+    void publishMqtt(int index, const uint8_t* const data, uint32_t now);
+    void publishMqtt(int index, const uint8_t* const data, int32_t rawValue, uint32_t now);
+    void addJsonState(uint16_t id, std::string_view value, uint32_t now);
+    void publishJsonState();
+    void announceNibeRegister(int index);
 };
 
 struct NibeMqttGwWriteRequest {
     uint16_t address;
-    char value[16];  // zero terminated string
+    uint8_t value[4];  // encoded by writeNibeRegister()
 };
 
 #endif
\ No newline at end of file
@@ -2,10 +2,13 @@
 
 #include <esp_log.h>
 
+#include <algorithm>
+
 static const char* TAG = "nibegw_rs485";
 
 NibeRS485::NibeRS485(HardwareSerial* serial, int RS485DirectionPin, int RS485RxPin, int RS485TxPin) {
     connectionState = false;
+    receiveTask = nullptr;
     RS485 = serial;
     directionPin = RS485DirectionPin;
     this->RS485RxPin = RS485RxPin;
@@ -23,6 +26,15 @@ esp_err_t NibeRS485::begin() {
 void NibeRS485::connect() {
     if (!connectionState) {
         RS485->begin(9600, SERIAL_8N1, RS485RxPin, RS485TxPin);
+        // UART event at end of frame -> wake up nibegw task once per frame, e.g. to answer read/write tokens
+        RS485->setRxFIFOFull(NIBE_RS485_RX_FIFO_FULL);
+        RS485->setRxTimeout(NIBE_RS485_RX_TIMEOUT_SYMBOLS);
+        RS485->onReceive([this]() {
+            TaskHandle_t task = receiveTask;
+            if (task != nullptr) {
+                xTaskNotifyGive(task);
+            }
+        });
         connectionState = true;
     }
 }
@@ -36,22 +48,33 @@ void NibeRS485::disconnect() {
 
 boolean NibeRS485::isDataAvailable() { return RS485->available() > 0; }
 
-int NibeRS485::readData() {
+bool NibeRS485::waitForData(uint32_t timeoutMs) {
+    receiveTask = xTaskGetCurrentTaskHandle();
     if (RS485->available() > 0) {
-        int b = RS485->read();
+        return true;
+    }
+    // notifications given while processing data are not lost, they are counted until taken
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeoutMs));
+    return RS485->available() > 0;
+}
+
+int NibeRS485::read(uint8_t* buf, size_t max) {
+    int available = RS485->available();
+    if (available <= 0) {
+        return 0;
+    }
+    // one UART driver call for all buffered bytes instead of available() + read() per byte
+    int len = RS485->read(buf, std::min((size_t)available, max));
 #if LOG_LOCAL_LEVEL == ESP_LOG_VERBOSE
-        if (b >= 0) {
-            readLogBuffer[readLogIndex++] = b;
-            if (readLogIndex >= sizeof(readLogBuffer)) {
-                ESP_LOGV(TAG, "Rec: %s", NibeGw::dataToString(readLogBuffer, readLogIndex).c_str());
-                readLogIndex = 0;
-            }
+    for (int i = 0; i < len; i++) {
+        readLogBuffer[readLogIndex++] = buf[i];
+        if (readLogIndex >= sizeof(readLogBuffer)) {
+            ESP_LOGV(TAG, "Rec: %s", NibeGw::dataToString(readLogBuffer, readLogIndex).c_str());
+            readLogIndex = 0;
         }
-#endif
-        return b;
-    } else {
-        return -1;
     }
+#endif
+    return len;
 }
 
 void NibeRS485::sendData(const uint8_t* const data, uint8_t len) {
@@ -42,6 +42,13 @@
 
 #include "nibegw.h"
 
+// UART receive event (wake-up of nibegw task) once per frame instead of per byte:
+// - line idle for NIBE_RS485_RX_TIMEOUT_SYMBOLS, i.e. end of frame, ~1.1ms per symbol at 9600 baud
+//   tokens are answered promptly, a response is only possible after the complete token anyway
+// - NIBE_RS485_RX_FIFO_FULL bytes received, UART FIFO holds 128 bytes, frames are up to ~90 bytes
+#define NIBE_RS485_RX_TIMEOUT_SYMBOLS 1
+#define NIBE_RS485_RX_FIFO_FULL 120
+
 class NibeRS485 final : public NibeInterface {
    public:
     NibeRS485(HardwareSerial* serial, int RS485DirectionPin, int RS485RxPin, int RS485TxPin);
@@ -50,7 +57,8 @@ class NibeRS485 final : public NibeInterface {
 
     // NibeInterface
     virtual boolean isDataAvailable();
-    virtual int readData();
+    virtual bool waitForData(uint32_t timeoutMs);
+    virtual int read(uint8_t* buf, size_t max);
     virtual void sendData(const uint8_t* const data, uint8_t len);
     virtual void sendData(const uint8_t data);
 
@@ -60,6 +68,8 @@ class NibeRS485 final : public NibeInterface {
     HardwareSerial* RS485;
     int RS485RxPin;
     int RS485TxPin;
+    // task waiting in waitForData(), notified by UART receive callback
+    volatile TaskHandle_t receiveTask;
 
     void connect();
     void disconnect();
@@ -2,6 +2,69 @@
 
 namespace nonstd {
 
+size_t ibufstream::read(char* s, size_t n) {
+    if (!good()) {
+        return 0;
+    }
+    size_t count = std::min(n, end - pos);
+    std::memcpy(s, buffer + pos, count);
+    pos += count;
+    if (count < n) {
+        // large reads bypass the buffer
+        count += is.read(s + count, n - count);
+        if (count < n) {
+            setstate(eofbit | failbit);
+        }
+    }
+    return count;
+}
+
+bool ibufstream::getline(std::string_view& line) {
+    if (!good()) {
+        return false;
+    }
+    size_t searched = pos;
+    while (1) {
+        const char* newline = (const char*)std::memchr(buffer + searched, '\n', end - searched);
+        if (newline != nullptr) {
+            line = std::string_view(buffer + pos, newline - (buffer + pos));
+            pos = newline - buffer + 1;
+            return true;
+        }
+        size_t scanned = end - pos;  // unread data w/o '\n', moved to the front of the buffer by refill()
+        if (scanned == size) {
+            // line too long
+            setstate(failbit);
+            return false;
+        }
+        if (refill() == 0) {
+            if (pos == end) {
+                setstate(eofbit | failbit);
+                return false;
+            }
+            // last line w/o '\n'
+            line = std::string_view(buffer + pos, end - pos);
+            pos = end;
+            return true;
+        }
+        searched = scanned;
+    }
+}
+
+size_t ibufstream::refill() {
+    if (pos > 0) {
+        std::memmove(buffer, buffer + pos, end - pos);
+        end -= pos;
+        pos = 0;
+    }
+    if (end == size || !is.good()) {
+        return 0;
+    }
+    size_t count = is.read(buffer + end, size - end);
+    end += count;
+    return count;
+}
+
 // https://en.cppreference.com/w/cpp/string/basic_string/getline
 istream& getline(istream& is, std::string& str) {
     str.erase();
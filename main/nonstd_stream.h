@@ -4,7 +4,7 @@
 //
 // Implements only the necessary parts needed for this project:
 // - reading unformatted data from istream
-// - no buffering (unless implicit or provided by the underlying streams)
+// - no buffering (unless implicit or provided by the underlying streams), ibufstream adds a block buffer
 // - adapter to std::istream for testing on linux target
 // - adapter to Arduino Stream (esp32)
 
@@ -12,8 +12,12 @@
 #define _nonstd_stream_h_
 
 #include <sdkconfig.h>
+
+#include <algorithm>
 #include <cstddef>
+#include <cstring>
 #include <string>
+#include <string_view>
 
 #if CONFIG_IDF_TARGET_LINUX
 // support for std::istream on linux
@@ -44,6 +48,9 @@ class istream {
     virtual void setstate(iostate state) = 0;
 
     virtual int get() = 0;
+    // https://en.cppreference.com/w/cpp/io/basic_istream/read
+    // returns number of characters read (gcount), sets eofbit and failbit if less than n characters are available
+    virtual size_t read(char* s, size_t n) = 0;
 };
 
 class istream_base : public istream {
@@ -81,6 +88,19 @@ class icharbufstream : public istream_base {
         return str[pos++];
     }
 
+    size_t read(char* s, size_t n) override {
+        if (!good()) {
+            return 0;
+        }
+        size_t count = std::min(n, len - pos);
+        std::memcpy(s, str + pos, count);
+        pos += count;
+        if (count < n) {
+            setstate(eofbit | failbit);
+        }
+        return count;
+    }
+
    private:
     const char* str;
     size_t pos;
@@ -97,6 +117,41 @@ class istringstream : public icharbufstream {
     istringstream(const char* str) : icharbufstream(str) {}
 };
 
+// buffered reader on top of another istream, the buffer is refilled by block reads
+// getline() returns lines as views into the buffer (no copy), valid until the next read
+// buffer is provided by the caller (no memory allocation), lines must fit into the buffer
+class ibufstream : public istream_base {
+   public:
+    ibufstream(istream& is, char* buffer, size_t size) : is(is), buffer(buffer), size(size), pos(0), end(0) {}
+
+    int get() override {
+        if (!good()) {
+            return EOF;
+        }
+        if (pos == end && refill() == 0) {
+            setstate(eofbit | failbit);
+            return EOF;
+        }
+        return (unsigned char)buffer[pos++];
+    }
+
+    size_t read(char* s, size_t n) override;
+
+    // next line w/o '\n', false on end of stream or if the line doesn't fit into the buffer (failbit only)
+    bool getline(std::string_view& line);
+
+    // moves unread data to the front of the buffer and reads the next block from the underlying stream
+    // returns number of characters read from the underlying stream
+    size_t refill();
+
+   private:
+    istream& is;
+    char* buffer;
+    size_t size;
+    size_t pos;  // next unread character
+    size_t end;  // end of valid data
+};
+
 // https://en.cppreference.com/w/cpp/string/basic_string/getline
 istream& getline(istream& is, std::string& str);
 
@@ -116,6 +171,10 @@ class istdstream : public istream {
     void setstate(iostate state) override { is.setstate(state); }
 
     int get() override { return is.get(); }
+    size_t read(char* s, size_t n) override {
+        is.read(s, n);
+        return is.gcount();
+    }
 
    private:
     std::istream& is;
@@ -139,6 +198,17 @@ class arduinostream : public istream_base {
         return stream.read();
     }
 
+    size_t read(char* s, size_t n) override {
+        if (!good()) {
+            return 0;
+        }
+        size_t count = stream.readBytes(s, n);
+        if (count < n) {
+            setstate(eofbit | failbit);
+        }
+        return count;
+    }
+
    private:
     Stream& stream;
 };
@@ -233,7 +233,8 @@ void NibeMqttGwWebServer::handlePostNibeRead() {
     uint16_t registerAddress = _register.toInt();
     if (registerAddress > 0) {
         ESP_LOGI(TAG, "Requesting register %d", registerAddress);
-        nibeMqttGw.requestNibeRegister(registerAddress);
+        // user waits for the result
+        nibeMqttGw.requestNibeRegister(registerAddress, NibeReadPriority::High);
         httpServer.send(200, "text/html", ROOT_REDIRECT_HTML "Sent request to Nibe for register " + _register);
     } else {
         httpServer.send(400, "text/plain", "Bad register parameter: " + _register);
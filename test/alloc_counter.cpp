@@ -0,0 +1,36 @@
+#include "alloc_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+std::atomic<int> alloccounter_allocations = 0;
+std::atomic<size_t> alloccounter_bytes = 0;
+std::atomic<size_t> alloccounter_live_bytes = 0;
+std::atomic<size_t> alloccounter_peak_bytes = 0;
+
+// size is stored in front of the allocation, keeps max alignment
+static constexpr size_t HEADER_SIZE = alignof(std::max_align_t);
+
+void* operator new(size_t size) {
+    alloccounter_allocations++;
+    alloccounter_bytes += size;
+    void* ptr = malloc(size + HEADER_SIZE);
+    if (ptr == nullptr) {
+        abort();
+    }
+    *(size_t*)ptr = size;
+    size_t live = alloccounter_live_bytes += size;
+    size_t peak = alloccounter_peak_bytes;
+    while (live > peak && !alloccounter_peak_bytes.compare_exchange_weak(peak, live)) {
+    }
+    return (char*)ptr + HEADER_SIZE;
+}
+
+void operator delete(void* ptr) noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+    ptr = (char*)ptr - HEADER_SIZE;
+    alloccounter_live_bytes -= *(size_t*)ptr;
+    free(ptr);
+}
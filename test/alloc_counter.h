@@ -0,0 +1,9 @@
+#include <atomic>
+#include <cstddef>
+
+// counts heap allocations (global operator new) of the whole test application
+extern std::atomic<int> alloccounter_allocations;
+extern std::atomic<size_t> alloccounter_bytes;
+// bytes currently allocated and high-water mark, reset alloccounter_peak_bytes = alloccounter_live_bytes to measure
+extern std::atomic<size_t> alloccounter_live_bytes;
+extern std::atomic<size_t> alloccounter_peak_bytes;
@@ -1,3 +1,11 @@
-// fake ringbuf header
+// fake ringbuf header, implemented by ringbuf_mock.cpp
 
-typedef void * RingbufHandle_t;
\ No newline at end of file
+#include <freertos/FreeRTOS.h>
+
+typedef void * RingbufHandle_t;
+
+RingbufHandle_t xRingbufferCreateNoSplit(size_t xItemSize, size_t xItemNum);
+void vRingbufferDelete(RingbufHandle_t xRingbuffer);
+BaseType_t xRingbufferSend(RingbufHandle_t xRingbuffer, const void *pvItem, size_t xItemSize, TickType_t xTicksToWait);
+void *xRingbufferReceive(RingbufHandle_t xRingbuffer, size_t *pxItemSize, TickType_t xTicksToWait);
+void vRingbufferReturnItem(RingbufHandle_t xRingbuffer, void *pvItem);
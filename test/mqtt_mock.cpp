@@ -1,9 +1,22 @@
 #include "mqtt_mock.h"
 
 #include "config.h"
+#include "mqtt_helper.h"
 
-MqttClient::MqttClient(Metrics& metrics) : metricMqttStatus(metrics.addMetric(METRIC_NAME_MQTT_STATUS, 1)) {
+MqttClient::MqttClient(Metrics& metrics)
+    : metricMqttStatus(metrics.addMetric(METRIC_NAME_MQTT_STATUS, 1)),
+      metricDiscoveryPublished(metrics.addMetric(R"(nibegw_mqtt_discovery_total{result="published"})", 1, 1, true)),
+      metricDiscoverySkipped(metrics.addMetric(R"(nibegw_mqtt_discovery_total{result="skipped"})", 1, 1, true)),
+      metricOutboxBytes(metrics.addMetric("nibegw_mqtt_outbox_bytes", 1)),
+      metricPacedQueueBytes(metrics.addMetric("nibegw_mqtt_paced_queue_bytes", 1)),
+      metricPacedDropped(metrics.addMetric("nibegw_mqtt_paced_dropped_total", 1, 1, true)),
+      metricPacedWaitTime(metrics.addHistogram("nibegw_mqtt_paced_wait_seconds", nullptr, 0, 1000)),
+      pacedQueue(MqttTokenBucket(MQTT_PACED_BYTES_PER_SECOND, MQTT_PACED_BURST_BYTES, MQTT_PACED_MESSAGES_PER_SECOND,
+                                 MQTT_PACED_BURST_MESSAGES)),
+      discovery(*this) {
     metricMqttStatus.setValue((int32_t)MqttStatus::Disconnected);
+    metricDiscoveryPublished.setValue(0);
+    metricDiscoverySkipped.setValue(0);
 }
 
 esp_err_t MqttClient::begin(const MqttConfig& config) {
@@ -24,14 +37,89 @@ esp_err_t MqttClient::begin(const MqttConfig& config) {
 
     deviceDiscoveryInfoRef["avty_t"] = availabilityTopic;
     deviceDiscoveryInfoRef["dev"]["ids"].add(config.clientId);
+    deviceDiscoveryInfoRefMembers = MqttHelper::toJsonMembers(deviceDiscoveryInfoRef);
+
+    JsonDocument deviceDiscoveryDoc;
+    deviceDiscoveryDoc["avty_t"] = availabilityTopic;
+    deviceDiscoveryDoc["dev"] = deviceDiscoveryInfo["dev"];
+    deviceDiscoveryDoc["o"]["name"] = "nibegw";
+    deviceDiscoveryDoc["o"]["sw"] = "1.0";
+    int bufferSize = config.bufferSize > 0       ? config.bufferSize
+                     : config.deviceDiscovery ? MQTT_DEVICE_DISCOVERY_BUFFER_SIZE_DEFAULT
+                                              : MQTT_BUFFER_SIZE_DEFAULT;
+
+    // no NVS, hashes persist in mqttmock_discoveryHashes
+    discovery.getHashes() = mqttmock_discoveryHashes;
+    discovery.begin(config.discoveryPrefix, MqttHelper::toJsonMembers(deviceDiscoveryDoc), deviceDiscoveryInfoRefMembers,
+                    config.deviceDiscovery, bufferSize, mqttmock_discoveryMode, mqttmock_discoveryFallbackSize);
+    homeassistantStatusTopic = config.discoveryPrefix + "/status";
 
     return ESP_OK;
 }
 
 esp_err_t MqttClient::registerLifecycleCallback(MqttClientLifecycleCallback* callback) { return ESP_OK; }
+
+esp_err_t MqttClient::registerDiscoveryCallback(MqttDiscoveryCallback* callback) {
+    discoveryCallbacks[discoveryCallbackCount++] = callback;
+    return ESP_OK;
+}
+
+MqttDiscoveryHashes mqttmock_discoveryHashes;
+MqttDiscoveryMode mqttmock_discoveryMode = MqttDiscoveryMode::Entity;
+uint32_t mqttmock_discoveryFallbackSize = 0;
+
+void MqttClient::saveDiscoveryMode(MqttDiscoveryMode mode, uint32_t fallbackSize) {
+    writeDiscoveryHashes();
+    mqttmock_discoveryMode = mode;
+    mqttmock_discoveryFallbackSize = fallbackSize;
+}
+
+// device discovery is published by publishDeviceDiscovery() only, no delay
+int MqttClient::publishDiscovery(std::string_view topic, std::string_view payload) {
+    std::lock_guard<std::mutex> lock(discoveryMutex);
+    int msg_id = discovery.publish(topic, payload, 0);
+    metricDiscoverySkipped.setValue(discovery.skipped());
+    return msg_id;
+}
+
+int MqttClient::publishDeviceDiscovery() {
+    std::lock_guard<std::mutex> lock(discoveryMutex);
+    int msg_id = discovery.publishDevice();
+    metricDiscoverySkipped.setValue(discovery.skipped());
+    return msg_id;
+}
+
+int MqttClient::enqueueDiscovery(std::string_view topic, std::string_view payload) {
+    return enqueuePaced(topic, payload, QOS0, true, true);
+}
+
+esp_err_t MqttClient::saveDiscoveryHashes() {
+    std::lock_guard<std::mutex> lock(discoveryMutex);
+    return writeDiscoveryHashes();
+}
+
+esp_err_t MqttClient::writeDiscoveryHashes() {
+    mqttmock_discoveryHashes = discovery.getHashes();
+    discovery.getHashes().clearDirty();
+    return ESP_OK;
+}
+
+void MqttClient::onMqttMessage(const std::string& topic, const std::string& payload) {
+    if (topic != homeassistantStatusTopic || payload != "online") {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(discoveryMutex);
+        discovery.invalidate();
+    }
+    for (int i = 0; i < discoveryCallbackCount; i++) {
+        discoveryCallbacks[i]->onHomeassistantOnline();
+    }
+}
 int MqttClient::publishAvailability() { return 0; }
 
 std::vector<MqttPublishData> mqttmock_publishData;
+bool mqttmock_recordPublishData = true;
 int MqttClient::publish(const std::string& topic, const std::string& payload, MqttQOS qos, bool retain) {
     return publish(topic, payload.c_str(), 0, qos, retain);
 }
@@ -43,5 +131,26 @@ int MqttClient::publish(const std::string& topic, const char* payload, int lengt
     mqttmock_publishData.push_back(data);
     return 0;
 }
+int MqttClient::publish(std::string_view topic, std::string_view payload, MqttQOS qos, bool retain) {
+    if (mqttmock_recordPublishData) {
+        mqttmock_publishData.push_back({std::string(topic), std::string(payload), qos, retain});
+    }
+    return 0;
+}
+
+// not paced, published immediately (MqttPacedQueue is tested separately)
+int MqttClient::publishPaced(std::string_view topic, std::string_view payload, MqttQOS qos, bool retain) {
+    return enqueuePaced(topic, payload, qos, retain, false);
+}
+
+// caller holds discoveryMutex for discovery messages, see publishNextPaced()
+int MqttClient::enqueuePaced(std::string_view topic, std::string_view payload, MqttQOS qos, bool retain, bool discovery) {
+    int msg_id = publish(topic, payload, qos, retain);
+    if (discovery) {
+        this->discovery.published(topic, payload);
+        metricDiscoveryPublished.incrementValue(1);
+    }
+    return msg_id;
+}
 
 int MqttClient::subscribe(const std::string& topic, MqttSubscriptionCallback* callback, int qos) { return 0; }
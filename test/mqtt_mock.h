@@ -8,4 +8,11 @@ struct MqttPublishData {
     bool retain;
 };
 
-extern std::vector<MqttPublishData> mqttmock_publishData;
\ No newline at end of file
+extern std::vector<MqttPublishData> mqttmock_publishData;
+// disable recording, e.g. for allocation counting
+extern bool mqttmock_recordPublishData;
+// "NVS" of MqttClient::saveDiscoveryHashes(), loaded by begin(), clear for a first boot
+extern MqttDiscoveryHashes mqttmock_discoveryHashes;
+// "NVS" of MqttClient::saveDiscoveryMode()
+extern MqttDiscoveryMode mqttmock_discoveryMode;
+extern uint32_t mqttmock_discoveryFallbackSize;
@@ -0,0 +1,42 @@
+#include <freertos/ringbuf.h>
+
+#include <cstring>
+#include <deque>
+#include <list>
+#include <vector>
+
+// no-split ring buffer with fixed number of items, not thread safe
+struct RingbufMock {
+    size_t maxItems;
+    std::deque<std::vector<uint8_t>> items;
+    std::list<std::vector<uint8_t>> receivedItems;  // received but not yet returned
+};
+
+RingbufHandle_t xRingbufferCreateNoSplit(size_t xItemSize, size_t xItemNum) { return new RingbufMock{.maxItems = xItemNum}; }
+
+void vRingbufferDelete(RingbufHandle_t xRingbuffer) { delete (RingbufMock*)xRingbuffer; }
+
+BaseType_t xRingbufferSend(RingbufHandle_t xRingbuffer, const void* pvItem, size_t xItemSize, TickType_t xTicksToWait) {
+    RingbufMock* rb = (RingbufMock*)xRingbuffer;
+    if (rb->items.size() + rb->receivedItems.size() >= rb->maxItems) {
+        return pdFALSE;
+    }
+    rb->items.emplace_back((const uint8_t*)pvItem, (const uint8_t*)pvItem + xItemSize);
+    return pdTRUE;
+}
+
+void* xRingbufferReceive(RingbufHandle_t xRingbuffer, size_t* pxItemSize, TickType_t xTicksToWait) {
+    RingbufMock* rb = (RingbufMock*)xRingbuffer;
+    if (rb->items.empty()) {
+        return nullptr;
+    }
+    rb->receivedItems.push_back(std::move(rb->items.front()));
+    rb->items.pop_front();
+    *pxItemSize = rb->receivedItems.back().size();
+    return rb->receivedItems.back().data();
+}
+
+void vRingbufferReturnItem(RingbufHandle_t xRingbuffer, void* pvItem) {
+    RingbufMock* rb = (RingbufMock*)xRingbuffer;
+    rb->receivedItems.remove_if([pvItem](const std::vector<uint8_t>& item) { return item.data() == pvItem; });
+}
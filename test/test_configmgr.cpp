@@ -1,10 +1,15 @@
 #include <unistd.h>
 #include <unity.h>
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
+#include <random>
 #include <regex>
 #include <sstream>
+#include <unordered_map>
 
+#include "alloc_counter.h"
 #include "configmgr.h"
 
 TEST_CASE("default config", "[config]") {
@@ -18,12 +23,17 @@ TEST_CASE("default config", "[config]") {
     TEST_ASSERT_EQUAL_STRING("Nibe", config.mqtt.deviceManufacturer.c_str());
     TEST_ASSERT_EQUAL_STRING("Heatpump", config.mqtt.deviceModel.c_str());
     TEST_ASSERT_EQUAL_STRING("", config.mqtt.deviceConfigurationUrl.c_str());
+    TEST_ASSERT_FALSE(config.mqtt.deviceDiscovery);
+    TEST_ASSERT_EQUAL(0, config.mqtt.bufferSize);
     TEST_ASSERT_EQUAL_STRING("", config.mqtt.hostname.c_str());
     TEST_ASSERT_EQUAL_STRING("nibegw/log", config.mqtt.logTopic.c_str());
 
     TEST_ASSERT_EQUAL(0, config.nibe.registers.size());
     TEST_ASSERT_EQUAL(0, config.nibe.pollRegisters.size());
     TEST_ASSERT_EQUAL(0, config.nibe.pollRegistersSlow.size());
+    TEST_ASSERT_EQUAL(0, config.nibe.poll.size());
+    TEST_ASSERT_EQUAL(0, config.nibe.publish.size());
+    TEST_ASSERT_EQUAL(NIBE_DATA_MESSAGE_PUBLISH_BUDGET_DEFAULT, config.nibe.dataMessagePublishBudget);
     TEST_ASSERT_EQUAL(0, config.nibe.metrics.size());
     TEST_ASSERT_EQUAL(0, config.nibe.homeassistantDiscoveryOverrides.size());
 
@@ -52,11 +62,22 @@ static const char* configJson = R"({
         "discoveryPrefix": "homeassistant",
         "deviceName": "Nibe GW",
         "deviceManufacturer": "Nibe",
-        "deviceModel": "VVM 310, S 2125-8"
+        "deviceModel": "VVM 310, S 2125-8",
+        "deviceDiscovery": true,
+        "bufferSize": 8192
     },
     "nibe": {
         "pollRegisters": [1,2],
         "pollRegistersSlow": [3,4],
+        "poll": {
+            "5": {"interval": 60},
+            "6": {"interval": 0}
+        },
+        "publish": {
+            "1": {"deadband": 5},
+            "2": {"deadband": 0, "heartbeat": 0}
+        },
+        "dataMessage": {"publishBudget": 10},
         "metrics": {
             "1": {"name": "prom_name_1{register=\"1\"}", "factor": 10},
             "2": {"name": "prom_name_2{register=\"2\"}"},
@@ -98,6 +119,8 @@ TEST_CASE("saveConfig", "[config]") {
     TEST_ASSERT_EQUAL_STRING("Nibe", config.mqtt.deviceManufacturer.c_str());
     TEST_ASSERT_EQUAL_STRING("VVM 310, S 2125-8", config.mqtt.deviceModel.c_str());
     TEST_ASSERT_EQUAL_STRING("http://nibegw.fritz.box", config.mqtt.deviceConfigurationUrl.c_str());
+    TEST_ASSERT_TRUE(config.mqtt.deviceDiscovery);
+    TEST_ASSERT_EQUAL(8192, config.mqtt.bufferSize);
 
     TEST_ASSERT_EQUAL_STRING("nibegw", config.mqtt.hostname.c_str());
     TEST_ASSERT_EQUAL_STRING("nibegw/logs", config.mqtt.logTopic.c_str());
@@ -113,6 +136,18 @@ TEST_CASE("saveConfig", "[config]") {
     TEST_ASSERT_EQUAL(3, config.nibe.pollRegistersSlow[0]);
     TEST_ASSERT_EQUAL(4, config.nibe.pollRegistersSlow[1]);
 
+    // invalid interval is skipped
+    TEST_ASSERT_EQUAL(1, config.nibe.poll.size());
+    TEST_ASSERT_EQUAL(60, config.nibe.poll.at(5).interval);
+
+    TEST_ASSERT_EQUAL(2, config.nibe.publish.size());
+    TEST_ASSERT_EQUAL(5, config.nibe.publish.at(1).deadband);
+    TEST_ASSERT_EQUAL(NIBE_PUBLISH_HEARTBEAT_DEFAULT, config.nibe.publish.at(1).heartbeat);
+    TEST_ASSERT_EQUAL(0, config.nibe.publish.at(2).deadband);
+    TEST_ASSERT_EQUAL(0, config.nibe.publish.at(2).heartbeat);
+    TEST_ASSERT_EQUAL(10, config.nibe.dataMessagePublishBudget);
+    TEST_ASSERT_EQUAL(NIBE_DATA_MESSAGE_PUBLISH_RATE_DEFAULT, config.nibe.dataMessagePublishRate);
+
     TEST_ASSERT_EQUAL(3, config.nibe.metrics.size());
     const NibeRegisterMetricConfig& metric1 = config.nibe.metrics.at(1);
     TEST_ASSERT_EQUAL_STRING(R"(prom_name_1{register="1"})", metric1.name.c_str());
@@ -128,10 +163,12 @@ TEST_CASE("saveConfig", "[config]") {
     TEST_ASSERT_EQUAL(10, metric3.scale);
 
     TEST_ASSERT_EQUAL(2, config.nibe.homeassistantDiscoveryOverrides.size());
-    const std::string& override1 = config.nibe.homeassistantDiscoveryOverrides.at(1);
-    TEST_ASSERT_EQUAL_STRING(R"({"override1":"value1"})", override1.c_str());
-    const std::string& override2 = config.nibe.homeassistantDiscoveryOverrides.at(2);
-    TEST_ASSERT_EQUAL_STRING(R"({"override2":{"sub2":"value2"}})", override2.c_str());
+    const MqttDiscoveryOverride& override1 = config.nibe.homeassistantDiscoveryOverrides.at(1);
+    TEST_ASSERT_EQUAL_STRING(R"({"override1":"value1"})", override1.json.c_str());
+    TEST_ASSERT_EQUAL_STRING(R"("override1":"value1")", override1.members.c_str());
+    const MqttDiscoveryOverride& override2 = config.nibe.homeassistantDiscoveryOverrides.at(2);
+    TEST_ASSERT_EQUAL_STRING(R"({"override2":{"sub2":"value2"}})", override2.json.c_str());
+    TEST_ASSERT_EQUAL_STRING(R"("override2":{"sub2":"value2"})", override2.members.c_str());
 
     TEST_ASSERT_EQUAL_STRING("myrelay-1", config.relays[0].name.c_str());
     TEST_ASSERT_EQUAL_STRING("myrelay-2", config.relays[1].name.c_str());
@@ -162,6 +199,8 @@ TEST_CASE("getConfigAsJson", "[config]") {
     TEST_ASSERT_TRUE(json.contains("1,"));
     TEST_ASSERT_TRUE(json.contains("pollRegistersSlow"));
     TEST_ASSERT_TRUE(json.contains("3,"));
+    TEST_ASSERT_TRUE(json.contains(R"("interval": 60)"));
+    TEST_ASSERT_TRUE(json.contains(R"("deadband": 5)"));
     TEST_ASSERT_TRUE(json.contains("metrics"));
     TEST_ASSERT_TRUE(json.contains("prom_name_1"));
     TEST_ASSERT_TRUE(json.contains(R"("factor": 10)"));
@@ -222,7 +261,7 @@ Title;Info;ID;Unit;Size;Factor;Min;Max;Default;Mode
                                       R"(C";s16;10;0;0;0;R;)";
 
 TEST_CASE("parseNibeModbusCSV", "[config]") {
-    std::unordered_map<uint16_t, NibeRegister> registers;
+    NibeRegisterTable registers;
     auto is = nonstd::icharbufstream("");
     TEST_ASSERT_EQUAL(ESP_FAIL, NibeMqttGwConfigManager::parseNibeModbusCSV(is, &registers));
     std::string badConfig = std::string(nibeModbusConfig);
@@ -233,8 +272,9 @@ TEST_CASE("parseNibeModbusCSV", "[config]") {
     is = nonstd::icharbufstream(nibeModbusConfig);
     TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::parseNibeModbusCSV(is, &registers));
     TEST_ASSERT_EQUAL(1, registers.size());
-    TEST_ASSERT(registers[40004] == NibeRegister(40004, "BT1 Outdoor Temperature", NibeRegisterUnit::GradCelcius,
-                                             NibeRegisterDataType::Int16, 10, 0, 0, 0, NibeRegisterMode::Read));
+    TEST_ASSERT(registers.get(*registers.find(40004)) == NibeRegister(40004, "BT1 Outdoor Temperature",
+                                                                      NibeRegisterUnit::GradCelcius, NibeRegisterDataType::Int16,
+                                                                      10, 0, 0, 0, NibeRegisterMode::Read));
 
     registers.clear();
     is = nonstd::icharbufstream(nibeModbusConfig);
@@ -263,8 +303,10 @@ TEST_CASE("parseNibeModbusCSVLine", "[config]") {
     TEST_ASSERT_EQUAL(4, NibeMqttGwConfigManager::parseNibeModbusCSVLine(R"("title";"info";40004;"XX";s16;10;0;0;0;R;)", _register));
     TEST_ASSERT_EQUAL(5, NibeMqttGwConfigManager::parseNibeModbusCSVLine(R"("title";"info";40004;"%";X16;10;0;0;0;R;)", _register));
     TEST_ASSERT_EQUAL(6, NibeMqttGwConfigManager::parseNibeModbusCSVLine(R"("title";"info";40004;"%";s16;;0;0;0;R;)", _register));
+    TEST_ASSERT_EQUAL(6, NibeMqttGwConfigManager::parseNibeModbusCSVLine(R"("title";"info";40004;"%";s16;40000;0;0;0;R;)", _register));
     TEST_ASSERT_EQUAL(7, NibeMqttGwConfigManager::parseNibeModbusCSVLine(R"("title";"info";40004;"%";s16;1;X0;0;0;R;)", _register));
     TEST_ASSERT_EQUAL(8, NibeMqttGwConfigManager::parseNibeModbusCSVLine(R"("title";"info";40004;"%";s16;1;0;X0;0;R;)", _register));
+    TEST_ASSERT_EQUAL(8, NibeMqttGwConfigManager::parseNibeModbusCSVLine(R"("title";"info";40004;"%";s16;1;10;5;0;R;)", _register));
     TEST_ASSERT_EQUAL(9, NibeMqttGwConfigManager::parseNibeModbusCSVLine(R"("title";"info";40004;"%";s16;1;0;0;X0;R;)", _register));
     TEST_ASSERT_EQUAL(10, NibeMqttGwConfigManager::parseNibeModbusCSVLine(R"("title";"info";40004;"%";s16;10;0;0;0;X;)", _register));
 
@@ -279,42 +321,54 @@ TEST_CASE("parseNibeModbusCSVLine", "[config]") {
 }
 
 TEST_CASE("getNextCsvToken", "[config]") {
-    std::string token;
-    nonstd::icharbufstream is("");
-
-    TEST_ASSERT_EQUAL(ESP_FAIL, NibeMqttGwConfigManager::getNextCsvToken(is, token));
-
-    is = nonstd::icharbufstream("token");
-    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(is, token));
-    TEST_ASSERT_EQUAL_STRING("token", token.c_str());
-    TEST_ASSERT_EQUAL(ESP_FAIL, NibeMqttGwConfigManager::getNextCsvToken(is, token));
-
-    is = nonstd::icharbufstream("token1;token2");
-    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(is, token));
-    TEST_ASSERT_EQUAL_STRING("token1", token.c_str());
-    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(is, token));
-    TEST_ASSERT_EQUAL_STRING("token2", token.c_str());
-    TEST_ASSERT_EQUAL(ESP_FAIL, NibeMqttGwConfigManager::getNextCsvToken(is, token));
-
-    is = nonstd::icharbufstream("token1;token2;;");
-    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(is, token));
-    TEST_ASSERT_EQUAL_STRING("token1", token.c_str());
-    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(is, token));
-    TEST_ASSERT_EQUAL_STRING("token2", token.c_str());
-    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(is, token));
-    TEST_ASSERT_EQUAL_STRING("", token.c_str());
-    TEST_ASSERT_EQUAL(ESP_FAIL, NibeMqttGwConfigManager::getNextCsvToken(is, token));
-
-    is = nonstd::icharbufstream(R"("token1";"token""2";tok"en3";"token;4")");
-    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(is, token));
-    TEST_ASSERT_EQUAL_STRING("token1", token.c_str());
-    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(is, token));
-    TEST_ASSERT_EQUAL_STRING(R"(token"2)", token.c_str());
-    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(is, token));
-    TEST_ASSERT_EQUAL_STRING(R"(tok"en3")", token.c_str());
-    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(is, token));
-    TEST_ASSERT_EQUAL_STRING("token;4", token.c_str());
-    TEST_ASSERT_EQUAL(ESP_FAIL, NibeMqttGwConfigManager::getNextCsvToken(is, token));
+    std::string_view line;
+    std::string_view token;
+    std::string unquoted;
+
+    line = "";
+    TEST_ASSERT_EQUAL(ESP_FAIL, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
+
+    line = "token";
+    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
+    TEST_ASSERT_TRUE(token == "token");
+    TEST_ASSERT_EQUAL(ESP_FAIL, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
+
+    line = "token1;token2";
+    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
+    TEST_ASSERT_TRUE(token == "token1");
+    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
+    TEST_ASSERT_TRUE(token == "token2");
+    TEST_ASSERT_EQUAL(ESP_FAIL, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
+
+    line = "token1;token2;;";
+    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
+    TEST_ASSERT_TRUE(token == "token1");
+    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
+    TEST_ASSERT_TRUE(token == "token2");
+    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
+    TEST_ASSERT_TRUE(token == "");
+    TEST_ASSERT_EQUAL(ESP_FAIL, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
+
+    const char* quoted = R"("token1";"token""2";tok"en3";"token;4";"to"ken5)";
+    line = quoted;
+    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
+    TEST_ASSERT_TRUE(token == "token1");
+    TEST_ASSERT_TRUE(token.data() == quoted + 1);  // in place
+    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
+    TEST_ASSERT_TRUE(token == R"(token"2)");
+    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
+    TEST_ASSERT_TRUE(token == R"(tok"en3")");
+    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
+    TEST_ASSERT_TRUE(token == "token;4");
+    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
+    TEST_ASSERT_TRUE(token == "token5");
+    TEST_ASSERT_EQUAL(ESP_FAIL, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
+
+    // missing closing quote
+    line = R"("token;)";
+    TEST_ASSERT_EQUAL(ESP_FAIL, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
+    line = R"("tok""en;)";
+    TEST_ASSERT_EQUAL(ESP_FAIL, NibeMqttGwConfigManager::getNextCsvToken(line, token, unquoted));
 }
 
 TEST_CASE("parseNibeModbusCSV - nibe-modbus-vvm310.csv", "[config]") {
@@ -324,7 +378,7 @@ TEST_CASE("parseNibeModbusCSV - nibe-modbus-vvm310.csv", "[config]") {
 
     std::ifstream ifs("config/nibe-modbus-vvm310.csv");
     nonstd::istdstream is(ifs);
-    std::unordered_map<uint16_t, NibeRegister> registers;
+    NibeRegisterTable registers;
 
     TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::parseNibeModbusCSV(is, &registers));
     TEST_ASSERT_GREATER_THAN(800, registers.size());
@@ -332,6 +386,40 @@ TEST_CASE("parseNibeModbusCSV - nibe-modbus-vvm310.csv", "[config]") {
     printf("nibe-modbus-vvm310.csv contains %lu registers\n", registers.size());
 }
 
+// buffered block reads, tokens parsed in place, results are logged only
+TEST_CASE("parseNibeModbusCSV - nibe-modbus-vvm310.csv throughput", "[config][benchmark]") {
+    std::ifstream ifs("config/nibe-modbus-vvm310.csv");
+    std::stringstream buffer;
+    buffer << ifs.rdbuf();
+    std::string csv = buffer.str();
+    TEST_ASSERT(csv.size() > 0);
+
+    // validate only: no register table, allocations of the parser itself
+    const int rounds = 20;
+    int allocations = alloccounter_allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        auto is = nonstd::istringstream(csv);
+        TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::parseNibeModbusCSV(is, nullptr));
+    }
+    std::chrono::nanoseconds memoryTime = (std::chrono::steady_clock::now() - start) / rounds;
+    int validateAllocations = (alloccounter_allocations - allocations) / rounds;
+
+    // from file
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        std::ifstream file("config/nibe-modbus-vvm310.csv");
+        nonstd::istdstream is(file);
+        TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::parseNibeModbusCSV(is, nullptr));
+    }
+    std::chrono::nanoseconds fileTime = (std::chrono::steady_clock::now() - start) / rounds;
+
+    printf("parse %d bytes CSV: memory %lld us, file %lld us, %d allocations\n", (int)csv.size(),
+           (long long)memoryTime.count() / 1000, (long long)fileTime.count() / 1000, validateAllocations);
+    // line buffer and title only
+    TEST_ASSERT_LESS_THAN(10, validateAllocations);
+}
+
 TEST_CASE("parseNibeModbusCSV - nibe-modbus-vvm310.csv, filter configured registers", "[config]") {
     std::ifstream ifs("config/config.json.template");
     std::stringstream buffer;
@@ -347,14 +435,128 @@ TEST_CASE("parseNibeModbusCSV - nibe-modbus-vvm310.csv, filter configured regist
 
     ifs.open("config/nibe-modbus-vvm310.csv");
     nonstd::istdstream is(ifs);
-    std::unordered_map<uint16_t, NibeRegister> registers;
+    NibeRegisterTable registers;
 
-    TEST_ASSERT_EQUAL(
-        ESP_OK,
-        NibeMqttGwConfigManager::parseNibeModbusCSV(
-            is, &registers, std::bind(&NibeMqttGwConfigManager::nibeRegisterFilterConfigured, configManager, std::placeholders::_1)));
+    NibeRegisterIdSet configured = configManager.configuredNibeRegisters();
+    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::parseNibeModbusCSV(is, &registers, configured));
     TEST_ASSERT_GREATER_THAN(20, registers.size());
     TEST_ASSERT_LESS_THAN(50, registers.size());
+    TEST_ASSERT_LESS_OR_EQUAL(configured.size(), registers.size());
 
     printf("config.json.template references %lu registers\n", registers.size());
-}
\ No newline at end of file
+}
+
+// compare with the former std::unordered_map<uint16_t, NibeRegister>, results are logged only
+TEST_CASE("NibeRegisterTable memory and lookup", "[config][benchmark]") {
+    std::ifstream ifs("config/nibe-modbus-vvm310.csv");
+    nonstd::istdstream is(ifs);
+    NibeRegisterTable parsed;
+    TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::parseNibeModbusCSV(is, &parsed));
+    std::vector<NibeRegister> registers;
+    for (const auto& entry : parsed) {
+        registers.push_back(parsed.get(entry));
+    }
+
+    size_t bytes = alloccounter_bytes;
+    int allocations = alloccounter_allocations;
+    std::unordered_map<uint16_t, NibeRegister> map;
+    for (const auto& _register : registers) {
+        map[_register.id] = _register;
+    }
+    size_t mapBytes = alloccounter_bytes - bytes;
+    int mapAllocations = alloccounter_allocations - allocations;
+
+    allocations = alloccounter_allocations;
+    NibeRegisterTable table;
+    for (const auto& _register : registers) {
+        table.insert(_register);
+    }
+    table.shrinkToFit();
+    int tableAllocations = alloccounter_allocations - allocations;
+    TEST_ASSERT_EQUAL(registers.size(), table.size());
+    TEST_ASSERT_LESS_THAN(mapBytes, table.memoryUsage());
+
+    // all registers in random order
+    std::vector<uint16_t> ids;
+    for (const auto& _register : registers) {
+        ids.push_back(_register.id);
+    }
+    std::shuffle(ids.begin(), ids.end(), std::mt19937(42));
+    const int rounds = 1000;
+    int found = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        for (auto id : ids) {
+            found += map.find(id)->second.factor;
+        }
+    }
+    std::chrono::nanoseconds mapTime = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        for (auto id : ids) {
+            found -= table.find(id)->factor;
+        }
+    }
+    std::chrono::nanoseconds tableTime = std::chrono::steady_clock::now() - start;
+    TEST_ASSERT_EQUAL(0, found);
+
+    printf("%d registers: unordered_map %d bytes (%d allocations), %lld ns/lookup; table %d bytes (%d allocations), %lld ns/lookup\n",
+           (int)registers.size(), (int)mapBytes, mapAllocations, (long long)mapTime.count() / (rounds * (long long)ids.size()),
+           (int)table.memoryUsage(), tableAllocations, (long long)tableTime.count() / (rounds * (long long)ids.size()));
+}
+
+// boot: parse ModbusManager CSV vs load precompiled database, results are logged only
+TEST_CASE("nibe modbus database parse vs load", "[config][benchmark]") {
+    std::ifstream ifs("config/nibe-modbus-vvm310.csv");
+    std::stringstream buffer;
+    buffer << ifs.rdbuf();
+    std::string csv = buffer.str();
+    TEST_ASSERT(csv.size() > 0);
+
+    const int rounds = 10;
+    NibeRegisterTable parsed;
+    int allocations = alloccounter_allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        parsed = NibeRegisterTable();
+        auto is = nonstd::istringstream(csv);
+        TEST_ASSERT_EQUAL(ESP_OK, NibeMqttGwConfigManager::parseNibeModbusCSV(is, &parsed));
+    }
+    std::chrono::nanoseconds parseTime = (std::chrono::steady_clock::now() - start) / rounds;
+    int parseAllocations = (alloccounter_allocations - allocations) / rounds;
+
+    std::string image;
+    TEST_ASSERT_TRUE(parsed.save([&image](const void* data, size_t size) {
+        image.append((const char*)data, size);
+        return true;
+    }));
+
+    NibeRegisterTable loaded;
+    allocations = alloccounter_allocations;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        loaded = NibeRegisterTable();
+        size_t pos = 0;
+        TEST_ASSERT_TRUE(loaded.load([&image, &pos](void* data, size_t size) {
+            if (pos + size > image.size()) {
+                return false;
+            }
+            std::memcpy(data, image.data() + pos, size);
+            pos += size;
+            return true;
+        }));
+    }
+    std::chrono::nanoseconds loadTime = (std::chrono::steady_clock::now() - start) / rounds;
+    int loadAllocations = (alloccounter_allocations - allocations) / rounds;
+
+    // round trip
+    TEST_ASSERT_GREATER_THAN(800, loaded.size());
+    TEST_ASSERT_EQUAL(parsed.size(), loaded.size());
+    for (size_t i = 0; i < parsed.size(); i++) {
+        TEST_ASSERT_TRUE(parsed.get(parsed[i]) == loaded.get(loaded[i]));
+    }
+
+    printf("%d registers: parse CSV (%d bytes) %lld us, %d allocations; load database (%d bytes) %lld us, %d allocations\n",
+           (int)loaded.size(), (int)csv.size(), (long long)parseTime.count() / 1000, parseAllocations, (int)image.size(),
+           (long long)loadTime.count() / 1000, loadAllocations);
+}
@@ -56,6 +56,11 @@ TEST_CASE("formatNumber", "[metrics]") {
     TEST_ASSERT_EQUAL_STRING("1.234", Metrics::formatNumber(1234, 1000, 1).c_str());
     TEST_ASSERT_EQUAL_STRING("-1.005", Metrics::formatNumber(-1005l, 1000, 1).c_str());
 
+    TEST_ASSERT_EQUAL_STRING("0.000000", Metrics::formatNumber(0, 1000000, 1).c_str());
+    TEST_ASSERT_EQUAL_STRING("0.000250", Metrics::formatNumber(250, 1000000, 1).c_str());
+    TEST_ASSERT_EQUAL_STRING("12.345678", Metrics::formatNumber(12345678ll, 1000000, 1).c_str());
+    TEST_ASSERT_EQUAL_STRING("5000.000001", Metrics::formatNumber(5000000001ll, 1000000, 1).c_str());
+
     TEST_ASSERT_EQUAL_STRING("0.000000", Metrics::formatNumber(0, 2, 1).c_str());
     TEST_ASSERT_EQUAL_STRING("0.500000", Metrics::formatNumber(1, 2, 1).c_str());
     TEST_ASSERT_EQUAL_STRING("5.000000", Metrics::formatNumber(10, 2, 1).c_str());
@@ -65,6 +70,22 @@ TEST_CASE("formatNumber", "[metrics]") {
     TEST_ASSERT_EQUAL_STRING("100", Metrics::formatNumber(10, 1, 10).c_str());
     TEST_ASSERT_EQUAL_STRING("-10000", Metrics::formatNumber(-1000l, 1, 10).c_str());
     TEST_ASSERT_EQUAL_STRING("250", Metrics::formatNumber((u_int8_t)25, 1, 10).c_str());
+
+    TEST_ASSERT_EQUAL_STRING("-0.5", Metrics::formatNumber(-5, 10, 1).c_str());
+    TEST_ASSERT_EQUAL_STRING("-0.05", Metrics::formatNumber(-5, 100, 1).c_str());
+    TEST_ASSERT_EQUAL_STRING("4294967295", Metrics::formatNumber((uint32_t)4294967295, 1, 1).c_str());
+}
+
+TEST_CASE("formatNumber to buffer", "[metrics]") {
+    char buffer[8];
+    TEST_ASSERT_EQUAL(6, Metrics::formatNumber(buffer, sizeof(buffer), -1001, 10, 1));
+    TEST_ASSERT_EQUAL_STRING_LEN("-100.1", buffer, 6);
+    TEST_ASSERT_EQUAL(8, Metrics::formatNumber(buffer, sizeof(buffer), 1234567, 1000, 1));
+    TEST_ASSERT_EQUAL_STRING_LEN("1234.567", buffer, 8);
+    // buffer too small
+    TEST_ASSERT_EQUAL(0, Metrics::formatNumber(buffer, sizeof(buffer), 12345678, 1000, 1));
+    TEST_ASSERT_EQUAL(0, Metrics::formatNumber(buffer, sizeof(buffer), 123456789, 1, 1));
+    TEST_ASSERT_EQUAL(0, Metrics::formatNumber(buffer, sizeof(buffer), 1001, 2, 1));
 }
 
 TEST_CASE("add/findMetric", "[metrics]") {
@@ -119,4 +140,58 @@ TEST_CASE("getAllMetricsAsString", "[metrics]") {
 metric1 0
 metric2 0.0
 )", m.getAllMetricsAsString().c_str());
-}
\ No newline at end of file
+}
+TEST_CASE("histogram", "[metrics]") {
+    Metrics m;
+    m.begin();
+    const int32_t bounds[] = {100, 1000};
+    Histogram& h1 = m.addHistogram("histogram1", bounds, 2, 1000000);
+    Histogram& h2 = m.addHistogram(R"(histogram2{label1="v1"})", bounds, 2);
+
+    TEST_ASSERT_EQUAL(0, h1.getCount());
+    TEST_ASSERT_EQUAL(0, h1.getSum());
+
+    h1.observe(50);
+    h1.observe(100);
+    h1.observe(101);
+    h1.observe(2000);
+    TEST_ASSERT_EQUAL(4, h1.getCount());
+    TEST_ASSERT_EQUAL(2251, h1.getSum());
+    TEST_ASSERT_EQUAL(2, h1.getBucketCount(0));
+    TEST_ASSERT_EQUAL(3, h1.getBucketCount(1));
+    TEST_ASSERT_EQUAL(4, h1.getBucketCount(2));
+
+    h2.observe(1);
+
+    TEST_ASSERT_EQUAL_STRING(R"(# nibe-mqtt-gateway metrics
+histogram1_bucket{le="0.000100"} 2
+histogram1_bucket{le="0.001000"} 3
+histogram1_bucket{le="+Inf"} 4
+histogram1_sum 0.002251
+histogram1_count 4
+histogram2_bucket{label1="v1",le="100"} 1
+histogram2_bucket{label1="v1",le="1000"} 1
+histogram2_bucket{label1="v1",le="+Inf"} 1
+histogram2_sum{label1="v1"} 1
+histogram2_count{label1="v1"} 1
+)", m.getAllMetricsAsString().c_str());
+}
+
+TEST_CASE("max number of metrics", "[metrics]") {
+    Metrics m;
+    m.begin();
+    const int32_t bounds[] = {100};
+    for (int i = 0; i < MAX_HISTOGRAMS; i++) {
+        m.addHistogram("histogram", bounds, 1);
+    }
+    // not exported, still usable
+    Histogram& h = m.addHistogram("histogram_overflow", bounds, 1);
+    h.observe(1);
+    for (int i = 0; i < MAX_METRICS; i++) {
+        m.addMetric("metric", 1);
+    }
+    Metric& metric = m.addMetric("metric_overflow", 1);
+    metric.setValue(1);
+    TEST_ASSERT_NULL(m.findMetric("metric_overflow"));
+    TEST_ASSERT_EQUAL(std::string::npos, m.getAllMetricsAsString().find("overflow"));
+}
@@ -71,4 +71,450 @@ TEST_CASE("mergeMqttDiscoveryInfoOverride", "[mqtt]") {
     MqttHelper::mergeMqttDiscoveryInfoOverride(doc, R"({"override": null})");
     TEST_ASSERT_EQUAL_STRING("b", doc["a"]);
     TEST_ASSERT_EQUAL(1, doc.size());
-}
\ No newline at end of file
+}
+TEST_CASE("parseMqttDiscoveryInfoOverride", "[mqtt]") {
+    MqttDiscoveryOverride override;
+    TEST_ASSERT_EQUAL(ESP_OK, MqttHelper::parseMqttDiscoveryInfoOverride("", override));
+    TEST_ASSERT_TRUE(override.component.empty());
+    TEST_ASSERT_TRUE(override.members.empty());
+    TEST_ASSERT_EQUAL(0, override.keys.size());
+
+    TEST_ASSERT_EQUAL(ESP_OK, MqttHelper::parseMqttDiscoveryInfoOverride(
+                                  R"({"_component_":"number","unit_of_meas":"Grad","dev_cla":null,"sub":{"a":1}})", override));
+    TEST_ASSERT_EQUAL_STRING("number", override.component.c_str());
+    TEST_ASSERT_EQUAL_STRING(R"("unit_of_meas":"Grad","sub":{"a":1})", override.members.c_str());
+    TEST_ASSERT_EQUAL(3, override.keys.size());
+    TEST_ASSERT_TRUE(override.overrides("unit_of_meas"));
+    TEST_ASSERT_TRUE(override.overrides("dev_cla"));
+    TEST_ASSERT_TRUE(override.overrides("sub"));
+    TEST_ASSERT_FALSE(override.overrides("_component_"));
+    TEST_ASSERT_FALSE(override.overrides("name"));
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, MqttHelper::parseMqttDiscoveryInfoOverride(R"({invalid-json-string})", override));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, MqttHelper::parseMqttDiscoveryInfoOverride(R"([1])", override));
+}
+
+TEST_CASE("MqttDiscoveryPayload", "[mqtt]") {
+    std::string payload;
+    MqttDiscoveryPayload empty(payload);
+    empty.finish();
+    TEST_ASSERT_EQUAL_STRING("{}", payload.c_str());
+
+    MqttDiscoveryPayload plain(payload);
+    plain.addFragment(R"("dev":{"ids":["id"]})");
+    plain.add("name", "a \"quoted\" \\ name\n");
+    plain.add("min", -10);
+    plain.addNumber("step", "0.1");
+    plain.finish();
+    TEST_ASSERT_EQUAL_STRING(R"({"dev":{"ids":["id"]},"name":"a \"quoted\" \\ name\n","min":-10,"step":0.1})", payload.c_str());
+    JsonDocument doc;
+    TEST_ASSERT_FALSE(deserializeJson(doc, payload));
+    TEST_ASSERT_EQUAL_STRING("a \"quoted\" \\ name\n", doc["name"]);
+
+    MqttDiscoveryOverride override;
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      MqttHelper::parseMqttDiscoveryInfoOverride(R"({"name":"overridden","min":null,"added":true})", override));
+    MqttDiscoveryPayload overridden(payload, &override);
+    overridden.add("name", "default");
+    overridden.add("min", -10);
+    overridden.add("max", 10);
+    overridden.finish();
+    TEST_ASSERT_EQUAL_STRING(R"({"max":10,"name":"overridden","added":true})", payload.c_str());
+}
+
+TEST_CASE("MqttDiscoveryHashes", "[mqtt]") {
+    TEST_ASSERT_EQUAL_HEX32(0x811c9dc5, MqttDiscoveryHashes::hash(""));
+    TEST_ASSERT_EQUAL_HEX32(0xe40c292c, MqttDiscoveryHashes::hash("a"));
+
+    MqttDiscoveryHashes hashes;
+    TEST_ASSERT_TRUE(hashes.isPublishRequired("t1", "p1"));
+    hashes.published("t1", "p1");
+    hashes.published("t2", "p2");
+    TEST_ASSERT_TRUE(hashes.isDirty());
+    TEST_ASSERT_FALSE(hashes.isPublishRequired("t1", "p1"));
+    TEST_ASSERT_TRUE(hashes.isPublishRequired("t1", "p2"));
+    TEST_ASSERT_FALSE(hashes.isPublishRequired("t2", "p2"));
+    TEST_ASSERT_TRUE(hashes.isPublishRequired("t3", "p2"));
+
+    // persisted image
+    std::string image((const char*)hashes.data(), hashes.dataSize());
+    MqttDiscoveryHashes loaded;
+    TEST_ASSERT_TRUE(loaded.load(image.data(), image.size()));
+    TEST_ASSERT_FALSE(loaded.isDirty());
+    TEST_ASSERT_EQUAL(2, loaded.size());
+    TEST_ASSERT_FALSE(loaded.isPublishRequired("t1", "p1"));
+    TEST_ASSERT_FALSE(loaded.load(image.data(), image.size() - 1));
+    TEST_ASSERT_EQUAL(0, loaded.size());
+
+    // unchanged payload is not dirty
+    hashes.clearDirty();
+    hashes.published("t1", "p1");
+    TEST_ASSERT_FALSE(hashes.isDirty());
+    hashes.published("t1", "p1 changed");
+    TEST_ASSERT_TRUE(hashes.isDirty());
+
+    // all messages are required after invalidate()
+    hashes.clearDirty();
+    hashes.invalidate();
+    TEST_ASSERT_FALSE(hashes.isDirty());
+    TEST_ASSERT_TRUE(hashes.isPublishRequired("t1", "p1 changed"));
+    TEST_ASSERT_TRUE(hashes.isPublishRequired("t2", "p2"));
+    hashes.published("t2", "p2");
+    TEST_ASSERT_FALSE(hashes.isPublishRequired("t2", "p2"));
+    TEST_ASSERT_TRUE(hashes.isPublishRequired("t1", "p1 changed"));
+
+    // removed topics are persisted as not published
+    hashes.clearDirty();
+    hashes.remove("t3");
+    TEST_ASSERT_FALSE(hashes.isDirty());
+    hashes.remove("t2");
+    TEST_ASSERT_TRUE(hashes.isDirty());
+    TEST_ASSERT_EQUAL(1, hashes.size());
+    TEST_ASSERT_TRUE(hashes.isPublishRequired("t2", "p2"));
+    hashes.clearDirty();
+    hashes.clear();
+    TEST_ASSERT_TRUE(hashes.isDirty());
+    TEST_ASSERT_EQUAL(0, hashes.size());
+
+    // bounded
+    for (int i = 0; i < MQTT_DISCOVERY_HASHES_MAX + 10; i++) {
+        hashes.published("topic" + std::to_string(i), "p");
+    }
+    TEST_ASSERT_EQUAL(MQTT_DISCOVERY_HASHES_MAX, hashes.size());
+}
+
+TEST_CASE("MqttTokenBucket", "[mqtt]") {
+    // 1000 bytes/s, burst 100 bytes, 10 messages/s, burst 2 messages
+    MqttTokenBucket bucket(1000, 100, 10, 2);
+    TEST_ASSERT_EQUAL(0, bucket.delay(50, 0));
+    bucket.consume(50);
+    TEST_ASSERT_EQUAL(0, bucket.delay(50, 0));
+    bucket.consume(50);
+    // message rate limits: 10ms for 10 bytes, 100ms for one message
+    TEST_ASSERT_EQUAL(100000, bucket.delay(10, 0));
+    TEST_ASSERT_EQUAL(50000, bucket.delay(10, 50000));
+    TEST_ASSERT_EQUAL(0, bucket.delay(10, 100000));
+
+    // message larger than burst: allowed with full bucket, deficit paid back
+    TEST_ASSERT_EQUAL(0, bucket.delay(500, 100000));
+    bucket.consume(500);
+    TEST_ASSERT_EQUAL(401000, bucket.delay(1, 100000));
+    TEST_ASSERT_EQUAL(0, bucket.delay(1, 501000));
+
+    // refill is capped by burst
+    TEST_ASSERT_EQUAL(0, bucket.delay(100, 10000000));
+    bucket.consume(100);
+    TEST_ASSERT_EQUAL(100000, bucket.delay(100, 10000000));
+}
+
+TEST_CASE("MqttPacedQueue", "[mqtt]") {
+    MqttPacedQueue queue(MqttTokenBucket(1000, 100, 10, 2), 20);
+    MqttPacedQueue::Message message;
+    TEST_ASSERT_EQUAL(-1, queue.pop(message, 0));
+
+    TEST_ASSERT_TRUE(queue.push("t", "12345", 0, false, 0));
+    TEST_ASSERT_TRUE(queue.push("r", "abc", 0, true, 0));
+    // retained message replaces queued message of same topic
+    TEST_ASSERT_TRUE(queue.push("r", "abcdef", 1, true, 10, true));
+    TEST_ASSERT_EQUAL(2, queue.size());
+    TEST_ASSERT_EQUAL(13, queue.bytes());
+    // non-retained messages are not replaced
+    TEST_ASSERT_TRUE(queue.push("t", "1", 0, false, 20));
+    TEST_ASSERT_EQUAL(3, queue.size());
+    // full
+    TEST_ASSERT_FALSE(queue.push("t", "12345678", 0, false, 30));
+    TEST_ASSERT_EQUAL(15, queue.bytes());
+
+    // FIFO
+    TEST_ASSERT_EQUAL(0, queue.pop(message, 1000));
+    TEST_ASSERT_EQUAL_STRING("t", message.topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("12345", message.payload.c_str());
+    TEST_ASSERT_EQUAL(0, message.enqueued);
+    TEST_ASSERT_FALSE(message.discovery);
+    TEST_ASSERT_EQUAL(0, queue.pop(message, 1000));
+    TEST_ASSERT_EQUAL_STRING("r", message.topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("abcdef", message.payload.c_str());
+    TEST_ASSERT_EQUAL(1, message.qos);
+    TEST_ASSERT_TRUE(message.retain);
+    TEST_ASSERT_TRUE(message.discovery);
+    TEST_ASSERT_EQUAL(0, message.enqueued);
+    TEST_ASSERT_EQUAL(2, queue.bytes());
+
+    // message burst exhausted, 100ms per message
+    TEST_ASSERT_EQUAL(100000, queue.pop(message, 1000));
+    queue.requeue(std::move(message));
+    TEST_ASSERT_EQUAL(2, queue.size());
+    TEST_ASSERT_EQUAL(9, queue.bytes());
+    TEST_ASSERT_EQUAL(0, queue.pop(message, 101000));
+    TEST_ASSERT_EQUAL_STRING("abcdef", message.payload.c_str());
+    TEST_ASSERT_EQUAL(100000, queue.pop(message, 101000));
+    TEST_ASSERT_EQUAL(0, queue.pop(message, 201000));
+    TEST_ASSERT_EQUAL_STRING("1", message.payload.c_str());
+    TEST_ASSERT_EQUAL(-1, queue.pop(message, 301000));
+    TEST_ASSERT_EQUAL(0, queue.bytes());
+    TEST_ASSERT_EQUAL(1, queue.dropped());
+}
+
+TEST_CASE("MqttPacedQueue discovery not dropped", "[mqtt]") {
+    MqttPacedQueue queue(MqttTokenBucket(1000, 100, 10, 2), 20);
+    MqttPacedQueue::Message message;
+    TEST_ASSERT_TRUE(queue.push("l", "log1", 0, false, 0));
+    TEST_ASSERT_TRUE(queue.push("d", "12345", 0, true, 0, true));
+    TEST_ASSERT_TRUE(queue.push("l", "log2", 0, false, 0));
+    TEST_ASSERT_EQUAL(16, queue.bytes());
+
+    // oldest log message evicted
+    TEST_ASSERT_TRUE(queue.push("e", "1234", 0, true, 0, true));
+    TEST_ASSERT_EQUAL(3, queue.size());
+    TEST_ASSERT_EQUAL(16, queue.bytes());
+    TEST_ASSERT_EQUAL(1, queue.dropped());
+    // replacing a discovery message evicts log messages, not the replaced message
+    TEST_ASSERT_TRUE(queue.push("d", "1234567890", 0, true, 0, true));
+    TEST_ASSERT_EQUAL(2, queue.size());
+    TEST_ASSERT_EQUAL(16, queue.bytes());
+    TEST_ASSERT_EQUAL(2, queue.dropped());
+    // log message rejected, discovery message exceeds limit
+    TEST_ASSERT_FALSE(queue.push("l", "log3", 0, false, 0));
+    TEST_ASSERT_TRUE(queue.push("f", "12345", 0, true, 0, true));
+    TEST_ASSERT_EQUAL(3, queue.size());
+    TEST_ASSERT_EQUAL(22, queue.bytes());
+    TEST_ASSERT_EQUAL(3, queue.dropped());
+
+    TEST_ASSERT_EQUAL(0, queue.pop(message, 1000));
+    TEST_ASSERT_EQUAL_STRING("d", message.topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("1234567890", message.payload.c_str());
+    TEST_ASSERT_EQUAL(0, queue.pop(message, 1000));
+    TEST_ASSERT_EQUAL_STRING("e", message.topic.c_str());
+}
+
+TEST_CASE("MqttDeviceDiscovery", "[mqtt]") {
+    MqttDeviceDiscovery discovery;
+    discovery.begin("homeassistant", R"("avty_t":"gw/availability","dev":{"name":"GW"},"o":{"name":"nibegw"})", 1024);
+    TEST_ASSERT_EQUAL(ESP_OK, discovery.add("homeassistant/sensor/nibegw/nibe-1/config",
+                                            R"({"avty_t":"gw/availability","dev":{"ids":["id"]},"uniq_id":"nibe-1"})"));
+    TEST_ASSERT_EQUAL(ESP_OK, discovery.add("homeassistant/switch/relay-1/config", R"({"dev":{"ids":["id"]},"cmd_t":"gw/set"})"));
+    // replaced
+    TEST_ASSERT_EQUAL(ESP_OK, discovery.add("homeassistant/sensor/nibegw/nibe-1/config",
+                                            R"({"avty_t":"gw/availability","dev":{"ids":["id"]},"uniq_id":"nibe-1","name":"1"})"));
+    TEST_ASSERT_EQUAL(2, discovery.size());
+
+    std::string payload;
+    discovery.build(payload);
+    TEST_ASSERT_EQUAL_STRING(
+        R"({"avty_t":"gw/availability","dev":{"name":"GW"},"o":{"name":"nibegw"},"cmps":{)"
+        R"("nibe-1":{"p":"sensor","uniq_id":"nibe-1","name":"1"},"relay-1":{"p":"switch","cmd_t":"gw/set"}}})",
+        payload.c_str());
+    TEST_ASSERT_EQUAL(payload.size(), discovery.payloadSize());
+
+    MqttDeviceDiscovery::entityPayload(discovery.getComponents()[1], R"("dev":{"ids":["id"]})", payload);
+    TEST_ASSERT_EQUAL_STRING(R"({"dev":{"ids":["id"]},"cmd_t":"gw/set"})", payload.c_str());
+
+    // invalid
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, discovery.add("other/sensor/nibegw/x/config", "{}"));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, discovery.add("homeassistant/sensor/x/state", "{}"));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, discovery.add("homeassistant/x/config", "{}"));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, discovery.add("homeassistant/sensor/x/config", "[1]"));
+    TEST_ASSERT_EQUAL(2, discovery.size());
+
+    // exceeding max size, collected for fallback
+    discovery.begin("homeassistant", "", 100);
+    TEST_ASSERT_EQUAL(ESP_OK, discovery.add("homeassistant/sensor/nibegw/nibe-1/config", R"({"name":"1"})"));
+    discovery.build(payload);
+    TEST_ASSERT_EQUAL_STRING(R"({"cmps":{"nibe-1":{"p":"sensor","name":"1"}}})", payload.c_str());
+    TEST_ASSERT_EQUAL(payload.size(), discovery.payloadSize());
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE,
+                      discovery.add("homeassistant/sensor/nibegw/nibe-2/config", R"({"name":"a long name of 64 bytes........"})"));
+    TEST_ASSERT_EQUAL(2, discovery.size());
+    TEST_ASSERT_FALSE(discovery.isFallback());
+    discovery.fallback();
+    TEST_ASSERT_TRUE(discovery.isFallback());
+    TEST_ASSERT_EQUAL(0, discovery.size());
+}
+
+// records queued discovery messages and saved modes, messages are sent by send()
+class TestDiscoveryTransport : public MqttDiscoveryTransport {
+   public:
+    std::vector<std::pair<std::string, std::string>> queued;
+    MqttDiscoveryMode savedMode = MqttDiscoveryMode::Entity;
+    uint32_t savedFallbackSize = 0;
+    int saved = 0;
+
+    int enqueueDiscovery(std::string_view topic, std::string_view payload) {
+        queued.emplace_back(topic, payload);
+        return 0;
+    }
+    void saveDiscoveryMode(MqttDiscoveryMode mode, uint32_t fallbackSize) {
+        savedMode = mode;
+        savedFallbackSize = fallbackSize;
+        saved++;
+    }
+    // messages queued so far, messages queued by published() are kept, returns the number sent
+    size_t send(MqttDiscovery& discovery) {
+        std::vector<std::pair<std::string, std::string>> sending;
+        sending.swap(queued);
+        for (const auto& [topic, payload] : sending) {
+            discovery.published(topic, payload);
+        }
+        return sending.size();
+    }
+};
+
+TEST_CASE("MqttDiscovery", "[mqtt]") {
+    const char* topic1 = "homeassistant/sensor/nibegw/nibe-1/config";
+    const char* topic2 = "homeassistant/sensor/nibegw/nibe-2/config";
+    const char* deviceTopic = "homeassistant/device/nibegw/config";
+    TestDiscoveryTransport transport;
+    MqttDiscovery discovery(transport);
+
+    // entity discovery, unchanged messages are skipped once sent
+    discovery.begin("homeassistant", R"("o":{"name":"nibegw"})", R"("dev":{"ids":["id"]})", false, 1024,
+                    MqttDiscoveryMode::Entity, 0);
+    TEST_ASSERT_EQUAL(0, transport.saved);
+    discovery.publish(topic1, R"({"name":"1"})", 0);
+    TEST_ASSERT_EQUAL(1, transport.send(discovery));
+    discovery.publish(topic1, R"({"name":"1"})", 0);
+    TEST_ASSERT_EQUAL(0, transport.send(discovery));
+    TEST_ASSERT_EQUAL(1, discovery.skipped());
+    // HA restarted
+    discovery.invalidate();
+    discovery.publish(topic1, R"({"name":"1"})", 0);
+    TEST_ASSERT_EQUAL(1, transport.send(discovery));
+
+    // switched to device discovery: components collected, published once due
+    discovery.begin("homeassistant", R"("o":{"name":"nibegw"})", R"("dev":{"ids":["id"]})", true, 1024,
+                    MqttDiscoveryMode::Entity, 0);
+    TEST_ASSERT_EQUAL(MqttDiscoveryMode::Device, discovery.getMode());
+    TEST_ASSERT_EQUAL(0, discovery.getHashes().size());
+    TEST_ASSERT_EQUAL(-1, discovery.due());
+    discovery.publish(topic1, R"({"name":"1"})", 1000);
+    TEST_ASSERT_EQUAL(1000 + MQTT_DEVICE_DISCOVERY_DELAY_MS * 1000, discovery.due());
+    // entity topic migrated, Home Assistant keeps the entity
+    TEST_ASSERT_EQUAL(1, transport.queued.size());
+    TEST_ASSERT_EQUAL_STRING(topic1, transport.queued[0].first.c_str());
+    TEST_ASSERT_EQUAL_STRING(MQTT_DISCOVERY_MIGRATE_PAYLOAD, transport.queued[0].second.c_str());
+    discovery.publishDevice();
+    TEST_ASSERT_EQUAL(-1, discovery.due());
+    TEST_ASSERT_EQUAL(2, transport.queued.size());
+    TEST_ASSERT_EQUAL_STRING(deviceTopic, transport.queued[1].first.c_str());
+    // removed once the device message was sent, mode saved once removed
+    TEST_ASSERT_EQUAL(2, transport.send(discovery));
+    TEST_ASSERT_EQUAL(1, transport.queued.size());
+    TEST_ASSERT_EQUAL_STRING(topic1, transport.queued[0].first.c_str());
+    TEST_ASSERT_EQUAL_STRING("", transport.queued[0].second.c_str());
+    TEST_ASSERT_EQUAL(0, transport.saved);
+    transport.send(discovery);
+    TEST_ASSERT_EQUAL(1, transport.saved);
+    TEST_ASSERT_EQUAL(MqttDiscoveryMode::Device, transport.savedMode);
+
+    // device message replaced while queued: removal after the latest was sent
+    discovery.publish(topic2, R"({"name":"2"})", 1000);
+    // delay doubled after each device message
+    TEST_ASSERT_EQUAL(1000 + 2 * MQTT_DEVICE_DISCOVERY_DELAY_MS * 1000, discovery.due());
+    discovery.publishDevice();
+    discovery.publish(topic2, R"({"name":"2b"})", 1000);
+    discovery.publishDevice();
+    discovery.published(transport.queued[1].first, transport.queued[1].second);
+    TEST_ASSERT_EQUAL(3, transport.queued.size());
+    discovery.published(transport.queued[2].first, transport.queued[2].second);
+    TEST_ASSERT_EQUAL(4, transport.queued.size());
+    TEST_ASSERT_EQUAL_STRING(topic2, transport.queued[3].first.c_str());
+    TEST_ASSERT_EQUAL_STRING("", transport.queued[3].second.c_str());
+    transport.queued.clear();
+
+    // device message exceeds buffer: migrated to entity messages, removed after they were sent
+    std::string longPayload = R"({"name":")" + std::string(1024, 'x') + R"("})";
+    discovery.publish(topic2, longPayload, 1000);
+    TEST_ASSERT_EQUAL(MqttDiscoveryMode::Entity, discovery.getMode());
+    TEST_ASSERT_EQUAL(-1, discovery.due());
+    TEST_ASSERT_EQUAL(3, transport.queued.size());
+    TEST_ASSERT_EQUAL_STRING(deviceTopic, transport.queued[0].first.c_str());
+    TEST_ASSERT_EQUAL_STRING(MQTT_DISCOVERY_MIGRATE_PAYLOAD, transport.queued[0].second.c_str());
+    TEST_ASSERT_EQUAL_STRING(topic1, transport.queued[1].first.c_str());
+    TEST_ASSERT_EQUAL_STRING(topic2, transport.queued[2].first.c_str());
+    TEST_ASSERT_EQUAL(3, transport.send(discovery));
+    TEST_ASSERT_EQUAL(1, transport.queued.size());
+    TEST_ASSERT_EQUAL_STRING(deviceTopic, transport.queued[0].first.c_str());
+    TEST_ASSERT_EQUAL_STRING("", transport.queued[0].second.c_str());
+    TEST_ASSERT_EQUAL(1, transport.saved);
+    transport.send(discovery);
+    TEST_ASSERT_EQUAL(2, transport.saved);
+    TEST_ASSERT_EQUAL(MqttDiscoveryMode::Entity, transport.savedMode);
+    TEST_ASSERT_EQUAL(1024, transport.savedFallbackSize);
+
+    // fallback persisted: entity discovery on reboot with same buffer size
+    discovery.begin("homeassistant", R"("o":{"name":"nibegw"})", R"("dev":{"ids":["id"]})", true, 1024,
+                    MqttDiscoveryMode::Entity, 1024);
+    TEST_ASSERT_EQUAL(MqttDiscoveryMode::Entity, discovery.getMode());
+    discovery.publish(topic1, R"({"name":"3"})", 0);
+    TEST_ASSERT_EQUAL(1, transport.queued.size());
+    TEST_ASSERT_EQUAL_STRING(topic1, transport.queued[0].first.c_str());
+    transport.send(discovery);
+
+    // switched to entity discovery: device message removed after the entity messages were queued
+    discovery.begin("homeassistant", R"("o":{"name":"nibegw"})", R"("dev":{"ids":["id"]})", false, 1024,
+                    MqttDiscoveryMode::Device, 0);
+    TEST_ASSERT_EQUAL(1, transport.queued.size());
+    TEST_ASSERT_EQUAL_STRING(MQTT_DISCOVERY_MIGRATE_PAYLOAD, transport.queued[0].second.c_str());
+    discovery.publish(topic1, R"({"name":"1"})", 1000);
+    TEST_ASSERT_EQUAL(1000 + MQTT_DEVICE_DISCOVERY_DELAY_MS * 1000, discovery.due());
+    discovery.publishDevice();
+    // migrate message not sent yet, not replaced by the removal
+    TEST_ASSERT_EQUAL(2, transport.queued.size());
+    TEST_ASSERT_EQUAL(2, transport.send(discovery));
+    TEST_ASSERT_EQUAL(1, transport.queued.size());
+    TEST_ASSERT_EQUAL_STRING(deviceTopic, transport.queued[0].first.c_str());
+    TEST_ASSERT_EQUAL_STRING("", transport.queued[0].second.c_str());
+    TEST_ASSERT_EQUAL(MqttDiscoveryMode::Entity, transport.savedMode);
+    TEST_ASSERT_EQUAL(2, transport.saved);
+    transport.send(discovery);
+    TEST_ASSERT_EQUAL(3, transport.saved);
+    TEST_ASSERT_EQUAL(0, transport.savedFallbackSize);
+}
+
+TEST_CASE("MqttDiscovery hash recorded after send", "[mqtt]") {
+    const char* topic1 = "homeassistant/sensor/nibegw/nibe-1/config";
+    const char* topic2 = "homeassistant/sensor/nibegw/nibe-2/config";
+    TestDiscoveryTransport transport;
+    MqttDiscovery discovery(transport);
+    discovery.begin("homeassistant", R"("o":{"name":"nibegw"})", R"("dev":{"ids":["id"]})", false, 1024,
+                    MqttDiscoveryMode::Entity, 0);
+
+    // queued, not sent yet: not skipped and not persisted
+    discovery.publish(topic1, R"({"name":"1"})", 0);
+    discovery.publish(topic2, R"({"name":"2"})", 0);
+    TEST_ASSERT_EQUAL(2, transport.queued.size());
+    TEST_ASSERT_TRUE(discovery.getHashes().isPublishRequired(topic1, R"({"name":"1"})"));
+    TEST_ASSERT_FALSE(discovery.getHashes().isDirty());
+    discovery.published(transport.queued[0].first, transport.queued[0].second);
+    TEST_ASSERT_FALSE(discovery.getHashes().isPublishRequired(topic1, R"({"name":"1"})"));
+    TEST_ASSERT_TRUE(discovery.getHashes().isPublishRequired(topic2, R"({"name":"2"})"));
+
+    // reboot with topic2 still queued: persisted hashes contain topic1 only
+    std::vector<uint8_t> image((const uint8_t*)discovery.getHashes().data(),
+                               (const uint8_t*)discovery.getHashes().data() + discovery.getHashes().dataSize());
+    TestDiscoveryTransport transportRebooted;
+    MqttDiscovery rebooted(transportRebooted);
+    TEST_ASSERT_TRUE(rebooted.getHashes().load(image.data(), image.size()));
+    rebooted.begin("homeassistant", R"("o":{"name":"nibegw"})", R"("dev":{"ids":["id"]})", false, 1024,
+                   MqttDiscoveryMode::Entity, 0);
+    rebooted.publish(topic1, R"({"name":"1"})", 0);
+    rebooted.publish(topic2, R"({"name":"2"})", 0);
+    TEST_ASSERT_EQUAL(1, rebooted.skipped());
+    TEST_ASSERT_EQUAL(1, transportRebooted.queued.size());
+    TEST_ASSERT_EQUAL_STRING(topic2, transportRebooted.queued[0].first.c_str());
+
+    // device message hash recorded after send as well
+    TestDiscoveryTransport transportDevice;
+    MqttDiscovery device(transportDevice);
+    device.begin("homeassistant", R"("o":{"name":"nibegw"})", R"("dev":{"ids":["id"]})", true, 1024,
+                 MqttDiscoveryMode::Device, 0);
+    device.publish(topic1, R"({"name":"1"})", 0);
+    device.publishDevice();
+    TEST_ASSERT_EQUAL(1, transportDevice.queued.size());
+    device.publishDevice();
+    TEST_ASSERT_EQUAL(2, transportDevice.queued.size());
+    transportDevice.send(device);
+    device.publishDevice();
+    TEST_ASSERT_EQUAL(0, transportDevice.queued.size());
+    TEST_ASSERT_EQUAL(1, device.skipped());
+}
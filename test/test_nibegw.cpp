@@ -1,6 +1,15 @@
 #include <esp_log.h>
 #include <unity.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "nibegw.h"
 
 static const char* TAG = "test_nibegw";
@@ -10,34 +19,42 @@ class NibeMockInterface : public NibeInterface {
     NibeMockInterface() {
         readBufferIndex = 0;
         sendBufferIndex = 0;
+        maxReadSize = SIZE_MAX;
+        waitForDataCnt = 0;
     }
 
-    void setReadData(const uint8_t* const data, uint8_t len);
+    void setReadData(const uint8_t* const data, size_t len);
     void assertWriteData(const uint8_t* const data, uint8_t len);
+    // limits number of bytes returned by one read() call, 1 = byte-wise reading
+    void setMaxReadSize(size_t max) { maxReadSize = max; }
+
+    // number of waitForData() calls = task wake-ups
+    int waitForDataCnt;
 
     // NibeInterface
     virtual bool isDataAvailable();
-    virtual int readData();
+    virtual bool waitForData(uint32_t timeoutMs);
+    virtual int read(uint8_t* buf, size_t max);
     virtual void sendData(const uint8_t* const data, uint8_t len);
     virtual void sendData(const uint8_t data);
 
    protected:
-    uint8_t readBuffer[MAX_DATA_LEN];
-    uint8_t readBufferIndex;
+    std::vector<uint8_t> readBuffer;
+    size_t readBufferIndex;
+    size_t maxReadSize;
     uint8_t sendBuffer[MAX_DATA_LEN];
     uint8_t sendBufferIndex;
 };
 
 // NibeMockInterface
 
-void NibeMockInterface::setReadData(const uint8_t* const data, uint8_t len) {
+void NibeMockInterface::setReadData(const uint8_t* const data, size_t len) {
     // forgets all former content
-    // store in reverse order so that first data byte is read first
+    readBuffer.assign(data, data + len);
     readBufferIndex = 0;
-    for (int i = len - 1; i >= 0; i--) {
-        readBuffer[readBufferIndex++] = data[i];
+    if (len <= MAX_DATA_LEN) {
+        ESP_LOGD(TAG, "setReadData=%s", NibeGw::dataToString(data, len).c_str());
     }
-    ESP_LOGD(TAG, "setReadData=%s", NibeGw::dataToString(data, len).c_str());
 }
 
 void NibeMockInterface::assertWriteData(const uint8_t* const data, uint8_t len) {
@@ -48,15 +65,19 @@ void NibeMockInterface::assertWriteData(const uint8_t* const data, uint8_t len)
     }
 }
 
-bool NibeMockInterface::isDataAvailable() { return readBufferIndex > 0; }
+bool NibeMockInterface::isDataAvailable() { return readBufferIndex < readBuffer.size(); }
 
-int NibeMockInterface::readData() {
-    int ret = -1;
-    if (readBufferIndex > 0) {
-        ret = readBuffer[--readBufferIndex];
-    }
-    // ESP_LOGV(TAG, "Read %02X", ret);
-    return ret;
+bool NibeMockInterface::waitForData(uint32_t timeoutMs) {
+    // never blocks, all data is set upfront
+    waitForDataCnt++;
+    return isDataAvailable();
+}
+
+int NibeMockInterface::read(uint8_t* buf, size_t max) {
+    size_t len = std::min({max, maxReadSize, readBuffer.size() - readBufferIndex});
+    std::memcpy(buf, readBuffer.data() + readBufferIndex, len);
+    readBufferIndex += len;
+    return len;
 }
 
 void NibeMockInterface::sendData(const uint8_t* const data, uint8_t len) {
@@ -71,6 +92,49 @@ void NibeMockInterface::sendData(const uint8_t data) {
     ESP_LOGD(TAG, "Send %02X", data);
 }
 
+// data arrives asynchronously from another thread, waitForData() blocks like the RS485 implementation
+class NibeThreadedMockInterface : public NibeMockInterface {
+   public:
+    // appends data to read buffer and wakes up waitForData()
+    void receive(const uint8_t* const data, size_t len) {
+        std::lock_guard<std::mutex> lock(mutex);
+        readBuffer.insert(readBuffer.end(), data, data + len);
+        receiveTime = std::chrono::steady_clock::now();
+        dataReceived.notify_one();
+    }
+
+    // NibeInterface
+    virtual bool waitForData(uint32_t timeoutMs) {
+        std::unique_lock<std::mutex> lock(mutex);
+        waitForDataCnt++;
+        return dataReceived.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                                     [this] { return readBufferIndex < readBuffer.size(); });
+    }
+    virtual bool isDataAvailable() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return NibeMockInterface::isDataAvailable();
+    }
+    virtual int read(uint8_t* buf, size_t max) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return NibeMockInterface::read(buf, max);
+    }
+    virtual void sendData(const uint8_t data) {
+        std::lock_guard<std::mutex> lock(mutex);
+        NibeMockInterface::sendData(data);
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - receiveTime);
+        maxLatencyUs = std::max(maxLatencyUs, (int64_t)latency.count());
+        sendDataCnt++;
+    }
+
+    int64_t maxLatencyUs = 0;
+    std::atomic<int> sendDataCnt = 0;
+
+   private:
+    std::mutex mutex;
+    std::condition_variable dataReceived;
+    std::chrono::steady_clock::time_point receiveTime;
+};
+
 class NibeMockCallback : public NibeGwCallback {
    public:
     NibeMockCallback() { reset(); }
@@ -200,7 +264,8 @@ TEST_CASE("dataToString", "[nibegw]") {
 TEST_CASE("read token", "[nibegw]") {
     NibeMockInterface interface;
     NibeMockCallback callback;
-    NibeGw gw(interface);
+    Metrics metrics;
+    NibeGw gw(interface, metrics);
     gw.setNibeGwCallback(callback);
 
     uint8_t data[] = {0x5C, 0x00, 0x20, 0x69, 0x00, 0x49};
@@ -220,7 +285,8 @@ TEST_CASE("read token", "[nibegw]") {
 TEST_CASE("read response", "[nibegw]") {
     NibeMockInterface interface;
     NibeMockCallback callback;
-    NibeGw gw(interface);
+    Metrics metrics;
+    NibeGw gw(interface, metrics);
     gw.setNibeGwCallback(callback);
 
     uint8_t data[] = {0x5C, 0x00, 0x20, 0x6A, 0x06, 0x44, 0x9C, 0x6E, 0x00, 0x00, 0x80, 0x7A};
@@ -245,7 +311,8 @@ TEST_CASE("read response", "[nibegw]") {
 TEST_CASE("write token", "[nibegw]") {
     NibeMockInterface interface;
     NibeMockCallback callback;
-    NibeGw gw(interface);
+    Metrics metrics;
+    NibeGw gw(interface, metrics);
     gw.setNibeGwCallback(callback);
 
     uint8_t data[] = {0x5C, 0x00, 0x20, 0x6B, 0x00, 0x4B};
@@ -265,7 +332,8 @@ TEST_CASE("write token", "[nibegw]") {
 TEST_CASE("non-modbus address", "[nibegw]") {
     NibeMockInterface interface;
     NibeMockCallback callback;
-    NibeGw gw(interface);
+    Metrics metrics;
+    NibeGw gw(interface, metrics);
     gw.setNibeGwCallback(callback);
 
     uint8_t data[] = {0x5C, 0x41, 0xC9, 0x69, 0x00, 0xE1};
@@ -284,7 +352,8 @@ TEST_CASE("non-modbus address", "[nibegw]") {
 TEST_CASE("wrong CRC", "[nibegw]") {
     NibeMockInterface interface;
     NibeMockCallback callback;
-    NibeGw gw(interface);
+    Metrics metrics;
+    NibeGw gw(interface, metrics);
     gw.setNibeGwCallback(callback);
 
     uint8_t data[] = {0x5C, 0x00, 0x20, 0x69, 0x00, 0xFF};
@@ -303,7 +372,8 @@ TEST_CASE("wrong CRC", "[nibegw]") {
 TEST_CASE("find response start", "[nibegw]") {
     NibeMockInterface interface;
     NibeMockCallback callback;
-    NibeGw gw(interface);
+    Metrics metrics;
+    NibeGw gw(interface, metrics);
     gw.setNibeGwCallback(callback);
 
     uint8_t data[] = {0x00, 0x01, 0x22, 0x5C, 0x00, 0x20, 0x69, 0x00, 0x49, 0x99, 0xaa};
@@ -319,7 +389,8 @@ TEST_CASE("find response start", "[nibegw]") {
 
 TEST_CASE("protocol handling w/o callback", "[nibegw]") {
     NibeMockInterface interface;
-    NibeGw gw(interface);
+    Metrics metrics;
+    NibeGw gw(interface, metrics);
 
     uint8_t data[] = {0x00, 0x01, 0x22, 0x5C, 0x00, 0x20, 0x69, 0x00, 0x49, 0x99, 0xaa};
     interface.setReadData(data, sizeof(data));
@@ -333,7 +404,8 @@ TEST_CASE("protocol handling w/o callback", "[nibegw]") {
 TEST_CASE("read on 'slow' interface", "[nibegw]") {
     NibeMockInterface interface;
     NibeMockCallback callback;
-    NibeGw gw(interface);
+    Metrics metrics;
+    NibeGw gw(interface, metrics);
     gw.setNibeGwCallback(callback);
 
     uint8_t data[] = {0x00, 0x5C, 0x00, 0x20, 0x6A, 0x04, 0x44, 0x9C, 0x6E, 0x80, 0x78, 0x00};
@@ -356,7 +428,8 @@ TEST_CASE("read on 'slow' interface", "[nibegw]") {
 TEST_CASE("deduplicate 5C in response data", "[nibegw]") {
     NibeMockInterface interface;
     NibeMockCallback callback;
-    NibeGw gw(interface);
+    Metrics metrics;
+    NibeGw gw(interface, metrics);
     gw.setNibeGwCallback(callback);
 
     // 5C 0020 6A 07 0102 5C5C E6 05 00 AD
@@ -389,3 +462,226 @@ TEST_CASE("deduplicate 5C in response data", "[nibegw]") {
     // check ACK
     interface.assertWriteData((uint8_t[]){0x06}, 1);
 }
+
+TEST_CASE("read in chunks", "[nibegw]") {
+    NibeMockInterface interface;
+    NibeMockCallback callback;
+    Metrics metrics;
+    NibeGw gw(interface, metrics);
+    gw.setNibeGwCallback(callback);
+
+    // garbage, read token, read response with duplicated 5C; split at every possible chunk size
+    uint8_t data[] = {0x00, 0x5C, 0x41, 0x5C, 0x00, 0x20, 0x69, 0x00, 0x49, 0x99, 0x5C, 0x00, 0x20,
+                      0x6A, 0x07, 0x01, 0x02, 0x5C, 0x5C, 0xE6, 0x05, 0x00, 0xAD};
+    for (size_t chunk = 1; chunk <= sizeof(data); chunk++) {
+        callback.reset();
+        interface.setMaxReadSize(chunk);
+        interface.setReadData(data, sizeof(data));
+        gw.stateMachineLoop();
+
+        TEST_ASSERT_EQUAL(eState::STATE_WAIT_START, gw.getState());
+        TEST_ASSERT_EQUAL(1, callback.onMessageReceivedCnt);
+        TEST_ASSERT_EQUAL(1, callback.onReadTokenReceivedCnt);
+        TEST_ASSERT_EQUAL(12, callback.lastMessageReceivedLen);
+        TEST_ASSERT_EQUAL(6, callback.lastMessageReceived->len);
+        uint8_t expected[] = {0x5c, 0xe6, 0x05, 0x00};
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, callback.lastMessageReceived->readResponse.value, 4);
+    }
+}
+
+TEST_CASE("too long message", "[nibegw]") {
+    NibeMockInterface interface;
+    NibeMockCallback callback;
+    Metrics metrics;
+    NibeGw gw(interface, metrics);
+    gw.setNibeGwCallback(callback);
+
+    // len = 0xFF doesn't fit into buffer -> message is dropped, next frame is found
+    std::vector<uint8_t> data = {0x5C, 0x00, 0x20, 0x68, 0xFF};
+    data.resize(data.size() + 0xFF + 1, 0x01);
+    data.insert(data.end(), {0x5C, 0x00, 0x20, 0x69, 0x00, 0x49});
+    interface.setReadData(data.data(), data.size());
+
+    gw.stateMachineLoop();
+    TEST_ASSERT_EQUAL(eState::STATE_WAIT_START, gw.getState());
+    TEST_ASSERT_EQUAL(0, callback.onMessageReceivedCnt);
+    TEST_ASSERT_EQUAL(1, callback.onReadTokenReceivedCnt);
+}
+
+// compares byte-wise (1 byte per read() call) with span-wise parsing, results are logged only
+TEST_CASE("parser throughput", "[nibegw][benchmark]") {
+    // typical bus traffic: data message, token for other device, read token
+    uint8_t dataMsg[] = {0x5C, 0x00, 0x20, 0x68, 0x50, 0x44, 0x9C, 0x00, 0x00, 0x45, 0x9C, 0x01, 0x01, 0x46, 0x9C, 0x02, 0x02,
+                         0x47, 0x9C, 0x03, 0x03, 0x48, 0x9C, 0x04, 0x04, 0x49, 0x9C, 0x05, 0x05, 0x4A, 0x9C, 0x06, 0x06, 0x4B,
+                         0x9C, 0x07, 0x07, 0x4C, 0x9C, 0x08, 0x08, 0x4D, 0x9C, 0x09, 0x09, 0x4E, 0x9C, 0x0A, 0x0A, 0x4F, 0x9C,
+                         0x0B, 0x0B, 0x50, 0x9C, 0x0C, 0x0C, 0x51, 0x9C, 0x0D, 0x0D, 0x52, 0x9C, 0x0E, 0x0E, 0x53, 0x9C, 0x0F,
+                         0x0F, 0x54, 0x9C, 0x10, 0x10, 0x55, 0x9C, 0x11, 0x11, 0x56, 0x9C, 0x12, 0x12, 0x57, 0x9C, 0x13, 0x13,
+                         0x00};
+    dataMsg[sizeof(dataMsg) - 1] = NibeGw::calcCheckSum(dataMsg + 1, sizeof(dataMsg) - 2);
+    uint8_t otherDevice[] = {0x5C, 0x41, 0xC9, 0x69, 0x00, 0xE1};
+    uint8_t readToken[] = {0x5C, 0x00, 0x20, 0x69, 0x00, 0x49};
+
+    const int frames = 2000;
+    std::vector<uint8_t> data;
+    for (int i = 0; i < frames; i++) {
+        data.insert(data.end(), dataMsg, dataMsg + sizeof(dataMsg));
+        data.insert(data.end(), otherDevice, otherDevice + sizeof(otherDevice));
+        data.insert(data.end(), readToken, readToken + sizeof(readToken));
+    }
+
+    size_t readSizes[] = {1, NIBE_GW_READ_CHUNK_SIZE};
+    for (size_t readSize : readSizes) {
+        NibeMockInterface interface;
+        NibeMockCallback callback;
+        Metrics metrics;
+        NibeGw gw(interface, metrics);
+        gw.setNibeGwCallback(callback);
+        interface.setMaxReadSize(readSize);
+        interface.setReadData(data.data(), data.size());
+
+        auto start = std::chrono::steady_clock::now();
+        gw.stateMachineLoop();
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+        TEST_ASSERT_EQUAL(frames, callback.onMessageReceivedCnt);
+        TEST_ASSERT_EQUAL(frames, callback.onReadTokenReceivedCnt);
+        ESP_LOGI(TAG, "read size %d: %d bytes in %lld us, %.1f MB/s", (int)readSize, (int)data.size(), (long long)duration.count(),
+                 duration.count() > 0 ? (double)data.size() / duration.count() : 0.0);
+    }
+}
+
+TEST_CASE("loop waits for data", "[nibegw]") {
+    NibeMockInterface interface;
+    NibeMockCallback callback;
+    Metrics metrics;
+    NibeGw gw(interface, metrics);
+    gw.setNibeGwCallback(callback);
+
+    // no data -> nothing processed
+    gw.loop();
+    TEST_ASSERT_EQUAL(1, interface.waitForDataCnt);
+    interface.assertWriteData((uint8_t[]){}, 0);
+
+    // all available data is processed in one wake-up
+    uint8_t data[] = {0x5C, 0x00, 0x20, 0x69, 0x00, 0x49, 0x5C, 0x00, 0x20, 0x6B, 0x00, 0x4B};
+    interface.setMaxReadSize(4);
+    interface.setReadData(data, sizeof(data));
+    gw.loop();
+    TEST_ASSERT_EQUAL(2, interface.waitForDataCnt);
+    TEST_ASSERT_EQUAL(1, callback.onReadTokenReceivedCnt);
+    TEST_ASSERT_EQUAL(1, callback.onWriteTokenReceivedCnt);
+    TEST_ASSERT_FALSE(interface.isDataAvailable());
+}
+
+TEST_CASE("token response latency", "[nibegw]") {
+    NibeThreadedMockInterface interface;
+    NibeMockCallback callback;
+    Metrics metrics;
+    NibeGw gw(interface, metrics);
+    gw.setNibeGwCallback(callback);
+
+    // heat pump sends a read token every 10ms
+    const int tokens = 20;
+    std::thread heatpump([&interface] {
+        uint8_t readToken[] = {0x5C, 0x00, 0x20, 0x69, 0x00, 0x49};
+        for (int i = 0; i < tokens; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            interface.receive(readToken, sizeof(readToken));
+        }
+    });
+
+    auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (interface.sendDataCnt < tokens && std::chrono::steady_clock::now() < timeout) {
+        gw.loop();
+    }
+    heatpump.join();
+
+    TEST_ASSERT_EQUAL(tokens, callback.onReadTokenReceivedCnt);
+    TEST_ASSERT_EQUAL(tokens, interface.sendDataCnt);
+    // 1ms polling would need ~200 wake-ups, event driven ~1 per token (+ spurious wake-ups)
+    ESP_LOGI(TAG, "wake-ups: %d, max token response latency: %lld us", interface.waitForDataCnt, (long long)interface.maxLatencyUs);
+    TEST_ASSERT_LESS_THAN(2 * tokens + 1, interface.waitForDataCnt);
+}
+
+TEST_CASE("response time metrics", "[nibegw]") {
+    NibeMockInterface interface;
+    NibeMockCallback callback;
+    Metrics metrics;
+    NibeGw gw(interface, metrics);
+    gw.setNibeGwCallback(callback);
+
+    // read token, write token, read response, data message w/o registers
+    uint8_t data[] = {0x5C, 0x00, 0x20, 0x69, 0x00, 0x49, 0x5C, 0x00, 0x20, 0x6B, 0x00, 0x4B, 0x5C, 0x00, 0x20, 0x6A,
+                      0x06, 0x44, 0x9C, 0x6E, 0x00, 0x00, 0x80, 0x7A, 0x5C, 0x00, 0x20, 0x68, 0x00, 0x48};
+    interface.setReadData(data, sizeof(data));
+    gw.stateMachineLoop();
+    TEST_ASSERT_EQUAL(1, callback.onReadTokenReceivedCnt);
+    TEST_ASSERT_EQUAL(1, callback.onWriteTokenReceivedCnt);
+    TEST_ASSERT_EQUAL(2, callback.onMessageReceivedCnt);
+
+    std::string s = metrics.getAllMetricsAsString();
+    TEST_ASSERT_TRUE(s.contains(R"(nibegw_token_response_seconds_count{token="read"} 1)"));
+    TEST_ASSERT_TRUE(s.contains(R"(nibegw_token_response_seconds_count{token="write"} 1)"));
+    TEST_ASSERT_TRUE(s.contains(R"(nibegw_callback_seconds_count{cmd="ModbusReadReq"} 1)"));
+    TEST_ASSERT_TRUE(s.contains(R"(nibegw_callback_seconds_count{cmd="ModbusWriteReq"} 1)"));
+    TEST_ASSERT_TRUE(s.contains(R"(nibegw_callback_seconds_count{cmd="ModbusReadResp"} 1)"));
+    TEST_ASSERT_TRUE(s.contains(R"(nibegw_callback_seconds_count{cmd="ModbusDataMsg"} 1)"));
+    TEST_ASSERT_TRUE(s.contains(R"(nibegw_callback_seconds_count{cmd="ModbusWriteResp"} 0)"));
+    // mock interface and callback are fast
+    TEST_ASSERT_TRUE(s.contains(R"(nibegw_token_response_seconds_bucket{token="read",le="0.001000"} 1)"));
+}
+
+TEST_CASE("protocol statistics", "[nibegw]") {
+    NibeMockInterface interface;
+    NibeMockCallback callback;
+    Metrics metrics;
+    NibeGw gw(interface, metrics);
+    gw.setNibeGwCallback(callback);
+
+    std::vector<uint8_t> data = {
+        0x00, 0x01, 0x02,                    // garbage
+        0x5C, 0x41, 0xC9, 0x69, 0x00, 0xE1,  // other device
+        0x5C, 0x00, 0x21,                    // other device
+        0x5C, 0x00, 0x20, 0x69, 0x00, 0x49,  // read token
+        0x5C, 0x00, 0x20, 0x6B, 0x00, 0xFF,  // write token with wrong CRC
+        0x5C, 0x00, 0x20, 0x6D, 0x00, 0x4D,  // product info
+        0x5C, 0x00, 0x20, 0x68, 0xFF,        // too long message
+    };
+    data.resize(data.size() + 0xFF, 0x01);
+    interface.setReadData(data.data(), data.size());
+    gw.stateMachineLoop();
+
+    TEST_ASSERT_EQUAL(1, metrics.findMetric(R"(nibegw_frames_total{cmd="ModbusReadReq"})")->getValue());
+    TEST_ASSERT_EQUAL(0, metrics.findMetric(R"(nibegw_frames_total{cmd="ModbusWriteReq"})")->getValue());
+    TEST_ASSERT_EQUAL(0, metrics.findMetric(R"(nibegw_frames_total{cmd="ModbusDataMsg"})")->getValue());
+    TEST_ASSERT_EQUAL(1, metrics.findMetric(R"(nibegw_frames_total{cmd="other"})")->getValue());
+    TEST_ASSERT_EQUAL(1, metrics.findMetric("nibegw_checksum_errors_total")->getValue());
+    TEST_ASSERT_EQUAL(1, metrics.findMetric("nibegw_naks_total")->getValue());
+    TEST_ASSERT_EQUAL(1, metrics.findMetric("nibegw_oversize_frames_total")->getValue());
+    // checksum failure, too long message
+    TEST_ASSERT_EQUAL(2, metrics.findMetric("nibegw_resyncs_total")->getValue());
+    TEST_ASSERT_EQUAL(data.size(), metrics.findMetric("nibegw_received_bytes_total")->getValue());
+    // garbage 3 + other device 6 + other device 3 + wrong CRC 6 + too long message 128 + remaining data bytes
+    TEST_ASSERT_EQUAL(3 + 6 + 3 + 6 + 128 + (0xFF - 123), metrics.findMetric("nibegw_discarded_bytes_total")->getValue());
+    TEST_ASSERT_EQUAL(data.size() - 2 * 6, metrics.findMetric("nibegw_discarded_bytes_total")->getValue());
+}
+
+TEST_CASE("receive rate", "[nibegw]") {
+    NibeMockInterface interface;
+    Metrics metrics;
+    NibeGw gw(interface, metrics);
+    Metric* rate = metrics.findMetric("nibegw_receive_rate_bytes_per_second");
+
+    // start new interval
+    int64_t now = 1000000000000ll;
+    gw.updateReceiveRate(now);
+
+    uint8_t data[96] = {};
+    for (int i = 0; i < 100; i++) {
+        gw.processData(data, sizeof(data));
+    }
+    gw.updateReceiveRate(now + NIBE_GW_RATE_INTERVAL_MS * 1000 - 1);
+    TEST_ASSERT_EQUAL(0, rate->getValue());
+    gw.updateReceiveRate(now + NIBE_GW_RATE_INTERVAL_MS * 1000);
+    TEST_ASSERT_EQUAL_STRING("nibegw_receive_rate_bytes_per_second 960.0", rate->getValueAsString().c_str());
+}
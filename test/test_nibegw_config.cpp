@@ -1,8 +1,8 @@
 #include <esp_log.h>
 #include <unity.h>
 
-#include <exception>
-#include <stdexcept>
+#include <chrono>
+#include <cstring>
 
 #include "nibegw_config.h"
 
@@ -119,138 +119,301 @@ TEST_CASE("encodeData", "[nibegw_config]") {
     TEST_ASSERT_FALSE(r.encodeData("1", data));
 }
 
-void testParseSignedNumberException(const NibeRegister& r, const char* number) {
-    try {
-        r.parseSignedNumber(number);
-        TEST_FAIL_MESSAGE("Expected std::invalid_argument exception");
-    } catch (std::invalid_argument& e) {
-        // expected
-    } catch (...) {
-        // linux target: throws std::invalid_argument but it is not caught by the catch block above
-        // libc++abi: terminating due to uncaught exception of type std::invalid_argument: stoi: no conversion
-    }
+static int32_t parseSigned(const NibeRegister& r, const char* number) {
+    int32_t value = 0;
+    TEST_ASSERT_EQUAL_MESSAGE(ESP_OK, r.parseSignedNumber(number, value), number);
+    return value;
+}
+
+static esp_err_t parseSignedError(const NibeRegister& r, const char* number) {
+    int32_t value = 0;
+    return r.parseSignedNumber(number, value);
 }
 
 TEST_CASE("parseSignedNumber", "[nibegw_config]") {
     NibeRegister r = {0, "", NibeRegisterUnit::NoUnit, NibeRegisterDataType::UInt8, 1, 0, 0, 0, NibeRegisterMode::Read};
 
-    TEST_ASSERT_EQUAL(0, r.parseSignedNumber("0"));
-    TEST_ASSERT_EQUAL(1, r.parseSignedNumber("1"));
-    TEST_ASSERT_EQUAL(1, r.parseSignedNumber("1."));
-    TEST_ASSERT_EQUAL(1, r.parseSignedNumber("1.1"));
-    TEST_ASSERT_EQUAL(10, r.parseSignedNumber("10"));
-    TEST_ASSERT_EQUAL(-1000, r.parseSignedNumber("-1000"));
+    TEST_ASSERT_EQUAL(0, parseSigned(r, "0"));
+    TEST_ASSERT_EQUAL(1, parseSigned(r, "1"));
+    TEST_ASSERT_EQUAL(1, parseSigned(r, "1."));
+    TEST_ASSERT_EQUAL(1, parseSigned(r, "1.1"));
+    TEST_ASSERT_EQUAL(10, parseSigned(r, "10"));
+    TEST_ASSERT_EQUAL(-1000, parseSigned(r, "-1000"));
+    TEST_ASSERT_EQUAL(INT32_MIN, parseSigned(r, "-2147483648"));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, parseSignedError(r, "2147483648"));
     // bad number format
-    testParseSignedNumberException(r, "x");
-    testParseSignedNumberException(r, "");
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parseSignedError(r, "x"));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parseSignedError(r, ""));
 
     r.factor = 10;
-    TEST_ASSERT_EQUAL(0, r.parseSignedNumber("0"));
-    TEST_ASSERT_EQUAL(1, r.parseSignedNumber("0.1"));
-    TEST_ASSERT_EQUAL(10, r.parseSignedNumber("1"));
-    TEST_ASSERT_EQUAL(10, r.parseSignedNumber("1."));
-    TEST_ASSERT_EQUAL(10, r.parseSignedNumber("1.0"));
-    TEST_ASSERT_EQUAL(10, r.parseSignedNumber("1.00"));
-    TEST_ASSERT_EQUAL(-1001, r.parseSignedNumber("-100.1"));
-    TEST_ASSERT_EQUAL(-1001, r.parseSignedNumber("-100.123"));
+    TEST_ASSERT_EQUAL(0, parseSigned(r, "0"));
+    TEST_ASSERT_EQUAL(1, parseSigned(r, "0.1"));
+    TEST_ASSERT_EQUAL(10, parseSigned(r, "1"));
+    TEST_ASSERT_EQUAL(10, parseSigned(r, "1."));
+    TEST_ASSERT_EQUAL(10, parseSigned(r, "1.0"));
+    TEST_ASSERT_EQUAL(10, parseSigned(r, "1.00"));
+    TEST_ASSERT_EQUAL(-1001, parseSigned(r, "-100.1"));
+    TEST_ASSERT_EQUAL(-1001, parseSigned(r, "-100.123"));
     // bad number format
-    testParseSignedNumberException(r, "x");
-    testParseSignedNumberException(r, "");
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parseSignedError(r, "x"));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parseSignedError(r, ""));
 
     r.factor = 100;
-    TEST_ASSERT_EQUAL(0, r.parseSignedNumber("0.00"));
-    TEST_ASSERT_EQUAL(1, r.parseSignedNumber("0.01"));
-    TEST_ASSERT_EQUAL(10, r.parseSignedNumber("0.10"));
-    TEST_ASSERT_EQUAL(100, r.parseSignedNumber("1"));
-    TEST_ASSERT_EQUAL(100, r.parseSignedNumber("1."));
-    TEST_ASSERT_EQUAL(100, r.parseSignedNumber("1.0"));
-    TEST_ASSERT_EQUAL(100, r.parseSignedNumber("1.00"));
-    TEST_ASSERT_EQUAL(100, r.parseSignedNumber("1.000"));
-    TEST_ASSERT_EQUAL(-1005, r.parseSignedNumber("-10.05"));
-    TEST_ASSERT_EQUAL(-1005, r.parseSignedNumber("-10.0599"));
+    TEST_ASSERT_EQUAL(0, parseSigned(r, "0.00"));
+    TEST_ASSERT_EQUAL(1, parseSigned(r, "0.01"));
+    TEST_ASSERT_EQUAL(10, parseSigned(r, "0.10"));
+    TEST_ASSERT_EQUAL(100, parseSigned(r, "1"));
+    TEST_ASSERT_EQUAL(100, parseSigned(r, "1."));
+    TEST_ASSERT_EQUAL(100, parseSigned(r, "1.0"));
+    TEST_ASSERT_EQUAL(100, parseSigned(r, "1.00"));
+    TEST_ASSERT_EQUAL(100, parseSigned(r, "1.000"));
+    TEST_ASSERT_EQUAL(-1005, parseSigned(r, "-10.05"));
+    TEST_ASSERT_EQUAL(-1005, parseSigned(r, "-10.0599"));
     // bad number format
-    testParseSignedNumberException(r, "x");
-    testParseSignedNumberException(r, "");
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parseSignedError(r, "x"));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parseSignedError(r, ""));
 
     r.factor = 2;
-    TEST_ASSERT_EQUAL(0, r.parseSignedNumber("0"));
-    TEST_ASSERT_EQUAL(1, r.parseSignedNumber("0.5"));
-    TEST_ASSERT_EQUAL(10, r.parseSignedNumber("5.0"));
-    TEST_ASSERT_EQUAL(-1001, r.parseSignedNumber("-500.5000"));
+    TEST_ASSERT_EQUAL(0, parseSigned(r, "0"));
+    TEST_ASSERT_EQUAL(1, parseSigned(r, "0.5"));
+    TEST_ASSERT_EQUAL(10, parseSigned(r, "5.0"));
+    TEST_ASSERT_EQUAL(-1001, parseSigned(r, "-500.5000"));
     // bad number format
-    testParseSignedNumberException(r, "x");
-    testParseSignedNumberException(r, "");
-}
-
-void testParseUnsignedNumberException(const NibeRegister& c, const char* number) {
-    try {
-        c.parseUnsignedNumber(number);
-        TEST_FAIL_MESSAGE("Expected std::invalid_argument exception");
-    } catch (std::invalid_argument& e) {
-        // expected
-    } catch (...) {
-        // linux target: throws std::invalid_argument but it is not caught by the catch block above
-        // libc++abi: terminating due to uncaught exception of type std::invalid_argument: stoi: no conversion
-    }
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parseSignedError(r, "x"));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parseSignedError(r, ""));
+}
+
+static uint32_t parseUnsigned(const NibeRegister& r, const char* number) {
+    uint32_t value = 0;
+    TEST_ASSERT_EQUAL_MESSAGE(ESP_OK, r.parseUnsignedNumber(number, value), number);
+    return value;
+}
+
+static esp_err_t parseUnsignedError(const NibeRegister& r, const char* number) {
+    uint32_t value = 0;
+    return r.parseUnsignedNumber(number, value);
 }
 
 TEST_CASE("parseUnsignedNumber", "[nibegw_config]") {
     NibeRegister r = {0, "", NibeRegisterUnit::NoUnit, NibeRegisterDataType::UInt8, 1, 0, 0, 0, NibeRegisterMode::Read};
 
-    TEST_ASSERT_EQUAL(0, r.parseUnsignedNumber("0"));
-    TEST_ASSERT_EQUAL(1, r.parseUnsignedNumber("1"));
-    TEST_ASSERT_EQUAL(1, r.parseUnsignedNumber("1."));
-    TEST_ASSERT_EQUAL(1, r.parseUnsignedNumber("1.1"));
-    TEST_ASSERT_EQUAL(10, r.parseUnsignedNumber("10"));
-    TEST_ASSERT_EQUAL(4294967295, r.parseUnsignedNumber("4294967295"));
-    TEST_ASSERT_EQUAL(4294967295, r.parseUnsignedNumber("-1"));  // not exactly nice but that's how std::stoul works
+    TEST_ASSERT_EQUAL(0, parseUnsigned(r, "0"));
+    TEST_ASSERT_EQUAL(1, parseUnsigned(r, "1"));
+    TEST_ASSERT_EQUAL(1, parseUnsigned(r, "1."));
+    TEST_ASSERT_EQUAL(1, parseUnsigned(r, "1.1"));
+    TEST_ASSERT_EQUAL(10, parseUnsigned(r, "10"));
+    TEST_ASSERT_EQUAL(4294967295, parseUnsigned(r, "4294967295"));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, parseUnsignedError(r, "-1"));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, parseUnsignedError(r, "4294967296"));
     // bad number format
-    testParseUnsignedNumberException(r, "x");
-    testParseUnsignedNumberException(r, "");
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parseUnsignedError(r, "x"));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parseUnsignedError(r, ""));
 
     r.factor = 10;
-    TEST_ASSERT_EQUAL(0, r.parseUnsignedNumber("0"));
-    TEST_ASSERT_EQUAL(1, r.parseUnsignedNumber("0.1"));
-    TEST_ASSERT_EQUAL(10, r.parseUnsignedNumber("1"));
-    TEST_ASSERT_EQUAL(10, r.parseUnsignedNumber("1."));
-    TEST_ASSERT_EQUAL(10, r.parseUnsignedNumber("1.0"));
-    TEST_ASSERT_EQUAL(10, r.parseUnsignedNumber("1.00"));
-    TEST_ASSERT_EQUAL(4294967290, r.parseUnsignedNumber("429496729"));
+    TEST_ASSERT_EQUAL(0, parseUnsigned(r, "0"));
+    TEST_ASSERT_EQUAL(1, parseUnsigned(r, "0.1"));
+    TEST_ASSERT_EQUAL(10, parseUnsigned(r, "1"));
+    TEST_ASSERT_EQUAL(10, parseUnsigned(r, "1."));
+    TEST_ASSERT_EQUAL(10, parseUnsigned(r, "1.0"));
+    TEST_ASSERT_EQUAL(10, parseUnsigned(r, "1.00"));
+    TEST_ASSERT_EQUAL(4294967290, parseUnsigned(r, "429496729"));
     // bad number format
-    testParseUnsignedNumberException(r, "x");
-    testParseUnsignedNumberException(r, "");
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parseUnsignedError(r, "x"));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parseUnsignedError(r, ""));
 
     r.factor = 100;
-    TEST_ASSERT_EQUAL(0, r.parseUnsignedNumber("0.00"));
-    TEST_ASSERT_EQUAL(1, r.parseUnsignedNumber("0.01"));
-    TEST_ASSERT_EQUAL(10, r.parseUnsignedNumber("0.10"));
-    TEST_ASSERT_EQUAL(100, r.parseUnsignedNumber("1"));
-    TEST_ASSERT_EQUAL(100, r.parseUnsignedNumber("1."));
-    TEST_ASSERT_EQUAL(100, r.parseUnsignedNumber("1.0"));
-    TEST_ASSERT_EQUAL(100, r.parseUnsignedNumber("1.00"));
-    TEST_ASSERT_EQUAL(100, r.parseUnsignedNumber("1.000"));
-    TEST_ASSERT_EQUAL(4294967200, r.parseUnsignedNumber("42949672"));
+    TEST_ASSERT_EQUAL(0, parseUnsigned(r, "0.00"));
+    TEST_ASSERT_EQUAL(1, parseUnsigned(r, "0.01"));
+    TEST_ASSERT_EQUAL(10, parseUnsigned(r, "0.10"));
+    TEST_ASSERT_EQUAL(100, parseUnsigned(r, "1"));
+    TEST_ASSERT_EQUAL(100, parseUnsigned(r, "1."));
+    TEST_ASSERT_EQUAL(100, parseUnsigned(r, "1.0"));
+    TEST_ASSERT_EQUAL(100, parseUnsigned(r, "1.00"));
+    TEST_ASSERT_EQUAL(100, parseUnsigned(r, "1.000"));
+    TEST_ASSERT_EQUAL(4294967200, parseUnsigned(r, "42949672"));
     // bad number format
-    testParseUnsignedNumberException(r, "x");
-    testParseUnsignedNumberException(r, "");
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parseUnsignedError(r, "x"));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parseUnsignedError(r, ""));
 
     r.factor = 2;
-    TEST_ASSERT_EQUAL(0, r.parseUnsignedNumber("0"));
-    TEST_ASSERT_EQUAL(1, r.parseUnsignedNumber("0.5"));
-    TEST_ASSERT_EQUAL(10, r.parseUnsignedNumber("5.0"));
-    TEST_ASSERT_EQUAL(4294967295, r.parseUnsignedNumber("2147483647"));  // precision problem
+    TEST_ASSERT_EQUAL(0, parseUnsigned(r, "0"));
+    TEST_ASSERT_EQUAL(1, parseUnsigned(r, "0.5"));
+    TEST_ASSERT_EQUAL(10, parseUnsigned(r, "5.0"));
+    TEST_ASSERT_EQUAL(4294967294, parseUnsigned(r, "2147483647"));  // exact, no floating point
     // bad number format
-    testParseUnsignedNumberException(r, "x");
-    testParseUnsignedNumberException(r, "");
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parseUnsignedError(r, "x"));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, parseUnsignedError(r, ""));
+}
+
+struct ParseTestCase {
+    const char* input;
+    int factor;
+    esp_err_t err;
+    int32_t value;
+};
+
+// table of edge cases, parsed by signed and (if not negative) unsigned parser
+static const ParseTestCase parseTestCases[] = {
+    {"0", 1, ESP_OK, 0},
+    {"-0", 1, ESP_OK, 0},
+    {"-0.05", 10, ESP_OK, 0},
+    {".5", 10, ESP_OK, 5},
+    {"5.", 10, ESP_OK, 50},
+    {"21.56", 10, ESP_OK, 215},
+    {"-21.56", 10, ESP_OK, -215},
+    {"0.001", 1000, ESP_OK, 1},
+    {"1.2345", 1000, ESP_OK, 1234},
+    {"1.23456789012345", 10000, ESP_OK, 12345},
+    {"00012", 1, ESP_OK, 12},
+    {"214748364.7", 10, ESP_OK, INT32_MAX},
+    {"-214748364.8", 10, ESP_OK, INT32_MIN},
+    {"214748364.8", 10, ESP_ERR_INVALID_SIZE, 0},
+    {"99999999999999999999", 1, ESP_ERR_INVALID_SIZE, 0},
+    {"", 1, ESP_ERR_INVALID_ARG, 0},
+    {"-", 1, ESP_ERR_INVALID_ARG, 0},
+    {".", 10, ESP_ERR_INVALID_ARG, 0},
+    {"-.", 10, ESP_ERR_INVALID_ARG, 0},
+    {"--1", 1, ESP_ERR_INVALID_ARG, 0},
+    {"+1", 1, ESP_ERR_INVALID_ARG, 0},
+    {" 1", 1, ESP_ERR_INVALID_ARG, 0},
+    {"1 ", 1, ESP_ERR_INVALID_ARG, 0},
+    {"1.2.3", 10, ESP_ERR_INVALID_ARG, 0},
+    {"1,5", 10, ESP_ERR_INVALID_ARG, 0},
+    {"1e3", 1, ESP_ERR_INVALID_ARG, 0},
+    {"0x10", 1, ESP_ERR_INVALID_ARG, 0},
+    {"nan", 1, ESP_ERR_INVALID_ARG, 0},
+    {"1.5x", 10, ESP_ERR_INVALID_ARG, 0},
+    {"1", 0, ESP_ERR_INVALID_ARG, 0},
+};
+
+TEST_CASE("parse number table", "[nibegw_config]") {
+    NibeRegister r = {0, "", NibeRegisterUnit::NoUnit, NibeRegisterDataType::Int32, 1, 0, 0, 0, NibeRegisterMode::Read};
+    for (const auto& testCase : parseTestCases) {
+        r.factor = testCase.factor;
+        int32_t value = 0;
+        TEST_ASSERT_EQUAL_MESSAGE(testCase.err, r.parseSignedNumber(testCase.input, value), testCase.input);
+        if (testCase.err == ESP_OK) {
+            TEST_ASSERT_EQUAL_MESSAGE(testCase.value, value, testCase.input);
+        }
+        // int32 range errors don't apply to uint32
+        if (testCase.value >= 0 && testCase.input[0] != '-' && testCase.err != ESP_ERR_INVALID_SIZE) {
+            uint32_t unsignedValue = 0;
+            TEST_ASSERT_EQUAL_MESSAGE(testCase.err, r.parseUnsignedNumber(testCase.input, unsignedValue), testCase.input);
+            if (testCase.err == ESP_OK) {
+                TEST_ASSERT_EQUAL_MESSAGE(testCase.value, unsignedValue, testCase.input);
+            }
+        }
+    }
+}
+
+// random values formatted like published values must parse to the same raw value, random input must not crash
+TEST_CASE("parse number fuzz", "[nibegw_config]") {
+    NibeRegister r = {0, "", NibeRegisterUnit::NoUnit, NibeRegisterDataType::Int32, 1, 0, 0, 0, NibeRegisterMode::Read};
+    const int factors[] = {1, 10, 100, 1000};
+    uint32_t seed = 42;
+    auto random = [&seed]() {
+        seed = seed * 1664525 + 1013904223;
+        return seed;
+    };
+    for (int i = 0; i < 10000; i++) {
+        r.factor = factors[random() % 4];
+        int32_t raw = (int32_t)random() >> (random() % 32);
+        std::string formatted = r.formatNumber(raw);
+        int32_t value = 0;
+        TEST_ASSERT_EQUAL_MESSAGE(ESP_OK, r.parseSignedNumber(formatted, value), formatted.c_str());
+        TEST_ASSERT_EQUAL_MESSAGE(raw, value, formatted.c_str());
+    }
+    const char alphabet[] = "0123456789-.+ex ";
+    for (int i = 0; i < 10000; i++) {
+        r.factor = factors[random() % 4];
+        char input[12];
+        size_t length = random() % sizeof(input);
+        for (size_t j = 0; j < length; j++) {
+            input[j] = alphabet[random() % (sizeof(alphabet) - 1)];
+        }
+        int32_t value;
+        esp_err_t err = r.parseSignedNumber(std::string_view(input, length), value);
+        TEST_ASSERT_TRUE(err == ESP_OK || err == ESP_ERR_INVALID_ARG || err == ESP_ERR_INVALID_SIZE);
+    }
+}
+
+TEST_CASE("encodeData validates range", "[nibegw_config]") {
+    NibeRegister r = {0, "", NibeRegisterUnit::NoUnit, NibeRegisterDataType::Int8, 1, 0, 0, 0, NibeRegisterMode::ReadWrite};
+    uint8_t data[4] = {0, 0, 0, 0};
+
+    // data type
+    TEST_ASSERT_TRUE(r.encodeData("-128", data));
+    TEST_ASSERT_TRUE(r.encodeData("127", data));
+    TEST_ASSERT_FALSE(r.encodeData("128", data));
+    TEST_ASSERT_FALSE(r.encodeData("-129", data));
+    r.dataType = NibeRegisterDataType::UInt8;
+    TEST_ASSERT_FALSE(r.encodeData("256", data));
+    TEST_ASSERT_FALSE(r.encodeData("-1", data));
+    r.dataType = NibeRegisterDataType::Int16;
+    TEST_ASSERT_TRUE(r.encodeData("-32768", data));
+    TEST_ASSERT_FALSE(r.encodeData("32768", data));
+    r.dataType = NibeRegisterDataType::UInt16;
+    TEST_ASSERT_TRUE(r.encodeData("65535", data));
+    TEST_ASSERT_FALSE(r.encodeData("65536", data));
+
+    // minValue..maxValue are raw values: 5.0 .. 70.0
+    r.dataType = NibeRegisterDataType::Int16;
+    r.factor = 10;
+    r.minValue = 50;
+    r.maxValue = 700;
+    TEST_ASSERT_TRUE(r.encodeData("5", data));
+    assertNibeRegisterData(data, 50, 0, 0, 0);
+    TEST_ASSERT_TRUE(r.encodeData("70.0", data));
+    TEST_ASSERT_FALSE(r.encodeData("4.9", data));
+    TEST_ASSERT_FALSE(r.encodeData("70.1", data));
+    TEST_ASSERT_FALSE(r.encodeData("-10", data));
+    // single valid value
+    r.minValue = 10;
+    r.maxValue = 10;
+    TEST_ASSERT_TRUE(r.encodeData("1", data));
+    TEST_ASSERT_FALSE(r.encodeData("2", data));
+    // no limits
+    r.minValue = 0;
+    r.maxValue = 0;
+    TEST_ASSERT_TRUE(r.encodeData("-10", data));
+}
+
+// results are logged only
+TEST_CASE("parse number benchmark", "[nibegw_config][benchmark]") {
+    NibeRegister r = {0, "", NibeRegisterUnit::NoUnit, NibeRegisterDataType::Int16, 10, -400, 400, 0, NibeRegisterMode::ReadWrite};
+    const char* inputs[] = {"21.5", "-10.25", "0", "38", "-39.9", "1.", "12.34567", "x"};
+    const int rounds = 100000;
+    uint8_t data[4];
+    int valid = 0;
+    esp_log_level_set("nibegw_config", ESP_LOG_NONE);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        valid += r.encodeData(inputs[i % (sizeof(inputs) / sizeof(inputs[0]))], data);
+    }
+    std::chrono::nanoseconds time = (std::chrono::steady_clock::now() - start) / rounds;
+    esp_log_level_set("nibegw_config", ESP_LOG_INFO);
+    TEST_ASSERT_EQUAL(rounds / 8 * 7, valid);
+    printf("encodeData: %lld ns per value\n", (long long)time.count());
+}
+
+// discovery payload parsed into a JsonDocument, returned component as "_component_"
+static JsonDocument discoveryMessage(const NibeRegister& r, const NibeMqttConfig& config) {
+    JsonDocument deviceDiscoveryInfo;
+    deviceDiscoveryInfo["dev"]["name"] = "Nibe GW";
+    std::string payload;
+    std::string_view component =
+        r.homeassistantDiscoveryMessage(config, "nibegw/nibe/", MqttHelper::toJsonMembers(deviceDiscoveryInfo), payload);
+    JsonDocument doc;
+    TEST_ASSERT_FALSE(deserializeJson(doc, payload));
+    doc["_component_"] = std::string(component);
+    return doc;
 }
 
 TEST_CASE("homeassistantDiscoveryMessage Temperature", "[nibegw_config]") {
     NibeMqttConfig config;
     NibeRegister r = {1, "Temperature",         NibeRegisterUnit::GradCelcius, NibeRegisterDataType::UInt8, 1, 0, 0,
                       0, NibeRegisterMode::Read};
-    JsonDocument deviceDiscoveryInfo;
-    deviceDiscoveryInfo["dev"]["name"] = "Nibe GW";
-    auto doc = r.homeassistantDiscoveryMessage(config, "nibegw/nibe/", deviceDiscoveryInfo);
+    auto doc = discoveryMessage(r, config);
 
     TEST_ASSERT_EQUAL_STRING("sensor", doc["_component_"]);
     TEST_ASSERT_EQUAL_STRING("sensor.nibe-1", doc["def_ent_id"]);
@@ -266,9 +429,7 @@ TEST_CASE("homeassistantDiscoveryMessage Temperature", "[nibegw_config]") {
 TEST_CASE("homeassistantDiscoveryMessage NoUnit", "[nibegw_config]") {
     NibeMqttConfig config;
     NibeRegister r = {1, "No Unit", NibeRegisterUnit::NoUnit, NibeRegisterDataType::UInt8, 1, 0, 0, 0, NibeRegisterMode::Read};
-    JsonDocument deviceDiscoveryInfo;
-    deviceDiscoveryInfo["dev"]["name"] = "Nibe GW";
-    auto doc = r.homeassistantDiscoveryMessage(config, "nibegw/nibe/", deviceDiscoveryInfo);
+    auto doc = discoveryMessage(r, config);
 
     TEST_ASSERT_EQUAL_STRING("sensor", doc["_component_"]);
     TEST_ASSERT_EQUAL_STRING("sensor.nibe-1", doc["def_ent_id"]);
@@ -284,9 +445,7 @@ TEST_CASE("homeassistantDiscoveryMessage Read/write", "[nibegw_config]") {
     NibeMqttConfig config;
     NibeRegister r = {
         1, "Temperature", NibeRegisterUnit::GradCelcius, NibeRegisterDataType::UInt8, 10, 0, 100, 0, NibeRegisterMode::ReadWrite};
-    JsonDocument deviceDiscoveryInfo;
-    deviceDiscoveryInfo["dev"]["name"] = "Nibe GW";
-    auto doc = r.homeassistantDiscoveryMessage(config, "nibegw/nibe/", deviceDiscoveryInfo);
+    auto doc = discoveryMessage(r, config);
 
     TEST_ASSERT_EQUAL_STRING("number", doc["_component_"]);
     TEST_ASSERT_EQUAL_STRING("number.nibe-1", doc["def_ent_id"]);
@@ -302,15 +461,26 @@ TEST_CASE("homeassistantDiscoveryMessage Read/write", "[nibegw_config]") {
     TEST_ASSERT_EQUAL_STRING("Nibe GW", doc["dev"]["name"]);
 }
 
+TEST_CASE("homeassistantDiscoveryMessage JSON state", "[nibegw_config]") {
+    NibeMqttConfig config;
+    config.jsonState = true;
+    NibeRegister r = {
+        1, "Temperature", NibeRegisterUnit::GradCelcius, NibeRegisterDataType::UInt8, 10, 0, 100, 0, NibeRegisterMode::ReadWrite};
+    auto doc = discoveryMessage(r, config);
+
+    TEST_ASSERT_EQUAL_STRING("nibegw/nibe/state", doc["stat_t"]);
+    TEST_ASSERT_EQUAL_STRING("{{ value_json['1'] | default(this.state) }}", doc["val_tpl"]);
+    TEST_ASSERT_EQUAL_STRING("nibegw/nibe/1/set", doc["cmd_t"]);
+}
+
 TEST_CASE("homeassistantDiscoveryMessage Override", "[nibegw_config]") {
     NibeMqttConfig config;
-    config.homeassistantDiscoveryOverrides[1] =
-        R"({"_component_":"mysensor","unit_of_meas":"Grad Celsius", "dev_cla":null, "added":123, "removeNonexistingKey":null})";
+    TEST_ASSERT_EQUAL(ESP_OK, MqttHelper::parseMqttDiscoveryInfoOverride(
+                                  R"({"_component_":"mysensor","unit_of_meas":"Grad Celsius", "dev_cla":null, "added":123, "removeNonexistingKey":null})",
+                                  config.homeassistantDiscoveryOverrides[1]));
     NibeRegister r = {1, "Override", NibeRegisterUnit::GradCelcius, NibeRegisterDataType::UInt8, 1, 0,
                       0, 0,          NibeRegisterMode::Read};
-    JsonDocument deviceDiscoveryInfo;
-    deviceDiscoveryInfo["dev"]["name"] = "Nibe GW";
-    auto doc = r.homeassistantDiscoveryMessage(config, "nibegw/nibe/", deviceDiscoveryInfo);
+    auto doc = discoveryMessage(r, config);
 
     TEST_ASSERT_EQUAL_STRING("mysensor", doc["_component_"]);
     TEST_ASSERT_EQUAL_STRING("mysensor.nibe-1", doc["def_ent_id"]);
@@ -326,12 +496,11 @@ TEST_CASE("homeassistantDiscoveryMessage Override", "[nibegw_config]") {
 
 TEST_CASE("homeassistantDiscoveryMessage Degree Minutes", "[nibegw_config]") {
     NibeMqttConfig config;
-    config.homeassistantDiscoveryOverrides[43005] = R"({"stat_cla":"measurement"})";
+    TEST_ASSERT_EQUAL(ESP_OK, MqttHelper::parseMqttDiscoveryInfoOverride(R"({"stat_cla":"measurement"})",
+                                                                         config.homeassistantDiscoveryOverrides[43005]));
     NibeRegister r = {43005, "Degree Minutes",      NibeRegisterUnit::NoUnit, NibeRegisterDataType::UInt8, 1, 0, 0,
                       0,     NibeRegisterMode::Read};
-    JsonDocument deviceDiscoveryInfo;
-    deviceDiscoveryInfo["dev"]["name"] = "Nibe GW";
-    auto doc = r.homeassistantDiscoveryMessage(config, "nibegw/nibe/", deviceDiscoveryInfo);
+    auto doc = discoveryMessage(r, config);
 
     TEST_ASSERT_EQUAL_STRING("sensor", doc["_component_"]);
     TEST_ASSERT_EQUAL_STRING("sensor.nibe-43005", doc["def_ent_id"]);
@@ -431,4 +600,252 @@ TEST_CASE("toPromMetricConfig", "[nibegw_config]") {
     TEST_ASSERT_EQUAL(0, metricCfg.factor);
     TEST_ASSERT_EQUAL(0, metricCfg.scale);
     TEST_ASSERT_FALSE(metricCfg.isValid());
-}
\ No newline at end of file
+}
+TEST_CASE("NibeRegisterTable", "[nibegw_config]") {
+    NibeRegisterTable table;
+    TEST_ASSERT_TRUE(table.empty());
+    TEST_ASSERT_NULL(table.find(40004));
+    TEST_ASSERT_EQUAL(-1, table.indexOf(40004));
+
+    NibeRegister r1 = {40004, "BT1 Outdoor Temperature", NibeRegisterUnit::GradCelcius, NibeRegisterDataType::Int16, 10, -400,
+                       400, 0, NibeRegisterMode::Read};
+    NibeRegister r2 = {43005, "Degree Minutes", NibeRegisterUnit::NoUnit, NibeRegisterDataType::Int16, 10, -30000, 30000, 0,
+                       NibeRegisterMode::ReadWrite};
+    NibeRegister r3 = {40001, "", NibeRegisterUnit::NoUnit, NibeRegisterDataType::UInt32, 1, 0, 0, 0, NibeRegisterMode::Read};
+    // out of order
+    table.insert(r1);
+    table.insert(r2);
+    table.insert(r3);
+    TEST_ASSERT_EQUAL(3, table.size());
+    TEST_ASSERT_EQUAL(40001, table[0].id);
+    TEST_ASSERT_EQUAL(40004, table[1].id);
+    TEST_ASSERT_EQUAL(43005, table[2].id);
+    TEST_ASSERT_EQUAL(1, table.indexOf(40004));
+    TEST_ASSERT_EQUAL(-1, table.indexOf(40002));
+    TEST_ASSERT_EQUAL(-1, table.indexOf(50000));
+
+    const NibeRegisterTable::Entry* entry = table.find(43005);
+    TEST_ASSERT_NOT_NULL(entry);
+    TEST_ASSERT_EQUAL_STRING("Degree Minutes", table.title(*entry));
+    TEST_ASSERT_TRUE(r2 == table.get(*entry));
+    TEST_ASSERT_TRUE(r1 == table.get(*table.find(40004)));
+    TEST_ASSERT_TRUE(r3 == table.get(*table.find(40001)));
+    TEST_ASSERT_EQUAL(-30000, entry->minValue);
+    TEST_ASSERT_EQUAL_STRING("-30.0", entry->decodeData((const uint8_t[]){0xD4, 0xFE}).c_str());
+
+    // replace
+    r1.title = "Outdoor";
+    r1.factor = 100;
+    table.insert(r1);
+    TEST_ASSERT_EQUAL(3, table.size());
+    TEST_ASSERT_TRUE(r1 == table.get(table[1]));
+
+    table.clear();
+    TEST_ASSERT_EQUAL(0, table.size());
+    TEST_ASSERT_NULL(table.find(40004));
+}
+
+TEST_CASE("NibeRegisterTable lookup index", "[nibegw_config]") {
+    // dense and sparse id ranges
+    for (uint16_t step : {1, 3, 7, 500}) {
+        NibeRegisterTable table;
+        std::vector<uint16_t> ids;
+        for (uint16_t id = 40001; id < 40200; id++) {
+            ids.push_back(id);
+        }
+        for (uint16_t id = 43001; id < 48000; id += step) {
+            ids.push_back(id);
+        }
+        for (uint16_t id : ids) {
+            table.insert({id, "", NibeRegisterUnit::NoUnit, NibeRegisterDataType::Int16, 1, 0, 0, 0, NibeRegisterMode::Read});
+        }
+        table.shrinkToFit();
+        for (size_t i = 0; i < ids.size(); i++) {
+            TEST_ASSERT_EQUAL(i, table.indexOf(ids[i]));
+        }
+        TEST_ASSERT_EQUAL(-1, table.indexOf(0));
+        TEST_ASSERT_EQUAL(-1, table.indexOf(40000));
+        TEST_ASSERT_EQUAL(-1, table.indexOf(40200));
+        TEST_ASSERT_EQUAL(-1, table.indexOf(43000));
+        TEST_ASSERT_EQUAL(-1, table.indexOf(48000 + step));
+        TEST_ASSERT_EQUAL(-1, table.indexOf(65535));
+        if (step > 1) {
+            TEST_ASSERT_EQUAL(-1, table.indexOf(43002));
+        }
+        // modified: binary search until rebuilt
+        table.insert({43000, "", NibeRegisterUnit::NoUnit, NibeRegisterDataType::Int16, 1, 0, 0, 0, NibeRegisterMode::Read});
+        TEST_ASSERT_EQUAL(199, table.indexOf(43000));
+        table.shrinkToFit();
+        TEST_ASSERT_EQUAL(199, table.indexOf(43000));
+        TEST_ASSERT_EQUAL(200, table.indexOf(43001));
+    }
+}
+
+static NibeRegisterTable::writeFunction_t writeTo(std::string& image) {
+    return [&image](const void* data, size_t size) {
+        image.append((const char*)data, size);
+        return true;
+    };
+}
+
+static NibeRegisterTable::readFunction_t readFrom(const std::string& image, size_t& pos) {
+    return [&image, &pos](void* data, size_t size) {
+        if (pos + size > image.size()) {
+            return false;
+        }
+        std::memcpy(data, image.data() + pos, size);
+        pos += size;
+        return true;
+    };
+}
+
+TEST_CASE("NibeRegisterTable save/load", "[nibegw_config]") {
+    NibeRegisterTable table;
+    table.insert({40004, "BT1 Outdoor Temperature", NibeRegisterUnit::GradCelcius, NibeRegisterDataType::Int16, 10, -400, 400, 0,
+                  NibeRegisterMode::Read});
+    table.insert({43005, "Degree Minutes", NibeRegisterUnit::NoUnit, NibeRegisterDataType::Int16, 10, -30000, 30000, 0,
+                  NibeRegisterMode::ReadWrite});
+    table.insert({40001, "", NibeRegisterUnit::NoUnit, NibeRegisterDataType::UInt32, 1, 0, 0, 0, NibeRegisterMode::Read});
+    std::string image;
+    TEST_ASSERT_TRUE(table.save(writeTo(image)));
+    TEST_ASSERT_EQUAL(sizeof(NibeRegisterTable::Header) + 3 * sizeof(NibeRegisterTable::Entry) + 24 + 15 + 1, image.size());
+
+    NibeRegisterTable loaded;
+    size_t pos = 0;
+    TEST_ASSERT_TRUE(loaded.load(readFrom(image, pos)));
+    TEST_ASSERT_EQUAL(image.size(), pos);
+    TEST_ASSERT_EQUAL(table.size(), loaded.size());
+    for (size_t i = 0; i < table.size(); i++) {
+        TEST_ASSERT_TRUE(table.get(table[i]) == loaded.get(loaded[i]));
+    }
+    TEST_ASSERT_EQUAL_STRING("Degree Minutes", loaded.title(*loaded.find(43005)));
+
+    // empty table
+    std::string emptyImage;
+    TEST_ASSERT_TRUE(NibeRegisterTable().save(writeTo(emptyImage)));
+    pos = 0;
+    TEST_ASSERT_TRUE(loaded.load(readFrom(emptyImage, pos)));
+    TEST_ASSERT_TRUE(loaded.empty());
+
+    // truncated
+    pos = 0;
+    TEST_ASSERT_FALSE(loaded.load(readFrom(image.substr(0, image.size() - 1), pos)));
+    TEST_ASSERT_TRUE(loaded.empty());
+    // bad magic
+    std::string bad = image;
+    bad[0] ^= 0xFF;
+    pos = 0;
+    TEST_ASSERT_FALSE(loaded.load(readFrom(bad, pos)));
+    // not sorted: swap ids of first and second entry
+    bad = image;
+    NibeRegisterTable::Entry* entries = (NibeRegisterTable::Entry*)(bad.data() + sizeof(NibeRegisterTable::Header));
+    std::swap(entries[0].id, entries[1].id);
+    pos = 0;
+    TEST_ASSERT_FALSE(loaded.load(readFrom(bad, pos)));
+    // title out of string pool
+    bad = image;
+    entries = (NibeRegisterTable::Entry*)(bad.data() + sizeof(NibeRegisterTable::Header));
+    entries[2].title = 1000;
+    pos = 0;
+    TEST_ASSERT_FALSE(loaded.load(readFrom(bad, pos)));
+    TEST_ASSERT_TRUE(loaded.empty());
+}
+
+static NibeRegisterCatalog::readAtFunction_t readAt(const std::string& image, int& reads) {
+    return [&image, &reads](size_t offset, void* data, size_t size) {
+        reads++;
+        if (offset + size > image.size()) {
+            return false;
+        }
+        std::memcpy(data, image.data() + offset, size);
+        return true;
+    };
+}
+
+TEST_CASE("NibeRegisterCatalog", "[nibegw_config]") {
+    NibeRegisterTable table;
+    for (uint16_t id = 40001; id <= 40100; id++) {
+        table.insert({id, "Register " + std::to_string(id), NibeRegisterUnit::NoUnit, NibeRegisterDataType::Int16, 10, 0, 0, 0,
+                      NibeRegisterMode::Read});
+    }
+    NibeRegister longTitle = {43005, "Degree Minutes, a title longer than one chunk of the title pool",
+                              NibeRegisterUnit::NoUnit, NibeRegisterDataType::Int16, 10, -30000, 30000, 0,
+                              NibeRegisterMode::ReadWrite};
+    table.insert(longTitle);
+    std::string image;
+    TEST_ASSERT_TRUE(table.save(writeTo(image)));
+
+    NibeRegisterCatalog catalog;
+    NibeRegister _register;
+    TEST_ASSERT_FALSE(catalog.isOpen());
+    TEST_ASSERT_FALSE(catalog.find(40001, _register));
+    int reads = 0;
+    TEST_ASSERT_TRUE(catalog.open(readAt(image, reads)));
+    TEST_ASSERT_TRUE(catalog.isOpen());
+    TEST_ASSERT_EQUAL(101, catalog.size());
+
+    // binary search, log2(101) entries + title
+    for (const auto& entry : table) {
+        reads = 0;
+        TEST_ASSERT_TRUE(catalog.find(entry.id, _register));
+        TEST_ASSERT_TRUE(table.get(entry) == _register);
+        TEST_ASSERT_LESS_OR_EQUAL(7 + 3, reads);
+    }
+    TEST_ASSERT_TRUE(catalog.find(43005, _register));
+    TEST_ASSERT_TRUE(longTitle == _register);
+    TEST_ASSERT_FALSE(catalog.find(40000, _register));
+    TEST_ASSERT_FALSE(catalog.find(40101, _register));
+    TEST_ASSERT_FALSE(catalog.find(50000, _register));
+
+    // configured registers only
+    NibeRegisterTable configured;
+    TEST_ASSERT_TRUE(catalog.load(configured, [](uint16_t id) { return id % 10 == 5; }));
+    TEST_ASSERT_EQUAL(11, configured.size());
+    TEST_ASSERT_TRUE(longTitle == configured.get(*configured.find(43005)));
+    TEST_ASSERT_EQUAL_STRING("Register 40015", configured.title(*configured.find(40015)));
+    TEST_ASSERT_NULL(configured.find(40016));
+
+    NibeRegisterIdSet ids;
+    ids.insert(40015);
+    ids.insert(40004);
+    ids.insert(40015);
+    ids.insert(49999);  // not in catalog
+    ids.build();
+    TEST_ASSERT_TRUE(catalog.load(configured, ids));
+    TEST_ASSERT_EQUAL(2, configured.size());
+    TEST_ASSERT_NOT_NULL(configured.find(40004));
+    TEST_ASSERT_NOT_NULL(configured.find(40015));
+
+    catalog.close();
+    TEST_ASSERT_FALSE(catalog.find(40001, _register));
+
+    // invalid images are rejected on open
+    TEST_ASSERT_FALSE(catalog.open(readAt(image.substr(0, image.size() - 1), reads)));
+    TEST_ASSERT_FALSE(catalog.isOpen());
+    std::string bad = image;
+    bad[0] ^= 0xFF;
+    TEST_ASSERT_FALSE(catalog.open(readAt(bad, reads)));
+    TEST_ASSERT_FALSE(catalog.open(readAt("", reads)));
+}
+
+TEST_CASE("NibeRegisterIdSet", "[nibegw_config]") {
+    NibeRegisterIdSet ids;
+    TEST_ASSERT_EQUAL(0, ids.size());
+    TEST_ASSERT_FALSE(ids.contains(40004));
+
+    std::unordered_map<uint16_t, int> map = {{40013, 1}, {40004, 2}};
+    ids.insert(48132);
+    ids.insert(40004);
+    ids.insertKeys(map);
+    ids.insert(0);
+    ids.insert(65535);
+    ids.build();
+    TEST_ASSERT_EQUAL(5, ids.size());
+    for (uint16_t id : {0, 40004, 40013, 48132, 65535}) {
+        TEST_ASSERT_TRUE(ids.contains(id));
+        TEST_ASSERT_TRUE(ids(id));
+    }
+    for (uint16_t id : {1, 40003, 40005, 48131, 65534}) {
+        TEST_ASSERT_FALSE(ids.contains(id));
+    }
+}
@@ -0,0 +1,1398 @@
+#include <esp_log.h>
+#include <unity.h>
+
+#include <chrono>
+#include <cstring>
+
+#include "alloc_counter.h"
+#include "mqtt_mock.h"
+#include "nibegw_mqtt.h"
+
+static const char* TAG = "test_nibegw_mqtt";
+
+static MqttConfig mqttConfig = {.brokerUri = "mqtt://localhost",
+                                .clientId = "clientid",
+                                .rootTopic = "nibegw",
+                                .discoveryPrefix = "homeassistant",
+                                .deviceName = "Nibe GW",
+                                .deviceManufacturer = "Nibe",
+                                .deviceModel = "Heatpump",
+                                .deviceConfigurationUrl = "http://nibegw"};
+
+static NibeRegister testRegister(uint16_t id, NibeRegisterDataType dataType = NibeRegisterDataType::Int16, int factor = 10,
+                                 NibeRegisterMode mode = NibeRegisterMode::Read) {
+    return {id, "Register " + std::to_string(id), NibeRegisterUnit::NoUnit, dataType, factor, 0, 0, 0, mode};
+}
+
+// registers 40001..40040, polling 40001..40020 fast and 40021..40030 slow
+static NibeMqttConfig testConfig() {
+    NibeMqttConfig config;
+    for (uint16_t id = 40001; id <= 40040; id++) {
+        config.registers.insert(testRegister(id));
+    }
+    for (uint16_t id = 40001; id <= 40020; id++) {
+        config.pollRegisters.push_back(id);
+    }
+    for (uint16_t id = 40021; id <= 40030; id++) {
+        config.pollRegistersSlow.push_back(id);
+    }
+    return config;
+}
+
+// fake clock for poll scheduling (ms)
+static uint32_t fakeTime = 0;
+static uint32_t fakeClock() { return fakeTime; }
+
+// returns address of read request or 0 if no request was sent
+static uint16_t readToken(NibeMqttGw& gw) {
+    uint8_t buffer[MAX_DATA_LEN];
+    NibeReadRequestMessage* request = (NibeReadRequestMessage*)buffer;
+    int len = gw.onReadTokenReceived(request);
+    if (len == 0) {
+        return 0;
+    }
+    TEST_ASSERT_EQUAL(sizeof(NibeReadRequestMessage), len);
+    TEST_ASSERT_EQUAL_HEX8(NibeStart::Request, request->start);
+    TEST_ASSERT_EQUAL_HEX8(NibeCmd::ModbusReadReq, request->cmd);
+    TEST_ASSERT_EQUAL(2, request->len);
+    TEST_ASSERT_EQUAL_HEX8(NibeGw::calcCheckSum(buffer, len - 1), request->chksum);
+    return request->registerAddress;
+}
+
+// all polled registers are due after begin(), read them until nothing is due
+static void drainPollSchedule(NibeMqttGw& gw) {
+    while (readToken(gw) != 0) {
+    }
+}
+
+TEST_CASE("read token w/o requests", "[nibegw_mqtt]") {
+    NibeMqttConfig config = testConfig();
+    Metrics metrics;
+    MqttClient mqttClient(metrics);
+    mqttClient.begin(mqttConfig);
+    NibeMqttGw gw(metrics);
+    gw.setClock(fakeClock);
+    TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+    drainPollSchedule(gw);
+
+    TEST_ASSERT_EQUAL(0, readToken(gw));
+}
+
+TEST_CASE("read request frames", "[nibegw_mqtt]") {
+    NibeMqttConfig config = testConfig();
+    Metrics metrics;
+    MqttClient mqttClient(metrics);
+    mqttClient.begin(mqttConfig);
+    NibeMqttGw gw(metrics);
+    gw.setClock(fakeClock);
+    TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+    drainPollSchedule(gw);
+
+    // precompiled frame
+    gw.requestNibeRegister(40004);
+    uint8_t buffer[MAX_DATA_LEN];
+    TEST_ASSERT_EQUAL(6, gw.onReadTokenReceived((NibeReadRequestMessage*)buffer));
+    uint8_t expected[] = {0xc0, 0x69, 0x02, 0x44, 0x9c, 0x73};
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, buffer, sizeof(expected));
+
+    // ad-hoc frame for register that is not polled
+    gw.requestNibeRegister(43424);
+    TEST_ASSERT_EQUAL(6, gw.onReadTokenReceived((NibeReadRequestMessage*)buffer));
+    uint8_t expected2[] = {0xc0, 0x69, 0x02, 0xa0, 0xa9, 0xa2};
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected2, buffer, sizeof(expected2));
+
+    TEST_ASSERT_EQUAL(0, readToken(gw));
+}
+
+TEST_CASE("poll schedule", "[nibegw_mqtt]") {
+    NibeMqttConfig config = testConfig();
+    config.poll[40031] = {.interval = 60};
+    config.poll[40001] = {.interval = 120};  // overrides legacy pollRegisters
+    Metrics metrics;
+    MqttClient mqttClient(metrics);
+    mqttClient.begin(mqttConfig);
+    NibeMqttGw gw(metrics);
+    fakeTime = 1000;
+    gw.setClock(fakeClock);
+    TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+
+    // all registers are due after begin, in config order
+    for (uint16_t id = 40001; id <= 40031; id++) {
+        TEST_ASSERT_EQUAL(id, readToken(gw));
+    }
+    TEST_ASSERT_EQUAL(0, readToken(gw));
+
+    // fast registers every 30s, 40031 every 60s, 40001 every 120s, slow registers every 10 * 30s
+    for (int cycle = 1; cycle <= 10; cycle++) {
+        fakeTime += 29999;
+        TEST_ASSERT_EQUAL(0, readToken(gw));
+        fakeTime += 1;
+        if (cycle % 4 == 0) {
+            TEST_ASSERT_EQUAL(40001, readToken(gw));
+        }
+        for (uint16_t id = 40002; id <= 40020; id++) {
+            TEST_ASSERT_EQUAL(id, readToken(gw));
+        }
+        if (cycle == 10) {
+            for (uint16_t id = 40021; id <= 40030; id++) {
+                TEST_ASSERT_EQUAL(id, readToken(gw));
+            }
+        }
+        if (cycle % 2 == 0) {
+            TEST_ASSERT_EQUAL(40031, readToken(gw));
+        }
+        TEST_ASSERT_EQUAL(0, readToken(gw));
+    }
+
+    // bus busy with interactive reads: polled registers are late but keep their phase
+    fakeTime += 30000;
+    for (uint16_t id = 40035; id <= 40040; id++) {
+        gw.requestNibeRegister(id);
+    }
+    fakeTime += 5000;
+    TEST_ASSERT_EQUAL(40035, readToken(gw));
+    TEST_ASSERT_EQUAL(40036, readToken(gw));
+    TEST_ASSERT_EQUAL(40037, readToken(gw));
+    TEST_ASSERT_EQUAL(40038, readToken(gw));
+    TEST_ASSERT_EQUAL(40002, readToken(gw));  // starvation protection
+    TEST_ASSERT_EQUAL(40039, readToken(gw));
+    TEST_ASSERT_EQUAL(40040, readToken(gw));
+    for (uint16_t id = 40003; id <= 40020; id++) {
+        TEST_ASSERT_EQUAL(id, readToken(gw));
+    }
+    TEST_ASSERT_EQUAL(0, readToken(gw));
+    fakeTime += 25000;
+    TEST_ASSERT_EQUAL(40001, readToken(gw));
+    TEST_ASSERT_EQUAL(40002, readToken(gw));
+
+    std::string all = metrics.getAllMetricsAsString();
+    TEST_ASSERT_TRUE(all.contains(R"(nibegw_poll_delay_seconds_bucket{le="2.000"} 240)"));
+    TEST_ASSERT_TRUE(all.contains(R"(nibegw_poll_delay_seconds_bucket{le="5.000"} 259)"));
+}
+
+TEST_CASE("NibePollScheduler", "[nibegw_mqtt]") {
+    NibePollScheduler scheduler;
+    uint16_t index;
+    uint32_t delay;
+    TEST_ASSERT_FALSE(scheduler.next(0, index, delay));
+
+    TEST_ASSERT_EQUAL(0, scheduler.add(40001, 1000, 0));
+    TEST_ASSERT_EQUAL(1, scheduler.add(40002, 3000, 0));
+    TEST_ASSERT_EQUAL(2, scheduler.size());
+    TEST_ASSERT_EQUAL(40002, scheduler[1].address);
+
+    TEST_ASSERT_TRUE(scheduler.next(0, index, delay));
+    TEST_ASSERT_EQUAL(0, index);
+    TEST_ASSERT_TRUE(scheduler.next(0, index, delay));
+    TEST_ASSERT_EQUAL(1, index);
+    TEST_ASSERT_FALSE(scheduler.next(0, index, delay));
+    TEST_ASSERT_FALSE(scheduler.next(999, index, delay));
+    TEST_ASSERT_TRUE(scheduler.next(1000, index, delay));
+    TEST_ASSERT_EQUAL(0, index);
+    TEST_ASSERT_EQUAL(0, delay);
+
+    // late, but keeps the phase
+    TEST_ASSERT_TRUE(scheduler.next(2500, index, delay));
+    TEST_ASSERT_EQUAL(0, index);
+    TEST_ASSERT_EQUAL(500, delay);
+    TEST_ASSERT_EQUAL(3000, scheduler[0].deadline);
+
+    // same deadline: lower index first
+    TEST_ASSERT_TRUE(scheduler.next(3000, index, delay));
+    TEST_ASSERT_EQUAL(0, index);
+    TEST_ASSERT_TRUE(scheduler.next(3000, index, delay));
+    TEST_ASSERT_EQUAL(1, index);
+    TEST_ASSERT_FALSE(scheduler.next(3000, index, delay));
+
+    // missed intervals are skipped
+    TEST_ASSERT_TRUE(scheduler.next(10000, index, delay));
+    TEST_ASSERT_EQUAL(0, index);
+    TEST_ASSERT_EQUAL(6000, delay);
+    TEST_ASSERT_EQUAL(11000, scheduler[0].deadline);
+    TEST_ASSERT_TRUE(scheduler.next(10000, index, delay));
+    TEST_ASSERT_EQUAL(1, index);
+    TEST_ASSERT_EQUAL(4000, delay);
+    TEST_ASSERT_FALSE(scheduler.next(10000, index, delay));
+
+    // wrap around of ms clock
+    scheduler.clear();
+    TEST_ASSERT_EQUAL(0, scheduler.size());
+    scheduler.add(40001, 1000, 0xFFFFFF00);
+    scheduler.add(40002, 2000, 0xFFFFFF00);
+    TEST_ASSERT_TRUE(scheduler.next(0xFFFFFF00, index, delay));
+    TEST_ASSERT_TRUE(scheduler.next(0xFFFFFF00, index, delay));
+    TEST_ASSERT_FALSE(scheduler.next(0xFFFFFF00 + 999, index, delay));
+    TEST_ASSERT_TRUE(scheduler.next(0xFFFFFF00 + 1000, index, delay));
+    TEST_ASSERT_EQUAL(0, index);
+    TEST_ASSERT_FALSE(scheduler.next(0xFFFFFF00 + 1999, index, delay));
+    TEST_ASSERT_TRUE(scheduler.next(0xFFFFFF00 + 2000, index, delay));
+    TEST_ASSERT_EQUAL(0, index);
+    TEST_ASSERT_TRUE(scheduler.next(0xFFFFFF00 + 2000, index, delay));
+    TEST_ASSERT_EQUAL(1, index);
+}
+
+// compares answering read tokens by building the frame (incl. formatting it for the debug log, as done before)
+// with copying the precompiled frame, results are logged only
+TEST_CASE("read token throughput", "[nibegw_mqtt][benchmark]") {
+    NibeMqttConfig config = testConfig();
+    Metrics metrics;
+    MqttClient mqttClient(metrics);
+    mqttClient.begin(mqttConfig);
+    NibeMqttGw gw(metrics);
+    gw.setClock(fakeClock);
+    TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+    drainPollSchedule(gw);
+
+    const int rounds = 1000;
+    uint8_t buffer[MAX_DATA_LEN];
+    std::chrono::nanoseconds adhocTime(0);
+    std::chrono::nanoseconds precompiledTime(0);
+    for (int i = 0; i < rounds; i++) {
+        // registers 40031..40040 are not polled -> ad-hoc frames
+        for (uint16_t id = 40031; id <= 40040; id++) {
+            gw.requestNibeRegister(id);
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (int j = 0; j < 10; j++) {
+            int len = gw.onReadTokenReceived((NibeReadRequestMessage*)buffer);
+            NibeGw::dataToString(buffer, len);
+        }
+        adhocTime += std::chrono::steady_clock::now() - start;
+
+        for (uint16_t id = 40001; id <= 40010; id++) {
+            gw.requestNibeRegister(id);
+        }
+        start = std::chrono::steady_clock::now();
+        for (int j = 0; j < 10; j++) {
+            gw.onReadTokenReceived((NibeReadRequestMessage*)buffer);
+        }
+        precompiledTime += std::chrono::steady_clock::now() - start;
+    }
+    TEST_ASSERT_EQUAL(0, readToken(gw));
+    ESP_LOGI(TAG, "read token: ad-hoc + log formatting %lld ns, precompiled %lld ns",
+             (long long)adhocTime.count() / (rounds * 10), (long long)precompiledTime.count() / (rounds * 10));
+}
+
+TEST_CASE("deduplicate read requests", "[nibegw_mqtt]") {
+    NibeMqttConfig config = testConfig();
+    Metrics metrics;
+    MqttClient mqttClient(metrics);
+    mqttClient.begin(mqttConfig);
+    NibeMqttGw gw(metrics);
+    gw.setClock(fakeClock);
+    TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+    drainPollSchedule(gw);
+    Metric* depth = metrics.findMetric(R"(nibegw_read_queue_depth{lane="low"})");
+    Metric* deduplicated = metrics.findMetric(R"(nibegw_read_requests_deduplicated_total{lane="low"})");
+    Metric* dropped = metrics.findMetric(R"(nibegw_read_requests_dropped_total{lane="low"})");
+
+    // 2nd request before 1st is sent is deduplicated
+    for (uint16_t id = 40001; id <= 40021; id++) {
+        gw.requestNibeRegister(id, NibeReadPriority::Low);
+    }
+    TEST_ASSERT_EQUAL(21, depth->getValue());
+    for (uint16_t id = 40001; id <= 40020; id++) {
+        gw.requestNibeRegister(id, NibeReadPriority::Low);
+    }
+    gw.requestNibeRegister(40022, NibeReadPriority::Low);
+    TEST_ASSERT_EQUAL(22, depth->getValue());
+    TEST_ASSERT_EQUAL(20, deduplicated->getValue());
+    gw.requestNibeRegister(40035, NibeReadPriority::Low);
+    gw.requestNibeRegister(40035, NibeReadPriority::Low);
+    TEST_ASSERT_EQUAL(23, depth->getValue());
+    TEST_ASSERT_EQUAL(21, deduplicated->getValue());
+
+    for (uint16_t id = 40001; id <= 40020; id++) {
+        TEST_ASSERT_EQUAL(id, readToken(gw));
+    }
+    TEST_ASSERT_EQUAL(40021, readToken(gw));
+    TEST_ASSERT_EQUAL(40022, readToken(gw));
+    TEST_ASSERT_EQUAL(40035, readToken(gw));
+    TEST_ASSERT_EQUAL(0, readToken(gw));
+    TEST_ASSERT_EQUAL(0, depth->getValue());
+
+    // register can be requested again after it was sent
+    gw.requestNibeRegister(40001, NibeReadPriority::Low);
+    TEST_ASSERT_EQUAL(40001, readToken(gw));
+
+    // addresses outside of 4xxxx are not deduplicated
+    gw.requestNibeRegister(1, NibeReadPriority::Low);
+    gw.requestNibeRegister(1, NibeReadPriority::Low);
+    TEST_ASSERT_EQUAL(1, readToken(gw));
+    TEST_ASSERT_EQUAL(1, readToken(gw));
+    TEST_ASSERT_EQUAL(0, readToken(gw));
+
+    // queue full
+    for (int i = 0; i < READ_REGISTER_RING_BUFFER_SIZE + 10; i++) {
+        gw.requestNibeRegister(41000 + i, NibeReadPriority::Low);
+    }
+    TEST_ASSERT_EQUAL(READ_REGISTER_RING_BUFFER_SIZE, depth->getValue());
+    TEST_ASSERT_EQUAL(10, dropped->getValue());
+    // dropped registers are not pending
+    gw.requestNibeRegister(41000 + READ_REGISTER_RING_BUFFER_SIZE, NibeReadPriority::Low);
+    TEST_ASSERT_EQUAL(11, dropped->getValue());
+    TEST_ASSERT_EQUAL(21, deduplicated->getValue());
+}
+
+TEST_CASE("read request priority lanes", "[nibegw_mqtt]") {
+    NibeMqttConfig config = testConfig();
+    Metrics metrics;
+    MqttClient mqttClient(metrics);
+    mqttClient.begin(mqttConfig);
+    NibeMqttGw gw(metrics);
+    gw.setClock(fakeClock);
+    TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+    Metric* depthHigh = metrics.findMetric(R"(nibegw_read_queue_depth{lane="high"})");
+    Metric* depthLow = metrics.findMetric(R"(nibegw_read_queue_depth{lane="low"})");
+    Metric* starvationAvoided = metrics.findMetric("nibegw_read_starvation_avoided_total");
+    TEST_ASSERT_NOT_NULL(depthHigh);
+    TEST_ASSERT_NOT_NULL(depthLow);
+    TEST_ASSERT_NOT_NULL(starvationAvoided);
+
+    // interactive read overtakes background polling (all polled registers are due)
+    gw.requestNibeRegister(40035);
+    TEST_ASSERT_EQUAL(1, depthHigh->getValue());
+    TEST_ASSERT_EQUAL(0, depthLow->getValue());
+    TEST_ASSERT_EQUAL(40035, readToken(gw));
+    TEST_ASSERT_EQUAL(40001, readToken(gw));
+
+    // polled register may be requested interactively
+    gw.requestNibeRegister(40002);
+    TEST_ASSERT_EQUAL(40002, readToken(gw));
+    TEST_ASSERT_EQUAL(40002, readToken(gw));
+
+    // low priority lane is served after a burst of high priority reads
+    for (uint16_t id = 40031; id <= 40040; id++) {
+        gw.requestNibeRegister(id);
+    }
+    for (uint16_t id = 40031; id < 40031 + READ_HIGH_PRIO_BURST; id++) {
+        TEST_ASSERT_EQUAL(id, readToken(gw));
+    }
+    TEST_ASSERT_EQUAL(40003, readToken(gw));
+    TEST_ASSERT_EQUAL(1, starvationAvoided->getValue());
+    for (uint16_t id = 40031 + READ_HIGH_PRIO_BURST; id < 40031 + 2 * READ_HIGH_PRIO_BURST; id++) {
+        TEST_ASSERT_EQUAL(id, readToken(gw));
+    }
+    TEST_ASSERT_EQUAL(40004, readToken(gw));
+    TEST_ASSERT_EQUAL(2, starvationAvoided->getValue());
+    for (uint16_t id = 40031 + 2 * READ_HIGH_PRIO_BURST; id <= 40040; id++) {
+        TEST_ASSERT_EQUAL(id, readToken(gw));
+    }
+    TEST_ASSERT_EQUAL(0, depthHigh->getValue());
+    for (uint16_t id = 40005; id <= 40030; id++) {
+        TEST_ASSERT_EQUAL(id, readToken(gw));
+    }
+    TEST_ASSERT_EQUAL(0, readToken(gw));
+    TEST_ASSERT_EQUAL(2, starvationAvoided->getValue());
+
+    // MQTT refresh is a background read
+    gw.onMqttMessage("nibegw/nibe/40036/get", "");
+    TEST_ASSERT_EQUAL(0, depthHigh->getValue());
+    TEST_ASSERT_EQUAL(1, depthLow->getValue());
+    gw.requestNibeRegister(40037);
+    TEST_ASSERT_EQUAL(40037, readToken(gw));
+    TEST_ASSERT_EQUAL(40036, readToken(gw));
+    gw.onMqttMessage("nibegw/nibe/x/get", "");
+    TEST_ASSERT_EQUAL(0, depthLow->getValue());
+
+    // wait time is observed per lane
+    std::string all = metrics.getAllMetricsAsString();
+    TEST_ASSERT_TRUE(all.contains(R"(nibegw_read_queue_wait_seconds_count{lane="high"} 13)"));
+    TEST_ASSERT_TRUE(all.contains(R"(nibegw_read_queue_wait_seconds_count{lane="low"} 1)"));
+    TEST_ASSERT_TRUE(all.contains(R"(nibegw_poll_delay_seconds_count 30)"));
+}
+
+static void queueReadResponse(NibeMqttGw& gw, uint16_t address, int16_t value) {
+    uint8_t buffer[MAX_DATA_LEN] = {};
+    NibeResponseMessage* msg = (NibeResponseMessage*)buffer;
+    msg->start = NibeStart::Response;
+    msg->deviceAddress = NibeDeviceAddress::MODBUS40;
+    msg->cmd = NibeCmd::ModbusReadResp;
+    msg->len = sizeof(NibeReadResponseData);
+    msg->readResponse.registerAddress = address;
+    msg->readResponse.value[0] = value & 0xFF;
+    msg->readResponse.value[1] = (value >> 8) & 0xFF;
+    gw.onMessageReceived(msg, 5 + msg->len);
+}
+
+static void readResponse(NibeMqttGw& gw, uint16_t address, int16_t value) {
+    queueReadResponse(gw, address, value);
+    gw.processPendingSamples();
+}
+
+// returns published payloads of a topic and clears all published data
+static std::vector<std::string> publishedPayloads(const std::string& topic) {
+    std::vector<std::string> payloads;
+    for (const auto& data : mqttmock_publishData) {
+        if (data.topic == topic) {
+            payloads.push_back(data.payload);
+        }
+    }
+    mqttmock_publishData.clear();
+    return payloads;
+}
+
+TEST_CASE("change-driven publishing", "[nibegw_mqtt]") {
+    NibeMqttConfig config = testConfig();
+    config.publish[40002] = {.deadband = 5, .heartbeat = 60};
+    config.publish[40003] = {.deadband = 0, .heartbeat = 0};
+    Metrics metrics;
+    MqttClient mqttClient(metrics);
+    mqttClient.begin(mqttConfig);
+    NibeMqttGw gw(metrics);
+    fakeTime = 1000;
+    gw.setClock(fakeClock);
+    TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+    mqttmock_publishData.clear();
+    Metric* published = metrics.findMetric(R"(nibegw_register_publish_total{result="published"})");
+    Metric* suppressed = metrics.findMetric(R"(nibegw_register_publish_total{result="suppressed"})");
+
+    // default: publish on every change and after NIBE_PUBLISH_HEARTBEAT_DEFAULT
+    readResponse(gw, 40001, 215);
+    readResponse(gw, 40001, 215);
+    readResponse(gw, 40001, 216);
+    readResponse(gw, 40001, 216);
+    std::vector<std::string> payloads = publishedPayloads("nibegw/nibe/40001");
+    TEST_ASSERT_EQUAL(2, payloads.size());
+    TEST_ASSERT_EQUAL_STRING("21.5", payloads[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("21.6", payloads[1].c_str());
+    TEST_ASSERT_EQUAL(2, published->getValue());
+    TEST_ASSERT_EQUAL(2, suppressed->getValue());
+    fakeTime += NIBE_PUBLISH_HEARTBEAT_DEFAULT * 1000 - 1;
+    readResponse(gw, 40001, 216);
+    TEST_ASSERT_EQUAL(0, publishedPayloads("nibegw/nibe/40001").size());
+    fakeTime += 1;
+    readResponse(gw, 40001, 216);
+    TEST_ASSERT_EQUAL(1, publishedPayloads("nibegw/nibe/40001").size());
+
+    // deadband is compared with last published value, not last received value
+    readResponse(gw, 40002, 200);
+    readResponse(gw, 40002, 205);
+    readResponse(gw, 40002, 195);
+    readResponse(gw, 40002, 203);
+    readResponse(gw, 40002, 206);
+    readResponse(gw, 40002, 201);
+    readResponse(gw, 40002, 200);
+    payloads = publishedPayloads("nibegw/nibe/40002");
+    TEST_ASSERT_EQUAL(3, payloads.size());
+    TEST_ASSERT_EQUAL_STRING("20.0", payloads[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("20.6", payloads[1].c_str());
+    TEST_ASSERT_EQUAL_STRING("20.0", payloads[2].c_str());
+    fakeTime += 60000;
+    readResponse(gw, 40002, 200);
+    TEST_ASSERT_EQUAL(1, publishedPayloads("nibegw/nibe/40002").size());
+
+    // no heartbeat
+    readResponse(gw, 40003, -10);
+    fakeTime += 24 * 3600 * 1000;
+    readResponse(gw, 40003, -10);
+    payloads = publishedPayloads("nibegw/nibe/40003");
+    TEST_ASSERT_EQUAL(1, payloads.size());
+    TEST_ASSERT_EQUAL_STRING("-1.0", payloads[0].c_str());
+
+    // write forces publishing of the next value
+    config.registers.insert(testRegister(40003, NibeRegisterDataType::Int16, 10, NibeRegisterMode::ReadWrite));
+    gw.writeNibeRegister(40003, "-1.0");
+    uint8_t buffer[MAX_DATA_LEN];
+    TEST_ASSERT_EQUAL(sizeof(NibeWriteRequestMessage), gw.onWriteTokenReceived((NibeWriteRequestMessage*)buffer));
+    readResponse(gw, 40003, -10);
+    TEST_ASSERT_EQUAL(1, publishedPayloads("nibegw/nibe/40003").size());
+    readResponse(gw, 40003, -10);
+    TEST_ASSERT_EQUAL(0, publishedPayloads("nibegw/nibe/40003").size());
+
+    // explicit reads (web UI, MQTT get) publish the value even if unchanged, polled reads don't
+    NibeReadRequestMessage* readRequest = (NibeReadRequestMessage*)buffer;
+    NibeReadPriority priorities[] = {NibeReadPriority::High, NibeReadPriority::Low};
+    for (NibeReadPriority priority : priorities) {
+        gw.requestNibeRegister(40003, priority);
+        TEST_ASSERT_EQUAL(sizeof(NibeReadRequestMessage), gw.onReadTokenReceived(readRequest));
+        TEST_ASSERT_EQUAL(40003, readRequest->registerAddress);
+        readResponse(gw, 40003, -10);
+        TEST_ASSERT_EQUAL(1, publishedPayloads("nibegw/nibe/40003").size());
+    }
+    readResponse(gw, 40001, 216);  // heartbeat expired
+    mqttmock_publishData.clear();
+    TEST_ASSERT_EQUAL(sizeof(NibeReadRequestMessage), gw.onReadTokenReceived(readRequest));
+    TEST_ASSERT_EQUAL(40001, readRequest->registerAddress);
+    readResponse(gw, 40001, 216);
+    TEST_ASSERT_EQUAL(0, publishedPayloads("nibegw/nibe/40001").size());
+}
+
+// ModbusDataMsg with registers 40001..40010, values[i] for register 40001 + i
+// registers firstAddress..firstAddress + 9, remaining slots unused
+static void queueDataMessage(NibeMqttGw& gw, const int16_t* values, uint16_t firstAddress = 40001) {
+    uint8_t buffer[MAX_DATA_LEN] = {};
+    NibeResponseMessage* msg = (NibeResponseMessage*)buffer;
+    msg->start = NibeStart::Response;
+    msg->deviceAddress = NibeDeviceAddress::MODBUS40;
+    msg->cmd = NibeCmd::ModbusDataMsg;
+    msg->len = sizeof(NibeDataMessage);
+    for (int i = 0; i < 20; i++) {
+        NibeDataMessageRegister& reg = msg->dataMessage.registers[i];
+        reg.registerAddress = i < 10 ? firstAddress + i : 0xFFFF;
+        reg.value[0] = i < 10 ? values[i] & 0xFF : 0;
+        reg.value[1] = i < 10 ? (values[i] >> 8) & 0xFF : 0;
+    }
+    gw.onMessageReceived(msg, 5 + msg->len);
+}
+
+static void dataMessage(NibeMqttGw& gw, const int16_t* values, uint16_t firstAddress = 40001) {
+    queueDataMessage(gw, values, firstAddress);
+    gw.processPendingSamples();
+}
+
+// returns published registers (state topics only) and clears all published data
+static std::vector<uint16_t> publishedRegisters() {
+    std::vector<uint16_t> registers;
+    for (const auto& data : mqttmock_publishData) {
+        if (data.topic.starts_with("nibegw/nibe/")) {
+            registers.push_back(atoi(data.topic.c_str() + 12));
+        }
+    }
+    mqttmock_publishData.clear();
+    return registers;
+}
+
+TEST_CASE("ModbusDataMsg publishing", "[nibegw_mqtt]") {
+    NibeMqttConfig config = testConfig();
+    config.metrics[40005] = {.name = "nibe_test", .factor = 10, .scale = 1, .counter = false};
+    Metrics metrics;
+    MqttClient mqttClient(metrics);
+    mqttClient.begin(mqttConfig);
+    NibeMqttGw gw(metrics);
+    fakeTime = 1000;
+    gw.setClock(fakeClock);
+    TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+    mqttmock_publishData.clear();
+    // metrics of registers are created in begin(), not on first data
+    TEST_ASSERT_NOT_NULL(metrics.findMetric(R"(nibe_test{register="40005"})"));
+    Metric* deferred = metrics.findMetric(R"(nibegw_register_publish_total{result="deferred"})");
+    TEST_ASSERT_EQUAL(4, config.dataMessagePublishBudget);
+    TEST_ASSERT_EQUAL(2, config.dataMessagePublishRate);
+
+    // all registers are new, published with budget of 4 per message
+    int16_t values[10] = {10, 11, 12, 13, 14, 15, 16, 17, 18, 19};
+    dataMessage(gw, values);
+    std::vector<uint16_t> expected = {40001, 40002, 40003, 40004};
+    TEST_ASSERT_TRUE(expected == publishedRegisters());
+    TEST_ASSERT_EQUAL(6, deferred->getValue());
+    // metrics are updated regardless of publishing
+    TEST_ASSERT_EQUAL(14, metrics.findMetric(R"(nibe_test{register="40005"})")->getValue());
+    fakeTime += 2000;
+    dataMessage(gw, values);
+    expected = {40005, 40006, 40007, 40008};
+    TEST_ASSERT_TRUE(expected == publishedRegisters());
+    fakeTime += 2000;
+    dataMessage(gw, values);
+    expected = {40009, 40010};
+    TEST_ASSERT_TRUE(expected == publishedRegisters());
+    fakeTime += 2000;
+    dataMessage(gw, values);
+    TEST_ASSERT_EQUAL(0, publishedRegisters().size());
+
+    // a change is published with the next message
+    values[2] = 100;
+    fakeTime += 2000;
+    dataMessage(gw, values);
+    expected = {40003};
+    TEST_ASSERT_TRUE(expected == publishedRegisters());
+
+    // rate limit: 2 registers/s, deferred registers come first with next message
+    for (int i = 0; i < 10; i++) {
+        values[i] += 1;
+    }
+    fakeTime += 2000;
+    dataMessage(gw, values);
+    expected = {40004, 40005, 40006, 40007};
+    TEST_ASSERT_TRUE(expected == publishedRegisters());
+    fakeTime += 500;
+    dataMessage(gw, values);
+    expected = {40008};
+    TEST_ASSERT_TRUE(expected == publishedRegisters());
+    fakeTime += 1000;
+    dataMessage(gw, values);
+    expected = {40009, 40010};
+    TEST_ASSERT_TRUE(expected == publishedRegisters());
+    fakeTime += 2000;
+    dataMessage(gw, values);
+    expected = {40001, 40002, 40003};
+    TEST_ASSERT_TRUE(expected == publishedRegisters());
+    fakeTime += 2000;
+    dataMessage(gw, values);
+    TEST_ASSERT_EQUAL(0, publishedRegisters().size());
+}
+
+TEST_CASE("JSON state publishing", "[nibegw_mqtt]") {
+    NibeMqttConfig config = testConfig();
+    config.jsonState = true;
+    Metrics metrics;
+    MqttClient mqttClient(metrics);
+    mqttClient.begin(mqttConfig);
+    NibeMqttGw gw(metrics);
+    fakeTime = 1000;
+    gw.setClock(fakeClock);
+    TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+    mqttmock_publishData.clear();
+
+    // all registers of a ModbusDataMsg in one message, no budget
+    int16_t values[10] = {10, 11, 12, 13, 14, 15, 16, 17, 18, 19};
+    dataMessage(gw, values);
+    dataMessage(gw, values);
+    fakeTime += 2000;
+    values[2] = 100;
+    dataMessage(gw, values);
+    for (const auto& data : mqttmock_publishData) {
+        TEST_ASSERT_FALSE(data.topic.starts_with("nibegw/nibe/4"));  // no topic per register
+    }
+    std::vector<std::string> payloads = publishedPayloads("nibegw/nibe/state");
+    TEST_ASSERT_EQUAL(2, payloads.size());
+    TEST_ASSERT_EQUAL_STRING(
+        R"({"40001":1.0,"40002":1.1,"40003":1.2,"40004":1.3,"40005":1.4,"40006":1.5,"40007":1.6,"40008":1.7,"40009":1.8,"40010":1.9})",
+        payloads[0].c_str());
+    TEST_ASSERT_EQUAL_STRING(R"({"40003":10.0})", payloads[1].c_str());
+
+    // read responses are batched
+    readResponse(gw, 40021, 215);
+    fakeTime += NIBE_JSON_STATE_BATCH_TIME - 1;
+    readResponse(gw, 40022, -5);
+    TEST_ASSERT_EQUAL(0, publishedPayloads("nibegw/nibe/state").size());
+    fakeTime += 1;
+    gw.processPendingSamples();
+    payloads = publishedPayloads("nibegw/nibe/state");
+    TEST_ASSERT_EQUAL(1, payloads.size());
+    TEST_ASSERT_EQUAL_STRING(R"({"40021":21.5,"40022":-0.5})", payloads[0].c_str());
+
+    // ... and published together with the next ModbusDataMsg
+    readResponse(gw, 40021, 216);
+    values[2] = 101;
+    dataMessage(gw, values);
+    payloads = publishedPayloads("nibegw/nibe/state");
+    TEST_ASSERT_EQUAL(1, payloads.size());
+    TEST_ASSERT_EQUAL_STRING(R"({"40021":21.6,"40003":10.1})", payloads[0].c_str());
+}
+
+TEST_CASE("ModbusDataMsg layout change", "[nibegw_mqtt]") {
+    NibeMqttConfig config = testConfig();
+    config.metrics[40001] = {.name = "nibe_test_1", .factor = 10, .scale = 1, .counter = false};
+    config.metrics[40002] = {.name = "nibe_test_2", .factor = 10, .scale = 1, .counter = false};
+    Metrics metrics;
+    MqttClient mqttClient(metrics);
+    mqttClient.begin(mqttConfig);
+    NibeMqttGw gw(metrics);
+    gw.setClock(fakeClock);
+    TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+    int16_t values[10] = {10, 20};
+    dataMessage(gw, values);
+    Metric* metric1 = metrics.findMetric(R"(nibe_test_1{register="40001"})");
+    Metric* metric2 = metrics.findMetric(R"(nibe_test_2{register="40002"})");
+    TEST_ASSERT_EQUAL(10, metric1->getValue());
+    TEST_ASSERT_EQUAL(20, metric2->getValue());
+
+    // LOG.SET changed: registers swapped, 40050 unknown
+    uint8_t buffer[MAX_DATA_LEN] = {};
+    NibeResponseMessage* msg = (NibeResponseMessage*)buffer;
+    msg->cmd = NibeCmd::ModbusDataMsg;
+    msg->len = sizeof(NibeDataMessage);
+    for (int i = 0; i < 20; i++) {
+        msg->dataMessage.registers[i].registerAddress = 0xFFFF;
+    }
+    msg->dataMessage.registers[0] = {40050, {1, 0}};
+    msg->dataMessage.registers[1] = {40002, {21, 0}};
+    msg->dataMessage.registers[2] = {40001, {11, 0}};
+    gw.onMessageReceived(msg, 5 + msg->len);
+    gw.processPendingSamples();
+    TEST_ASSERT_EQUAL(11, metric1->getValue());
+    TEST_ASSERT_EQUAL(21, metric2->getValue());
+}
+
+TEST_CASE("ModbusDataMsg 32 bit registers", "[nibegw_mqtt]") {
+    NibeMqttConfig config = testConfig();
+    config.registers.insert(testRegister(40021, NibeRegisterDataType::UInt32, 1));
+    config.registers.insert(testRegister(40031, NibeRegisterDataType::Int32));
+    config.registers.insert(testRegister(40033, NibeRegisterDataType::Int32));
+    config.metrics[40021] = {.name = "nibe_test_32", .factor = 1, .scale = 1, .counter = true};
+    Metrics metrics;
+    MqttClient mqttClient(metrics);
+    mqttClient.begin(mqttConfig);
+    NibeMqttGw gw(metrics);
+    gw.setClock(fakeClock);
+    TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+    mqttmock_publishData.clear();
+
+    uint8_t buffer[MAX_DATA_LEN] = {};
+    NibeResponseMessage* msg = (NibeResponseMessage*)buffer;
+    msg->cmd = NibeCmd::ModbusDataMsg;
+    msg->len = sizeof(NibeDataMessage);
+    for (int i = 0; i < 20; i++) {
+        msg->dataMessage.registers[i].registerAddress = 0xFFFF;
+    }
+    msg->dataMessage.registers[0] = {40021, {0x40, 0xE2}};  // low word
+    msg->dataMessage.registers[1] = {40022, {0x01, 0x00}};  // high word
+    msg->dataMessage.registers[2] = {40031, {0xF6, 0xFF}};
+    msg->dataMessage.registers[3] = {40032, {0xFF, 0xFF}};
+    msg->dataMessage.registers[4] = {40033, {0x01, 0x00}};  // not paired, skipped
+    msg->dataMessage.registers[5] = {40001, {0x01, 0x00}};
+    gw.onMessageReceived(msg, 5 + msg->len);
+    gw.processPendingSamples();
+
+    TEST_ASSERT_EQUAL(123456, metrics.findMetric(R"(nibe_test_32{register="40021"})")->getValue());
+    std::string state40021, state40031;
+    for (const auto& data : mqttmock_publishData) {
+        if (data.topic == "nibegw/nibe/40021") {
+            state40021 = data.payload;
+        } else if (data.topic == "nibegw/nibe/40031") {
+            state40031 = data.payload;
+        }
+    }
+    TEST_ASSERT_EQUAL_STRING("123456", state40021.c_str());
+    TEST_ASSERT_EQUAL_STRING("-1.0", state40031.c_str());
+    std::vector<uint16_t> expected = {40021, 40031, 40001};
+    TEST_ASSERT_TRUE(expected == publishedRegisters());
+}
+
+TEST_CASE("NibeSampleQueue", "[nibegw_mqtt]") {
+    NibeSampleQueue queue;
+    NibeSample sample;
+    TEST_ASSERT_FALSE(queue.pop(sample));
+    TEST_ASSERT_EQUAL(NIBE_SAMPLE_QUEUE_SIZE, queue.available());
+    for (int round = 0; round < 3; round++) {  // wrap around
+        for (int i = 0; i < NIBE_SAMPLE_QUEUE_SIZE; i++) {
+            TEST_ASSERT_TRUE(queue.push({(uint16_t)(40000 + i), NibeSampleSource::ReadResponse, 0, {}, (uint32_t)i}));
+        }
+        TEST_ASSERT_FALSE(queue.push({49999, NibeSampleSource::ReadResponse, 0, {}, 0}));
+        TEST_ASSERT_EQUAL(0, queue.available());
+        for (int i = 0; i < NIBE_SAMPLE_QUEUE_SIZE; i++) {
+            TEST_ASSERT_TRUE(queue.pop(sample));
+            TEST_ASSERT_EQUAL(40000 + i, sample.address);
+            TEST_ASSERT_EQUAL(i, sample.time);
+        }
+        TEST_ASSERT_FALSE(queue.pop(sample));
+    }
+}
+
+TEST_CASE("publish samples deferred", "[nibegw_mqtt]") {
+    NibeMqttConfig config = testConfig();
+    Metrics metrics;
+    MqttClient mqttClient(metrics);
+    mqttClient.begin(mqttConfig);
+    NibeMqttGw gw(metrics);
+    fakeTime = 1000;
+    gw.setClock(fakeClock);
+    TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+    mqttmock_publishData.clear();
+    Metric* dropped = metrics.findMetric("nibegw_samples_dropped_total");
+
+    // nothing is published on receive, 3 messages fit into the queue
+    int16_t values[10] = {10, 11, 12, 13, 14, 15, 16, 17, 18, 19};
+    for (int i = 0; i < 4; i++) {
+        queueDataMessage(gw, values);
+        fakeTime += 2000;
+    }
+    TEST_ASSERT_EQUAL(0, publishedRegisters().size());
+    TEST_ASSERT_EQUAL(20, dropped->getValue());
+
+    // receive time of samples is used for publish budget
+    TEST_ASSERT_EQUAL(60, gw.processPendingSamples());
+    std::vector<uint16_t> expected = {40001, 40002, 40003, 40004, 40005, 40006, 40007, 40008, 40009, 40010};
+    TEST_ASSERT_TRUE(expected == publishedRegisters());
+    TEST_ASSERT_EQUAL(0, gw.processPendingSamples());
+}
+
+TEST_CASE("publish w/o heap allocation", "[nibegw_mqtt]") {
+    NibeMqttConfig config = testConfig();
+    config.metrics[40001] = {.name = "nibe_test_1", .factor = 10, .scale = 1, .counter = false};
+    config.metrics[40021] = {.name = "nibe_test_21", .factor = 10, .scale = 1, .counter = false};
+    Metrics metrics;
+    MqttClient mqttClient(metrics);
+    mqttClient.begin(mqttConfig);
+    NibeMqttGw gw(metrics);
+    fakeTime = 1000;
+    gw.setClock(fakeClock);
+    TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+    Metric* published = metrics.findMetric(R"(nibegw_register_publish_total{result="published"})");
+
+    // warm up: learn ModbusDataMsg layout, create metrics and announce registers
+    int16_t values[10] = {};
+    dataMessage(gw, values);
+    readResponse(gw, 40021, 0);
+    mqttmock_publishData.clear();
+
+    mqttmock_recordPublishData = false;
+    int32_t publishedBefore = published->getValue();
+    int processed = 0;
+    alloccounter_allocations = 0;
+    for (int16_t n = 1; n <= 100; n++) {
+        for (int i = 0; i < 10; i++) {
+            values[i] = -n * (i + 1);
+        }
+        fakeTime += 2000;
+        queueDataMessage(gw, values);
+        queueReadResponse(gw, 40021, n);
+        processed += gw.processPendingSamples();
+    }
+    int allocations = alloccounter_allocations;
+    mqttmock_recordPublishData = true;
+    TEST_ASSERT_EQUAL(100 * 21, processed);
+    TEST_ASSERT_EQUAL(100 * 5, published->getValue() - publishedBefore);  // 4 data message registers, 1 read response
+    TEST_ASSERT_EQUAL(0, allocations);  // in total for all samples
+    TEST_ASSERT_EQUAL(-100, metrics.findMetric(R"(nibe_test_1{register="40001"})")->getValue());
+    TEST_ASSERT_EQUAL(100, metrics.findMetric(R"(nibe_test_21{register="40021"})")->getValue());
+}
+
+// recorded ModbusDataMsg frames (19 registers as configured in config.json.template), results are logged only
+static const uint8_t recordedDataMessages[][MAX_DATA_LEN] = {
+    {
+     0x5C, 0x00, 0x20, 0x68, 0x50, 0xC9, 0xAF, 0x00, 0x00, 0x44, 0x9C, 0x2C, 0x00, 0x83, 0x9C, 0x28,
+     0x00, 0x4D, 0x9C, 0x02, 0x02, 0x4E, 0x9C, 0xDF, 0x01, 0x01, 0xA8, 0x09, 0x01, 0xEE, 0xAC, 0xB6,
+     0x00, 0x48, 0x9C, 0x2E, 0x01, 0x4C, 0x9C, 0x08, 0x01, 0x17, 0xAC, 0xFD, 0x00, 0x1A, 0xAC, 0x42,
+     0x01, 0xAD, 0xA9, 0x2B, 0x00, 0x6C, 0xAD, 0x38, 0x00, 0x88, 0x9C, 0x98, 0x00, 0xFD, 0xA7, 0x8A,
+     0xFF, 0x9D, 0xAE, 0x29, 0x00, 0x9F, 0xAE, 0x00, 0x00, 0x4A, 0xAF, 0x00, 0x00, 0x4E, 0xA8, 0x1E,
+     0x00, 0xFF, 0xFF, 0x00, 0x00, 0xE7,
+    },
+    {
+     0x5C, 0x00, 0x20, 0x68, 0x50, 0xC9, 0xAF, 0x00, 0x00, 0x44, 0x9C, 0x2C, 0x00, 0x83, 0x9C, 0x27,
+     0x00, 0x4D, 0x9C, 0x02, 0x02, 0x4E, 0x9C, 0xE2, 0x01, 0x01, 0xA8, 0x0A, 0x01, 0xEE, 0xAC, 0xB5,
+     0x00, 0x48, 0x9C, 0x2C, 0x01, 0x4C, 0x9C, 0x05, 0x01, 0x17, 0xAC, 0xFE, 0x00, 0x1A, 0xAC, 0x42,
+     0x01, 0xAD, 0xA9, 0x2E, 0x00, 0x6C, 0xAD, 0x35, 0x00, 0x88, 0x9C, 0x96, 0x00, 0xFD, 0xA7, 0x87,
+     0xFF, 0x9D, 0xAE, 0x2C, 0x00, 0x9F, 0xAE, 0x00, 0x00, 0x4A, 0xAF, 0x00, 0x00, 0x4E, 0xA8, 0x1E,
+     0x00, 0xFF, 0xFF, 0x00, 0x00, 0xD7,
+    },
+    {
+     0x5C, 0x00, 0x20, 0x68, 0x50, 0xC9, 0xAF, 0x00, 0x00, 0x44, 0x9C, 0x2B, 0x00, 0x83, 0x9C, 0x26,
+     0x00, 0x4D, 0x9C, 0xFE, 0x01, 0x4E, 0x9C, 0xE0, 0x01, 0x01, 0xA8, 0x0A, 0x01, 0xEE, 0xAC, 0xB6,
+     0x00, 0x48, 0x9C, 0x2E, 0x01, 0x4C, 0x9C, 0x07, 0x01, 0x17, 0xAC, 0x00, 0x01, 0x1A, 0xAC, 0x42,
+     0x01, 0xAD, 0xA9, 0x2E, 0x00, 0x6C, 0xAD, 0x36, 0x00, 0x88, 0x9C, 0x98, 0x00, 0xFD, 0xA7, 0x86,
+     0xFF, 0x9D, 0xAE, 0x28, 0x00, 0x9F, 0xAE, 0x00, 0x00, 0x4A, 0xAF, 0x00, 0x00, 0x4E, 0xA8, 0x1E,
+     0x00, 0xFF, 0xFF, 0x00, 0x00, 0xD8,
+    },
+    {
+     0x5C, 0x00, 0x20, 0x68, 0x50, 0xC9, 0xAF, 0x00, 0x00, 0x44, 0x9C, 0x2C, 0x00, 0x83, 0x9C, 0x27,
+     0x00, 0x4D, 0x9C, 0xFF, 0x01, 0x4E, 0x9C, 0xE0, 0x01, 0x01, 0xA8, 0x0A, 0x01, 0xEE, 0xAC, 0xB4,
+     0x00, 0x48, 0x9C, 0x2E, 0x01, 0x4C, 0x9C, 0x08, 0x01, 0x17, 0xAC, 0x00, 0x01, 0x1A, 0xAC, 0x42,
+     0x01, 0xAD, 0xA9, 0x2D, 0x00, 0x6C, 0xAD, 0x39, 0x00, 0x88, 0x9C, 0x9A, 0x00, 0xFD, 0xA7, 0x89,
+     0xFF, 0x9D, 0xAE, 0x2C, 0x00, 0x9F, 0xAE, 0x00, 0x00, 0x4A, 0xAF, 0x00, 0x00, 0x4E, 0xA8, 0x1E,
+     0x00, 0xFF, 0xFF, 0x00, 0x00, 0xD7,
+    },
+};
+
+TEST_CASE("ModbusDataMsg throughput", "[nibegw_mqtt][benchmark]") {
+    NibeMqttConfig config;
+    const NibeResponseMessage* first = (const NibeResponseMessage*)recordedDataMessages[0];
+    for (int i = 0; i < 20; i++) {
+        uint16_t address = first->dataMessage.registers[i].registerAddress;
+        if (address != 0xFFFF) {
+            config.registers.insert(testRegister(address));
+            config.metrics[address] = {.name = "nibe_" + std::to_string(address), .factor = 10, .scale = 1, .counter = false};
+        }
+    }
+    Metrics metrics;
+    MqttClient mqttClient(metrics);
+    mqttClient.begin(mqttConfig);
+    NibeMqttGw gw(metrics);
+    TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+
+    // same frames with swapped slots, forces learning the layout with every message
+    uint8_t swapped[4][MAX_DATA_LEN];
+    std::memcpy(swapped, recordedDataMessages, sizeof(swapped));
+    for (int f = 1; f < 4; f += 2) {
+        NibeResponseMessage* msg = (NibeResponseMessage*)swapped[f];
+        std::swap(msg->dataMessage.registers[0], msg->dataMessage.registers[1]);
+    }
+
+    const int rounds = 2500;
+    int numFrames = sizeof(recordedDataMessages) / sizeof(recordedDataMessages[0]);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds * numFrames; i++) {
+        const uint8_t* frame = recordedDataMessages[i % numFrames];
+        gw.onMessageReceived((const NibeResponseMessage*)frame, 5 + frame[4] + 1);
+        gw.processPendingSamples();
+        mqttmock_publishData.clear();
+    }
+    std::chrono::nanoseconds cachedTime = std::chrono::steady_clock::now() - start;
+    esp_log_level_set("nibegw_mqtt", ESP_LOG_WARN);  // learning is logged
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds * numFrames; i++) {
+        const uint8_t* frame = swapped[i % 4];
+        gw.onMessageReceived((const NibeResponseMessage*)frame, 5 + frame[4] + 1);
+        gw.processPendingSamples();
+        mqttmock_publishData.clear();
+    }
+    std::chrono::nanoseconds learningTime = std::chrono::steady_clock::now() - start;
+    esp_log_level_set("nibegw_mqtt", ESP_LOG_INFO);
+    ESP_LOGI(TAG, "ModbusDataMsg: cached slot layout %lld ns, learning slot layout %lld ns",
+             (long long)cachedTime.count() / (rounds * numFrames), (long long)learningTime.count() / (rounds * numFrames));
+}
+
+// MQTT PUBLISH packet, QoS 0: fixed header, remaining length, topic length, topic, payload
+static size_t mqttPublishPacketSize(const MqttPublishData& data) {
+    size_t remaining = 2 + data.topic.size() + data.payload.size();
+    return 1 + (remaining < 128 ? 1 : remaining < 16384 ? 2 : 3) + remaining;
+}
+
+TEST_CASE("JSON state vs topic per register", "[nibegw_mqtt][benchmark]") {
+    const int rounds = 2500;
+    int numFrames = sizeof(recordedDataMessages) / sizeof(recordedDataMessages[0]);
+    for (bool jsonState : {false, true}) {
+        NibeMqttConfig config;
+        const NibeResponseMessage* first = (const NibeResponseMessage*)recordedDataMessages[0];
+        for (int i = 0; i < 20; i++) {
+            uint16_t address = first->dataMessage.registers[i].registerAddress;
+            if (address != 0xFFFF) {
+                config.registers.insert(testRegister(address));
+            }
+        }
+        // publish every change in both modes
+        config.dataMessagePublishBudget = 20;
+        config.dataMessagePublishRate = 20;
+        config.jsonState = jsonState;
+        Metrics metrics;
+        MqttClient mqttClient(metrics);
+        mqttClient.begin(mqttConfig);
+        NibeMqttGw gw(metrics);
+        fakeTime = 1000;
+        gw.setClock(fakeClock);
+        TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+        // first round announces registers
+        for (int i = 0; i < numFrames; i++) {
+            fakeTime += 2000;
+            gw.onMessageReceived((const NibeResponseMessage*)recordedDataMessages[i], 5 + recordedDataMessages[i][4] + 1);
+            gw.processPendingSamples();
+        }
+
+        // bytes on the wire, state messages only
+        mqttmock_publishData.clear();
+        for (int i = 0; i < numFrames; i++) {
+            fakeTime += 2000;
+            gw.onMessageReceived((const NibeResponseMessage*)recordedDataMessages[i], 5 + recordedDataMessages[i][4] + 1);
+            gw.processPendingSamples();
+        }
+        size_t bytes = 0;
+        for (const auto& data : mqttmock_publishData) {
+            TEST_ASSERT_TRUE(data.topic.starts_with("nibegw/nibe/"));
+            bytes += mqttPublishPacketSize(data);
+        }
+        size_t packets = mqttmock_publishData.size();
+        mqttmock_publishData.clear();
+
+        mqttmock_recordPublishData = false;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds * numFrames; i++) {
+            fakeTime += 2000;
+            const uint8_t* frame = recordedDataMessages[i % numFrames];
+            gw.onMessageReceived((const NibeResponseMessage*)frame, 5 + frame[4] + 1);
+            gw.processPendingSamples();
+        }
+        std::chrono::nanoseconds time = std::chrono::steady_clock::now() - start;
+        mqttmock_recordPublishData = true;
+        ESP_LOGI(TAG, "%s: %d PUBLISH packets, %d bytes per %d ModbusDataMsg, %lld ns per ModbusDataMsg",
+                 jsonState ? "JSON state" : "topic per register", (int)packets, (int)bytes, numFrames,
+                 (long long)time.count() / (rounds * numFrames));
+    }
+}
+
+TEST_CASE("NibeRegisterAddressSet", "[nibegw_mqtt]") {
+    NibeRegisterAddressSet set;
+    TEST_ASSERT_FALSE(set.contains(40000));
+    TEST_ASSERT_TRUE(set.insert(40000));
+    TEST_ASSERT_FALSE(set.insert(40000));
+    TEST_ASSERT_TRUE(set.contains(40000));
+    TEST_ASSERT_TRUE(set.insert(49999));
+    TEST_ASSERT_TRUE(set.insert(40031));
+    TEST_ASSERT_TRUE(set.insert(40032));
+    set.erase(40000);
+    TEST_ASSERT_FALSE(set.contains(40000));
+    TEST_ASSERT_TRUE(set.contains(49999));
+    TEST_ASSERT_TRUE(set.contains(40031));
+    TEST_ASSERT_TRUE(set.contains(40032));
+
+    // out of range
+    TEST_ASSERT_FALSE(set.insert(39999));
+    TEST_ASSERT_FALSE(set.contains(39999));
+    TEST_ASSERT_FALSE(set.insert(50000));
+    TEST_ASSERT_FALSE(set.contains(50000));
+}
+
+// catalog with all registers 40001..40200, 40100 is writable, image must outlive catalog
+static void openTestCatalog(NibeRegisterCatalog& catalog, std::string& image) {
+    NibeRegisterTable all;
+    for (uint16_t id = 40001; id <= 40200; id++) {
+        all.insert(testRegister(id, NibeRegisterDataType::Int16, 10,
+                                id == 40100 ? NibeRegisterMode::ReadWrite : NibeRegisterMode::Read));
+    }
+    all.save([&image](const void* data, size_t size) {
+        image.append((const char*)data, size);
+        return true;
+    });
+    TEST_ASSERT_TRUE(catalog.open([&image](size_t offset, void* data, size_t size) {
+        if (offset + size > image.size()) {
+            return false;
+        }
+        std::memcpy(data, image.data() + offset, size);
+        return true;
+    }));
+}
+
+TEST_CASE("unconfigured registers from catalog", "[nibegw_mqtt]") {
+    // 40001..40040 configured
+    std::string image;
+    NibeRegisterCatalog catalog;
+    openTestCatalog(catalog, image);
+    NibeMqttConfig config = testConfig();
+    config.catalog = &catalog;
+    Metrics metrics;
+    MqttClient mqttClient(metrics);
+    mqttClient.begin(mqttConfig);
+    NibeMqttGw gw(metrics);
+    gw.setClock(fakeClock);
+    TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+    mqttmock_publishData.clear();
+
+    // ad-hoc read of an unconfigured register is published, not announced as (retained) HA entity
+    readResponse(gw, 40100, 123);
+    TEST_ASSERT_EQUAL(0, publishedPayloads("homeassistant/number/nibegw/nibe-40100/config").size());
+    readResponse(gw, 40100, 124);
+    std::vector<std::string> payloads = publishedPayloads("nibegw/nibe/40100");
+    TEST_ASSERT_EQUAL(1, payloads.size());
+    TEST_ASSERT_EQUAL_STRING("12.4", payloads[0].c_str());
+    // unknown register
+    readResponse(gw, 40300, 1);
+    TEST_ASSERT_EQUAL(0, mqttmock_publishData.size());
+
+    // write of an unconfigured register, value is encoded before it is queued
+    uint8_t buffer[MAX_DATA_LEN];
+    NibeWriteRequestMessage* writeRequest = (NibeWriteRequestMessage*)buffer;
+    gw.writeNibeRegister(40101, "1.0");
+    TEST_ASSERT_EQUAL(0, gw.onWriteTokenReceived(writeRequest));
+    gw.writeNibeRegister(40300, "1.0");
+    TEST_ASSERT_EQUAL(0, gw.onWriteTokenReceived(writeRequest));
+    gw.writeNibeRegister(40100, "invalid");
+    TEST_ASSERT_EQUAL(0, gw.onWriteTokenReceived(writeRequest));
+    gw.writeNibeRegister(40100, "-1.5");
+    TEST_ASSERT_EQUAL(sizeof(NibeWriteRequestMessage), gw.onWriteTokenReceived(writeRequest));
+    TEST_ASSERT_EQUAL(40100, writeRequest->registerAddress);
+    TEST_ASSERT_EQUAL(-15, (int16_t)(writeRequest->value[0] | writeRequest->value[1] << 8));
+    TEST_ASSERT_EQUAL_HEX8(NibeGw::calcCheckSum(buffer, sizeof(NibeWriteRequestMessage) - 1), writeRequest->chksum);
+
+    // number of unconfigured registers is limited
+    for (uint16_t id = 40101; id < 40101 + NIBE_ADHOC_REGISTERS_MAX; id++) {
+        readResponse(gw, id, 1);
+    }
+    std::vector<uint16_t> registers = publishedRegisters();
+    TEST_ASSERT_EQUAL(NIBE_ADHOC_REGISTERS_MAX - 1, registers.size());
+    TEST_ASSERT_EQUAL(40100 + NIBE_ADHOC_REGISTERS_MAX - 1, registers.back());
+    // configured registers are not affected
+    readResponse(gw, 40001, 1);
+    TEST_ASSERT_EQUAL(1, publishedPayloads("nibegw/nibe/40001").size());
+}
+
+TEST_CASE("unconfigured registers in ModbusDataMsg", "[nibegw_mqtt]") {
+    // 40001..40040 configured, ModbusDataMsg with 40191..40200 set up in ModbusManager only
+    std::string image;
+    NibeRegisterCatalog catalog;
+    openTestCatalog(catalog, image);
+    NibeMqttConfig config = testConfig();
+    config.catalog = &catalog;
+    Metrics metrics;
+    MqttClient mqttClient(metrics);
+    mqttClient.begin(mqttConfig);
+    NibeMqttGw gw(metrics);
+    fakeTime = 1000;
+    gw.setClock(fakeClock);
+    TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+    mqttmock_publishData.clear();
+
+    // sent permanently by the heat pump -> announced like configured registers
+    int16_t values[10] = {};
+    dataMessage(gw, values, 40191);
+    TEST_ASSERT_EQUAL(1, publishedPayloads("homeassistant/sensor/nibegw/nibe-40191/config").size());
+    // ad-hoc read of another unconfigured register is still not announced
+    readResponse(gw, 40150, 1);
+    TEST_ASSERT_EQUAL(0, publishedPayloads("homeassistant/sensor/nibegw/nibe-40150/config").size());
+}
+
+// 50 registers with HA discovery overrides, announced on begin(), results are logged only
+TEST_CASE("announce discovery benchmark", "[nibegw_mqtt][benchmark]") {
+    NibeMqttConfig config;
+    for (uint16_t id = 40001; id <= 40050; id++) {
+        NibeRegister _register = {id,
+                                  "BT" + std::to_string(id) + " Supply temperature",
+                                  NibeRegisterUnit::GradCelcius,
+                                  NibeRegisterDataType::Int16,
+                                  10,
+                                  -300,
+                                  800,
+                                  0,
+                                  id % 5 == 0 ? NibeRegisterMode::ReadWrite : NibeRegisterMode::Read};
+        config.registers.insert(_register);
+        TEST_ASSERT_EQUAL(ESP_OK, MqttHelper::parseMqttDiscoveryInfoOverride(
+                                      R"({"icon":"mdi:thermometer","unit_of_meas":"Grad Celsius","stat_cla":null})",
+                                      config.homeassistantDiscoveryOverrides[id]));
+    }
+    Metrics metrics;
+    MqttClient mqttClient(metrics);
+    mqttClient.begin(mqttConfig);
+    mqttmock_publishData.clear();
+
+    // former approach: device info copied into a JsonDocument, override parsed and merged, serialized
+    const MqttDiscoveryOverride& override = config.homeassistantDiscoveryOverrides[40001];
+    size_t live = alloccounter_live_bytes;
+    alloccounter_peak_bytes = live;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 50; i++) {
+        JsonDocument discoveryDoc = mqttClient.getDeviceDiscoveryInfoRef();
+        discoveryDoc["uniq_id"] = "nibe-40001";
+        discoveryDoc["name"] = "BT40001 Supply temperature";
+        discoveryDoc["stat_t"] = "nibegw/nibe/40001";
+        MqttHelper::mergeMqttDiscoveryInfoOverride(discoveryDoc, override.json);
+        std::string discoveryMsg;
+        serializeJson(discoveryDoc, discoveryMsg);
+    }
+    std::chrono::nanoseconds jsonTime = std::chrono::steady_clock::now() - start;
+    size_t jsonPeak = alloccounter_peak_bytes - live;
+
+    // first announce builds and caches the payloads
+    NibeMqttGw gw(metrics);
+    gw.setClock(fakeClock);
+    mqttmock_recordPublishData = false;
+    live = alloccounter_live_bytes;
+    alloccounter_peak_bytes = live;
+    start = std::chrono::steady_clock::now();
+    TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+    std::chrono::nanoseconds beginTime = std::chrono::steady_clock::now() - start;
+    size_t beginPeak = alloccounter_peak_bytes - live;
+    size_t cached = alloccounter_live_bytes - live;
+
+    // re-announce after HA restart is a plain publish
+    mqttClient.onMqttMessage("homeassistant/status", "online");
+    int allocations = alloccounter_allocations;
+    live = alloccounter_live_bytes;
+    alloccounter_peak_bytes = live;
+    start = std::chrono::steady_clock::now();
+    gw.processPendingSamples();
+    std::chrono::nanoseconds announceTime = std::chrono::steady_clock::now() - start;
+    size_t announcePeak = alloccounter_peak_bytes - live;
+    int announceAllocations = alloccounter_allocations - allocations;
+    mqttmock_recordPublishData = true;
+
+    printf("announce 50 overridden registers: JsonDocument %lld us (peak %d bytes), begin %lld us (peak %d bytes, %d bytes "
+           "cached), re-announce %lld us (peak %d bytes)\n",
+           (long long)jsonTime.count() / 1000, (int)jsonPeak, (long long)beginTime.count() / 1000, (int)beginPeak,
+           (int)cached, (long long)announceTime.count() / 1000, (int)announcePeak);
+    TEST_ASSERT_EQUAL(0, announceAllocations);
+
+    mqttClient.onMqttMessage("homeassistant/status", "online");
+    gw.processPendingSamples();
+    TEST_ASSERT_EQUAL(50, mqttmock_publishData.size());
+    std::vector<std::string> payloads = publishedPayloads("homeassistant/number/nibegw/nibe-40005/config");
+    TEST_ASSERT_EQUAL(1, payloads.size());
+    JsonDocument doc;
+    TEST_ASSERT_FALSE(deserializeJson(doc, payloads[0]));
+    TEST_ASSERT_EQUAL_STRING("Grad Celsius", doc["unit_of_meas"]);
+    TEST_ASSERT_EQUAL_STRING("mdi:thermometer", doc["icon"]);
+    TEST_ASSERT_EQUAL_STRING("number.nibe-40005", doc["def_ent_id"]);
+    TEST_ASSERT_EQUAL_STRING("nibegw/nibe/40005/set", doc["cmd_t"]);
+    TEST_ASSERT_EQUAL_STRING("nibegw/availability", doc["avty_t"]);
+    TEST_ASSERT_EQUAL_STRING("clientid", doc["dev"]["ids"][0]);
+    TEST_ASSERT_TRUE(doc["stat_cla"].isUnbound());
+}
+
+TEST_CASE("discovery skipped if unchanged", "[nibegw_mqtt]") {
+    NibeMqttConfig config = testConfig();
+    TEST_ASSERT_EQUAL(ESP_OK, MqttHelper::parseMqttDiscoveryInfoOverride(R"({"icon":"mdi:a"})",
+                                                                         config.homeassistantDiscoveryOverrides[40031]));
+    auto announced = []() {
+        int count = 0;
+        for (const auto& data : mqttmock_publishData) {
+            count += data.topic.starts_with("homeassistant/") ? 1 : 0;
+        }
+        return count;
+    };
+    mqttmock_discoveryHashes = {};
+
+    // first boot: polled registers and registers with overrides are announced
+    {
+        Metrics metrics;
+        MqttClient mqttClient(metrics);
+        mqttClient.begin(mqttConfig);
+        NibeMqttGw gw(metrics);
+        gw.setClock(fakeClock);
+        mqttmock_publishData.clear();
+        TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+        TEST_ASSERT_EQUAL(31, announced());
+        TEST_ASSERT_EQUAL(ESP_OK, mqttClient.saveDiscoveryHashes());
+    }
+    // reboot, same config: nothing to announce
+    config.homeassistantDiscoveryOverrides[40031].members = R"("icon":"mdi:b")";
+    {
+        Metrics metrics;
+        MqttClient mqttClient(metrics);
+        mqttClient.begin(mqttConfig);
+        NibeMqttGw gw(metrics);
+        gw.setClock(fakeClock);
+        mqttmock_publishData.clear();
+        TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+        // changed override only
+        TEST_ASSERT_EQUAL(1, announced());
+        TEST_ASSERT_EQUAL(1, publishedPayloads("homeassistant/sensor/nibegw/nibe-40031/config").size());
+        TEST_ASSERT_EQUAL(30, metrics.findMetric(R"(nibegw_mqtt_discovery_total{result="skipped"})")->getValue());
+
+        // HA restarted: all announced registers again
+        mqttmock_publishData.clear();
+        mqttClient.onMqttMessage("homeassistant/status", "offline");
+        gw.processPendingSamples();
+        TEST_ASSERT_EQUAL(0, announced());
+        mqttClient.onMqttMessage("homeassistant/status", "online");
+        gw.processPendingSamples();
+        TEST_ASSERT_EQUAL(31, announced());
+        mqttmock_publishData.clear();
+        gw.processPendingSamples();
+        TEST_ASSERT_EQUAL(0, announced());
+    }
+    mqttmock_discoveryHashes = {};
+}
+
+TEST_CASE("device discovery", "[nibegw_mqtt]") {
+    NibeMqttConfig config = testConfig();
+    MqttConfig deviceMqttConfig = mqttConfig;
+    deviceMqttConfig.deviceDiscovery = true;
+    deviceMqttConfig.bufferSize = 8192;
+    mqttmock_discoveryHashes = {};
+    mqttmock_discoveryMode = MqttDiscoveryMode::Entity;
+    mqttmock_discoveryFallbackSize = 0;
+    auto entityMessages = [](const char* payload) {
+        int count = 0;
+        for (const auto& data : mqttmock_publishData) {
+            if (data.topic.starts_with("homeassistant/sensor/nibegw/nibe-") && (payload == nullptr || data.payload == payload)) {
+                count++;
+            }
+        }
+        return count;
+    };
+
+    // polled registers are components of one device discovery message
+    {
+        Metrics metrics;
+        MqttClient mqttClient(metrics);
+        mqttmock_publishData.clear();
+        mqttClient.begin(deviceMqttConfig);
+        NibeMqttGw gw(metrics);
+        gw.setClock(fakeClock);
+        TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+        // switched from entity discovery: retained entity messages migrated, removed after the device message
+        TEST_ASSERT_EQUAL(30, entityMessages(MQTT_DISCOVERY_MIGRATE_PAYLOAD));
+        TEST_ASSERT_EQUAL(30, mqttmock_publishData.size());
+        TEST_ASSERT_EQUAL(MqttDiscoveryMode::Entity, mqttmock_discoveryMode);
+        mqttmock_publishData.clear();
+        mqttClient.publishDeviceDiscovery();
+        TEST_ASSERT_EQUAL_STRING("homeassistant/device/nibegw/config", mqttmock_publishData[0].topic.c_str());
+        TEST_ASSERT_EQUAL(30, entityMessages(""));
+        TEST_ASSERT_EQUAL(31, mqttmock_publishData.size());
+        TEST_ASSERT_EQUAL(MqttDiscoveryMode::Device, mqttmock_discoveryMode);
+        std::vector<std::string> payloads = publishedPayloads("homeassistant/device/nibegw/config");
+        TEST_ASSERT_EQUAL(1, payloads.size());
+        JsonDocument doc;
+        TEST_ASSERT_FALSE(deserializeJson(doc, payloads[0]));
+        TEST_ASSERT_EQUAL_STRING("nibegw/availability", doc["avty_t"]);
+        TEST_ASSERT_EQUAL_STRING("Nibe GW", doc["dev"]["name"]);
+        TEST_ASSERT_EQUAL_STRING("nibegw", doc["o"]["name"]);
+        TEST_ASSERT_EQUAL(30, doc["cmps"].size());
+        TEST_ASSERT_EQUAL_STRING("sensor", doc["cmps"]["nibe-40001"]["p"]);
+        TEST_ASSERT_EQUAL_STRING("nibegw/nibe/40001", doc["cmps"]["nibe-40001"]["stat_t"]);
+        TEST_ASSERT_TRUE(doc["cmps"]["nibe-40001"]["dev"].isUnbound());
+
+        // unchanged
+        mqttClient.publishDeviceDiscovery();
+        TEST_ASSERT_EQUAL(0, publishedPayloads("homeassistant/device/nibegw/config").size());
+        mqttClient.saveDiscoveryHashes();
+    }
+
+    // reboot: entity messages are not removed again
+    {
+        Metrics metrics;
+        MqttClient mqttClient(metrics);
+        mqttClient.begin(deviceMqttConfig);
+        NibeMqttGw gw(metrics);
+        gw.setClock(fakeClock);
+        mqttmock_publishData.clear();
+        TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+        mqttClient.publishDeviceDiscovery();
+        TEST_ASSERT_EQUAL(0, mqttmock_publishData.size());
+    }
+
+    // device message too large: device message migrated to entity messages, then removed
+    deviceMqttConfig.bufferSize = 2048;
+    {
+        Metrics metrics;
+        MqttClient mqttClient(metrics);
+        mqttClient.begin(deviceMqttConfig);
+        NibeMqttGw gw(metrics);
+        gw.setClock(fakeClock);
+        mqttmock_publishData.clear();
+        TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+        mqttClient.publishDeviceDiscovery();
+        int entities = 0;
+        int entitiesBeforeRemoval = -1;
+        for (const auto& data : mqttmock_publishData) {
+            if (data.topic == "homeassistant/device/nibegw/config") {
+                if (data.payload.empty()) {
+                    entitiesBeforeRemoval = entities;
+                } else {
+                    TEST_ASSERT_EQUAL_STRING(MQTT_DISCOVERY_MIGRATE_PAYLOAD, data.payload.c_str());
+                    TEST_ASSERT_EQUAL(0, entities);
+                }
+            } else if (data.topic.starts_with("homeassistant/sensor/nibegw/nibe-")) {
+                JsonDocument doc;
+                TEST_ASSERT_FALSE(deserializeJson(doc, data.payload));
+                TEST_ASSERT_EQUAL_STRING("clientid", doc["dev"]["ids"][0]);
+                entities++;
+            }
+        }
+        TEST_ASSERT_EQUAL(30, entities);
+        TEST_ASSERT_GREATER_THAN(0, entitiesBeforeRemoval);
+        TEST_ASSERT_EQUAL(2, publishedPayloads("homeassistant/device/nibegw/config").size());
+        TEST_ASSERT_EQUAL(MqttDiscoveryMode::Entity, mqttmock_discoveryMode);
+        TEST_ASSERT_EQUAL(2048, mqttmock_discoveryFallbackSize);
+        mqttClient.saveDiscoveryHashes();
+    }
+
+    // fallback persisted: no partial device message on reboot, entity messages unchanged
+    {
+        Metrics metrics;
+        MqttClient mqttClient(metrics);
+        mqttmock_publishData.clear();
+        mqttClient.begin(deviceMqttConfig);
+        NibeMqttGw gw(metrics);
+        gw.setClock(fakeClock);
+        TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+        mqttClient.publishDeviceDiscovery();
+        TEST_ASSERT_EQUAL(0, mqttmock_publishData.size());
+    }
+
+    // disabled: device message migrated to entity messages, removed once they were announced
+    deviceMqttConfig.deviceDiscovery = false;
+    mqttmock_discoveryMode = MqttDiscoveryMode::Device;
+    {
+        Metrics metrics;
+        MqttClient mqttClient(metrics);
+        mqttmock_publishData.clear();
+        mqttClient.begin(deviceMqttConfig);
+        std::vector<std::string> payloads = publishedPayloads("homeassistant/device/nibegw/config");
+        TEST_ASSERT_EQUAL(1, payloads.size());
+        TEST_ASSERT_EQUAL_STRING(MQTT_DISCOVERY_MIGRATE_PAYLOAD, payloads[0].c_str());
+        NibeMqttGw gw(metrics);
+        gw.setClock(fakeClock);
+        TEST_ASSERT_EQUAL(ESP_OK, gw.begin(config, mqttClient));
+        TEST_ASSERT_EQUAL(30, entityMessages(nullptr));
+        TEST_ASSERT_EQUAL(0, entityMessages(""));
+        TEST_ASSERT_EQUAL(MqttDiscoveryMode::Device, mqttmock_discoveryMode);
+        // device discovery delay expired
+        mqttClient.publishDeviceDiscovery();
+        payloads = publishedPayloads("homeassistant/device/nibegw/config");
+        TEST_ASSERT_EQUAL(1, payloads.size());
+        TEST_ASSERT_EQUAL_STRING("", payloads[0].c_str());
+        TEST_ASSERT_EQUAL(MqttDiscoveryMode::Entity, mqttmock_discoveryMode);
+    }
+    mqttmock_discoveryHashes = {};
+    mqttmock_discoveryMode = MqttDiscoveryMode::Entity;
+    mqttmock_discoveryFallbackSize = 0;
+}
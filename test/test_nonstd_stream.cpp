@@ -185,4 +185,90 @@ TEST_CASE("nonstd::istdstream", "[nonstd_stream]") {
     buffer.clear();
     buffer << "\nline1\n\nline2\n";
     test_getline(is, std::vector<std::string>{"", "line1", "", "line2", ""});
-}
\ No newline at end of file
+}
+TEST_CASE("nonstd::icharbufstream read", "[nonstd_stream]") {
+    char buf[8];
+    nonstd::icharbufstream is("0123456789");
+    TEST_ASSERT_EQUAL(4, is.read(buf, 4));
+    TEST_ASSERT_EQUAL_MEMORY("0123", buf, 4);
+    TEST_ASSERT_TRUE(is.good());
+    TEST_ASSERT_EQUAL(6, is.read(buf, 8));
+    TEST_ASSERT_EQUAL_MEMORY("456789", buf, 6);
+    TEST_ASSERT_TRUE(is.eof());
+    TEST_ASSERT_TRUE(is.fail());
+    TEST_ASSERT_EQUAL(0, is.read(buf, 8));
+}
+
+TEST_CASE("nonstd::ibufstream", "[nonstd_stream]") {
+    char buffer[4];
+    nonstd::icharbufstream source("");
+    nonstd::ibufstream is(source, buffer, sizeof(buffer));
+    test_iostate(is);
+    test_get(is, "");
+
+    // buffer is smaller than the input
+    std::string testString = "ibufstream";
+    nonstd::icharbufstream source2(testString.c_str());
+    nonstd::ibufstream is2(source2, buffer, sizeof(buffer));
+    test_get(is2, testString);
+
+    nonstd::icharbufstream source3("\nline1\n\nline2\n");
+    nonstd::ibufstream is3(source3, buffer, sizeof(buffer));
+    test_getline(is3, std::vector<std::string>{"", "line1", "", "line2", ""});
+}
+
+TEST_CASE("nonstd::ibufstream read", "[nonstd_stream]") {
+    // read across buffer refills and bypassing the buffer
+    char buffer[4];
+    char data[16];
+    nonstd::icharbufstream source("0123456789abcdef");
+    nonstd::ibufstream is(source, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL('0', is.get());
+    TEST_ASSERT_EQUAL(2, is.read(data, 2));
+    TEST_ASSERT_EQUAL_MEMORY("12", data, 2);
+    TEST_ASSERT_EQUAL(10, is.read(data, 10));
+    TEST_ASSERT_EQUAL_MEMORY("3456789abc", data, 10);
+    TEST_ASSERT_TRUE(is.good());
+    TEST_ASSERT_EQUAL(3, is.read(data, 16));
+    TEST_ASSERT_EQUAL_MEMORY("def", data, 3);
+    TEST_ASSERT_TRUE(is.eof());
+}
+
+TEST_CASE("nonstd::ibufstream getline", "[nonstd_stream]") {
+    char buffer[8];
+    nonstd::icharbufstream source("line1\n\nline 3\nlast");
+    nonstd::ibufstream is(source, buffer, sizeof(buffer));
+    std::string_view line;
+    TEST_ASSERT_TRUE(is.getline(line));
+    TEST_ASSERT_TRUE(line == "line1");
+    TEST_ASSERT_TRUE(line.data() >= buffer && line.data() < buffer + sizeof(buffer));  // no copy
+    TEST_ASSERT_TRUE(is.getline(line));
+    TEST_ASSERT_TRUE(line == "");
+    // line fills the whole buffer incl. '\n'
+    TEST_ASSERT_TRUE(is.getline(line));
+    TEST_ASSERT_TRUE(line == "line 3");
+    // last line w/o '\n'
+    TEST_ASSERT_TRUE(is.getline(line));
+    TEST_ASSERT_TRUE(line == "last");
+    TEST_ASSERT_FALSE(is.getline(line));
+    TEST_ASSERT_TRUE(is.eof());
+
+    // line longer than buffer
+    nonstd::icharbufstream longSource("short\nthis line is too long\n");
+    nonstd::ibufstream longIs(longSource, buffer, sizeof(buffer));
+    TEST_ASSERT_TRUE(longIs.getline(line));
+    TEST_ASSERT_TRUE(line == "short");
+    TEST_ASSERT_FALSE(longIs.getline(line));
+    TEST_ASSERT_TRUE(longIs.fail());
+    TEST_ASSERT_FALSE(longIs.eof());
+
+    // block reads from std::istream
+    std::stringstream stdBuffer("a;b\nc;d\n");
+    nonstd::istdstream stdSource(stdBuffer);
+    nonstd::ibufstream stdIs(stdSource, buffer, sizeof(buffer));
+    TEST_ASSERT_TRUE(stdIs.getline(line));
+    TEST_ASSERT_TRUE(line == "a;b");
+    TEST_ASSERT_TRUE(stdIs.getline(line));
+    TEST_ASSERT_TRUE(line == "c;d");
+    TEST_ASSERT_FALSE(stdIs.getline(line));
+}